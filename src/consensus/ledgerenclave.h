@@ -15,6 +15,7 @@ namespace consensus
   {
   public:
     static constexpr size_t FRAME_SIZE = sizeof(uint32_t);
+    static constexpr size_t SNAPSHOT_CHUNK_SIZE = 1 << 20;
 
   private:
     std::unique_ptr<ringbuffer::AbstractWriter> to_host;
@@ -74,10 +75,58 @@ namespace consensus
      * Truncate the ledger at a given index.
      *
      * @param idx Index to truncate from
+     * @param epoch Epoch of the ledger once truncated, echoed by the host when
+     * it reports entries as durable
      */
-    void truncate(Index idx)
+    void truncate(Index idx, size_t epoch)
     {
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx);
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx, epoch);
+    }
+
+    /**
+     * Inform the host that the ledger is committed up to a given index.
+     *
+     * Committed entries are never truncated.
+     *
+     * @param idx Index of the last committed entry
+     */
+    void commit(Index idx)
+    {
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_commit, to_host, idx);
+    }
+
+    /**
+     * Replace the ledger with a snapshot of the state at a given index.
+     *
+     * The snapshot is written in chunks, so that it is not limited by the
+     * maximum size of a ringbuffer message. Once the last chunk has been
+     * written, entries are appended after the snapshot index. The host keeps
+     * the entries from before the first snapshot, and re-opens the ledger
+     * from the snapshot when the node restarts.
+     *
+     * @param idx Index of the snapshot
+     * @param snapshot Serialised snapshot
+     * @param epoch Epoch of the ledger once replaced, echoed by the host when
+     * it reports entries as durable
+     */
+    void put_snapshot(
+      Index idx, const std::vector<uint8_t>& snapshot, size_t epoch)
+    {
+      size_t offset = 0;
+      do
+      {
+        auto end = std::min(offset + SNAPSHOT_CHUNK_SIZE, snapshot.size());
+        std::vector<uint8_t> chunk(
+          snapshot.begin() + offset, snapshot.begin() + end);
+
+        RINGBUFFER_WRITE_MESSAGE(
+          consensus::ledger_snapshot_chunk, to_host, idx, offset, chunk);
+
+        offset = end;
+      } while (offset < snapshot.size());
+
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_snapshot_commit, to_host, idx, epoch);
     }
   };
 }
\ No newline at end of file
@@ -10,28 +10,72 @@ namespace consensus
   /// Consensus-related ringbuffer messages
   enum : ringbuffer::Message
   {
-    /// Request individual log entries. Enclave -> Host
-    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get),
+    /// Request the log entries from an index to another, inclusive.
+    /// Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get_range),
 
     ///@{
-    /// Respond to log_get. Host -> Enclave
+    /// Respond to ledger_get_range, with each entry in turn, and with the
+    /// index of the first requested entry past the end of the log.
+    /// Host -> Enclave
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_entry),
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_no_entry),
     ///@}
 
+    /// Request the snapshot the local log starts from. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get_snapshot),
+
+    ///@{
+    /// Respond to ledger_get_snapshot, with the snapshot in chunks, and then
+    /// with its index, which is 0 if the log does not start from a snapshot.
+    /// Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_snapshot_part),
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_snapshot_end),
+    ///@}
+
     ///@{
     /// Modify the local log. Enclave -> Host
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_append),
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_truncate),
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_commit),
     ///@}
+
+    ///@{
+    /// Replace the local log with a snapshot, sent in chunks and then
+    /// committed. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_snapshot_chunk),
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_snapshot_commit),
+    ///@}
+
+    /// Report the index up to which the local log has been synced to disk,
+    /// along with the epoch of the last truncation or snapshot that the host
+    /// has applied. Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_durable),
   };
 }
 
-DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_get, consensus::Index);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
-  consensus::ledger_entry, std::vector<uint8_t>);
-DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_no_entry);
+  consensus::ledger_get_range, consensus::Index, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_entry, consensus::Index, std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_no_entry, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_get_snapshot);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_snapshot_part, size_t, std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_snapshot_end, consensus::Index);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
   consensus::ledger_append, std::vector<uint8_t>);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
-  consensus::ledger_truncate, consensus::Index);
+  consensus::ledger_truncate, consensus::Index, size_t);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_commit, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_snapshot_chunk,
+  consensus::Index,
+  size_t,
+  std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_snapshot_commit, consensus::Index, size_t);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_durable, consensus::Index, size_t);
@@ -139,5 +139,7 @@ std::pair<std::vector<uint8_t>, bool> LedgerWriter::record_entry(
 
 void LedgerWriter::truncate(Seqno seqno)
 {
-  ledger->truncate(seqno);
+  // PBFT does not wait for the host to report entries as durable, so the
+  // ledger epoch is not used
+  ledger->truncate(seqno, 0);
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <deque>
 #include <list>
+#include <memory>
 #include <random>
 #include <unordered_map>
 #include <vector>
@@ -35,6 +36,15 @@ namespace raft
         terms.push_back(idx);
     }
 
+    void reset(Index idx, Term term)
+    {
+      // Forget the history before idx, which is known to be in the given term.
+      // This is used when the log is replaced by a snapshot at idx.
+      LOG_DEBUG_FMT("Resetting term to: {} at index: {}", term, idx);
+      terms.assign(term + 1, idx);
+      terms[0] = 0;
+    }
+
     Term term_at(Index idx)
     {
       if (idx == 0)
@@ -56,12 +66,23 @@ namespace raft
       Candidate
     };
 
+    struct SnapshotTransfer
+    {
+      Index idx;
+      Term term_of_idx;
+      std::shared_ptr<const std::vector<uint8_t>> data;
+      // offset of the chunk waiting to be acknowledged
+      size_t offset;
+    };
+
     struct NodeState
     {
       // the highest matching index with the node that was confirmed
       Index match_idx;
       // the highest index sent to the node
       Index sent_idx;
+      // the snapshot being sent to the node, instead of entries
+      std::optional<SnapshotTransfer> snapshot = std::nullopt;
     };
 
     struct Configuration
@@ -115,12 +136,43 @@ namespace raft
     // should be replicated
     std::optional<Index> recovery_max_index;
 
+    // Followers lagging by more than snapshot_lag entries are sent a snapshot
+    // of the committed state instead of the entries. When set, snapshot_idx
+    // is the index of the snapshot this node's log starts from: no earlier
+    // entries can be sent and a snapshot must be sent instead.
+    size_t snapshot_lag = 0;
+    Index snapshot_idx = 0;
+    std::optional<
+      std::pair<Index, std::shared_ptr<const std::vector<uint8_t>>>>
+      leader_snapshot;
+
+    // Snapshot being received from the leader, one chunk at a time
+    struct PendingSnapshot
+    {
+      Index idx;
+      Term term_of_idx;
+      std::vector<uint8_t> data;
+    };
+    std::optional<PendingSnapshot> pending_snapshot;
+
+    // When the host syncs the ledger to disk, entries are only acknowledged,
+    // and only count towards commit on the leader, once the host has reported
+    // them as durable
+    bool wait_for_durable = false;
+    Index durable_idx = 0;
+
+    // Incremented whenever the ledger is truncated or replaced by a snapshot.
+    // The host echoes the latest epoch it has seen in its durability reports,
+    // so that reports about entries that have since been discarded are ignored
+    size_t ledger_epoch = 0;
+
     // Randomness
     std::uniform_int_distribution<int> distrib;
     std::default_random_engine rand;
 
   public:
     static constexpr size_t append_entries_size_limit = 20000;
+    static constexpr size_t snapshot_chunk_size = 1 << 20;
     std::unique_ptr<LedgerProxy> ledger;
     std::shared_ptr<ChannelProxy> channels;
 
@@ -132,7 +184,9 @@ namespace raft
       NodeId id,
       std::chrono::milliseconds request_timeout_,
       std::chrono::milliseconds election_timeout_,
-      bool public_only_ = false) :
+      bool public_only_ = false,
+      size_t snapshot_lag_ = 0,
+      bool wait_for_durable_ = false) :
       store(std::move(store)),
 
       current_term(0),
@@ -149,6 +203,8 @@ namespace raft
       request_timeout(request_timeout_),
       election_timeout(election_timeout_),
       public_only(public_only_),
+      snapshot_lag(snapshot_lag_),
+      wait_for_durable(wait_for_durable_),
 
       ledger(std::move(ledger_)),
       channels(channels_),
@@ -183,6 +239,9 @@ namespace raft
       // be deserialised
       std::lock_guard<SpinLock> guard(lock);
       public_only = false;
+
+      // Snapshots now hold the private state as well
+      leader_snapshot.reset();
     }
 
     void suspend_replication(Index idx)
@@ -228,6 +287,7 @@ namespace raft
       std::lock_guard<SpinLock> guard(lock);
       current_term = term;
       last_idx = index;
+      durable_idx = index;
       commit_idx = commit_idx_;
       term_history.update(index, term);
       current_term += 2;
@@ -248,6 +308,7 @@ namespace raft
       std::lock_guard<SpinLock> guard(lock);
       current_term = term;
       last_idx = index;
+      durable_idx = index;
       commit_idx = commit_idx_;
       term_history.initialise(terms);
       term_history.update(index, term);
@@ -260,6 +321,32 @@ namespace raft
       return last_idx;
     }
 
+    void set_snapshot(Index idx, const std::vector<uint8_t>& snapshot)
+    {
+      // The log of this node starts from a snapshot at idx, which it was
+      // recovered from, so earlier entries are sent as that snapshot
+      std::lock_guard<SpinLock> guard(lock);
+      snapshot_idx = idx;
+      leader_snapshot = std::make_pair(
+        idx, std::make_shared<const std::vector<uint8_t>>(snapshot));
+    }
+
+    void set_durable_idx(Index idx, size_t epoch)
+    {
+      // The host has synced the ledger up to idx, as of the given epoch
+      std::lock_guard<SpinLock> guard(lock);
+
+      if (!wait_for_durable || epoch != ledger_epoch || idx <= durable_idx)
+        return;
+
+      durable_idx = std::min(idx, last_idx);
+
+      if (state == Leader)
+        update_commit();
+      else if (state == Follower && leader_id != NoNode)
+        send_append_entries_response(leader_id, true);
+    }
+
     Index get_commit_idx()
     {
       std::lock_guard<SpinLock> guard(lock);
@@ -369,6 +456,14 @@ namespace raft
           recv_request_vote_response(data, size);
           break;
 
+        case raft_install_snapshot:
+          recv_install_snapshot(data, size);
+          break;
+
+        case raft_install_snapshot_response:
+          recv_install_snapshot_response(data, size);
+          break;
+
         default:
         {}
       }
@@ -387,10 +482,14 @@ namespace raft
           timeout_elapsed = 0ms;
 
           update_batch_size();
-          // Send newly available entries to all nodes.
+          // Send newly available entries to all nodes, or the snapshot chunk
+          // they have not acknowledged yet.
           for (const auto& it : nodes)
           {
-            send_append_entries(it.first, it.second.sent_idx + 1);
+            if (it.second.snapshot.has_value())
+              send_snapshot_chunk(it.first);
+            else
+              send_append_entries(it.first, it.second.sent_idx + 1);
           }
         }
       }
@@ -431,6 +530,17 @@ namespace raft
 
     void send_append_entries(NodeId to, Index start_idx)
     {
+      // Entries are only sent once the node has installed the snapshot it is
+      // being sent
+      if (nodes.at(to).snapshot.has_value())
+        return;
+
+      if (should_send_snapshot(start_idx))
+      {
+        send_snapshot(to);
+        return;
+      }
+
       Index end_idx = (last_idx == 0) ?
         0 :
         std::min(start_idx + entries_batch_size, last_idx);
@@ -480,6 +590,331 @@ namespace raft
       channels->send_authenticated(ccf::NodeMsgType::consensus_msg, to, ae);
     }
 
+    bool should_send_snapshot(Index start_idx)
+    {
+      // Only committed state can be snapshotted, and entries that precede the
+      // snapshot this log starts from can only be sent as a snapshot.
+      if (commit_idx == 0 || start_idx > commit_idx)
+        return false;
+
+      if (start_idx <= snapshot_idx)
+        return true;
+
+      // The private state is not known to this node during recovery, so it
+      // only sends the snapshot its log starts from
+      return !public_only && snapshot_lag != 0 &&
+        static_cast<size_t>(last_idx - start_idx) >= snapshot_lag;
+    }
+
+    void send_snapshot(NodeId to)
+    {
+      // The snapshot is taken at commit_idx and kept until the next commit, so
+      // that several lagging followers can be sent the same one. During
+      // recovery, the snapshot the log starts from is sent instead.
+      if (
+        !public_only &&
+        (!leader_snapshot.has_value() || leader_snapshot->first != commit_idx))
+      {
+        LOG_INFO_FMT("Creating snapshot at {}", commit_idx);
+        leader_snapshot = std::make_pair(
+          commit_idx,
+          std::make_shared<const std::vector<uint8_t>>(
+            store->serialise_snapshot(commit_idx)));
+      }
+
+      const auto& [idx, snapshot] = leader_snapshot.value();
+
+      LOG_INFO_FMT(
+        "Send snapshot from {} to {}: {} ({} bytes)",
+        local_id,
+        to,
+        idx,
+        snapshot->size());
+
+      // Append entries resume from the snapshot index, once it has been
+      // installed.
+      auto& node = nodes.at(to);
+      node.snapshot =
+        SnapshotTransfer{idx, get_term_internal(idx), snapshot, 0};
+      node.sent_idx = idx;
+
+      send_snapshot_chunk(to);
+    }
+
+    void send_snapshot_chunk(NodeId to)
+    {
+      // Only one chunk is sent at a time, so that a snapshot does not flood
+      // the connection to the follower. The next one is sent once this one
+      // has been acknowledged, and this one is sent again periodically until
+      // then.
+      const auto& transfer = nodes.at(to).snapshot.value();
+      const auto& snapshot = *transfer.data;
+      auto end =
+        std::min(transfer.offset + snapshot_chunk_size, snapshot.size());
+
+      LOG_DEBUG_FMT(
+        "Send snapshot chunk from {} to {}: {} at {}",
+        local_id,
+        to,
+        transfer.idx,
+        transfer.offset);
+
+      InstallSnapshot is = {raft_install_snapshot,
+                            local_id,
+                            current_term,
+                            transfer.idx,
+                            transfer.term_of_idx,
+                            snapshot.size(),
+                            transfer.offset};
+
+      channels->send_encrypted(
+        ccf::NodeMsgType::consensus_msg,
+        to,
+        {snapshot.begin() + transfer.offset, snapshot.begin() + end},
+        is);
+    }
+
+    void recv_install_snapshot(const uint8_t* data, size_t size)
+    {
+      std::pair<InstallSnapshot, std::vector<uint8_t>> p;
+
+      try
+      {
+        p = channels->template recv_encrypted<InstallSnapshot>(data, size);
+      }
+      catch (const std::logic_error& err)
+      {
+        LOG_FAIL_FMT(err.what());
+        return;
+      }
+
+      auto& [r, chunk] = p;
+
+      LOG_DEBUG_FMT(
+        "Recv install snapshot to {} from {} at {}: {}/{}",
+        local_id,
+        r.from_node,
+        r.idx,
+        r.offset + chunk.size(),
+        r.total_size);
+
+      if (current_term > r.term)
+      {
+        // Reply false, since our term is later than the received term.
+        LOG_DEBUG_FMT(
+          "Recv install snapshot to {} from {} but our term is later",
+          local_id,
+          r.from_node);
+        send_append_entries_response(r.from_node, false);
+        return;
+      }
+      else if (current_term < r.term || state == Candidate)
+      {
+        become_follower(r.term);
+      }
+
+      restart_election_timeout();
+
+      if (r.idx <= commit_idx)
+      {
+        // This node has already committed the state in the snapshot, so the
+        // leader can send entries instead.
+        pending_snapshot.reset();
+        send_append_entries_response(r.from_node, true);
+        return;
+      }
+
+      if (recovery_max_index.has_value())
+      {
+        // While this node reads the private ledger, it cannot install a
+        // snapshot past the state it is recovering.
+        LOG_INFO_FMT(
+          "Recv install snapshot to {} from {} but recovery is in progress",
+          local_id,
+          r.from_node);
+        return;
+      }
+
+      if (r.offset == 0)
+      {
+        pending_snapshot = PendingSnapshot{r.idx, r.term_of_idx, {}};
+        pending_snapshot->data.reserve(r.total_size);
+      }
+      else if (
+        !pending_snapshot.has_value() || pending_snapshot->idx != r.idx ||
+        pending_snapshot->data.size() != r.offset)
+      {
+        // The chunk was already received, or one was missed. The leader is
+        // told which chunk to send next, from the start of the snapshot if
+        // this node is not receiving it.
+        LOG_DEBUG_FMT(
+          "Recv install snapshot to {} from {} with unexpected chunk at {}",
+          local_id,
+          r.from_node,
+          r.offset);
+        if (pending_snapshot.has_value() && pending_snapshot->idx != r.idx)
+          pending_snapshot.reset();
+
+        send_install_snapshot_response(
+          r.from_node,
+          r.idx,
+          pending_snapshot.has_value() ? pending_snapshot->data.size() : 0);
+        return;
+      }
+
+      auto& pending = pending_snapshot.value();
+      pending.data.insert(pending.data.end(), chunk.begin(), chunk.end());
+
+      if (pending.data.size() < r.total_size)
+      {
+        send_install_snapshot_response(
+          r.from_node, r.idx, pending.data.size());
+        return;
+      }
+
+      if (pending.data.size() > r.total_size)
+      {
+        LOG_FAIL_FMT(
+          "Recv install snapshot to {} from {} larger than expected ({} > {})",
+          local_id,
+          r.from_node,
+          pending.data.size(),
+          r.total_size);
+        pending_snapshot.reset();
+        return;
+      }
+
+      install_snapshot(pending.idx, pending.term_of_idx, pending.data);
+      pending_snapshot.reset();
+
+      if (leader_id != r.from_node)
+      {
+        leader_id = r.from_node;
+        LOG_DEBUG_FMT("Node {} thinks leader is {}", local_id, leader_id);
+      }
+
+      send_append_entries_response(r.from_node, true);
+    }
+
+    void send_install_snapshot_response(NodeId to, Index idx, size_t offset)
+    {
+      LOG_DEBUG_FMT(
+        "Send install snapshot response from {} to {} for {}: {}",
+        local_id,
+        to,
+        idx,
+        offset);
+
+      InstallSnapshotResponse response = {
+        raft_install_snapshot_response, local_id, current_term, idx, offset};
+
+      channels->send_authenticated(
+        ccf::NodeMsgType::consensus_msg, to, response);
+    }
+
+    void recv_install_snapshot_response(const uint8_t* data, size_t size)
+    {
+      // Ignore if we're not the leader.
+      if (state != Leader)
+        return;
+
+      InstallSnapshotResponse r;
+
+      try
+      {
+        r = channels->template recv_authenticated<InstallSnapshotResponse>(
+          data, size);
+      }
+      catch (const std::logic_error& err)
+      {
+        LOG_FAIL_FMT(err.what());
+        return;
+      }
+
+      auto node = nodes.find(r.from_node);
+      if (node == nodes.end())
+      {
+        // Ignore if we don't recognise the node.
+        LOG_FAIL_FMT(
+          "Recv install snapshot response to {} from {}: unknown node",
+          local_id,
+          r.from_node);
+        return;
+      }
+      else if (current_term < r.term)
+      {
+        // We are behind, convert to a follower.
+        LOG_DEBUG_FMT(
+          "Recv install snapshot response to {} from {}: more recent term",
+          local_id,
+          r.from_node);
+        become_follower(r.term);
+        return;
+      }
+
+      auto& transfer = node->second.snapshot;
+      if (
+        current_term != r.term || !transfer.has_value() ||
+        transfer->idx != r.idx || transfer->offset == r.offset ||
+        r.offset >= transfer->data->size())
+      {
+        // Stale response, or the chunk waiting to be acknowledged is still
+        // expected by the follower, and is sent again periodically.
+        LOG_DEBUG_FMT(
+          "Recv install snapshot response to {} from {}: stale",
+          local_id,
+          r.from_node);
+        return;
+      }
+
+      LOG_DEBUG_FMT(
+        "Recv install snapshot response to {} from {} for {}: {}",
+        local_id,
+        r.from_node,
+        r.idx,
+        r.offset);
+
+      transfer->offset = r.offset;
+      send_snapshot_chunk(r.from_node);
+    }
+
+    void install_snapshot(
+      Index idx, Term term_of_idx, const std::vector<uint8_t>& snapshot)
+    {
+      LOG_INFO_FMT("Installing snapshot on {}: {}", local_id, idx);
+
+      // Uncommitted configurations are replaced by the ones in the snapshot,
+      // which are added by the store as it is deserialised.
+      while (!configurations.empty() &&
+             (configurations.back().idx > commit_idx))
+        configurations.pop_back();
+
+      // During recovery, only the public state of the snapshot is loaded. It
+      // is still recorded whole, so that the private state is recovered from
+      // it along with the rest of the ledger.
+      if (
+        store->deserialise_snapshot(snapshot, public_only) ==
+        kv::DeserialiseSuccess::FAILED)
+      {
+        throw std::logic_error(
+          "Follower failed to install snapshot at " + std::to_string(idx));
+      }
+
+      ledger->put_snapshot(idx, snapshot, ++ledger_epoch);
+
+      // The snapshot is already committed, so it is acknowledged without
+      // waiting for the host to sync it
+      last_idx = idx;
+      durable_idx = std::max(durable_idx, idx);
+      commit_idx = idx;
+      snapshot_idx = idx;
+      committable_indices.clear();
+      term_history.reset(idx, term_of_idx);
+
+      prune_configurations(idx);
+      create_and_remove_node_state();
+    }
+
     void recv_append_entries(const uint8_t* data, size_t size)
     {
       AppendEntries r;
@@ -630,7 +1065,8 @@ namespace raft
             r.from_node);
 
           last_idx = r.prev_idx;
-          ledger->truncate(r.prev_idx);
+          durable_idx = std::min(durable_idx, last_idx);
+          ledger->truncate(r.prev_idx, ++ledger_epoch);
           send_append_entries_response(r.from_node, false);
           return;
         }
@@ -671,17 +1107,25 @@ namespace raft
       term_history.update(commit_idx + 1, r.term_of_idx);
     }
 
+    Index last_durable_idx()
+    {
+      return wait_for_durable ? std::min(last_idx, durable_idx) : last_idx;
+    }
+
     void send_append_entries_response(NodeId to, bool answer)
     {
       LOG_DEBUG_FMT(
         "Send append entries response from {} to {} for index {}: {}",
         local_id,
         to,
-        last_idx,
+        last_durable_idx(),
         answer);
 
-      AppendEntriesResponse response = {
-        raft_append_entries_response, local_id, current_term, last_idx, answer};
+      AppendEntriesResponse response = {raft_append_entries_response,
+                                        local_id,
+                                        current_term,
+                                        last_durable_idx(),
+                                        answer};
 
       channels->send_authenticated(
         ccf::NodeMsgType::consensus_msg, to, response);
@@ -742,6 +1186,12 @@ namespace raft
       // Update next and match for the responding node.
       node->second.match_idx = std::min(r.last_log_idx, last_idx);
 
+      // Once the node has installed the snapshot it was sent, or no longer
+      // needs it, entries are sent again.
+      auto& transfer = node->second.snapshot;
+      if (r.success && transfer.has_value() && r.last_log_idx >= transfer->idx)
+        transfer.reset();
+
       if (!r.success)
       {
         // Failed due to log inconsistency. Reset sent_idx and try again.
@@ -974,6 +1424,7 @@ namespace raft
       {
         it->second.match_idx = 0;
         it->second.sent_idx = next - 1;
+        it->second.snapshot.reset();
 
         // Send an empty append_entries to all nodes.
         send_append_entries(it->first, next);
@@ -1023,7 +1474,7 @@ namespace raft
         for (auto node : c.nodes)
         {
           if (node == local_id)
-            match.push_back(last_idx);
+            match.push_back(last_durable_idx());
           else
             match.push_back(nodes.at(node).match_idx);
         }
@@ -1088,6 +1539,14 @@ namespace raft
       store->compact(idx);
       LOG_DEBUG_FMT("Commit on {}: {}", local_id, idx);
 
+      ledger->commit(idx);
+
+      if (prune_configurations(idx))
+        create_and_remove_node_state();
+    }
+
+    bool prune_configurations(Index idx)
+    {
       // Examine all configurations that are followed by a globally committed
       // configuration.
       bool changed = false;
@@ -1109,8 +1568,7 @@ namespace raft
         changed = true;
       }
 
-      if (changed)
-        create_and_remove_node_state();
+      return changed;
     }
 
     void rollback(Index idx)
@@ -109,6 +109,17 @@ namespace raft
       raft->suspend_replication(version);
     }
 
+    void set_durable_seqno(SeqNo seqno, size_t epoch) override
+    {
+      raft->set_durable_idx(seqno, epoch);
+    }
+
+    void set_snapshot(
+      SeqNo seqno, const std::vector<uint8_t>& snapshot) override
+    {
+      raft->set_snapshot(seqno, snapshot);
+    }
+
     void set_f(ccf::NodeId) override
     {
       return;
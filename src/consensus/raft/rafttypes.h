@@ -22,7 +22,14 @@ namespace raft
   {
     size_t request_timeout;
     size_t election_timeout;
-    MSGPACK_DEFINE(request_timeout, election_timeout);
+    // A follower lagging by more than this many entries is sent a snapshot
+    // rather than the entries themselves. 0 disables snapshot transfer.
+    size_t snapshot_lag = 0;
+    // Set when the host syncs the ledger to disk, in which case entries are
+    // only acknowledged once the host has reported them as durable
+    bool wait_for_durable = false;
+    MSGPACK_DEFINE(
+      request_timeout, election_timeout, snapshot_lag, wait_for_durable);
   };
 
   template <typename S>
@@ -36,6 +43,9 @@ namespace raft
       Term* term = nullptr) = 0;
     virtual void compact(Index v) = 0;
     virtual void rollback(Index v) = 0;
+    virtual std::vector<uint8_t> serialise_snapshot(Index v) = 0;
+    virtual S deserialise_snapshot(
+      const std::vector<uint8_t>& data, bool public_only = false) = 0;
   };
 
   template <typename T, typename S>
@@ -72,6 +82,25 @@ namespace raft
       if (p)
         p->rollback(v);
     }
+
+    std::vector<uint8_t> serialise_snapshot(Index v)
+    {
+      auto p = x.lock();
+      if (p)
+        return p->serialise_snapshot(v);
+
+      return {};
+    }
+
+    S deserialise_snapshot(
+      const std::vector<uint8_t>& data, bool public_only = false)
+    {
+      auto p = x.lock();
+      if (p)
+        return p->deserialise_snapshot(data, public_only);
+
+      return S::FAILED;
+    }
   };
 
   enum RaftMsgType : Node2NodeMsg
@@ -80,6 +109,8 @@ namespace raft
     raft_append_entries_response,
     raft_request_vote,
     raft_request_vote_response,
+    raft_install_snapshot,
+    raft_install_snapshot_response,
   };
 
 #pragma pack(push, 1)
@@ -106,6 +137,26 @@ namespace raft
     bool success;
   };
 
+  struct InstallSnapshot : RaftHeader
+  {
+    Term term;
+    Index idx;
+    Term term_of_idx;
+    // The snapshot is sent in chunks, each one encrypted as the payload of
+    // its own message
+    uint64_t total_size;
+    uint64_t offset;
+  };
+
+  struct InstallSnapshotResponse : RaftHeader
+  {
+    Term term;
+    Index idx;
+    // Offset of the next chunk expected by the follower, which the leader
+    // only sends once the previous one has been acknowledged
+    uint64_t offset;
+  };
+
   struct RequestVote : RaftHeader
   {
     Term term;
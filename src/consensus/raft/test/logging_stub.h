@@ -5,6 +5,7 @@
 #include "consensus/raft/raft.h"
 #include "consensus/raft/rafttypes.h"
 
+#include <cstring>
 #include <map>
 #include <vector>
 
@@ -18,6 +19,9 @@ namespace raft
   public:
     std::vector<std::shared_ptr<std::vector<uint8_t>>> ledger;
     uint64_t skip_count = 0;
+    Index snapshot_idx = 0;
+    // Entries are recorded as malformed while set
+    bool reject_entries = false;
 
     LedgerStubProxy(NodeId id) : _id(id) {}
 
@@ -45,6 +49,9 @@ namespace raft
                 << ": record s: " << size << std::endl;
 #endif
 
+      if (reject_entries)
+        return std::make_pair(std::vector<uint8_t>(), false);
+
       auto buffer = std::make_shared<std::vector<uint8_t>>(data, data + size);
       ledger.push_back(buffer);
       return std::make_pair(*buffer, true);
@@ -55,7 +62,7 @@ namespace raft
       skip_count++;
     }
 
-    void truncate(Index idx)
+    void truncate(Index idx, size_t epoch)
     {
 #ifdef STUB_LOG
       std::cout << "  KV" << _id << "->>Node" << _id << ": truncate i: " << idx
@@ -63,6 +70,27 @@ namespace raft
 #endif
     }
 
+    void commit(Index idx)
+    {
+#ifdef STUB_LOG
+      std::cout << "  Node" << _id << "->>Ledger" << _id
+                << ": commit i: " << idx << std::endl;
+#endif
+    }
+
+    void put_snapshot(
+      Index idx, const std::vector<uint8_t>& snapshot, size_t epoch)
+    {
+#ifdef STUB_LOG
+      std::cout << "  Node" << _id << "->>Ledger" << _id
+                << ": snapshot i: " << idx << ", s: " << snapshot.size()
+                << std::endl;
+#endif
+
+      ledger.clear();
+      snapshot_idx = idx;
+    }
+
     void reset_skip_count()
     {
       skip_count = 0;
@@ -79,6 +107,11 @@ namespace raft
       sent_request_vote_response;
     std::list<std::pair<NodeId, AppendEntriesResponse>>
       sent_append_entries_response;
+    // Install snapshot messages are captured as they would be received: the
+    // header followed by the chunk
+    std::list<std::pair<NodeId, std::vector<uint8_t>>> sent_install_snapshot;
+    std::list<std::pair<NodeId, InstallSnapshotResponse>>
+      sent_install_snapshot_response;
 
     ChannelStubProxy() {}
 
@@ -110,10 +143,32 @@ namespace raft
       sent_append_entries_response.push_back(std::make_pair(to, data));
     }
 
+    void send_authenticated(
+      const ccf::NodeMsgType& msg_type,
+      NodeId to,
+      const InstallSnapshotResponse& data)
+    {
+      sent_install_snapshot_response.push_back(std::make_pair(to, data));
+    }
+
+    bool send_encrypted(
+      const ccf::NodeMsgType& msg_type,
+      NodeId to,
+      const std::vector<uint8_t>& data,
+      const InstallSnapshot& msg)
+    {
+      std::vector<uint8_t> wire(sizeof(msg));
+      std::memcpy(wire.data(), &msg, sizeof(msg));
+      wire.insert(wire.end(), data.begin(), data.end());
+      sent_install_snapshot.push_back(std::make_pair(to, wire));
+      return true;
+    }
+
     size_t sent_msg_count() const
     {
       return sent_request_vote.size() + sent_request_vote_response.size() +
-        sent_append_entries.size() + sent_append_entries_response.size();
+        sent_append_entries.size() + sent_append_entries_response.size() +
+        sent_install_snapshot.size() + sent_install_snapshot_response.size();
     }
 
     template <class T>
@@ -121,6 +176,14 @@ namespace raft
     {
       return serialized::overlay<T>(data, size);
     }
+
+    template <class T>
+    std::pair<T, std::vector<uint8_t>> recv_encrypted(
+      const uint8_t* data, size_t size)
+    {
+      auto t = serialized::read<T>(data, size);
+      return std::make_pair(t, std::vector<uint8_t>(data, data + size));
+    }
   };
 
   class LoggingStubStore
@@ -129,6 +192,9 @@ namespace raft
     raft::NodeId _id;
 
   public:
+    size_t snapshot_size = 16;
+    std::vector<uint8_t> installed_snapshot;
+
     LoggingStubStore(raft::NodeId id) : _id(id) {}
 
     void compact(Index i)
@@ -154,5 +220,21 @@ namespace raft
     {
       return kv::DeserialiseSuccess::PASS;
     }
+
+    std::vector<uint8_t> serialise_snapshot(Index i)
+    {
+#ifdef STUB_LOG
+      std::cout << "  Node" << _id << "->>KV" << _id << ": snapshot i: " << i
+                << std::endl;
+#endif
+      return std::vector<uint8_t>(snapshot_size, (uint8_t)i);
+    }
+
+    kv::DeserialiseSuccess deserialise_snapshot(
+      const std::vector<uint8_t>& data, bool public_only = false)
+    {
+      installed_snapshot = data;
+      return kv::DeserialiseSuccess::PASS;
+    }
   };
 }
\ No newline at end of file
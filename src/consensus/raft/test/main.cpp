@@ -740,3 +740,342 @@ TEST_CASE("Exceed append entries limit")
      sent_entries <= num_small_entries_sent + num_big_entries));
   REQUIRE(r2.ledger->ledger.size() == individual_entries);
 }
+
+TEST_CASE("Lagging follower is sent a snapshot")
+{
+  auto kv_store0 = std::make_shared<Store>(0);
+  auto kv_store1 = std::make_shared<Store>(1);
+  auto kv_store2 = std::make_shared<Store>(2);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+  raft::NodeId node_id2(2);
+
+  ms request_timeout(10);
+  size_t snapshot_lag = 3;
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20),
+    false,
+    snapshot_lag);
+  TRaft r1(
+    std::make_unique<Adaptor>(kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100));
+  TRaft r2(
+    std::make_unique<Adaptor>(kv_store2),
+    std::make_unique<raft::LedgerStubProxy>(node_id2),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id2,
+    request_timeout,
+    ms(50));
+
+  // Large enough to be sent in several chunks
+  kv_store0->snapshot_size = TRaft::snapshot_chunk_size * 2 + 1;
+
+  std::unordered_set<raft::NodeId> config0 = {node_id0, node_id1};
+  r0.add_configuration(0, config0);
+  r1.add_configuration(0, config0);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+
+  r0.periodic(std::chrono::milliseconds(200));
+
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_request_vote_response));
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  const raft::Index last_committed = 10;
+  for (raft::Index i = 1; i <= last_committed; ++i)
+  {
+    REQUIRE(r0.replicate({{i, {(uint8_t)i}, true}}));
+    r0.periodic(request_timeout);
+    dispatch_all(nodes, r0.channels->sent_append_entries);
+    dispatch_all(nodes, r1.channels->sent_append_entries_response);
+  }
+  REQUIRE(r0.get_commit_idx() == last_committed);
+
+  INFO("Node 2 joins the ensemble");
+
+  std::unordered_set<raft::NodeId> config1 = {node_id0, node_id1, node_id2};
+  r0.add_configuration(1, config1);
+  r1.add_configuration(1, config1);
+  r2.add_configuration(0, config1);
+
+  nodes[node_id2] = &r2;
+
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(r2.channels->sent_append_entries_response.size() == 1);
+  REQUIRE(!r2.channels->sent_append_entries_response.front().second.success);
+
+  INFO("Node 0 sends a snapshot rather than the entries Node 2 has missed");
+
+  REQUIRE(1 == dispatch_all(nodes, r2.channels->sent_append_entries_response));
+  REQUIRE(r0.channels->sent_append_entries.empty());
+
+  INFO("Each chunk is sent once the previous one has been acknowledged");
+
+  size_t offset = 0;
+  size_t chunks = 0;
+  while (r0.channels->sent_install_snapshot.size())
+  {
+    REQUIRE(r0.channels->sent_install_snapshot.size() == 1);
+    auto [to, wire] = r0.channels->sent_install_snapshot.front();
+    r0.channels->sent_install_snapshot.pop_front();
+    REQUIRE(to == node_id2);
+
+    raft::InstallSnapshot is;
+    std::memcpy(&is, wire.data(), sizeof(is));
+    REQUIRE(is.idx == last_committed);
+    REQUIRE(is.term == 1);
+    REQUIRE(is.term_of_idx == 1);
+    REQUIRE(is.total_size == kv_store0->snapshot_size);
+    REQUIRE(is.offset == offset);
+    offset += wire.size() - sizeof(is);
+    ++chunks;
+
+    r2.recv_message(wire.data(), wire.size());
+
+    if (chunks == 1)
+    {
+      // A chunk is sent again until it has been acknowledged, and the
+      // follower ignores the copy
+      r0.periodic(request_timeout);
+      r0.channels->sent_append_entries.clear();
+      REQUIRE(r0.channels->sent_install_snapshot.size() == 1);
+      auto copy = r0.channels->sent_install_snapshot.front().second;
+      r0.channels->sent_install_snapshot.pop_front();
+      REQUIRE(copy == wire);
+      r2.recv_message(copy.data(), copy.size());
+    }
+
+    if (offset < kv_store0->snapshot_size)
+    {
+      REQUIRE(
+        dispatch_all_and_check(
+          nodes,
+          r2.channels->sent_install_snapshot_response,
+          [&](const auto& msg) {
+            REQUIRE(msg.idx == last_committed);
+            REQUIRE(msg.offset == offset);
+          }) == (chunks == 1 ? 2 : 1));
+    }
+  }
+  REQUIRE(chunks == 3);
+
+  REQUIRE(kv_store2->installed_snapshot.size() == kv_store0->snapshot_size);
+  REQUIRE(kv_store2->installed_snapshot.front() == (uint8_t)last_committed);
+  REQUIRE(r2.ledger->snapshot_idx == last_committed);
+  REQUIRE(r2.ledger->ledger.size() == 0);
+  REQUIRE(r2.get_last_idx() == last_committed);
+  REQUIRE(r2.get_commit_idx() == last_committed);
+  REQUIRE(r2.get_term(last_committed) == 1);
+
+  REQUIRE(
+    1 ==
+    dispatch_all_and_check(
+      nodes, r2.channels->sent_append_entries_response, [&](const auto& msg) {
+        REQUIRE(msg.last_log_idx == last_committed);
+        REQUIRE(msg.success);
+      }));
+
+  INFO("Append entries resume from the snapshot index");
+
+  REQUIRE(r0.replicate({{last_committed + 1, {1, 2, 3}, true}}));
+  r0.periodic(request_timeout);
+  r0.channels->sent_append_entries.remove_if(
+    [&](const auto& msg) { return msg.first != node_id2; });
+
+  REQUIRE(
+    1 ==
+    dispatch_all_and_check(
+      nodes, r0.channels->sent_append_entries, [&](const auto& msg) {
+        REQUIRE(msg.idx == last_committed + 1);
+        REQUIRE(msg.prev_idx == last_committed);
+        REQUIRE(msg.prev_term == 1);
+      }));
+  REQUIRE(r0.channels->sent_install_snapshot.empty());
+  REQUIRE(r2.ledger->ledger.size() == 1);
+  REQUIRE(r2.get_last_idx() == last_committed + 1);
+}
+
+TEST_CASE("Entries are only acknowledged once durable")
+{
+  auto kv_store0 = std::make_shared<Store>(0);
+  auto kv_store1 = std::make_shared<Store>(1);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+
+  ms request_timeout(10);
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20),
+    false,
+    0,
+    true);
+  TRaft r1(
+    std::make_unique<Adaptor>(kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100),
+    false,
+    0,
+    true);
+
+  std::unordered_set<raft::NodeId> config0 = {node_id0, node_id1};
+  r0.add_configuration(0, config0);
+  r1.add_configuration(0, config0);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+
+  r0.periodic(std::chrono::milliseconds(200));
+
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_request_vote_response));
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  REQUIRE(r0.replicate({{1, {1}, true}, {2, {2}, true}}));
+  r0.periodic(request_timeout);
+  REQUIRE(r0.get_commit_idx() == 0);
+
+  INFO("Node 1 does not acknowledge the entries until they are durable");
+
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(r1.get_last_idx() == 2);
+  REQUIRE(
+    1 ==
+    dispatch_all_and_check(
+      nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+        REQUIRE(msg.last_log_idx == 0);
+        REQUIRE(msg.success);
+      }));
+  REQUIRE(r0.get_commit_idx() == 0);
+
+  r1.set_durable_idx(1, 0);
+  REQUIRE(
+    1 ==
+    dispatch_all_and_check(
+      nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+        REQUIRE(msg.last_log_idx == 1);
+        REQUIRE(msg.success);
+      }));
+
+  INFO("Node 0 only counts the entries it has made durable");
+
+  REQUIRE(r0.get_commit_idx() == 0);
+  r0.set_durable_idx(2, 0);
+  REQUIRE(r0.get_commit_idx() == 1);
+
+  r1.set_durable_idx(2, 0);
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+  REQUIRE(r0.get_commit_idx() == 2);
+}
+
+TEST_CASE("Durability reports from before a truncation are ignored")
+{
+  auto kv_store0 = std::make_shared<Store>(0);
+  auto kv_store1 = std::make_shared<Store>(1);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+
+  ms request_timeout(10);
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20),
+    false,
+    0,
+    true);
+  TRaft r1(
+    std::make_unique<Adaptor>(kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100),
+    false,
+    0,
+    true);
+
+  std::unordered_set<raft::NodeId> config0 = {node_id0, node_id1};
+  r0.add_configuration(0, config0);
+  r1.add_configuration(0, config0);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+
+  r0.periodic(std::chrono::milliseconds(200));
+
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_request_vote_response));
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  REQUIRE(r0.replicate({{1, {1}, true}, {2, {2}, true}}));
+  r0.periodic(request_timeout);
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+  REQUIRE(r1.get_last_idx() == 2);
+
+  INFO("Node 1 truncates its ledger when it receives a malformed entry");
+
+  r1.ledger->reject_entries = true;
+  REQUIRE(r0.replicate({{3, {3}, true}}));
+  r0.periodic(request_timeout);
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(r1.get_last_idx() == 2);
+  REQUIRE(
+    1 ==
+    dispatch_all_and_check(
+      nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+        REQUIRE(msg.last_log_idx == 0);
+        REQUIRE(!msg.success);
+      }));
+
+  r1.ledger->reject_entries = false;
+  REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  REQUIRE(r1.get_last_idx() == 3);
+  REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  INFO("Reports sent by the host before the truncation are ignored");
+
+  r1.set_durable_idx(3, 0);
+  REQUIRE(r1.channels->sent_append_entries_response.empty());
+
+  r1.set_durable_idx(3, 1);
+  REQUIRE(
+    1 ==
+    dispatch_all_and_check(
+      nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+        REQUIRE(msg.last_log_idx == 3);
+        REQUIRE(msg.success);
+      }));
+}
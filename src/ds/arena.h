@@ -0,0 +1,118 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace arena
+{
+  // Bump allocator for objects that are all released together, such as the
+  // views of a transaction and their read and write sets. Memory is taken
+  // from blocks of doubling size, the first of which is held inline, and is
+  // only reclaimed when the arena is reset or destroyed: deallocation is a
+  // no-op. An arena must not be moved while memory is allocated from it.
+  class Arena
+  {
+  private:
+    static constexpr size_t inline_size = 1024;
+
+    alignas(std::max_align_t) uint8_t first_block[inline_size];
+    std::vector<std::unique_ptr<uint8_t[]>> blocks;
+    uint8_t* next;
+    size_t remaining;
+    size_t next_block_size;
+
+    void add_block(size_t min_size)
+    {
+      while (next_block_size < min_size)
+        next_block_size *= 2;
+
+      blocks.emplace_back(new uint8_t[next_block_size]);
+      next = blocks.back().get();
+      remaining = next_block_size;
+      next_block_size *= 2;
+    }
+
+  public:
+    Arena()
+    {
+      reset();
+    }
+
+    Arena(const Arena& that) = delete;
+    Arena& operator=(const Arena& that) = delete;
+
+    void* allocate(size_t size, size_t align)
+    {
+      auto offset = (align - reinterpret_cast<uintptr_t>(next) % align) % align;
+      if (offset + size > remaining)
+      {
+        // Blocks are aligned for any type
+        add_block(size);
+        offset = 0;
+      }
+
+      auto p = next + offset;
+      next = p + size;
+      remaining -= offset + size;
+      return p;
+    }
+
+    // Releases all allocated memory, other than the inline block
+    void reset()
+    {
+      blocks.clear();
+      next = first_block;
+      remaining = inline_size;
+      next_block_size = 2 * inline_size;
+    }
+  };
+
+  // Standard allocator drawing from an arena, or from the heap if it has no
+  // arena, so that containers can be used the same way in both cases.
+  template <class T>
+  class Allocator
+  {
+  public:
+    using value_type = T;
+
+    Arena* arena = nullptr;
+
+    Allocator() = default;
+    Allocator(Arena* arena) : arena(arena) {}
+
+    template <class U>
+    Allocator(const Allocator<U>& that) : arena(that.arena)
+    {}
+
+    T* allocate(size_t n)
+    {
+      if (arena == nullptr)
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+
+      return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+      if (arena == nullptr)
+        ::operator delete(p);
+    }
+
+    template <class U>
+    bool operator==(const Allocator<U>& that) const
+    {
+      return arena == that.arena;
+    }
+
+    template <class U>
+    bool operator!=(const Allocator<U>& that) const
+    {
+      return arena != that.arena;
+    }
+  };
+}
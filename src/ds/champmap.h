@@ -3,8 +3,11 @@
 #pragma once
 
 #include <array>
-#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <new>
 #include <optional>
+#include <utility>
 #include <vector>
 
 namespace champ
@@ -69,16 +72,226 @@ namespace champ
     }
   };
 
-  template <class K, class V, class H>
+  // Nodes are immutable once they are shared, and are shared by all the
+  // versions of a map that contain them. Each holds an intrusive reference
+  // count, rather than being owned by std::shared_ptr, which halves the size
+  // of the pointers to children and avoids a control block per node. The
+  // count of nodes shared between threads, as the states of a store are, is
+  // atomic. Maps only ever used by one thread can use a plain count.
+  using SharedCount = std::atomic<uint32_t>;
+  using LocalCount = uint32_t;
+
+  inline void acquire(SharedCount& refs)
+  {
+    refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  inline bool release(SharedCount& refs)
+  {
+    return refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+  // Whether the caller holds the only reference to a node, which it may then
+  // mutate in place
+  inline bool unique(const SharedCount& refs)
+  {
+    return refs.load(std::memory_order_acquire) == 1;
+  }
+
+  inline bool unique(const LocalCount& refs)
+  {
+    return refs == 1;
+  }
+
+  inline void acquire(LocalCount& refs)
+  {
+    ++refs;
+  }
+
+  inline bool release(LocalCount& refs)
+  {
+    return --refs == 0;
+  }
+
+  // Free list of blocks the size of a node, per thread, from which nodes are
+  // allocated. Blocks freed by a thread are reused by the same thread, up to
+  // max_free of them, and the others are returned to the heap.
+  template <class T>
+  class Pool
+  {
+  private:
+    static constexpr size_t max_free = 4096;
+
+    union Block
+    {
+      Block* next;
+      alignas(T) uint8_t node[sizeof(T)];
+    };
+
+    // Trivially destructible, so that it remains usable while other thread
+    // local objects are destroyed
+    struct FreeList
+    {
+      Block* head;
+      size_t size;
+      bool closed;
+    };
+
+    static inline thread_local FreeList free_list = {nullptr, 0, false};
+
+    // Returns the blocks of a thread to the heap when it exits
+    struct Drain
+    {
+      ~Drain()
+      {
+        while (free_list.head != nullptr)
+        {
+          auto next = free_list.head->next;
+          delete free_list.head;
+          free_list.head = next;
+        }
+        free_list.size = 0;
+        free_list.closed = true;
+      }
+    };
+
+    static void register_drain()
+    {
+      static thread_local Drain drain;
+      (void)drain;
+    }
+
+  public:
+    static void* allocate()
+    {
+      if (free_list.head == nullptr)
+      {
+        register_drain();
+        return new Block;
+      }
+
+      auto block = free_list.head;
+      free_list.head = block->next;
+      --free_list.size;
+      return block;
+    }
+
+    static void deallocate(void* p)
+    {
+      auto block = static_cast<Block*>(p);
+      if (free_list.size >= max_free || free_list.closed)
+      {
+        delete block;
+        return;
+      }
+
+      block->next = free_list.head;
+      free_list.head = block;
+      ++free_list.size;
+    }
+  };
+
+  enum class NodeKind : uint8_t
+  {
+    Entry,
+    SubNodes,
+    Collisions
+  };
+
+  template <class K, class V, class H, class R>
+  struct Node
+  {
+    mutable R refs = 0;
+    const NodeKind kind;
+
+    Node(NodeKind kind_) : kind(kind_) {}
+
+    // A copy of a node is not shared
+    Node(const Node& that) : kind(that.kind) {}
+
+    void destroy();
+  };
+
+  // Intrusive pointer to a node
+  template <class T>
+  class Ptr
+  {
+  private:
+    T* p = nullptr;
+
+  public:
+    Ptr() = default;
+
+    explicit Ptr(T* p_) : p(p_)
+    {
+      if (p != nullptr)
+        acquire(p->refs);
+    }
+
+    template <class U>
+    friend class Ptr;
+
+    Ptr(const Ptr& that) : Ptr(that.p) {}
+
+    Ptr(Ptr&& that) noexcept : p(that.p)
+    {
+      that.p = nullptr;
+    }
+
+    template <class U>
+    Ptr(const Ptr<U>& that) : Ptr(that.p)
+    {}
+
+    template <class U>
+    Ptr(Ptr<U>&& that) noexcept : p(that.p)
+    {
+      that.p = nullptr;
+    }
+
+    ~Ptr()
+    {
+      if (p != nullptr && release(p->refs))
+        p->destroy();
+    }
+
+    Ptr& operator=(Ptr that) noexcept
+    {
+      std::swap(p, that.p);
+      return *this;
+    }
+
+    T* get() const
+    {
+      return p;
+    }
+
+    T* operator->() const
+    {
+      return p;
+    }
+
+    T& operator*() const
+    {
+      return *p;
+    }
+  };
+
+  template <class T, class... Args>
+  static Ptr<T> make_node(Args&&... args)
+  {
+    return Ptr<T>(new (Pool<T>::allocate()) T(std::forward<Args>(args)...));
+  }
+
+  template <class K, class V, class H, class R>
   struct SubNodes;
 
-  template <class K, class V>
-  struct Entry
+  template <class K, class V, class H, class R>
+  struct Entry : public Node<K, V, H, R>
   {
     K key;
     V value;
 
-    Entry(K k, V v) : key(k), value(v) {}
+    Entry(K k, V v) : Node<K, V, H, R>(NodeKind::Entry), key(k), value(v) {}
 
     const V* getp(const K& k) const
     {
@@ -89,13 +302,14 @@ namespace champ
     }
   };
 
-  template <class K, class V, class H>
-  using Node = std::shared_ptr<void>;
-
-  template <class K, class V, class H>
-  struct Collisions
+  template <class K, class V, class H, class R>
+  struct Collisions : public Node<K, V, H, R>
   {
-    std::array<std::vector<std::shared_ptr<Entry<K, V>>>, collision_bins> bins;
+    using EntryPtr = Ptr<Entry<K, V, H, R>>;
+
+    std::array<std::vector<EntryPtr>, collision_bins> bins;
+
+    Collisions() : Node<K, V, H, R>(NodeKind::Collisions) {}
 
     const V* getp(Hash hash, const K& k) const
     {
@@ -118,11 +332,14 @@ namespace champ
         const auto& entry = bin[i];
         if (k == entry->key)
         {
-          bin[i] = std::make_shared<Entry<K, V>>(k, v);
+          if (unique(entry->refs))
+            entry->value = v;
+          else
+            bin[i] = make_node<Entry<K, V, H, R>>(k, v);
           return false;
         }
       }
-      bin.push_back(std::make_shared<Entry<K, V>>(k, v));
+      bin.push_back(make_node<Entry<K, V, H, R>>(k, v));
       return true;
     }
 
@@ -139,19 +356,20 @@ namespace champ
     }
   };
 
-  template <class K, class V, class H>
-  struct SubNodes
+  template <class K, class V, class H, class R>
+  struct SubNodes : public Node<K, V, H, R>
   {
-    std::vector<Node<K, V, H>> nodes;
+    using NodePtr = Ptr<Node<K, V, H, R>>;
+
+    std::vector<NodePtr> nodes;
     Bitmap node_map;
     Bitmap data_map;
 
-    SubNodes() {}
-
-    SubNodes(std::vector<Node<K, V, H>> ns) : nodes(ns) {}
+    SubNodes() : Node<K, V, H, R>(NodeKind::SubNodes) {}
 
-    SubNodes(std::vector<Node<K, V, H>> ns, Bitmap nm, Bitmap dm) :
-      nodes(ns),
+    SubNodes(std::vector<NodePtr> ns, Bitmap nm, Bitmap dm) :
+      Node<K, V, H, R>(NodeKind::SubNodes),
+      nodes(std::move(ns)),
       node_map(nm),
       data_map(dm)
     {}
@@ -177,12 +395,12 @@ namespace champ
         return nullptr;
 
       if (data_map.check(idx))
-        return node_as<Entry<K, V>>(c_idx)->getp(k);
+        return node_as<Entry<K, V, H, R>>(c_idx)->getp(k);
 
       if (depth == (collision_depth - 1))
-        return node_as<Collisions<K, V, H>>(c_idx)->getp(hash, k);
+        return node_as<Collisions<K, V, H, R>>(c_idx)->getp(hash, k);
 
-      return node_as<SubNodes<K, V, H>>(c_idx)->getp(depth + 1, hash, k);
+      return node_as<SubNodes<K, V, H, R>>(c_idx)->getp(depth + 1, hash, k);
     }
 
     bool put_mut(SmallIndex depth, Hash hash, const K& k, const V& v)
@@ -195,32 +413,26 @@ namespace champ
         data_map = data_map.set(idx);
         c_idx = compressed_idx(idx);
         nodes.insert(
-          nodes.begin() + c_idx, std::make_shared<Entry<K, V>>(k, v));
+          nodes.begin() + c_idx, make_node<Entry<K, V, H, R>>(k, v));
         return true;
       }
 
       if (node_map.check(idx))
       {
-        bool insert;
         if (depth < (collision_depth - 1))
-        {
-          auto sn = *node_as<SubNodes<K, V, H>>(c_idx);
-          insert = sn.put_mut(depth + 1, hash, k, v);
-          nodes[c_idx] = std::make_shared<SubNodes<K, V, H>>(std::move(sn));
-        }
+          return owned<SubNodes<K, V, H, R>>(c_idx)->put_mut(
+            depth + 1, hash, k, v);
         else
-        {
-          auto sn = *node_as<Collisions<K, V, H>>(c_idx);
-          insert = sn.put_mut(hash, k, v);
-          nodes[c_idx] = std::make_shared<Collisions<K, V, H>>(std::move(sn));
-        }
-        return insert;
+          return owned<Collisions<K, V, H, R>>(c_idx)->put_mut(hash, k, v);
       }
 
-      const auto& entry0 = node_as<Entry<K, V>>(c_idx);
+      const auto entry0 = node_as<Entry<K, V, H, R>>(c_idx);
       if (k == entry0->key)
       {
-        nodes[c_idx] = std::make_shared<Entry<K, V>>(k, v);
+        if (unique(entry0->refs))
+          entry0->value = v;
+        else
+          nodes[c_idx] = make_node<Entry<K, V, H, R>>(k, v);
         return false;
       }
 
@@ -228,8 +440,8 @@ namespace champ
       {
         const auto hash0 = H()(entry0->key);
         const auto idx0 = mask(hash0, depth + 1);
-        auto sub_node =
-          SubNodes<K, V, H>({entry0}, Bitmap(0), Bitmap(0).set(idx0));
+        auto sub_node = SubNodes<K, V, H, R>(
+          {NodePtr(entry0)}, Bitmap(0), Bitmap(0).set(idx0));
         sub_node.put_mut(depth + 1, hash, k, v);
 
         nodes.erase(nodes.begin() + c_idx);
@@ -238,16 +450,16 @@ namespace champ
         c_idx = compressed_idx(idx);
         nodes.insert(
           nodes.begin() + c_idx,
-          std::make_shared<SubNodes<K, V, H>>(std::move(sub_node)));
+          make_node<SubNodes<K, V, H, R>>(std::move(sub_node)));
       }
       else
       {
-        auto sub_node = Collisions<K, V, H>();
+        auto sub_node = Collisions<K, V, H, R>();
         const auto hash0 = H()(entry0->key);
         const auto idx0 = mask(hash0, collision_depth);
-        sub_node.bins[idx0].push_back(entry0);
+        sub_node.bins[idx0].emplace_back(entry0);
         const auto idx1 = mask(hash, collision_depth);
-        sub_node.bins[idx1].push_back(std::make_shared<Entry<K, V>>(k, v));
+        sub_node.bins[idx1].push_back(make_node<Entry<K, V, H, R>>(k, v));
 
         nodes.erase(nodes.begin() + c_idx);
         data_map = data_map.clear(idx);
@@ -255,18 +467,17 @@ namespace champ
         c_idx = compressed_idx(idx);
         nodes.insert(
           nodes.begin() + c_idx,
-          std::make_shared<Collisions<K, V, H>>(std::move(sub_node)));
+          make_node<Collisions<K, V, H, R>>(std::move(sub_node)));
       }
       return true;
     }
 
-    std::pair<std::shared_ptr<SubNodes<K, V, H>>, bool> put(
+    std::pair<Ptr<SubNodes<K, V, H, R>>, bool> put(
       SmallIndex depth, Hash hash, const K& k, const V& v) const
     {
-      auto node = *this;
-      auto r = node.put_mut(depth, hash, k, v);
-      return std::make_pair(
-        std::make_shared<SubNodes<K, V, H>>(std::move(node)), r);
+      auto node = make_node<SubNodes<K, V, H, R>>(*this);
+      auto r = node->put_mut(depth, hash, k, v);
+      return std::make_pair(std::move(node), r);
     }
 
     template <class F>
@@ -275,7 +486,7 @@ namespace champ
       const auto entries = data_map.pop();
       for (SmallIndex i = 0; i < entries; ++i)
       {
-        const auto& entry = node_as<Entry<K, V>>(i);
+        const auto entry = node_as<Entry<K, V, H, R>>(i);
         if (!f(entry->key, entry->value))
           return false;
       }
@@ -283,12 +494,12 @@ namespace champ
       {
         if (depth == (collision_depth - 1))
         {
-          if (!node_as<Collisions<K, V, H>>(i)->foreach(std::forward<F>(f)))
+          if (!node_as<Collisions<K, V, H, R>>(i)->foreach(std::forward<F>(f)))
             return false;
         }
         else
         {
-          if (!node_as<SubNodes<K, V, H>>(i)->foreach(
+          if (!node_as<SubNodes<K, V, H, R>>(i)->foreach(
                 depth + 1, std::forward<F>(f)))
             return false;
         }
@@ -298,26 +509,66 @@ namespace champ
 
   private:
     template <class A>
-    const std::shared_ptr<A>& node_as(SmallIndex c_idx) const
+    A* node_as(SmallIndex c_idx) const
     {
-      return reinterpret_cast<const std::shared_ptr<A>&>(nodes[c_idx]);
+      return static_cast<A*>(nodes[c_idx].get());
+    }
+
+    // Nodes that are only referred to by this one belong to the same
+    // version of the map, and were created by an earlier put of the same
+    // transient: they are mutated in place. Others are copied first.
+    template <class A>
+    A* owned(SmallIndex c_idx)
+    {
+      auto node = node_as<A>(c_idx);
+      if (unique(node->refs))
+        return node;
+
+      auto copy = make_node<A>(*node);
+      node = copy.get();
+      nodes[c_idx] = std::move(copy);
+      return node;
     }
   };
 
-  template <class K, class V, class H = std::hash<K>>
+  template <class T>
+  static void delete_node(T* node)
+  {
+    node->~T();
+    Pool<T>::deallocate(node);
+  }
+
+  template <class K, class V, class H, class R>
+  void Node<K, V, H, R>::destroy()
+  {
+    switch (kind)
+    {
+      case NodeKind::Entry:
+        delete_node(static_cast<Entry<K, V, H, R>*>(this));
+        break;
+      case NodeKind::SubNodes:
+        delete_node(static_cast<SubNodes<K, V, H, R>*>(this));
+        break;
+      case NodeKind::Collisions:
+        delete_node(static_cast<Collisions<K, V, H, R>*>(this));
+        break;
+    }
+  }
+
+  template <class K, class V, class H = std::hash<K>, class R = SharedCount>
   class Map
   {
   private:
-    std::shared_ptr<SubNodes<K, V, H>> root;
+    Ptr<SubNodes<K, V, H, R>> root;
     size_t _size = 0;
 
-    Map(std::shared_ptr<SubNodes<K, V, H>> root_, size_t size_) :
-      root(root_),
+    Map(Ptr<SubNodes<K, V, H, R>> root_, size_t size_) :
+      root(std::move(root_)),
       _size(size_)
     {}
 
   public:
-    Map() : root(std::make_shared<SubNodes<K, V, H>>()) {}
+    Map() : root(make_node<SubNodes<K, V, H, R>>()) {}
 
     size_t size() const
     {
@@ -344,7 +595,7 @@ namespace champ
       return root->getp(0, H()(key), key);
     }
 
-    const Map<K, V, H> put(const K& key, const V& value) const
+    const Map<K, V, H, R> put(const K& key, const V& value) const
     {
       auto r = root->put(0, H()(key), key, value);
       auto size_ = _size;
@@ -359,5 +610,61 @@ namespace champ
     {
       return root->foreach(0, std::forward<F>(f));
     }
+
+    // Applies a batch of puts to a map. Its intermediate versions are never
+    // observed, so each node is copied at most once: the nodes created by
+    // earlier puts of the batch are mutated in place. Pointers returned by
+    // getp may be invalidated by later puts. Once the batch has been applied,
+    // persistent() returns the resulting map, and the transient must no
+    // longer be used.
+    class Transient
+    {
+    private:
+      Ptr<SubNodes<K, V, H, R>> root;
+      size_t _size;
+
+    public:
+      Transient(const Map<K, V, H, R>& map) : root(map.root), _size(map._size)
+      {}
+
+      size_t size() const
+      {
+        return _size;
+      }
+
+      std::optional<V> get(const K& key) const
+      {
+        auto v = getp(key);
+
+        if (v)
+          return *v;
+        else
+          return {};
+      }
+
+      const V* getp(const K& key) const
+      {
+        return root->getp(0, H()(key), key);
+      }
+
+      void put(const K& key, const V& value)
+      {
+        if (!unique(root->refs))
+          root = make_node<SubNodes<K, V, H, R>>(*root);
+
+        if (root->put_mut(0, H()(key), key, value))
+          _size++;
+      }
+
+      Map<K, V, H, R> persistent()
+      {
+        return Map(std::move(root), _size);
+      }
+    };
+
+    Transient transient() const
+    {
+      return Transient(*this);
+    }
   };
 }
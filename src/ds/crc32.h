@@ -0,0 +1,45 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320), as used by zlib. This
+// detects accidental corruption only: use a MAC where integrity matters.
+namespace crc32
+{
+  namespace detail
+  {
+    constexpr std::array<uint32_t, 256> make_table()
+    {
+      std::array<uint32_t, 256> table = {};
+
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+        uint32_t c = i;
+        for (size_t k = 0; k < 8; ++k)
+          c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+        table[i] = c;
+      }
+
+      return table;
+    }
+
+    // inline, so that all translation units share a single table
+    inline constexpr std::array<uint32_t, 256> table = make_table();
+  }
+
+  // Passing the result of a previous call as crc continues the computation
+  // over a following buffer.
+  inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+  {
+    crc = ~crc;
+
+    for (size_t i = 0; i < size; ++i)
+      crc = detail::table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+  }
+}
@@ -0,0 +1,203 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace flat
+{
+  // Map holding its entries in a vector, in insertion order, which is
+  // searched linearly while the map is small. This avoids allocating a node
+  // per entry and a bucket array, as a hash map does, in the common case of a
+  // handful of entries. Once the map grows past small_size entries, the
+  // positions of its keys are also indexed in a hash map. Erasing an entry
+  // moves the last one in its place. As with a vector, inserting may
+  // invalidate iterators.
+  template <
+    class K,
+    class V,
+    class H = std::hash<K>,
+    class A = std::allocator<std::pair<K, V>>>
+  class Map
+  {
+  public:
+    using value_type = std::pair<K, V>;
+    using allocator_type = A;
+
+    static constexpr size_t small_size = 8;
+
+  private:
+    using Entries = std::vector<value_type, A>;
+    using IndexAllocator = typename std::allocator_traits<
+      A>::template rebind_alloc<std::pair<const K, size_t>>;
+    using Index =
+      std::unordered_map<K, size_t, H, std::equal_to<K>, IndexAllocator>;
+
+    Entries entries;
+    std::optional<Index> index;
+
+    size_t position(const K& k) const
+    {
+      if (index.has_value())
+      {
+        auto search = index->find(k);
+        return search == index->end() ? entries.size() : search->second;
+      }
+
+      for (size_t i = 0; i < entries.size(); ++i)
+      {
+        if (entries[i].first == k)
+          return i;
+      }
+
+      return entries.size();
+    }
+
+    void index_last()
+    {
+      if (index.has_value())
+      {
+        index->emplace(entries.back().first, entries.size() - 1);
+      }
+      else if (entries.size() > small_size)
+      {
+        index.emplace(
+          2 * entries.size(), H(), std::equal_to<K>(), entries.get_allocator());
+        for (size_t i = 0; i < entries.size(); ++i)
+          index->emplace(entries[i].first, i);
+      }
+    }
+
+  public:
+    using iterator = typename Entries::iterator;
+    using const_iterator = typename Entries::const_iterator;
+
+    Map(const A& alloc = A()) : entries(alloc) {}
+
+    template <class It>
+    Map(It first, It last, const A& alloc = A()) : entries(alloc)
+    {
+      for (; first != last; ++first)
+        insert(*first);
+    }
+
+    iterator begin()
+    {
+      return entries.begin();
+    }
+
+    iterator end()
+    {
+      return entries.end();
+    }
+
+    const_iterator begin() const
+    {
+      return entries.begin();
+    }
+
+    const_iterator end() const
+    {
+      return entries.end();
+    }
+
+    const_iterator cbegin() const
+    {
+      return entries.cbegin();
+    }
+
+    const_iterator cend() const
+    {
+      return entries.cend();
+    }
+
+    size_t size() const
+    {
+      return entries.size();
+    }
+
+    bool empty() const
+    {
+      return entries.empty();
+    }
+
+    void clear()
+    {
+      entries.clear();
+      index.reset();
+    }
+
+    iterator find(const K& k)
+    {
+      return entries.begin() + position(k);
+    }
+
+    const_iterator find(const K& k) const
+    {
+      return entries.begin() + position(k);
+    }
+
+    size_t count(const K& k) const
+    {
+      return position(k) == entries.size() ? 0 : 1;
+    }
+
+    /** Insert an entry, unless its key is already present
+     *
+     * @return iterator to the entry with that key, and whether it was
+     * inserted
+     */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K& k, Args&&... args)
+    {
+      auto pos = position(k);
+      if (pos != entries.size())
+        return {entries.begin() + pos, false};
+
+      entries.emplace_back(
+        std::piecewise_construct,
+        std::forward_as_tuple(k),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+      index_last();
+      return {entries.end() - 1, true};
+    }
+
+    template <class P>
+    std::pair<iterator, bool> insert(const P& p)
+    {
+      return try_emplace(p.first, p.second);
+    }
+
+    V& operator[](const K& k)
+    {
+      return try_emplace(k).first->second;
+    }
+
+    size_t erase(const K& k)
+    {
+      auto pos = position(k);
+      if (pos == entries.size())
+        return 0;
+
+      if (index.has_value())
+        index->erase(k);
+
+      auto last = entries.size() - 1;
+      if (pos != last)
+      {
+        entries[pos] = std::move(entries[last]);
+        if (index.has_value())
+          (*index)[entries[pos].first] = pos;
+      }
+
+      entries.pop_back();
+      return 1;
+    }
+  };
+}
@@ -88,19 +88,88 @@ public:
   }
 
   template <class F>
-  void foreach(F&& f) const
+  bool foreach(F&& f) const
   {
-    if (!empty())
+    return foreach_between(nullptr, nullptr, f);
+  }
+
+  // Iterate, in key order, over the keys in [from, to), until f returns false
+  template <class F>
+  bool range(const K& from, const K& to, F&& f) const
+  {
+    return foreach_between(&from, &to, f);
+  }
+
+  // Iterate, in key order, over the keys from the first one not less than
+  // from, until f returns false
+  template <class F>
+  bool foreach_from(const K& from, F&& f) const
+  {
+    return foreach_between(&from, nullptr, f);
+  }
+
+  // Same interface as champ::Map::Transient. Nodes of a red-black tree are
+  // rebalanced as keys are inserted, so they are still copied on every put.
+  class Transient
+  {
+  private:
+    RBMap map;
+
+  public:
+    Transient(const RBMap& map_) : map(map_) {}
+
+    std::optional<V> get(const K& key) const
     {
-      left().foreach(std::forward<F>(f));
-      f(rootKey(), rootValue());
-      right().foreach(std::forward<F>(f));
+      return map.get(key);
     }
+
+    const V* getp(const K& key) const
+    {
+      return map.getp(key);
+    }
+
+    void put(const K& key, const V& value)
+    {
+      map = map.put(key, value);
+    }
+
+    RBMap persistent()
+    {
+      return std::move(map);
+    }
+  };
+
+  Transient transient() const
+  {
+    return Transient(*this);
   }
 
 private:
   std::shared_ptr<const Node> _root;
 
+  // Bounds are ignored when null. Subtrees that are entirely out of bounds
+  // are not visited.
+  template <class F>
+  bool foreach_between(const K* from, const K* to, F& f) const
+  {
+    if (empty())
+      return true;
+
+    auto& k = rootKey();
+
+    if (
+      (from == nullptr || *from < k) && !left().foreach_between(from, to, f))
+      return false;
+
+    if (to != nullptr && !(k < *to))
+      return true;
+
+    if ((from == nullptr || !(k < *from)) && !f(k, rootValue()))
+      return false;
+
+    return right().foreach_between(from, to, f);
+  }
+
   Color rootColor() const
   {
     return _root->_c;
@@ -0,0 +1,136 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#include "../arena.h"
+#include "../flatmap.h"
+
+#include <cstring>
+#include <doctest/doctest.h>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using Entry = std::pair<uint64_t, std::string>;
+using HeapMap = flat::Map<uint64_t, std::string>;
+using ArenaMap = flat::Map<
+  uint64_t,
+  std::string,
+  std::hash<uint64_t>,
+  arena::Allocator<Entry>>;
+
+template <class M>
+void check_same(const M& m, const std::map<uint64_t, std::string>& model)
+{
+  REQUIRE(m.size() == model.size());
+  for (auto& [k, v] : m)
+  {
+    auto search = model.find(k);
+    REQUIRE(search != model.end());
+    REQUIRE(search->second == v);
+  }
+}
+
+template <class M>
+void random_ops(M& m, size_t max_key)
+{
+  std::mt19937 rand(42);
+  std::map<uint64_t, std::string> model;
+
+  for (size_t i = 0; i < 2000; ++i)
+  {
+    uint64_t k = rand() % max_key;
+    switch (rand() % 4)
+    {
+      case 0:
+      {
+        auto v = std::to_string(i);
+        m[k] = v;
+        model[k] = v;
+        break;
+      }
+      case 1:
+      {
+        auto [it, inserted] = m.insert(Entry(k, "inserted"));
+        auto [mit, minserted] = model.insert(Entry(k, "inserted"));
+        REQUIRE(inserted == minserted);
+        REQUIRE(it->second == mit->second);
+        break;
+      }
+      case 2:
+      {
+        REQUIRE(m.erase(k) == model.erase(k));
+        break;
+      }
+      case 3:
+      {
+        auto it = m.find(k);
+        auto mit = model.find(k);
+        REQUIRE((it == m.end()) == (mit == model.end()));
+        if (it != m.end())
+          REQUIRE(it->second == mit->second);
+        break;
+      }
+    }
+  }
+
+  check_same(m, model);
+}
+
+TEST_CASE("Flat map operations")
+{
+  // Small maps are searched linearly, larger ones are indexed
+  for (size_t max_key : {size_t(4), HeapMap::small_size + 1, size_t(100)})
+  {
+    INFO("Keys: " << max_key);
+    {
+      HeapMap m;
+      random_ops(m, max_key);
+    }
+    {
+      arena::Arena a;
+      ArenaMap m(&a);
+      random_ops(m, max_key);
+    }
+  }
+
+  INFO("Copy into another map");
+  {
+    HeapMap m;
+    for (uint64_t k = 0; k < 20; ++k)
+      m[k] = std::to_string(k);
+
+    std::unordered_map<uint64_t, std::string> copy(m.begin(), m.end());
+    REQUIRE(copy.size() == m.size());
+    REQUIRE(copy[7] == "7");
+
+    m.clear();
+    REQUIRE(m.empty());
+    REQUIRE(m.find(7) == m.end());
+  }
+}
+
+TEST_CASE("Arena allocation")
+{
+  arena::Arena a;
+
+  std::vector<void*> ps;
+  for (size_t i = 0; i < 1000; ++i)
+  {
+    auto size = 1 + i % 50;
+    auto align = alignof(std::max_align_t) >> (i % 4);
+    auto p = a.allocate(size, align);
+    REQUIRE(reinterpret_cast<uintptr_t>(p) % align == 0);
+    std::memset(p, static_cast<int>(i), size);
+    ps.push_back(p);
+  }
+
+  // Allocations larger than a block get a block of their own
+  auto large = a.allocate(100000, 8);
+  std::memset(large, 0, 100000);
+
+  for (size_t i = 0; i < ps.size(); ++i)
+    REQUIRE(*static_cast<uint8_t*>(ps[i]) == static_cast<uint8_t>(i));
+
+  a.reset();
+  REQUIRE(a.allocate(8, 8) == ps[0]);
+}
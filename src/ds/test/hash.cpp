@@ -2,6 +2,7 @@
 // Licensed under the Apache 2.0 License.
 #include "../hash.h"
 
+#include "../crc32.h"
 #include "../siphash.h"
 #include "siphash_knownhashes.h"
 
@@ -198,4 +199,16 @@ TEST_CASE("FNV-1a collision resistance" * doctest::test_suite("hash"))
       }
     }
   }
-}
\ No newline at end of file
+}
+TEST_CASE("CRC-32 correctness" * doctest::test_suite("hash"))
+{
+  const std::string check = "123456789";
+  const auto data = reinterpret_cast<const uint8_t*>(check.data());
+
+  REQUIRE(crc32::crc32(nullptr, 0) == 0);
+  REQUIRE(crc32::crc32(data, check.size()) == 0xCBF43926);
+
+  // The computation can be continued over several buffers
+  auto partial = crc32::crc32(data, 4);
+  REQUIRE(crc32::crc32(data + 4, check.size() - 4, partial) == 0xCBF43926);
+}
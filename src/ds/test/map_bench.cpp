@@ -12,6 +12,7 @@ using K = uint64_t;
 using V = std::vector<uint64_t>;
 
 static size_t val_size = 32;
+static size_t batch_size = 16;
 
 static V gen_val(size_t size)
 {
@@ -66,6 +67,46 @@ static void benchmark_put(picobench::state& s)
   s.stop_timer();
 }
 
+// Puts a batch of keys, as committing a transaction does
+template <class M>
+static void benchmark_put_batch(picobench::state& s)
+{
+  size_t size = s.iterations();
+  auto v = gen_val(val_size);
+  auto map = gen_map<M>(size);
+  s.start_timer();
+  for (auto _ : s)
+  {
+    (void)_;
+    auto res = map;
+    for (size_t i = 0; i < batch_size; ++i)
+      res = res.put(i * 7, v);
+    do_not_optimize(res);
+    clobber_memory();
+  }
+  s.stop_timer();
+}
+
+template <class M>
+static void benchmark_transient_put_batch(picobench::state& s)
+{
+  size_t size = s.iterations();
+  auto v = gen_val(val_size);
+  auto map = gen_map<M>(size);
+  s.start_timer();
+  for (auto _ : s)
+  {
+    (void)_;
+    auto transient = map.transient();
+    for (size_t i = 0; i < batch_size; ++i)
+      transient.put(i * 7, v);
+    auto res = transient.persistent();
+    do_not_optimize(res);
+    clobber_memory();
+  }
+  s.stop_timer();
+}
+
 template <class M>
 static void benchmark_get(picobench::state& s)
 {
@@ -124,6 +165,16 @@ auto bench_rb_map_put = benchmark_put<RBMap<K, V>>;
 PICOBENCH(bench_rb_map_put).iterations(sizes).samples(10).baseline();
 auto bench_champ_map_put = benchmark_put<champ::Map<K, V>>;
 PICOBENCH(bench_champ_map_put).iterations(sizes).samples(10);
+auto bench_champ_local_map_put =
+  benchmark_put<champ::Map<K, V, std::hash<K>, champ::LocalCount>>;
+PICOBENCH(bench_champ_local_map_put).iterations(sizes).samples(10);
+
+PICOBENCH_SUITE("put batch");
+auto bench_champ_map_put_batch = benchmark_put_batch<champ::Map<K, V>>;
+PICOBENCH(bench_champ_map_put_batch).iterations(sizes).samples(10).baseline();
+auto bench_champ_map_transient_put_batch =
+  benchmark_transient_put_batch<champ::Map<K, V>>;
+PICOBENCH(bench_champ_map_transient_put_batch).iterations(sizes).samples(10);
 
 PICOBENCH_SUITE("get");
 auto bench_rb_map_get = benchmark_get<RBMap<K, V>>;
@@ -0,0 +1,57 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#include "../champmap.h"
+#include "../logger.h"
+
+#include <deque>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+using namespace std;
+
+using K = uint64_t;
+using V = uint64_t;
+
+static constexpr size_t keys = 1000000;
+// As a store keeps the versions that have not been compacted
+static constexpr size_t versions_kept = 100;
+
+static constexpr size_t max_expected_rss = 256 * 1024;
+
+static size_t get_maxrss()
+{
+  rusage r;
+  auto rc = getrusage(RUSAGE_SELF, &r);
+  if (rc != 0)
+    throw std::logic_error("getrusage failed");
+  return r.ru_maxrss;
+}
+
+static int put_and_compact()
+{
+  auto start_rss = get_maxrss();
+
+  std::deque<champ::Map<K, V>> versions;
+  versions.emplace_back();
+  for (size_t i = 0; i < keys; ++i)
+  {
+    versions.push_back(versions.back().put(i, i));
+    if (versions.size() > versions_kept)
+      versions.pop_front();
+
+    if (i % (keys / 10) == 0)
+      LOG_INFO_FMT("MAX RSS: {}Kb", get_maxrss());
+  }
+
+  auto rss = get_maxrss();
+  LOG_INFO_FMT("MAX RSS: {}Kb", rss);
+  LOG_INFO_FMT(
+    "{} bytes per key", ((rss - start_rss) * 1024) / versions.back().size());
+
+  return rss < max_expected_rss ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+  return put_and_compact();
+}
@@ -4,8 +4,11 @@
 #include "../champmap.h"
 #include "../rbmap.h"
 
+#include <atomic>
 #include <doctest/doctest.h>
+#include <map>
 #include <random>
+#include <thread>
 
 using namespace std;
 
@@ -136,3 +139,189 @@ TEST_CASE("persistent map operations")
     champ = champ_new;
   }
 }
+
+TEST_CASE("ordered map range iteration")
+{
+  RBMap<K, V> rb;
+  std::map<K, V> ordered;
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<K> dist(0, 1000);
+  for (size_t i = 0; i < 300; ++i)
+  {
+    auto k = dist(gen);
+    rb = rb.put(k, i);
+    ordered[k] = i;
+  }
+
+  for (size_t i = 0; i < 100; ++i)
+  {
+    auto from = dist(gen);
+    auto to = dist(gen);
+
+    INFO("range visits the keys in [from, to), in order");
+    {
+      auto it = ordered.lower_bound(from);
+      auto end = from < to ? ordered.lower_bound(to) : it;
+      REQUIRE(rb.range(from, to, [&](const auto& k, const auto& v) {
+        REQUIRE(it != end);
+        REQUIRE(k == it->first);
+        REQUIRE(v == it->second);
+        ++it;
+        return true;
+      }));
+      REQUIRE(it == end);
+    }
+
+    INFO("foreach_from stops when the functor returns false");
+    {
+      auto it = ordered.lower_bound(from);
+      size_t n = 0;
+      bool completed = rb.foreach_from(from, [&](const auto& k, const auto&) {
+        REQUIRE(k == it->first);
+        ++it;
+        return ++n < 3;
+      });
+      auto remaining = std::distance(ordered.lower_bound(from), ordered.end());
+      REQUIRE(n == std::min<size_t>(3, remaining));
+      REQUIRE(completed == (n < 3));
+    }
+  }
+}
+
+// Counts its live instances, to check that the nodes holding them are
+// released
+struct Counted
+{
+  static inline std::atomic<int> live = 0;
+
+  V v;
+
+  Counted(V v_) : v(v_)
+  {
+    ++live;
+  }
+
+  Counted(const Counted& that) : v(that.v)
+  {
+    ++live;
+  }
+
+  Counted& operator=(const Counted& that) = default;
+
+  ~Counted()
+  {
+    --live;
+  }
+};
+
+template <class M>
+static void put_and_release(size_t n)
+{
+  std::vector<M> versions;
+  M m;
+  for (size_t i = 0; i < n; ++i)
+  {
+    m = m.put(i % (n / 2), Counted(i));
+    versions.push_back(m);
+  }
+
+  for (size_t i = 0; i < versions.size(); ++i)
+  {
+    REQUIRE(versions[i].size() == std::min(i + 1, n / 2));
+    REQUIRE(versions[i].get(i % (n / 2))->v == i);
+  }
+}
+
+TEST_CASE("champ map nodes are released")
+{
+  INFO("with shared reference counts");
+  {
+    put_and_release<champ::Map<K, Counted, H>>(1000);
+    REQUIRE(Counted::live == 0);
+  }
+
+  INFO("with local reference counts");
+  {
+    put_and_release<champ::Map<K, Counted, H, champ::LocalCount>>(1000);
+    REQUIRE(Counted::live == 0);
+  }
+
+  INFO("with versions shared and released by several threads");
+  {
+    champ::Map<K, Counted, H> base;
+    for (size_t i = 0; i < 100; ++i)
+      base = base.put(i, Counted(i));
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t)
+    {
+      threads.emplace_back([base, t]() {
+        auto m = base;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+          auto next = m.put((i * 7 + t) % 200, Counted(i));
+          m = i % 2 == 0 ? next : base;
+        }
+      });
+    }
+    for (auto& thread : threads)
+      thread.join();
+
+    REQUIRE(base.size() == 100);
+    base = champ::Map<K, Counted, H>();
+    REQUIRE(Counted::live == 0);
+  }
+}
+
+TEST_CASE("transient puts")
+{
+  RBMap<K, V> rb;
+  champ::Map<K, V, H> champ;
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<K> dist(0, 500);
+  for (size_t batch = 0; batch < 100; ++batch)
+  {
+    auto rb_transient = rb.transient();
+    auto champ_transient = champ.transient();
+    for (size_t i = 0; i < batch % 20; ++i)
+    {
+      auto k = dist(gen);
+      rb_transient.put(k, batch * 100 + i);
+      champ_transient.put(k, batch * 100 + i);
+      REQUIRE(champ_transient.get(k) == rb_transient.get(k));
+    }
+    auto rb_new = rb_transient.persistent();
+    auto champ_new = champ_transient.persistent();
+
+    INFO("check consistency of persistent maps");
+    {
+      size_t n = 0;
+      champ_new.foreach([&](const auto& k, const auto& v) {
+        n++;
+        auto p = rb_new.get(k);
+        REQUIRE(p.has_value());
+        REQUIRE(p.value() == v);
+        return true;
+      });
+      REQUIRE(n == champ_new.size());
+    }
+
+    INFO("check that the maps the batches were applied to are unchanged");
+    {
+      size_t n = 0;
+      champ.foreach([&](const auto& k, const auto& v) {
+        n++;
+        auto p = rb.get(k);
+        REQUIRE(p.has_value());
+        REQUIRE(p.value() == v);
+        return true;
+      });
+      REQUIRE(n == champ.size());
+    }
+
+    rb = rb_new;
+    champ = champ_new;
+  }
+}
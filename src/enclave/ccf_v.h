@@ -133,6 +133,25 @@ extern "C"
     return *_retval ? OE_OK : OE_FAILURE;
   }
 
+  inline oe_result_t enclave_run_worker(oe_enclave_t* enclave, bool* _retval)
+  {
+    static run_func_t run_worker_func =
+      get_enclave_exported_function<run_func_t>("enclave_run_worker");
+
+    *_retval = run_worker_func();
+    return *_retval ? OE_OK : OE_FAILURE;
+  }
+
+  inline oe_result_t enclave_run_recovery_worker(
+    oe_enclave_t* enclave, bool* _retval)
+  {
+    static run_func_t run_recovery_worker_func =
+      get_enclave_exported_function<run_func_t>("enclave_run_recovery_worker");
+
+    *_retval = run_recovery_worker_func();
+    return *_retval ? OE_OK : OE_FAILURE;
+  }
+
   inline oe_result_t oe_create_ccf_enclave(
     const char* path,
     oe_enclave_type_t type,
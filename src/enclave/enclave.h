@@ -18,6 +18,7 @@
 #include "rpcclient.h"
 #include "rpcmap.h"
 #include "rpcsessions.h"
+#include "rpcworkers.h"
 
 namespace enclave
 {
@@ -31,6 +32,8 @@ namespace enclave
     ccf::Notifier notifier;
     ccf::Timers timers;
     std::shared_ptr<RPCMap> rpc_map;
+    std::shared_ptr<RPCWorkers> rpc_workers;
+    std::shared_ptr<RPCWorkers> recovery_workers;
     std::shared_ptr<RPCSessions> rpcsessions;
     ccf::NodeState node;
     std::shared_ptr<ccf::Forwarder<ccf::NodeToNode>> cmd_forwarder;
@@ -42,13 +45,21 @@ namespace enclave
     Enclave(
       EnclaveConfig* enclave_config,
       const CCFConfig::SignatureIntervals& signature_intervals,
-      const raft::Config& raft_config) :
+      const raft::Config& raft_config,
+      size_t ledger_prefetch_entries,
+      size_t recovery_threads,
+      size_t historical_versions,
+      size_t worker_threads) :
       circuit(enclave_config->circuit),
       writer_factory(circuit, enclave_config->writer_config),
       n2n_channels(std::make_shared<ccf::NodeToNode>(writer_factory)),
       notifier(writer_factory),
       rpc_map(std::make_shared<RPCMap>()),
-      rpcsessions(std::make_shared<RPCSessions>(writer_factory, rpc_map)),
+      rpc_workers(std::make_shared<RPCWorkers>(worker_threads)),
+      recovery_workers(
+        std::make_shared<RPCWorkers>(recovery_threads, "recovery")),
+      rpcsessions(
+        std::make_shared<RPCSessions>(writer_factory, rpc_map, rpc_workers)),
       node(writer_factory, network, rpcsessions, notifier, timers),
       cmd_forwarder(std::make_shared<ccf::Forwarder<ccf::NodeToNode>>(
         rpcsessions, n2n_channels, rpc_map))
@@ -74,7 +85,14 @@ namespace enclave
         fe->set_cmd_forwarder(cmd_forwarder);
       }
 
-      node.initialize(raft_config, n2n_channels, rpc_map, cmd_forwarder);
+      node.initialize(
+        raft_config,
+        ledger_prefetch_entries,
+        recovery_workers,
+        historical_versions,
+        n2n_channels,
+        rpc_map,
+        cmd_forwarder);
     }
 
     bool create_new_node(
@@ -183,22 +201,64 @@ namespace enclave
           bp,
           consensus::ledger_entry,
           [this](const uint8_t* data, size_t size) {
-            auto [body] =
+            auto [idx, body] =
               ringbuffer::read_message<consensus::ledger_entry>(data, size);
             if (node.is_reading_public_ledger())
-              node.recover_public_ledger_entry(body);
+              node.recover_public_ledger_entry(idx, body);
             else if (node.is_reading_private_ledger())
-              node.recover_private_ledger_entry(body);
+              node.recover_private_ledger_entry(idx, body);
             else
-              LOG_FAIL_FMT("Cannot recover ledger entry: Unexpected state");
+              // Entries requested for historical reads, or prefetched past
+              // the end of recovery
+              node.replay_historical_ledger_entry(idx, body);
           });
 
         DISPATCHER_SET_MESSAGE_HANDLER(
           bp,
           consensus::ledger_no_entry,
           [this](const uint8_t* data, size_t size) {
-            ringbuffer::read_message<consensus::ledger_no_entry>(data, size);
-            node.recover_ledger_end();
+            auto [idx] =
+              ringbuffer::read_message<consensus::ledger_no_entry>(data, size);
+            if (
+              node.is_reading_public_ledger() ||
+              node.is_reading_private_ledger())
+              node.recover_ledger_end(idx);
+            else
+              node.replay_historical_ledger_end(idx);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::ledger_snapshot_part,
+          [this](const uint8_t* data, size_t size) {
+            auto [offset, part] =
+              ringbuffer::read_message<consensus::ledger_snapshot_part>(
+                data, size);
+            node.recv_ledger_snapshot_part(offset, part);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::ledger_snapshot_end,
+          [this](const uint8_t* data, size_t size) {
+            auto [idx] =
+              ringbuffer::read_message<consensus::ledger_snapshot_end>(
+                data, size);
+            if (
+              node.is_reading_public_ledger() ||
+              node.is_reading_private_ledger())
+              node.recover_ledger_snapshot(idx);
+            else
+              node.replay_historical_ledger_snapshot(idx);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::ledger_durable,
+          [this](const uint8_t* data, size_t size) {
+            auto [idx, epoch] =
+              ringbuffer::read_message<consensus::ledger_durable>(data, size);
+            node.ledger_durable(idx, epoch);
           });
 
         rpcsessions->register_message_handlers(bp.get_dispatcher());
@@ -212,8 +272,54 @@ namespace enclave
           node.start_ledger_recovery();
         }
         bp.run(circuit->read_from_outside());
+        rpc_workers->stop();
+        recovery_workers->stop();
         return true;
       }
+#ifndef VIRTUAL_ENCLAVE
+      catch (const std::exception& e)
+      {
+        rpc_workers->stop();
+        recovery_workers->stop();
+        auto w = writer_factory.create_writer_to_outside();
+        RINGBUFFER_WRITE_MESSAGE(
+          AdminMessage::fatal_error_msg, w, std::string(e.what()));
+        return false;
+      }
+#endif
+    }
+
+    // Process RPC sessions, until the enclave thread stops. This is called
+    // by each of the worker threads started by the host.
+    bool run_worker()
+    {
+#ifndef VIRTUAL_ENCLAVE
+      try
+#endif
+      {
+        return rpc_workers->run();
+      }
+#ifndef VIRTUAL_ENCLAVE
+      catch (const std::exception& e)
+      {
+        auto w = writer_factory.create_writer_to_outside();
+        RINGBUFFER_WRITE_MESSAGE(
+          AdminMessage::fatal_error_msg, w, std::string(e.what()));
+        return false;
+      }
+#endif
+    }
+
+    // Decrypt ledger entries when recovering, until the enclave thread stops.
+    // This is called by each of the recovery threads started by the host.
+    bool run_recovery_worker()
+    {
+#ifndef VIRTUAL_ENCLAVE
+      try
+#endif
+      {
+        return recovery_workers->run();
+      }
 #ifndef VIRTUAL_ENCLAVE
       catch (const std::exception& e)
       {
@@ -43,6 +43,22 @@ struct CCFConfig
   };
   SignatureIntervals signature_intervals = {};
 
+  // Number of ledger entries requested ahead of the one being read when
+  // recovering
+  size_t ledger_prefetch_entries = 1;
+
+  // Number of threads decrypting private ledger entries when recovering, or 0
+  // to decrypt them on the enclave thread
+  size_t recovery_threads = 0;
+
+  // Number of past versions of the store kept when rebuilding them from the
+  // ledger for historical reads
+  size_t historical_versions = 1;
+
+  // Number of threads processing RPC sessions, which the host starts and
+  // which enter the enclave, or 0 to process them on the enclave thread
+  size_t worker_threads = 0;
+
   struct Genesis
   {
     std::vector<std::vector<uint8_t>> member_certs;
@@ -61,7 +77,15 @@ struct CCFConfig
   Joining joining = {};
 
   MSGPACK_DEFINE(
-    raft_config, node_info_network, signature_intervals, genesis, joining);
+    raft_config,
+    node_info_network,
+    signature_intervals,
+    ledger_prefetch_entries,
+    recovery_threads,
+    historical_versions,
+    worker_threads,
+    genesis,
+    joining);
 };
 
 /// General administrative messages
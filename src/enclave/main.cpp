@@ -51,7 +51,14 @@ extern "C"
     reserved_memory = new uint8_t[ec->debug_config.memory_reserve_startup];
 #endif
 
-    e = new enclave::Enclave(ec, cc.signature_intervals, cc.raft_config);
+    e = new enclave::Enclave(
+      ec,
+      cc.signature_intervals,
+      cc.raft_config,
+      cc.ledger_prefetch_entries,
+      cc.recovery_threads,
+      cc.historical_versions,
+      cc.worker_threads);
 
     return e->create_new_node(
       start_type,
@@ -74,4 +81,20 @@ extern "C"
     else
       return false;
   }
+
+  bool enclave_run_worker()
+  {
+    if (e != nullptr)
+      return e->run_worker();
+    else
+      return false;
+  }
+
+  bool enclave_run_recovery_worker()
+  {
+    if (e != nullptr)
+      return e->run_recovery_worker();
+    else
+      return false;
+  }
 }
@@ -8,6 +8,7 @@
 #include "rpcclient.h"
 #include "rpcendpoint.h"
 #include "rpchandler.h"
+#include "rpcworkers.h"
 #include "tls/cert.h"
 #include "tls/client.h"
 #include "tls/context.h"
@@ -23,6 +24,7 @@ namespace enclave
   {
   private:
     std::shared_ptr<RPCMap> rpc_map;
+    std::shared_ptr<RPCWorkers> workers;
     std::vector<std::shared_ptr<tls::Cert>> certs;
 
     SpinLock lock;
@@ -30,17 +32,37 @@ namespace enclave
 
     // Upper half of sessions range is reserved for those originating from
     // the enclave via create_client().
-    std::atomic<size_t> next_client_session_id =
+    static constexpr size_t first_client_session_id =
       std::numeric_limits<size_t>::max() / 2;
+    std::atomic<size_t> next_client_session_id = first_client_session_id;
 
     ringbuffer::AbstractWriterFactory& writer_factory;
 
+    // Incoming RPC sessions are processed by the workers, if there are any.
+    // Sessions created by the enclave are processed by the enclave thread.
+    bool on_worker(size_t id)
+    {
+      return id <= first_client_session_id && workers->size() > 0;
+    }
+
+    std::shared_ptr<Endpoint> find_session(size_t id)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      auto search = sessions.find(id);
+      if (search == sessions.end())
+        return nullptr;
+
+      return search->second;
+    }
+
   public:
     RPCSessions(
       ringbuffer::AbstractWriterFactory& writer_factory,
-      std::shared_ptr<RPCMap> rpc_map_) :
+      std::shared_ptr<RPCMap> rpc_map_,
+      std::shared_ptr<RPCWorkers> workers_ = std::make_shared<RPCWorkers>(0)) :
       writer_factory(writer_factory),
-      rpc_map(rpc_map_)
+      rpc_map(rpc_map_),
+      workers(workers_)
     {}
 
     void add_cert(
@@ -77,10 +99,8 @@ namespace enclave
 
     bool reply_async(size_t id, const std::vector<uint8_t>& data) override
     {
-      std::lock_guard<SpinLock> guard(lock);
-
-      auto search = sessions.find(id);
-      if (search == sessions.end())
+      auto session = find_session(id);
+      if (session == nullptr)
       {
         LOG_FAIL_FMT("Replying to unknown session {}", id);
         return false;
@@ -88,7 +108,12 @@ namespace enclave
 
       LOG_DEBUG_FMT("Replying to session {}", id);
 
-      search->second->send(data);
+      // The reply is sent by the thread that processes the session
+      if (on_worker(id))
+        workers->post(id, [session, data]() { session->send(data); });
+      else
+        session->send(data);
+
       return true;
     }
 
@@ -127,14 +152,24 @@ namespace enclave
           auto [id, body] =
             ringbuffer::read_message<tls::tls_inbound>(data, size);
 
-          auto search = sessions.find(id);
-          if (search == sessions.end())
+          auto session = find_session(id);
+          if (session == nullptr)
           {
             throw std::logic_error(
               "tls_inbound for unknown session: " + std::to_string(id));
           }
 
-          search->second->recv(body.data, body.size);
+          if (!on_worker(id))
+          {
+            session->recv(body.data, body.size);
+            return;
+          }
+
+          // The message is only valid for the duration of this handler
+          std::vector<uint8_t> msg(body.data, body.data + body.size);
+          workers->post(id, [session, msg = std::move(msg)]() {
+            session->recv(msg.data(), msg.size());
+          });
         });
 
       DISPATCHER_SET_MESSAGE_HANDLER(
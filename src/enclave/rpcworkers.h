@@ -0,0 +1,136 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/logger.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace enclave
+{
+  // Processes RPC sessions on worker threads. Each session is assigned to a
+  // single worker, so that its messages are processed in order and its TLS
+  // context is only used by one thread at a time, while independent sessions
+  // are processed concurrently. Threads cannot be started from inside the
+  // enclave, so worker threads are started by the host and enter the enclave
+  // to call run(). With no workers, jobs are run when they are posted. The
+  // same kind of pool is used to decrypt ledger entries when recovering.
+  class RPCWorkers
+  {
+  public:
+    using Job = std::function<void()>;
+
+  private:
+    struct Worker
+    {
+      std::mutex lock;
+      std::condition_variable ready;
+      std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_worker = 0;
+    std::atomic<bool> stopping = false;
+    // Kind of workers, for logging
+    const std::string name;
+
+  public:
+    RPCWorkers(size_t num_workers, const std::string& name = "RPC") :
+      name(name)
+    {
+      for (size_t i = 0; i < num_workers; ++i)
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    RPCWorkers(const RPCWorkers& that) = delete;
+
+    size_t size() const
+    {
+      return workers.size();
+    }
+
+    /**
+     * Queue a job for the worker of a session.
+     *
+     * @param session_id Session the job belongs to
+     * @param job Job to run on the worker
+     */
+    void post(size_t session_id, Job job)
+    {
+      if (workers.empty())
+      {
+        job();
+        return;
+      }
+
+      auto& w = *workers[session_id % workers.size()];
+      {
+        std::lock_guard<std::mutex> guard(w.lock);
+        w.jobs.push_back(std::move(job));
+      }
+      w.ready.notify_one();
+    }
+
+    /**
+     * Run jobs as one of the workers, until stop() is called.
+     *
+     * @return false if all workers are already running
+     */
+    bool run()
+    {
+      auto id = next_worker++;
+      if (id >= workers.size())
+      {
+        LOG_FAIL_FMT(
+          "Cannot start {} worker {}, only {} configured",
+          name,
+          id,
+          workers.size());
+        return false;
+      }
+
+      LOG_INFO_FMT("Starting {} worker {}", name, id);
+      auto& w = *workers[id];
+      std::unique_lock<std::mutex> guard(w.lock);
+
+      while (true)
+      {
+        w.ready.wait(
+          guard, [this, &w]() { return stopping || !w.jobs.empty(); });
+
+        // Jobs that have not been run are discarded
+        if (stopping)
+          break;
+
+        auto job = std::move(w.jobs.front());
+        w.jobs.pop_front();
+
+        guard.unlock();
+        job();
+        guard.lock();
+      }
+
+      return true;
+    }
+
+    void stop()
+    {
+      stopping = true;
+
+      for (auto& w : workers)
+      {
+        // Taking the lock ensures the worker is either waiting or will see
+        // stopping before it waits
+        std::lock_guard<std::mutex> guard(w->lock);
+        w->ready.notify_all();
+      }
+    }
+  };
+}
@@ -0,0 +1,74 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "../rpcworkers.h"
+
+#include <doctest/doctest.h>
+#include <thread>
+
+TEST_CASE("Jobs run inline without workers")
+{
+  enclave::RPCWorkers workers(0);
+  size_t runs = 0;
+  workers.post(1, [&runs]() { ++runs; });
+  workers.post(2, [&runs]() { ++runs; });
+  REQUIRE(runs == 2);
+  REQUIRE_FALSE(workers.run());
+}
+
+TEST_CASE("Jobs of a session run in order on one worker")
+{
+  constexpr size_t num_workers = 4;
+  constexpr size_t num_sessions = 16;
+  constexpr size_t jobs_per_session = 1000;
+
+  enclave::RPCWorkers workers(num_workers);
+
+  std::atomic<size_t> started = 0;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_workers; ++i)
+    threads.emplace_back([&workers, &started]() {
+      if (workers.run())
+        ++started;
+    });
+
+  std::vector<std::vector<size_t>> seen(num_sessions);
+  std::vector<std::thread::id> session_thread(num_sessions);
+  std::atomic<size_t> done = 0;
+  bool wrong_thread = false;
+
+  for (size_t j = 0; j < jobs_per_session; ++j)
+  {
+    for (size_t s = 0; s < num_sessions; ++s)
+    {
+      workers.post(s, [&, s, j]() {
+        // Only touched by the worker of session s
+        if (j == 0)
+          session_thread[s] = std::this_thread::get_id();
+        else if (session_thread[s] != std::this_thread::get_id())
+          wrong_thread = true;
+        seen[s].push_back(j);
+        ++done;
+      });
+    }
+  }
+
+  while (done < num_sessions * jobs_per_session)
+    std::this_thread::yield();
+
+  // All workers are already running
+  REQUIRE_FALSE(workers.run());
+
+  workers.stop();
+  for (auto& t : threads)
+    t.join();
+
+  REQUIRE(started == num_workers);
+  REQUIRE_FALSE(wrong_thread);
+  for (auto& s : seen)
+  {
+    REQUIRE(s.size() == jobs_per_session);
+    for (size_t j = 0; j < jobs_per_session; ++j)
+      REQUIRE(s[j] == j);
+  }
+}
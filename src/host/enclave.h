@@ -137,6 +137,39 @@ namespace host
       return ret;
     }
 
+    // Process RPC sessions inside the enclave, until the enclave stops - should
+    // be called from each worker thread
+    bool run_worker()
+    {
+      bool ret;
+      auto err = enclave_run_worker(e, &ret);
+
+      if (err != OE_OK)
+      {
+        LOG_FATAL_FMT(
+          "Failed to call in enclave_run_worker: {}", oe_result_str(err));
+      }
+
+      return ret;
+    }
+
+    // Decrypt ledger entries inside the enclave when recovering, until the
+    // enclave stops - should be called from each recovery thread
+    bool run_recovery_worker()
+    {
+      bool ret;
+      auto err = enclave_run_recovery_worker(e, &ret);
+
+      if (err != OE_OK)
+      {
+        LOG_FATAL_FMT(
+          "Failed to call in enclave_run_recovery_worker: {}",
+          oe_result_str(err));
+      }
+
+      return ret;
+    }
+
     /**
      * Checks that a quote is valid, the signing authority is trusted, and the
      * quote is over some expected data.
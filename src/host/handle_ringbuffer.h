@@ -6,6 +6,7 @@
 #include "../ds/logger.h"
 #include "../enclave/interface.h"
 #include "everyio.h"
+#include "ledgerworker.h"
 
 #include <chrono>
 #include <ctime>
@@ -24,15 +25,19 @@ namespace asynchost
 
     messaging::BufferProcessor& bp;
     ringbuffer::Reader& r;
+    LedgerWorker& ledger_worker;
 
     // Sealed secrets file path
     std::string sealed_secrets_file;
 
   public:
     HandleRingbufferImpl(
-      messaging::BufferProcessor& bp, ringbuffer::Reader& r) :
+      messaging::BufferProcessor& bp,
+      ringbuffer::Reader& r,
+      LedgerWorker& ledger_worker) :
       bp(bp),
-      r(r)
+      r(r),
+      ledger_worker(ledger_worker)
     {
       // Register message handler for log message from enclave
       DISPATCHER_SET_MESSAGE_HANDLER(
@@ -102,8 +107,10 @@ namespace asynchost
     void every()
     {
       // This flushes the enclave to host ringbuffer on each libuv loop
-      // iteration.
-      while (bp.read_n(max_messages, r) > 0)
+      // iteration. Reading stops while the ledger worker is full, so that the
+      // enclave is held back by the ringbuffer until the disk has caught up,
+      // rather than blocking the loop.
+      while (!ledger_worker.is_full() && bp.read_n(max_messages, r) > 0)
         continue;
     }
   };
@@ -5,54 +5,108 @@
 #include "consensus/ledgerenclavetypes.h"
 #include "ds/logger.h"
 #include "ds/messaging.h"
+#include "ledgerindex.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
 #include <errno.h>
+#include <memory>
+#include <optional>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <vector>
 
 namespace asynchost
 {
-  class Ledger
+  enum class LedgerDurability
   {
-  private:
+    // Entries are written to the ledger, which is never explicitly synced
+    none,
+    // Entries appended one after the other are synced together, once there
+    // are no more pending writes
+    batch,
+    // Entries are synced once sync_interval has elapsed or sync_bytes have
+    // been written since the last sync, whichever comes first
+    interval
+  };
+
+  // A contiguous range of framed ledger entries. The owner keeps the data
+  // alive, so that it can be used without being copied.
+  struct LedgerSegment
+  {
+    std::shared_ptr<const void> owner;
+    const uint8_t* data;
+    size_t size;
+  };
+
+  using LedgerView = std::vector<LedgerSegment>;
+
+  // A single ledger file, holding consecutive entries from start_idx
+  class LedgerFile
+  {
+  public:
     static constexpr size_t frame_header_size = sizeof(uint32_t);
 
+  private:
+    std::string filename;
+    size_t start_idx;
+    bool read_only;
+
     // This uses C stdio instead of fstream because an fstream
     // cannot be truncated.
     FILE* file;
     std::vector<size_t> positions;
     size_t total_len;
-    std::unique_ptr<ringbuffer::AbstractWriter> to_enclave;
 
-  public:
-    Ledger(
-      const std::string& filename,
-      ringbuffer::AbstractWriterFactory& writer_factory) :
-      file(NULL),
-      to_enclave(writer_factory.create_writer_to_inside())
-    {
-      file = fopen(filename.c_str(), "r+b");
+    // Positions of the entries, persisted alongside the ledger file so that
+    // only entries that were not yet indexed are scanned on startup
+    std::unique_ptr<LedgerIndex> index;
 
-      if (!file)
-        file = fopen(filename.c_str(), "w+b");
+    // Read-only files are mapped on first read, and entries are then read
+    // from the mapping. Views of these entries share the mapping, which
+    // remains valid after the file has been closed or removed.
+    std::shared_ptr<const uint8_t> mapping;
 
-      if (!file)
-        throw std::logic_error("Unable to open or create ledger file");
+    const uint8_t* mapped()
+    {
+      if (!read_only || total_len == 0)
+        return nullptr;
 
-      fseeko(file, 0, SEEK_END);
-      auto len = ftello(file);
-      if (len == 1)
+      if (!mapping)
       {
-        std::stringstream ss;
-        ss << "Failed to tell file size: " << strerror(errno);
-        throw std::logic_error(ss.str());
+        auto len = total_len;
+        auto p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fileno(file), 0);
+        if (p == MAP_FAILED)
+        {
+          LOG_FAIL_FMT(
+            "Failed to map ledger file {}: {}", filename, strerror(errno));
+          return nullptr;
+        }
+
+        mapping = std::shared_ptr<const uint8_t>(
+          static_cast<const uint8_t*>(p),
+          [len](const uint8_t* p) { munmap((void*)p, len); });
       }
-      fseeko(file, 0, SEEK_SET);
-      size_t pos = 0;
+
+      return mapping.get();
+    }
+
+    bool scan(size_t pos, size_t len)
+    {
+      // Reads the frame headers of the entries from pos to the end of the
+      // file, adding them to the index. Returns false if the file does not
+      // end with a complete entry.
+      fseeko(file, pos, SEEK_SET);
+      len -= pos;
       uint32_t size = 0;
 
       while (len >= frame_header_size)
@@ -63,24 +117,142 @@ namespace asynchost
         len -= frame_header_size;
 
         if (len < size)
-          throw std::logic_error("Malformed ledger file");
+          return false;
 
         fseeko(file, size, SEEK_CUR);
         len -= size;
 
         positions.push_back(pos);
+        index->append(pos);
         pos += (size + frame_header_size);
       }
 
       total_len = pos;
 
-      if (len != 0)
-        throw std::logic_error("Malformed ledger file");
+      return len == 0;
     }
 
-    Ledger(const Ledger& that) = delete;
+    void flush()
+    {
+      if (fflush(file) != 0)
+      {
+        std::stringstream ss;
+        ss << "Failed to flush file: " << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+    }
 
-    ~Ledger()
+    void reopen(bool read_only_)
+    {
+      // Changes the permissions of the file, so that it cannot be modified
+      // by any process once it is read-only
+      fclose(file);
+      file = NULL;
+
+      auto mode = S_IRUSR | S_IRGRP | S_IROTH | (read_only_ ? 0 : S_IWUSR);
+      if (chmod(filename.c_str(), mode) != 0)
+        throw std::logic_error(
+          "Failed to change permissions of ledger file " + filename);
+
+      file = fopen(filename.c_str(), read_only_ ? "rb" : "r+b");
+      if (!file)
+        throw std::logic_error("Unable to open ledger file " + filename);
+
+      read_only = read_only_;
+      mapping.reset();
+    }
+
+  public:
+    static std::string index_filename(const std::string& filename)
+    {
+      return filename + ".idx";
+    }
+
+    LedgerFile(
+      const std::string& filename_,
+      size_t start_idx_,
+      bool read_only_,
+      size_t entries_per_index_checkpoint) :
+      filename(filename_),
+      start_idx(start_idx_),
+      read_only(read_only_),
+      file(NULL),
+      total_len(0),
+      index(std::make_unique<LedgerIndex>(
+        index_filename(filename_), entries_per_index_checkpoint))
+    {
+      if (read_only)
+      {
+        file = fopen(filename.c_str(), "rb");
+      }
+      else
+      {
+        file = fopen(filename.c_str(), "r+b");
+
+        if (!file)
+          file = fopen(filename.c_str(), "w+b");
+      }
+
+      if (!file)
+        throw std::logic_error("Unable to open or create ledger file");
+
+      fseeko(file, 0, SEEK_END);
+      auto len = ftello(file);
+      if (len == -1)
+      {
+        std::stringstream ss;
+        ss << "Failed to tell file size: " << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+
+      // Only the entries following the last indexed entry are scanned. The
+      // end of that entry is found from its frame header.
+      positions = index->load(len);
+      size_t pos = 0;
+
+      if (!positions.empty())
+      {
+        uint32_t size = 0;
+        fseeko(file, positions.back(), SEEK_SET);
+
+        if (
+          fread(&size, frame_header_size, 1, file) == 1 &&
+          positions.back() + frame_header_size + size <= (size_t)len)
+        {
+          pos = positions.back() + frame_header_size + size;
+        }
+        else
+        {
+          LOG_FAIL_FMT("Ledger index does not match ledger file {}", filename);
+          positions.clear();
+          index->truncate(positions);
+        }
+      }
+
+      LOG_INFO_FMT(
+        "Ledger index of {} has {} entries, scanning from {}",
+        filename,
+        positions.size(),
+        pos);
+
+      if (!scan(pos, len))
+      {
+        if (pos == 0)
+          throw std::logic_error("Malformed ledger file " + filename);
+
+        // The index may not belong to this file: scan the whole file
+        LOG_FAIL_FMT("Ledger index does not match ledger file {}", filename);
+        positions.clear();
+        index->truncate(positions);
+
+        if (!scan(0, len))
+          throw std::logic_error("Malformed ledger file " + filename);
+      }
+    }
+
+    LedgerFile(const LedgerFile& that) = delete;
+
+    ~LedgerFile()
     {
       if (file)
       {
@@ -89,19 +261,51 @@ namespace asynchost
       }
     }
 
-    size_t get_last_idx()
+    size_t get_start_idx() const
+    {
+      return start_idx;
+    }
+
+    size_t get_last_idx() const
+    {
+      return start_idx + positions.size() - 1;
+    }
+
+    size_t get_len() const
     {
-      return positions.size();
+      return total_len;
+    }
+
+    bool is_read_only() const
+    {
+      return read_only;
+    }
+
+    void sync()
+    {
+      // The index is not synced, as it is checked against the ledger file on
+      // startup
+      flush();
+
+      if (fdatasync(fileno(file)) != 0)
+      {
+        std::stringstream ss;
+        ss << "Failed to sync file: " << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
     }
 
     const std::vector<uint8_t> read_entry(size_t idx)
     {
-      if ((idx == 0) || (idx > positions.size()))
-        return {};
+      auto len = framed_entries_size(idx, idx) - frame_header_size;
+      auto pos = positions.at(idx - start_idx) + frame_header_size;
+
+      auto m = mapped();
+      if (m)
+        return std::vector<uint8_t>(m + pos, m + pos + len);
 
-      auto len = entry_size(idx);
       std::vector<uint8_t> entry(len);
-      fseeko(file, positions.at(idx - 1) + frame_header_size, SEEK_SET);
+      fseeko(file, pos, SEEK_SET);
 
       if (fread(entry.data(), len, 1, file) != 1)
         throw std::logic_error("Failed to read from file");
@@ -109,50 +313,64 @@ namespace asynchost
       return entry;
     }
 
-    const std::vector<uint8_t> read_framed_entries(size_t from, size_t to)
+    void read_framed_entries(size_t from, size_t to, uint8_t* data)
     {
       auto framed_size = framed_entries_size(from, to);
+      auto pos = positions.at(from - start_idx);
 
-      std::vector<uint8_t> framed_entries(framed_size);
-      if (framed_size == 0)
-        return framed_entries;
+      auto m = mapped();
+      if (m)
+      {
+        std::memcpy(data, m + pos, framed_size);
+        return;
+      }
 
-      fseeko(file, positions.at(from - 1), SEEK_SET);
+      fseeko(file, pos, SEEK_SET);
 
-      if (fread(framed_entries.data(), framed_size, 1, file) != 1)
+      if (fread(data, framed_size, 1, file) != 1)
         throw std::logic_error("Failed to read from file");
+    }
 
-      return framed_entries;
+    LedgerSegment view_framed_entries(size_t from, size_t to)
+    {
+      // Entries of read-only files are not copied
+      auto framed_size = framed_entries_size(from, to);
+
+      auto m = mapped();
+      if (m)
+        return {mapping, m + positions.at(from - start_idx), framed_size};
+
+      auto copy = std::make_shared<std::vector<uint8_t>>(framed_size);
+      read_framed_entries(from, to, copy->data());
+      return {copy, copy->data(), framed_size};
     }
 
-    size_t framed_entries_size(size_t from, size_t to)
+    size_t framed_entries_size(size_t from, size_t to) const
     {
-      if ((from == 0) || (to < from) || (to > positions.size()))
-        return 0;
+      // Entries from and to must both be in this file
+      from -= start_idx;
+      to -= start_idx;
 
-      if (to == positions.size())
+      if (to == positions.size() - 1)
       {
-        return total_len - positions.at(from - 1);
+        return total_len - positions.at(from);
       }
       else
       {
-        return positions.at(to) - positions.at(from - 1);
+        return positions.at(to + 1) - positions.at(from);
       }
     }
 
-    size_t entry_size(size_t idx)
-    {
-      auto framed_size = framed_entries_size(idx, idx);
-
-      return framed_size ? framed_size - frame_header_size : 0;
-    }
-
     void write_entry(const uint8_t* data, size_t size)
     {
+      if (read_only)
+        throw std::logic_error("Cannot write to read-only ledger file");
+
       fseeko(file, total_len, SEEK_SET);
       positions.push_back(total_len);
+      index->append(total_len);
 
-      LOG_DEBUG_FMT("Ledger write {}: {} bytes", positions.size(), size);
+      LOG_DEBUG_FMT("Ledger write {}: {} bytes", get_last_idx(), size);
 
       total_len += (size + frame_header_size);
 
@@ -167,22 +385,20 @@ namespace asynchost
 
     void truncate(size_t last_idx)
     {
-      LOG_DEBUG_FMT("Ledger truncate: {}/{}", last_idx, positions.size());
+      // Keeps the entries up to last_idx, which is either in this file or
+      // immediately precedes it
+      if (read_only)
+        throw std::logic_error("Cannot truncate read-only ledger file");
 
-      // positions[last_idx - 1] is the position of the specified
-      // final index. Truncate the ledger at position[last_idx].
-      if (last_idx >= positions.size())
+      auto count = last_idx + 1 - start_idx;
+      if (count >= positions.size())
         return;
 
-      total_len = positions.at(last_idx);
-      positions.resize(last_idx);
+      total_len = positions.at(count);
+      positions.resize(count);
+      index->truncate(positions);
 
-      if (fflush(file) != 0)
-      {
-        std::stringstream ss;
-        ss << "Failed to flush file: " << strerror(errno);
-        throw std::logic_error(ss.str());
-      }
+      flush();
 
       if (ftruncate(fileno(file), total_len))
         throw std::logic_error("Failed to truncate file");
@@ -190,40 +406,754 @@ namespace asynchost
       fseeko(file, total_len, SEEK_SET);
     }
 
-    void register_message_handlers(
-      messaging::Dispatcher<ringbuffer::Message>& disp)
+    void rename(const std::string& new_filename, bool read_only_)
     {
-      DISPATCHER_SET_MESSAGE_HANDLER(
-        disp,
-        consensus::ledger_append,
-        [this](const uint8_t* data, size_t size) { write_entry(data, size); });
+      flush();
+
+      if (
+        std::rename(filename.c_str(), new_filename.c_str()) != 0 ||
+        std::rename(
+          index_filename(filename).c_str(),
+          index_filename(new_filename).c_str()) != 0)
+      {
+        throw std::logic_error(
+          "Failed to rename ledger file " + filename + " to " + new_filename);
+      }
+
+      filename = new_filename;
+
+      if (read_only_ != read_only)
+        reopen(read_only_);
+    }
+
+    void remove()
+    {
+      fclose(file);
+      file = NULL;
+      index.reset();
+      mapping.reset();
+
+      std::remove(filename.c_str());
+      std::remove(index_filename(filename).c_str());
+    }
+  };
+
+  // The ledger is split into chunks, each held in its own file. Entries are
+  // appended to the file at filename. Once it reaches chunk_size bytes, it is
+  // renamed to filename.<first>-<last> and a new file is started. Once all of
+  // its entries are committed, a chunk is renamed to
+  // filename.<first>-<last>.committed and made read-only.
+  class Ledger
+  {
+  public:
+    static constexpr size_t default_max_cache_bytes = 1 << 24;
+    static constexpr size_t snapshot_chunk_size = 1 << 20;
+
+  private:
+    static constexpr size_t frame_header_size = LedgerFile::frame_header_size;
+    static constexpr auto committed_suffix = ".committed";
+
+    std::string filename;
+    size_t chunk_size;
+    size_t entries_per_index_checkpoint;
+
+    // Files ordered by index. Entries are appended to the last one.
+    std::vector<std::unique_ptr<LedgerFile>> files;
+    size_t commit_idx = 0;
+
+    std::unique_ptr<ringbuffer::AbstractWriter> to_enclave;
+
+    // Entries up to durable_idx have been synced, and reported as durable to
+    // the enclave
+    LedgerDurability durability = LedgerDurability::none;
+    std::chrono::milliseconds sync_interval{0};
+    size_t sync_bytes = 0;
+    size_t durable_idx = 0;
+    size_t unsynced_bytes = 0;
+    // Epoch of the last truncation or snapshot requested by the enclave,
+    // echoed with durable_idx so that it can ignore outdated reports
+    size_t epoch = 0;
+    std::chrono::steady_clock::time_point last_sync;
+
+    // The most recently written entries, framed, up to the last entry, so
+    // that sending them to followers does not read them back from the files
+    std::deque<std::shared_ptr<const std::vector<uint8_t>>> cache;
+    size_t cache_bytes = 0;
+    size_t max_cache_bytes = default_max_cache_bytes;
+
+    // Once a snapshot has been installed, the entries following it are
+    // appended to files of their own. The files holding the entries from
+    // before the first snapshot are kept, and still serve the entries they
+    // hold up to the snapshot index.
+    std::string snapshot_filename;
+    size_t snapshot_idx = 0;
+    std::vector<std::unique_ptr<LedgerFile>> previous_files;
+
+    // Snapshot being written, until it is committed
+    FILE* pending_snapshot = NULL;
+    std::optional<size_t> pending_snapshot_idx;
 
-      DISPATCHER_SET_MESSAGE_HANDLER(
-        disp,
-        consensus::ledger_truncate,
-        [this](const uint8_t* data, size_t size) {
-          auto idx = serialized::read<consensus::Index>(data, size);
-          truncate(idx);
+    struct Chunk
+    {
+      std::string filename;
+      size_t from;
+      size_t to;
+      bool committed;
+    };
+
+    std::string pending_snapshot_filename()
+    {
+      return snapshot_filename + ".tmp";
+    }
+
+    void discard_pending_snapshot()
+    {
+      if (pending_snapshot)
+      {
+        fclose(pending_snapshot);
+        pending_snapshot = NULL;
+        std::remove(pending_snapshot_filename().c_str());
+      }
+      pending_snapshot_idx.reset();
+    }
+
+    std::string current_filename()
+    {
+      // File entries are appended to
+      return snapshot_idx == 0 ? filename : snapshot_filename + ".entries";
+    }
+
+    std::string chunk_filename(size_t from, size_t to, bool committed)
+    {
+      return current_filename() + "." + std::to_string(from) + "-" +
+        std::to_string(to) + (committed ? committed_suffix : "");
+    }
+
+    std::vector<Chunk> find_chunks(const std::string& filename)
+    {
+      // Lists the chunk files of the ledger at filename, ordered by index
+      std::vector<Chunk> chunks;
+
+      auto sep = filename.find_last_of('/');
+      auto dir = (sep == std::string::npos) ? "." : filename.substr(0, sep);
+      auto prefix = filename.substr(sep + 1) + ".";
+
+      DIR* d = opendir(dir.c_str());
+      if (!d)
+        throw std::logic_error("Unable to open ledger directory " + dir);
+
+      for (auto e = readdir(d); e != nullptr; e = readdir(d))
+      {
+        std::string name(e->d_name);
+        if (name.compare(0, prefix.size(), prefix) != 0)
+          continue;
+
+        // Expects <first>-<last>, optionally followed by the committed suffix
+        auto range = name.substr(prefix.size());
+        auto dash = range.find('-');
+        if (
+          dash == 0 || dash == std::string::npos ||
+          !std::all_of(range.begin(), range.begin() + dash, ::isdigit))
+          continue;
+
+        auto end = range.find_first_not_of("0123456789", dash + 1);
+        auto suffix =
+          (end == std::string::npos) ? std::string() : range.substr(end);
+        if (end == dash + 1 || (!suffix.empty() && suffix != committed_suffix))
+          continue;
+
+        chunks.push_back({filename.substr(0, sep + 1) + name,
+                          std::stoull(range.substr(0, dash)),
+                          std::stoull(range.substr(dash + 1, end - dash - 1)),
+                          !suffix.empty()});
+      }
+
+      closedir(d);
+
+      std::sort(
+        chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) {
+          return a.from < b.from;
         });
 
-      DISPATCHER_SET_MESSAGE_HANDLER(
-        disp, consensus::ledger_get, [&](const uint8_t* data, size_t size) {
-          // The enclave has asked for a ledger entry.
-          auto [idx] =
-            ringbuffer::read_message<consensus::ledger_get>(data, size);
-
-          auto& entry = read_entry(idx);
-
-          if (entry.size() > 0)
-          {
-            RINGBUFFER_WRITE_MESSAGE(
-              consensus::ledger_entry, to_enclave, entry);
-          }
-          else
-          {
-            RINGBUFFER_WRITE_MESSAGE(consensus::ledger_no_entry, to_enclave);
-          }
+      return chunks;
+    }
+
+    std::vector<std::unique_ptr<LedgerFile>>* find_files(size_t from, size_t to)
+    {
+      // Returns the files holding all the entries from from to to, if any
+      if (from == 0 || to < from)
+        return nullptr;
+
+      if (from > snapshot_idx && to <= get_last_idx())
+        return &files;
+
+      if (
+        !previous_files.empty() && to <= snapshot_idx &&
+        to <= previous_files.back()->get_last_idx())
+        return &previous_files;
+
+      return nullptr;
+    }
+
+    LedgerFile* find_file(
+      std::vector<std::unique_ptr<LedgerFile>>& files, size_t idx)
+    {
+      // Returns the file holding the entry at idx
+      auto it = std::upper_bound(
+        files.begin(), files.end(), idx, [](size_t idx, const auto& f) {
+          return idx < f->get_start_idx();
         });
+
+      return std::prev(it)->get();
+    }
+
+    size_t read_snapshot_idx()
+    {
+      // Index of the snapshot the ledger starts from, if any, as recorded in
+      // the header of the snapshot file
+      FILE* f = fopen(snapshot_filename.c_str(), "rb");
+      if (!f)
+        return 0;
+
+      uint64_t header = 0;
+      auto read = fread(&header, sizeof(header), 1, f);
+      fclose(f);
+
+      if (read != 1 || header == 0)
+        throw std::logic_error(
+          "Malformed ledger snapshot " + snapshot_filename);
+
+      return header;
+    }
+
+    std::vector<std::unique_ptr<LedgerFile>> open_files(
+      const std::string& filename, size_t start_idx)
+    {
+      // Opens the chunks of the ledger at filename, which must hold all the
+      // entries from start_idx, followed by the file entries are appended to
+      std::vector<std::unique_ptr<LedgerFile>> files;
+      size_t next_idx = start_idx;
+
+      for (auto& chunk : find_chunks(filename))
+      {
+        if (chunk.from != next_idx)
+          throw std::logic_error(
+            "Ledger chunk " + chunk.filename + " should start at " +
+            std::to_string(next_idx));
+
+        auto f = std::make_unique<LedgerFile>(
+          chunk.filename,
+          chunk.from,
+          chunk.committed,
+          entries_per_index_checkpoint);
+
+        if (f->get_last_idx() != chunk.to)
+          throw std::logic_error("Malformed ledger chunk " + chunk.filename);
+
+        if (chunk.committed)
+          commit_idx = std::max(commit_idx, chunk.to);
+
+        next_idx = chunk.to + 1;
+        files.push_back(std::move(f));
+      }
+
+      files.push_back(std::make_unique<LedgerFile>(
+        filename, next_idx, false, entries_per_index_checkpoint));
+
+      return files;
+    }
+
+    size_t first_cached_idx()
+    {
+      return get_last_idx() + 1 - cache.size();
+    }
+
+    void evict()
+    {
+      while (cache_bytes > max_cache_bytes)
+      {
+        cache_bytes -= cache.front()->size();
+        cache.pop_front();
+      }
+    }
+
+    void rotate()
+    {
+      // The file entries are appended to becomes a chunk, and a new file is
+      // started
+      auto& f = files.back();
+      auto from = f->get_start_idx();
+      auto to = f->get_last_idx();
+      auto committed = to <= commit_idx;
+
+      LOG_INFO_FMT("Ledger chunk {}-{} complete", from, to);
+
+      // Only the file entries are appended to is synced by sync()
+      if (durability != LedgerDurability::none)
+        f->sync();
+
+      f->rename(chunk_filename(from, to, committed), committed);
+      files.push_back(std::make_unique<LedgerFile>(
+        current_filename(), to + 1, false, entries_per_index_checkpoint));
+    }
+
+  public:
+    Ledger(
+      const std::string& filename_,
+      ringbuffer::AbstractWriterFactory& writer_factory,
+      size_t chunk_size_ = 0,
+      size_t entries_per_index_checkpoint_ =
+        LedgerIndex::default_entries_per_checkpoint) :
+      filename(filename_),
+      chunk_size(chunk_size_),
+      entries_per_index_checkpoint(entries_per_index_checkpoint_),
+      to_enclave(writer_factory.create_writer_to_inside()),
+      snapshot_filename(filename_ + ".snapshot")
+    {
+      // If a snapshot has been installed, the ledger is re-opened from it and
+      // the entries following it, along with the files from before the first
+      // snapshot. Files that do not fit together are left as they are, and
+      // the ledger is not opened.
+      snapshot_idx = read_snapshot_idx();
+      if (snapshot_idx != 0)
+      {
+        LOG_INFO_FMT(
+          "Ledger starts from snapshot {} at {}",
+          snapshot_filename,
+          snapshot_idx);
+        previous_files = open_files(filename, 1);
+        commit_idx = snapshot_idx;
+      }
+
+      files = open_files(current_filename(), snapshot_idx + 1);
+
+      durable_idx = get_last_idx();
+      last_sync = std::chrono::steady_clock::now();
+    }
+
+    Ledger(const Ledger& that) = delete;
+
+    ~Ledger()
+    {
+      discard_pending_snapshot();
+    }
+
+    size_t get_last_idx()
+    {
+      return files.back()->get_last_idx();
+    }
+
+    size_t get_snapshot_idx()
+    {
+      return snapshot_idx;
+    }
+
+    size_t get_chunk_count()
+    {
+      return files.size() - 1;
+    }
+
+    size_t get_durable_idx()
+    {
+      return durable_idx;
+    }
+
+    size_t get_cache_bytes()
+    {
+      return cache_bytes;
+    }
+
+    void set_max_cache_bytes(size_t max_cache_bytes_)
+    {
+      max_cache_bytes = max_cache_bytes_;
+      evict();
+    }
+
+    void set_durability(
+      LedgerDurability durability_,
+      std::chrono::milliseconds sync_interval_ = std::chrono::milliseconds(0),
+      size_t sync_bytes_ = 0)
+    {
+      if (
+        durability_ == LedgerDurability::interval &&
+        sync_interval_.count() == 0 && sync_bytes_ == 0)
+        throw std::logic_error(
+          "Ledger sync interval requires a duration or a number of bytes");
+
+      durability = durability_;
+      sync_interval = sync_interval_;
+      sync_bytes = sync_bytes_;
+    }
+
+    LedgerDurability get_durability()
+    {
+      return durability;
+    }
+
+    void set_epoch(size_t epoch_)
+    {
+      epoch = epoch_;
+    }
+
+    const std::vector<uint8_t> read_entry(size_t idx)
+    {
+      auto fs = find_files(idx, idx);
+      if (fs == nullptr)
+        return {};
+
+      if (fs == &files && idx >= first_cached_idx())
+      {
+        auto& framed = cache.at(idx - first_cached_idx());
+        return std::vector<uint8_t>(
+          framed->begin() + frame_header_size, framed->end());
+      }
+
+      return find_file(*fs, idx)->read_entry(idx);
+    }
+
+    const std::vector<uint8_t> read_framed_entries(size_t from, size_t to)
+    {
+      std::vector<uint8_t> framed_entries;
+      framed_entries.reserve(framed_entries_size(from, to));
+
+      for (auto& segment : view_framed_entries(from, to))
+        framed_entries.insert(
+          framed_entries.end(), segment.data, segment.data + segment.size);
+
+      return framed_entries;
+    }
+
+    LedgerView view_framed_entries(size_t from, size_t to)
+    {
+      // Cached entries are not copied, and neither are entries in committed
+      // chunks, which are mapped. Other entries are read from the files, with
+      // a segment per file they span.
+      LedgerView view;
+      auto fs = find_files(from, to);
+      if (fs == nullptr)
+        return view;
+
+      // Only the entries following the snapshot are cached
+      auto cached_from = (fs == &files) ? first_cached_idx() : to + 1;
+
+      while (from <= to && from < cached_from)
+      {
+        auto f = find_file(*fs, from);
+        auto last = std::min({to, f->get_last_idx(), cached_from - 1});
+        view.push_back(f->view_framed_entries(from, last));
+        from = last + 1;
+      }
+
+      for (; from <= to; ++from)
+      {
+        auto& framed = cache.at(from - cached_from);
+        view.push_back({framed, framed->data(), framed->size()});
+      }
+
+      return view;
+    }
+
+    size_t framed_entries_size(size_t from, size_t to)
+    {
+      auto fs = find_files(from, to);
+      if (fs == nullptr)
+        return 0;
+
+      size_t size = 0;
+      while (from <= to)
+      {
+        auto f = find_file(*fs, from);
+        auto last = std::min(to, f->get_last_idx());
+        size += f->framed_entries_size(from, last);
+        from = last + 1;
+      }
+
+      return size;
+    }
+
+    size_t entry_size(size_t idx)
+    {
+      auto framed_size = framed_entries_size(idx, idx);
+
+      return framed_size ? framed_size - frame_header_size : 0;
+    }
+
+    void write_entry(const uint8_t* data, size_t size)
+    {
+      files.back()->write_entry(data, size);
+      unsynced_bytes += size + frame_header_size;
+
+      if (max_cache_bytes != 0)
+      {
+        auto framed =
+          std::make_shared<std::vector<uint8_t>>(frame_header_size + size);
+        uint32_t frame = (uint32_t)size;
+        std::memcpy(framed->data(), &frame, frame_header_size);
+        std::memcpy(framed->data() + frame_header_size, data, size);
+
+        cache_bytes += framed->size();
+        cache.push_back(std::move(framed));
+        evict();
+      }
+
+      if (chunk_size != 0 && files.back()->get_len() >= chunk_size)
+        rotate();
+    }
+
+    void truncate(size_t last_idx)
+    {
+      LOG_DEBUG_FMT("Ledger truncate: {}/{}", last_idx, get_last_idx());
+
+      if (last_idx >= get_last_idx())
+        return;
+
+      // Entries up to the snapshot index cannot be truncated
+      last_idx = std::max(last_idx, snapshot_idx);
+
+      if (last_idx < commit_idx)
+        throw std::logic_error(
+          "Cannot truncate ledger at " + std::to_string(last_idx) +
+          ", committed up to " + std::to_string(commit_idx));
+
+      // Truncated entries are dropped from the cache first
+      auto truncated = get_last_idx() - last_idx;
+      while (truncated-- > 0 && !cache.empty())
+      {
+        cache_bytes -= cache.back()->size();
+        cache.pop_back();
+      }
+
+      // Files that only hold truncated entries are removed, and entries are
+      // then appended to the file holding last_idx
+      while (files.size() > 1 && files.back()->get_start_idx() > last_idx + 1)
+      {
+        files.back()->remove();
+        files.pop_back();
+
+        auto& f = files.back();
+        LOG_INFO_FMT(
+          "Ledger chunk {}-{} reopened", f->get_start_idx(), f->get_last_idx());
+        f->rename(current_filename(), false);
+      }
+
+      files.back()->truncate(last_idx);
+      durable_idx = std::min(durable_idx, last_idx);
+    }
+
+    void sync()
+    {
+      // Called once there are no more pending writes, so that all the entries
+      // appended since the last call are written and synced together
+      if (durability == LedgerDurability::none)
+        return;
+
+      auto last_idx = get_last_idx();
+      if (last_idx <= durable_idx)
+        return;
+
+      auto now = std::chrono::steady_clock::now();
+
+      if (
+        durability == LedgerDurability::interval &&
+        !(sync_interval.count() != 0 && now - last_sync >= sync_interval) &&
+        !(sync_bytes != 0 && unsynced_bytes >= sync_bytes))
+        return;
+
+      files.back()->sync();
+
+      LOG_DEBUG_FMT("Ledger sync: {} bytes up to {}", unsynced_bytes, last_idx);
+
+      durable_idx = last_idx;
+      unsynced_bytes = 0;
+      last_sync = now;
+
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_durable,
+        to_enclave,
+        (consensus::Index)durable_idx,
+        epoch);
+    }
+
+    void commit(size_t idx)
+    {
+      LOG_DEBUG_FMT("Ledger commit: {}/{}", idx, get_last_idx());
+
+      if (idx <= commit_idx)
+        return;
+
+      commit_idx = idx;
+
+      for (auto it = files.begin(); std::next(it) != files.end(); ++it)
+      {
+        auto& f = *it;
+        if (f->is_read_only())
+          continue;
+
+        if (f->get_last_idx() > commit_idx)
+          break;
+
+        LOG_INFO_FMT(
+          "Ledger chunk {}-{} committed",
+          f->get_start_idx(),
+          f->get_last_idx());
+        f->rename(
+          chunk_filename(f->get_start_idx(), f->get_last_idx(), true), true);
+      }
+    }
+
+    void write_snapshot_chunk(
+      size_t idx, size_t offset, const std::vector<uint8_t>& chunk)
+    {
+      LOG_DEBUG_FMT(
+        "Ledger snapshot write {}: {} bytes at {}", idx, chunk.size(), offset);
+
+      if (offset == 0)
+      {
+        discard_pending_snapshot();
+
+        pending_snapshot = fopen(pending_snapshot_filename().c_str(), "wb");
+        if (!pending_snapshot)
+          throw std::logic_error("Unable to create ledger snapshot file");
+
+        uint64_t header = idx;
+        if (fwrite(&header, sizeof(header), 1, pending_snapshot) != 1)
+          throw std::logic_error("Failed to write to file");
+
+        pending_snapshot_idx = idx;
+      }
+      else if (pending_snapshot_idx != idx)
+      {
+        throw std::logic_error(
+          "Ledger snapshot chunk does not match pending snapshot");
+      }
+
+      if (
+        !chunk.empty() &&
+        fwrite(chunk.data(), chunk.size(), 1, pending_snapshot) != 1)
+        throw std::logic_error("Failed to write to file");
+    }
+
+    void commit_snapshot(size_t idx)
+    {
+      LOG_DEBUG_FMT("Ledger snapshot commit: {}", idx);
+
+      if (pending_snapshot_idx != idx)
+        throw std::logic_error("No pending ledger snapshot to commit");
+
+      // The snapshot is only visible once it has been completely written.
+      // The entries following it are then written to new files, while the
+      // files from before the first snapshot are kept.
+      if (
+        fflush(pending_snapshot) != 0 ||
+        fsync(fileno(pending_snapshot)) != 0)
+      {
+        std::stringstream ss;
+        ss << "Failed to flush file: " << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+
+      fclose(pending_snapshot);
+      pending_snapshot = NULL;
+      pending_snapshot_idx.reset();
+
+      if (
+        std::rename(
+          pending_snapshot_filename().c_str(), snapshot_filename.c_str()) != 0)
+        throw std::logic_error("Failed to rename ledger snapshot file");
+
+      if (snapshot_idx == 0)
+      {
+        previous_files = std::move(files);
+      }
+      else
+      {
+        for (auto& f : files)
+          f->remove();
+      }
+      files.clear();
+
+      snapshot_idx = idx;
+      commit_idx = idx;
+      durable_idx = idx;
+      unsynced_bytes = 0;
+      cache.clear();
+      cache_bytes = 0;
+
+      files.push_back(std::make_unique<LedgerFile>(
+        current_filename(), idx + 1, false, entries_per_index_checkpoint));
+    }
+
+    const std::vector<uint8_t> read_snapshot()
+    {
+      std::vector<uint8_t> snapshot;
+
+      FILE* f = fopen(snapshot_filename.c_str(), "rb");
+      if (!f)
+        return snapshot;
+
+      fseeko(f, 0, SEEK_END);
+      auto len = ftello(f);
+      fseeko(f, sizeof(uint64_t), SEEK_SET);
+
+      if (len > (off_t)sizeof(uint64_t))
+      {
+        snapshot.resize(len - sizeof(uint64_t));
+        if (fread(snapshot.data(), snapshot.size(), 1, f) != 1)
+        {
+          fclose(f);
+          throw std::logic_error("Failed to read from file");
+        }
+      }
+
+      fclose(f);
+      return snapshot;
+    }
+
+    void send_snapshot()
+    {
+      // Responds to the enclave asking for the snapshot the ledger starts
+      // from, in chunks that each fit in a message
+      if (snapshot_idx != 0)
+      {
+        auto snapshot = read_snapshot();
+        for (size_t offset = 0; offset < snapshot.size();
+             offset += snapshot_chunk_size)
+        {
+          auto end = std::min(offset + snapshot_chunk_size, snapshot.size());
+          RINGBUFFER_WRITE_MESSAGE(
+            consensus::ledger_snapshot_part,
+            to_enclave,
+            offset,
+            std::vector<uint8_t>(
+              snapshot.begin() + offset, snapshot.begin() + end));
+        }
+      }
+
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_snapshot_end,
+        to_enclave,
+        (consensus::Index)snapshot_idx);
+    }
+
+    void send_entries(size_t from, size_t to)
+    {
+      // Responds to the enclave asking for a range of ledger entries. The
+      // entries are streamed one message each, so that the enclave can
+      // process them as they arrive.
+      for (auto idx = from; idx <= to; ++idx)
+      {
+        auto entry = read_entry(idx);
+
+        if (entry.empty())
+        {
+          RINGBUFFER_WRITE_MESSAGE(
+            consensus::ledger_no_entry, to_enclave, (consensus::Index)idx);
+          return;
+        }
+
+        RINGBUFFER_WRITE_MESSAGE(
+          consensus::ledger_entry, to_enclave, (consensus::Index)idx, entry);
+      }
     }
   };
-}
\ No newline at end of file
+}
@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "everyio.h"
+#include "ledgerworker.h"
+
+namespace asynchost
+{
+  class LedgerCompletionsImpl
+  {
+  private:
+    LedgerWorker& ledger_worker;
+
+  public:
+    LedgerCompletionsImpl(LedgerWorker& ledger_worker) :
+      ledger_worker(ledger_worker)
+    {}
+
+    void every()
+    {
+      // This runs the results of the ledger worker jobs, such as sending the
+      // entries it has read, on the libuv loop thread
+      ledger_worker.run_completions();
+    }
+  };
+
+  using LedgerCompletions = proxy_ptr<EveryIO<LedgerCompletionsImpl>>;
+}
@@ -0,0 +1,223 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/crc32.h"
+#include "ds/logger.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <errno.h>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace asynchost
+{
+  // Append-only index of the positions of the entries in a ledger file, so
+  // that the ledger does not need to be scanned on startup. The index is a
+  // sequence of checkpoints, each made of the positions of
+  // entries_per_checkpoint consecutive entries followed by the CRC-32 of these
+  // positions. Positions that are not yet followed by a checkpoint CRC are
+  // discarded on load, and the corresponding entries are scanned again.
+  class LedgerIndex
+  {
+  public:
+    static constexpr size_t default_entries_per_checkpoint = 1024;
+
+  private:
+    using Position = uint64_t;
+    static constexpr size_t crc_size = sizeof(uint32_t);
+
+    FILE* file;
+    const size_t entries_per_checkpoint;
+
+    // Number of positions in the index, including the ones since the last
+    // checkpoint
+    size_t count = 0;
+    uint32_t crc = 0;
+
+    size_t checkpoint_size() const
+    {
+      return entries_per_checkpoint * sizeof(Position) + crc_size;
+    }
+
+    size_t file_size(size_t entries) const
+    {
+      return (entries / entries_per_checkpoint) * checkpoint_size() +
+        (entries % entries_per_checkpoint) * sizeof(Position);
+    }
+
+    void resize(size_t entries)
+    {
+      if (fflush(file) != 0)
+      {
+        std::stringstream ss;
+        ss << "Failed to flush file: " << strerror(errno);
+        throw std::logic_error(ss.str());
+      }
+
+      auto size = file_size(entries);
+      if (ftruncate(fileno(file), size))
+        throw std::logic_error("Failed to truncate ledger index file");
+
+      fseeko(file, size, SEEK_SET);
+      count = entries;
+    }
+
+  public:
+    LedgerIndex(
+      const std::string& filename,
+      size_t entries_per_checkpoint_ = default_entries_per_checkpoint) :
+      file(NULL),
+      entries_per_checkpoint(entries_per_checkpoint_)
+    {
+      if (entries_per_checkpoint == 0)
+        throw std::logic_error("Ledger index checkpoints cannot be empty");
+
+      file = fopen(filename.c_str(), "r+b");
+
+      if (!file)
+        file = fopen(filename.c_str(), "w+b");
+
+      if (!file)
+        throw std::logic_error("Unable to open or create ledger index file");
+    }
+
+    LedgerIndex(const LedgerIndex& that) = delete;
+
+    ~LedgerIndex()
+    {
+      if (file)
+      {
+        fflush(file);
+        fclose(file);
+      }
+    }
+
+    /**
+     * Read the positions of all checkpointed entries.
+     *
+     * Reading stops at the first checkpoint that is incomplete, fails its CRC,
+     * or is inconsistent with a ledger of the given length. The index is then
+     * truncated to the positions that have been returned.
+     *
+     * @param ledger_len Length of the ledger file
+     *
+     * @return Positions of the entries in the ledger file
+     */
+    std::vector<size_t> load(size_t ledger_len)
+    {
+      std::vector<size_t> positions;
+      std::vector<Position> checkpoint(entries_per_checkpoint);
+      uint32_t checkpoint_crc;
+
+      fseeko(file, 0, SEEK_SET);
+
+      while (true)
+      {
+        if (
+          fread(
+            checkpoint.data(),
+            sizeof(Position),
+            checkpoint.size(),
+            file) != checkpoint.size() ||
+          fread(&checkpoint_crc, crc_size, 1, file) != 1)
+          break;
+
+        auto data = reinterpret_cast<const uint8_t*>(checkpoint.data());
+        if (
+          crc32::crc32(data, checkpoint.size() * sizeof(Position)) !=
+          checkpoint_crc)
+        {
+          LOG_FAIL_FMT(
+            "Ledger index checkpoint at {} has an invalid CRC",
+            positions.size());
+          break;
+        }
+
+        // Each entry has a frame header, so positions must be strictly
+        // increasing, starting at the beginning of the ledger
+        bool consistent = true;
+        size_t prev = positions.empty() ? 0 : positions.back();
+        for (auto pos : checkpoint)
+        {
+          if (
+            pos >= ledger_len ||
+            (positions.empty() ? pos != 0 : pos <= prev))
+          {
+            consistent = false;
+            break;
+          }
+          positions.push_back(pos);
+          prev = pos;
+        }
+
+        if (!consistent)
+        {
+          LOG_FAIL_FMT(
+            "Ledger index checkpoint at {} does not match the ledger",
+            (positions.size() / entries_per_checkpoint) *
+              entries_per_checkpoint);
+          positions.resize(
+            (positions.size() / entries_per_checkpoint) *
+            entries_per_checkpoint);
+          break;
+        }
+      }
+
+      resize(positions.size());
+      crc = 0;
+
+      return positions;
+    }
+
+    void append(size_t position)
+    {
+      Position pos = position;
+
+      if (fwrite(&pos, sizeof(pos), 1, file) != 1)
+        throw std::logic_error("Failed to write to ledger index file");
+
+      crc = crc32::crc32(
+        reinterpret_cast<const uint8_t*>(&pos), sizeof(pos), crc);
+      count++;
+
+      if (count % entries_per_checkpoint == 0)
+      {
+        if (fwrite(&crc, crc_size, 1, file) != 1)
+          throw std::logic_error("Failed to write to ledger index file");
+
+        crc = 0;
+      }
+    }
+
+    /**
+     * Truncate the index to the first positions of the ledger.
+     *
+     * @param positions Positions of the entries that remain in the ledger
+     */
+    void truncate(const std::vector<size_t>& positions)
+    {
+      if (positions.size() >= count)
+        return;
+
+      resize(positions.size());
+
+      // Resume the CRC of the last checkpoint from its first position
+      crc = 0;
+      for (size_t i = count - (count % entries_per_checkpoint); i < count; ++i)
+      {
+        Position pos = positions[i];
+        crc = crc32::crc32(
+          reinterpret_cast<const uint8_t*>(&pos), sizeof(pos), crc);
+      }
+    }
+
+    size_t get_count() const
+    {
+      return count;
+    }
+  };
+}
@@ -0,0 +1,253 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ledger.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace asynchost
+{
+  // Runs all ledger I/O on a dedicated thread, so that a slow disk does not
+  // stall the libuv loop. Jobs run one at a time, in the order they were
+  // posted. Once there are no more jobs to run, the entries they appended are
+  // synced together, according to the durability of the ledger. Results that
+  // must be handled on the loop thread are posted as completions, which are
+  // run by run_completions().
+  //
+  // Posting never blocks. Once max_jobs are queued, the worker is full, and
+  // the loop stops reading messages from the enclave until it has caught up.
+  //
+  // An exception thrown by a job is rethrown by run_completions(), as it
+  // would have been had the job run on the loop thread.
+  class LedgerWorker
+  {
+  public:
+    using Job = std::function<void(Ledger&)>;
+    using Completion = std::function<void()>;
+
+    static constexpr size_t default_max_jobs = 4096;
+
+  private:
+    // Period at which a durable ledger is synced when no jobs are posted. A
+    // ledger without durability is never synced, so the worker only wakes up
+    // for new jobs.
+    static constexpr std::chrono::milliseconds sync_period{1};
+
+    Ledger& ledger;
+    const size_t max_jobs;
+
+    std::mutex jobs_lock;
+    std::condition_variable jobs_not_empty;
+    std::deque<Job> jobs;
+    bool stopping = false;
+
+    std::mutex completions_lock;
+    std::vector<Completion> completions;
+
+    std::thread thread;
+
+    void run()
+    {
+      std::unique_lock<std::mutex> guard(jobs_lock);
+
+      while (true)
+      {
+        if (jobs.empty())
+        {
+          if (stopping)
+            break;
+
+          guard.unlock();
+          run_job([](Ledger& l) { l.sync(); });
+          guard.lock();
+
+          auto ready = [this]() { return stopping || !jobs.empty(); };
+          if (ledger.get_durability() == LedgerDurability::none)
+            jobs_not_empty.wait(guard, ready);
+          else
+            jobs_not_empty.wait_for(guard, sync_period, ready);
+          continue;
+        }
+
+        auto job = std::move(jobs.front());
+        jobs.pop_front();
+
+        guard.unlock();
+        run_job(job);
+        guard.lock();
+      }
+
+      guard.unlock();
+      run_job([](Ledger& l) { l.sync(); });
+    }
+
+    void run_job(const Job& job)
+    {
+      try
+      {
+        job(ledger);
+      }
+      catch (const std::exception& e)
+      {
+        LOG_FAIL_FMT("Exception in ledger worker: {}", e.what());
+        post_completion(
+          [e = std::current_exception()]() { std::rethrow_exception(e); });
+      }
+    }
+
+  public:
+    LedgerWorker(Ledger& ledger, size_t max_jobs_ = default_max_jobs) :
+      ledger(ledger),
+      max_jobs(max_jobs_)
+    {
+      if (max_jobs == 0)
+        throw std::logic_error("Ledger worker queue cannot be empty");
+
+      thread = std::thread(&LedgerWorker::run, this);
+    }
+
+    LedgerWorker(const LedgerWorker& that) = delete;
+
+    ~LedgerWorker()
+    {
+      // Jobs that have already been posted are run before the thread exits
+      {
+        std::lock_guard<std::mutex> guard(jobs_lock);
+        stopping = true;
+      }
+      jobs_not_empty.notify_one();
+      thread.join();
+    }
+
+    /**
+     * Post a job to run on the ledger thread.
+     *
+     * The job is queued even if the worker is full, so that the messages
+     * already read from the ringbuffer are all handled. Callers should check
+     * is_full() before reading more of them.
+     *
+     * @param job Job to run, given the ledger
+     */
+    void post(Job job)
+    {
+      {
+        std::lock_guard<std::mutex> guard(jobs_lock);
+        jobs.push_back(std::move(job));
+      }
+      jobs_not_empty.notify_one();
+    }
+
+    bool is_full()
+    {
+      std::lock_guard<std::mutex> guard(jobs_lock);
+      return jobs.size() >= max_jobs;
+    }
+
+    // Called from a job, to run f on the thread calling run_completions()
+    void post_completion(Completion f)
+    {
+      std::lock_guard<std::mutex> guard(completions_lock);
+      completions.push_back(std::move(f));
+    }
+
+    size_t run_completions()
+    {
+      std::vector<Completion> ready;
+      {
+        std::lock_guard<std::mutex> guard(completions_lock);
+        ready.swap(completions);
+      }
+
+      for (auto& f : ready)
+        f();
+
+      return ready.size();
+    }
+
+    void register_message_handlers(
+      messaging::Dispatcher<ringbuffer::Message>& disp)
+    {
+      // The messages are only valid while they are being dispatched, so the
+      // jobs own a copy of their payload
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_append,
+        [this](const uint8_t* data, size_t size) {
+          post([entry = std::vector<uint8_t>(data, data + size)](Ledger& l) {
+            l.write_entry(entry.data(), entry.size());
+          });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_truncate,
+        [this](const uint8_t* data, size_t size) {
+          auto [idx, epoch] =
+            ringbuffer::read_message<consensus::ledger_truncate>(data, size);
+          post([idx = idx, epoch = epoch](Ledger& l) {
+            l.truncate(idx);
+            l.set_epoch(epoch);
+          });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_commit,
+        [this](const uint8_t* data, size_t size) {
+          auto [idx] =
+            ringbuffer::read_message<consensus::ledger_commit>(data, size);
+          post([idx = idx](Ledger& l) { l.commit(idx); });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_snapshot_chunk,
+        [this](const uint8_t* data, size_t size) {
+          auto [idx, offset, chunk] =
+            ringbuffer::read_message<consensus::ledger_snapshot_chunk>(
+              data, size);
+          post([idx = idx, offset = offset, chunk = std::move(chunk)](
+                 Ledger& l) { l.write_snapshot_chunk(idx, offset, chunk); });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_snapshot_commit,
+        [this](const uint8_t* data, size_t size) {
+          auto [idx, epoch] =
+            ringbuffer::read_message<consensus::ledger_snapshot_commit>(
+              data, size);
+          post([idx = idx, epoch = epoch](Ledger& l) {
+            l.commit_snapshot(idx);
+            l.set_epoch(epoch);
+          });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_get_range,
+        [this](const uint8_t* data, size_t size) {
+          // The enclave has asked for a range of ledger entries.
+          auto [from, to] =
+            ringbuffer::read_message<consensus::ledger_get_range>(data, size);
+          post([from = from, to = to](Ledger& l) { l.send_entries(from, to); });
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_get_snapshot,
+        [this](const uint8_t* data, size_t size) {
+          // The enclave has asked for the snapshot the ledger starts from
+          post([](Ledger& l) { l.send_snapshot(); });
+        });
+    }
+  };
+}
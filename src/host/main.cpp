@@ -6,6 +6,7 @@
 #include "ds/oversized.h"
 #include "enclave.h"
 #include "handle_ringbuffer.h"
+#include "ledgercompletions.h"
 #include "nodeconnections.h"
 #include "notifyconnections.h"
 #include "rpcconnections.h"
@@ -70,6 +71,91 @@ int main(int argc, char** argv)
   std::string ledger_file("ccf.ledger");
   app.add_option("--ledger-file", ledger_file, "Ledger file", true);
 
+  size_t ledger_chunk_bytes = 0;
+  app.add_option(
+    "--ledger-chunk-bytes",
+    ledger_chunk_bytes,
+    "Size in bytes after which the ledger file is completed as a chunk and a "
+    "new file is started (0 to disable)",
+    true);
+
+  std::string ledger_durability("none");
+  app.add_set(
+    "--ledger-durability",
+    ledger_durability,
+    {"none", "batch", "interval"},
+    "When the ledger is synced to disk: never, after each batch of entries "
+    "received from the enclave, or after --ledger-sync-interval-ms or "
+    "--ledger-sync-interval-bytes. Unless none, entries are only "
+    "acknowledged once synced",
+    true);
+
+  size_t ledger_sync_interval_ms = 0;
+  app.add_option(
+    "--ledger-sync-interval-ms",
+    ledger_sync_interval_ms,
+    "With interval durability, time in milliseconds after which written "
+    "entries are synced (0 to disable)",
+    true);
+
+  size_t ledger_sync_interval_bytes = 0;
+  app.add_option(
+    "--ledger-sync-interval-bytes",
+    ledger_sync_interval_bytes,
+    "With interval durability, number of written bytes after which entries "
+    "are synced (0 to disable)",
+    true);
+
+  size_t ledger_cache_bytes = asynchost::Ledger::default_max_cache_bytes;
+  app.add_option(
+    "--ledger-cache-bytes",
+    ledger_cache_bytes,
+    "Size in bytes of the most recent ledger entries kept in memory, from "
+    "which entries are sent to other nodes without reading the ledger file",
+    true);
+
+  size_t ledger_prefetch_entries = 1000;
+  app.add_option(
+    "--ledger-prefetch-entries",
+    ledger_prefetch_entries,
+    "Number of ledger entries streamed to the enclave ahead of the one being "
+    "recovered",
+    true);
+
+  size_t recovery_threads = 0;
+  app.add_option(
+    "--recovery-threads",
+    recovery_threads,
+    "Number of threads decrypting private ledger entries when recovering (0 "
+    "to decrypt them on the enclave thread)",
+    true);
+
+  size_t historical_versions = 1000;
+  app.add_option(
+    "--historical-versions",
+    historical_versions,
+    "Number of past versions of the store kept in the enclave when they are "
+    "rebuilt from the ledger for historical reads",
+    true);
+
+  size_t worker_threads = 0;
+  app.add_option(
+    "--worker-threads",
+    worker_threads,
+    "Number of threads processing RPC sessions inside the enclave, in addition "
+    "to the enclave thread (0 to process them on the enclave thread). Each "
+    "thread enters the enclave, which must be signed with enough TCS",
+    true);
+
+  size_t ledger_worker_queue_size =
+    asynchost::LedgerWorker::default_max_jobs;
+  app.add_option(
+    "--ledger-worker-queue-size",
+    ledger_worker_queue_size,
+    "Maximum number of ledger operations queued for the ledger I/O thread, "
+    "beyond which messages from the enclave are no longer processed",
+    true);
+
   std::string host_log_level("info");
   app.add_set(
     "-l,--host-log-level",
@@ -133,6 +219,14 @@ int main(int argc, char** argv)
     "Raft election timeout in milliseconds",
     true);
 
+  size_t raft_snapshot_lag = 0;
+  app.add_option(
+    "--raft-snapshot-lag",
+    raft_snapshot_lag,
+    "Number of entries a follower can lag behind before it is sent a snapshot "
+    "instead of the entries (0 to disable)",
+    true);
+
   size_t max_msg_size = 24;
   app.add_option(
     "--max-msg-size",
@@ -244,6 +338,13 @@ int main(int argc, char** argv)
   if (!host_log_level_)
     throw std::logic_error("No such logging level: "s + host_log_level);
 
+#ifdef PBFT
+  // PBFT executes requests, and records their results in the history, on the
+  // enclave thread
+  if (worker_threads != 0)
+    throw std::logic_error("--worker-threads is not supported with PBFT");
+#endif
+
   // set the host log level
   logger::config::level() = host_log_level_.value();
 
@@ -273,9 +374,6 @@ int main(int argc, char** argv)
     logger::config::set_start(s);
   });
 
-  // handle outbound messages from the enclave
-  asynchost::HandleRingbuffer handle_ringbuffer(bp, circuit.read_from_inside());
-
   // graceful shutdown on sigterm
   asynchost::Sigterm sigterm(writer_factory);
 
@@ -295,8 +393,15 @@ int main(int argc, char** argv)
 #endif
 
   CCFConfig ccf_config;
-  ccf_config.raft_config = {raft_timeout, raft_election_timeout};
+  ccf_config.raft_config = {raft_timeout,
+                            raft_election_timeout,
+                            raft_snapshot_lag,
+                            ledger_durability != "none"};
   ccf_config.signature_intervals = {sig_max_tx, sig_max_ms};
+  ccf_config.ledger_prefetch_entries = ledger_prefetch_entries;
+  ccf_config.recovery_threads = recovery_threads;
+  ccf_config.historical_versions = historical_versions;
+  ccf_config.worker_threads = worker_threads;
   ccf_config.node_info_network = {rpc_address.hostname,
                                   public_rpc_address.hostname,
                                   node_address.port,
@@ -340,11 +445,33 @@ int main(int argc, char** argv)
   LOG_INFO_FMT("Created new node");
 
   // ledger
-  asynchost::Ledger ledger(ledger_file, writer_factory);
-  ledger.register_message_handlers(bp.get_dispatcher());
+  asynchost::Ledger ledger(ledger_file, writer_factory, ledger_chunk_bytes);
+  ledger.set_max_cache_bytes(ledger_cache_bytes);
+
+  if (ledger_durability == "batch")
+  {
+    ledger.set_durability(asynchost::LedgerDurability::batch);
+  }
+  else if (ledger_durability == "interval")
+  {
+    ledger.set_durability(
+      asynchost::LedgerDurability::interval,
+      std::chrono::milliseconds(ledger_sync_interval_ms),
+      ledger_sync_interval_bytes);
+  }
+
+  // run ledger I/O on a separate thread, off the libuv loop
+  asynchost::LedgerWorker ledger_worker(ledger, ledger_worker_queue_size);
+  ledger_worker.register_message_handlers(bp.get_dispatcher());
+  asynchost::LedgerCompletions ledger_completions(ledger_worker);
+
+  // handle outbound messages from the enclave, as fast as the ledger worker
+  // can keep up with them
+  asynchost::HandleRingbuffer handle_ringbuffer(
+    bp, circuit.read_from_inside(), ledger_worker);
 
   asynchost::NodeConnections node(
-    ledger, writer_factory, node_address.hostname, node_address.port);
+    ledger_worker, writer_factory, node_address.hostname, node_address.port);
   node.register_message_handlers(bp.get_dispatcher());
 
   asynchost::NotifyConnections report(
@@ -393,8 +520,35 @@ int main(int argc, char** argv)
 #endif
   });
 
+  // Start threads which will ECall and process RPC sessions inside the
+  // enclave, until the enclave thread stops
+  std::vector<std::thread> rpc_worker_threads;
+  for (size_t i = 0; i < worker_threads; ++i)
+  {
+    rpc_worker_threads.emplace_back([&]() { enclave.run_worker(); });
+  }
+
+  // Likewise, start threads which will ECall and decrypt ledger entries when
+  // the node recovers
+  std::vector<std::thread> recovery_worker_threads;
+  for (size_t i = 0; i < recovery_threads; ++i)
+  {
+    recovery_worker_threads.emplace_back(
+      [&]() { enclave.run_recovery_worker(); });
+  }
+
   uv_run(uv_default_loop(), UV_RUN_DEFAULT);
   enclave_thread.join();
 
+  for (auto& t : rpc_worker_threads)
+  {
+    t.join();
+  }
+
+  for (auto& t : recovery_worker_threads)
+  {
+    t.join();
+  }
+
   return 0;
 }
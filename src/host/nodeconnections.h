@@ -3,7 +3,7 @@
 #pragma once
 
 #include "consensus/raft/rafttypes.h"
-#include "ledger.h"
+#include "ledgerworker.h"
 #include "node/nodetypes.h"
 #include "tcp.h"
 
@@ -162,7 +162,7 @@ namespace asynchost
       }
     };
 
-    Ledger& ledger;
+    LedgerWorker& ledger_worker;
     TCP listener;
     std::unordered_map<ccf::NodeId, TCP> outgoing;
     std::unordered_map<size_t, TCP> incoming;
@@ -172,11 +172,11 @@ namespace asynchost
 
   public:
     NodeConnections(
-      Ledger& ledger,
+      LedgerWorker& ledger_worker,
       ringbuffer::AbstractWriterFactory& writer_factory,
       const std::string& host,
       const std::string& service) :
-      ledger(ledger),
+      ledger_worker(ledger_worker),
       to_enclave(writer_factory.create_writer_to_inside())
     {
       listener->set_behaviour(std::make_unique<ServerBehaviour>(*this));
@@ -202,63 +202,90 @@ namespace asynchost
       DISPATCHER_SET_MESSAGE_HANDLER(
         disp, ccf::node_outbound, [this](const uint8_t* data, size_t size) {
           auto to = serialized::read<ccf::NodeId>(data, size);
-          auto node = find(to, true);
+          std::vector<uint8_t> msg(data, data + size);
 
-          if (!node)
-            return;
-
-          auto data_to_send = data;
-          auto size_to_send = size;
+          const uint8_t* p = data;
+          auto psize = size;
 
-          // If the message is a raft append entries message, affix the
-          // corresponding ledger entries
           if (
-            serialized::read<ccf::NodeMsgType>(data, size) ==
-              ccf::NodeMsgType::consensus_msg &&
-            serialized::peek<raft::RaftMsgType>(data, size) ==
+            serialized::read<ccf::NodeMsgType>(p, psize) !=
+              ccf::NodeMsgType::consensus_msg ||
+            serialized::peek<raft::RaftMsgType>(p, psize) !=
               raft::raft_append_entries)
           {
-            // Parse the indices to be sent to the recipient.
-            auto p = data;
-            auto psize = size;
-            const auto& ae = serialized::overlay<raft::AppendEntries>(p, psize);
-
-            // Find the total frame size, and write it along with the header.
-            auto count = ae.idx - ae.prev_idx;
-            uint32_t frame = (uint32_t)(
-              size_to_send +
-              ledger.framed_entries_size(ae.prev_idx + 1, ae.idx));
-
-            LOG_DEBUG_FMT(
-              "raft send AE to {} [{}]: {}, {}",
-              to,
-              frame,
-              ae.idx,
-              ae.prev_idx);
-
-            // TODO(#performance): writev
-            node.value()->write(sizeof(uint32_t), (uint8_t*)&frame);
-            node.value()->write(size_to_send, data_to_send);
-
-            auto framed_entries =
-              ledger.read_framed_entries(ae.prev_idx + 1, ae.idx);
-            frame = (uint32_t)framed_entries.size();
-            node.value()->write(frame, framed_entries.data());
+            send(to, std::move(msg), {});
+            return;
           }
-          else
-          {
-            // Write as framed data to the recipient.
-            uint32_t frame = (uint32_t)size_to_send;
-
-            LOG_DEBUG_FMT("node send to {} [{}]", to, frame);
 
-            node.value()->write(sizeof(uint32_t), (uint8_t*)&frame);
-            node.value()->write(size_to_send, data_to_send);
-          }
+          // Parse the indices to be sent to the recipient.
+          const auto& ae = serialized::overlay<raft::AppendEntries>(p, psize);
+
+          LOG_DEBUG_FMT("raft send AE to {}: {}, {}", to, ae.idx, ae.prev_idx);
+
+          // Raft append entries messages go through the ledger worker, which
+          // reads the corresponding ledger entries after the ones written
+          // before them, and affixes them to the message. Other messages are
+          // sent directly above, so that they are not held up behind ledger
+          // writes: raft does not rely on their order relative to append
+          // entries.
+          ledger_worker.post([this,
+                              to,
+                              from = ae.prev_idx + 1,
+                              last = ae.idx,
+                              msg = std::move(msg)](Ledger& ledger) mutable {
+            auto framed_entries = ledger.view_framed_entries(from, last);
+
+            ledger_worker.post_completion(
+              [this,
+               to,
+               msg = std::move(msg),
+               framed_entries = std::move(framed_entries)]() mutable {
+                send(to, std::move(msg), std::move(framed_entries));
+              });
+          });
         });
     }
 
   private:
+    struct Outbound
+    {
+      uint32_t frame;
+      std::vector<uint8_t> msg;
+      LedgerView framed_entries;
+    };
+
+    void send(
+      ccf::NodeId to, std::vector<uint8_t>&& msg, LedgerView&& framed_entries)
+    {
+      auto node = find(to, true);
+
+      if (!node)
+        return;
+
+      // Write as framed data to the recipient, followed by the ledger
+      // entries if there are any, in a single write. The entries are not
+      // copied: the write keeps the view alive until it has completed.
+      auto out = std::make_shared<Outbound>(
+        Outbound{0, std::move(msg), std::move(framed_entries)});
+
+      std::vector<std::pair<const uint8_t*, size_t>> buffers = {
+        {(const uint8_t*)&out->frame, sizeof(out->frame)},
+        {out->msg.data(), out->msg.size()}};
+
+      size_t size = out->msg.size();
+      for (auto& segment : out->framed_entries)
+      {
+        buffers.emplace_back(segment.data, segment.size);
+        size += segment.size;
+      }
+
+      out->frame = (uint32_t)size;
+
+      LOG_DEBUG_FMT("node send to {} [{}]", to, out->frame);
+
+      node.value()->writev(buffers, out);
+    }
+
     bool add_node(
       ccf::NodeId node, const std::string& host, const std::string& service)
     {
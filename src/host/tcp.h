@@ -6,6 +6,9 @@
 #include "dns.h"
 #include "proxy.h"
 
+#include <memory>
+#include <vector>
+
 namespace asynchost
 {
   class TCPImpl;
@@ -48,14 +51,21 @@ namespace asynchost
       RECONNECTING
     };
 
+    // Buffers of a write, which must remain valid until it has completed.
+    // The owner keeps them alive.
+    struct WriteBuffers
+    {
+      std::vector<uv_buf_t> bufs;
+      std::shared_ptr<const void> owner;
+    };
+
     struct PendingWrite
     {
       uv_write_t* req;
-      size_t len;
 
-      PendingWrite(uv_write_t* req, size_t len) : req(req), len(len) {}
+      PendingWrite(uv_write_t* req) : req(req) {}
 
-      PendingWrite(PendingWrite&& that) : req(that.req), len(that.len)
+      PendingWrite(PendingWrite&& that) : req(that.req)
       {
         that.req = nullptr;
       }
@@ -142,11 +152,38 @@ namespace asynchost
 
     bool write(size_t len, const uint8_t* data)
     {
-      auto req = new uv_write_t;
-      char* copy = new char[len];
+      auto copy = std::make_shared<std::vector<uint8_t>>(len);
       if (data)
-        memcpy(copy, data, len);
-      req->data = copy;
+        memcpy(copy->data(), data, len);
+
+      return writev({{copy->data(), len}}, copy);
+    }
+
+    /**
+     * Write several buffers at once, without copying them.
+     *
+     * @param buffers Data and size of each buffer, written in order
+     * @param owner Keeps the buffers alive until the write has completed
+     *
+     * @return false if the write failed and the connection was closed
+     */
+    bool writev(
+      const std::vector<std::pair<const uint8_t*, size_t>>& buffers,
+      std::shared_ptr<const void> owner)
+    {
+      auto wb = new WriteBuffers;
+      wb->owner = std::move(owner);
+      wb->bufs.reserve(buffers.size());
+
+      size_t len = 0;
+      for (auto& [data, size] : buffers)
+      {
+        wb->bufs.push_back(uv_buf_init((char*)data, (unsigned int)size));
+        len += size;
+      }
+
+      auto req = new uv_write_t;
+      req->data = wb;
 
       switch (status)
       {
@@ -155,16 +192,17 @@ namespace asynchost
         case RESOLVING_FAILED:
         case CONNECTING_FAILED:
         {
-          pending_writes.emplace_back(req, len);
+          pending_writes.emplace_back(req);
           break;
         }
 
         case CONNECTED:
-          return send_write(req, len);
+          return send_write(req);
 
         case DISCONNECTED:
         {
           LOG_DEBUG_FMT("Disconnected: Ignoring write of size {}", len);
+          free_write(req);
           break;
         }
 
@@ -200,17 +238,19 @@ namespace asynchost
       return true;
     }
 
-    bool send_write(uv_write_t* req, size_t len)
+    bool send_write(uv_write_t* req)
     {
-      char* copy = (char*)req->data;
-
-      uv_buf_t buf;
-      buf.base = copy;
-      buf.len = len;
+      auto wb = (WriteBuffers*)req->data;
 
       int rc;
 
-      if ((rc = uv_write(req, (uv_stream_t*)&uv_handle, &buf, 1, on_write)) < 0)
+      if (
+        (rc = uv_write(
+           req,
+           (uv_stream_t*)&uv_handle,
+           wb->bufs.data(),
+           (unsigned int)wb->bufs.size(),
+           on_write)) < 0)
       {
         free_write(req);
         LOG_FAIL_FMT("uv_write failed: {}", uv_strerror(rc));
@@ -429,7 +469,7 @@ namespace asynchost
 
         for (auto& w : pending_writes)
         {
-          send_write(w.req, w.len);
+          send_write(w.req);
           w.req = nullptr;
         }
 
@@ -515,8 +555,7 @@ namespace asynchost
       if (req == nullptr)
         return;
 
-      char* copy = (char*)req->data;
-      delete[] copy;
+      delete (WriteBuffers*)req->data;
       delete req;
     }
 
@@ -2,9 +2,13 @@
 // Licensed under the Apache 2.0 License.
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "../ledger.h"
+#include "../ledgerworker.h"
 
+#include <atomic>
 #include <doctest/doctest.h>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
 
 TEST_CASE("Read/Write test")
 {
@@ -58,4 +62,642 @@ TEST_CASE("Entry sizes")
     for (auto c : e)
       std::cout << std::hex << (int)c;
     std::cout << std::endl;*/
-}
\ No newline at end of file
+}
+TEST_CASE("Snapshot")
+{
+  ringbuffer::Circuit eio(2);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_snapshot";
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+  std::remove((filename + ".snapshot").c_str());
+
+  const std::vector<uint8_t> e1 = {1, 2, 3};
+  const std::vector<uint8_t> e2 = {5, 5, 6, 7};
+  const std::vector<uint8_t> snapshot_chunk1 = {9, 9};
+  const std::vector<uint8_t> snapshot_chunk2 = {8};
+
+  {
+    asynchost::Ledger l(filename, wf);
+    l.write_entry(e1.data(), e1.size());
+    l.write_entry(e2.data(), e2.size());
+    REQUIRE(l.read_snapshot().empty());
+
+    INFO("Snapshot is only applied once committed");
+    l.write_snapshot_chunk(5, 0, snapshot_chunk1);
+    l.write_snapshot_chunk(5, snapshot_chunk1.size(), snapshot_chunk2);
+    REQUIRE_THROWS_AS(l.write_snapshot_chunk(6, 3, e1), std::logic_error);
+    REQUIRE(l.get_last_idx() == 2);
+    REQUIRE(l.read_snapshot().empty());
+
+    l.commit_snapshot(5);
+    REQUIRE(l.get_snapshot_idx() == 5);
+    REQUIRE(l.get_last_idx() == 5);
+    REQUIRE(l.read_snapshot() == std::vector<uint8_t>({9, 9, 8}));
+
+    INFO("Entries from before the snapshot are kept");
+    REQUIRE(l.read_entry(1) == e1);
+    REQUIRE(l.read_entry(2) == e2);
+    REQUIRE(
+      l.framed_entries_size(1, 2) ==
+      (e1.size() + sizeof(uint32_t) + e2.size() + sizeof(uint32_t)));
+    REQUIRE(l.read_entry(3).empty());
+    REQUIRE(l.read_entry(5).empty());
+    REQUIRE(l.framed_entries_size(1, 5) == 0);
+    REQUIRE(l.framed_entries_size(2, 6) == 0);
+
+    l.write_entry(e1.data(), e1.size());
+    l.write_entry(e2.data(), e2.size());
+    REQUIRE(l.get_last_idx() == 7);
+    REQUIRE(l.read_entry(6) == e1);
+    REQUIRE(l.entry_size(7) == e2.size());
+    REQUIRE(
+      l.read_framed_entries(6, 7).size() ==
+      (e1.size() + sizeof(uint32_t) + e2.size() + sizeof(uint32_t)));
+
+    l.truncate(6);
+    REQUIRE(l.get_last_idx() == 6);
+    l.truncate(3);
+    REQUIRE(l.get_last_idx() == 5);
+    l.write_entry(e2.data(), e2.size());
+
+    INFO("A later snapshot replaces the entries following the first one");
+    l.write_snapshot_chunk(8, 0, snapshot_chunk2);
+    l.commit_snapshot(8);
+    REQUIRE(l.get_last_idx() == 8);
+    REQUIRE(l.read_snapshot() == snapshot_chunk2);
+    REQUIRE(l.read_entry(2) == e2);
+    REQUIRE(l.read_entry(6).empty());
+    l.write_entry(e1.data(), e1.size());
+    REQUIRE(l.read_entry(9) == e1);
+  }
+
+  INFO("The ledger is re-opened from the snapshot and the entries after it");
+  {
+    asynchost::Ledger l(filename, wf);
+    REQUIRE(l.get_snapshot_idx() == 8);
+    REQUIRE(l.get_last_idx() == 9);
+    REQUIRE(l.read_snapshot() == snapshot_chunk2);
+    REQUIRE(l.read_entry(2) == e2);
+    REQUIRE(l.read_entry(8).empty());
+    REQUIRE(l.read_entry(9) == e1);
+
+    INFO("Entries up to the snapshot index cannot be truncated");
+    l.truncate(7);
+    REQUIRE(l.get_last_idx() == 8);
+    l.write_entry(e2.data(), e2.size());
+  }
+
+  INFO("Ledger files that do not follow the snapshot are left as they are");
+  {
+    auto entries_filename = filename + ".snapshot.entries";
+    REQUIRE(
+      std::rename(
+        entries_filename.c_str(), (entries_filename + ".10-10").c_str()) ==
+      0);
+    REQUIRE_THROWS_AS(asynchost::Ledger(filename, wf), std::logic_error);
+    REQUIRE(
+      std::rename(
+        (entries_filename + ".10-10").c_str(), entries_filename.c_str()) ==
+      0);
+
+    asynchost::Ledger l(filename, wf);
+    REQUIRE(l.get_last_idx() == 9);
+    REQUIRE(l.read_entry(9) == e2);
+  }
+
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+  std::remove((filename + ".snapshot").c_str());
+  std::remove((filename + ".snapshot.entries").c_str());
+  std::remove((filename + ".snapshot.entries.idx").c_str());
+}
+
+TEST_CASE("Ledger index")
+{
+  ringbuffer::Circuit eio(2);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_index";
+  const std::string index_filename = filename + ".idx";
+  std::remove(filename.c_str());
+  std::remove(index_filename.c_str());
+
+  const size_t entries_per_checkpoint = 4;
+  std::vector<std::vector<uint8_t>> entries;
+  for (uint8_t i = 1; i <= 10; ++i)
+    entries.emplace_back(i, i);
+
+  auto check_entries = [&](asynchost::Ledger& l, size_t count) {
+    REQUIRE(l.get_last_idx() == count);
+    for (size_t i = 1; i <= count; ++i)
+      REQUIRE(l.read_entry(i) == entries.at(i - 1));
+  };
+
+  {
+    asynchost::Ledger l(filename, wf, 0, entries_per_checkpoint);
+    for (auto& e : entries)
+      l.write_entry(e.data(), e.size());
+  }
+
+  INFO("Only checkpointed positions are loaded from the index");
+  {
+    asynchost::LedgerIndex index(index_filename, entries_per_checkpoint);
+    auto positions = index.load(1024);
+    REQUIRE(positions.size() == 8);
+    REQUIRE(positions.at(0) == 0);
+    REQUIRE(positions.at(1) == sizeof(uint32_t) + entries.at(0).size());
+  }
+
+  INFO("Entries that are not indexed are scanned on open");
+  {
+    asynchost::Ledger l(filename, wf, 0, entries_per_checkpoint);
+    check_entries(l, 10);
+
+    l.truncate(6);
+    l.write_entry(entries.at(6).data(), entries.at(6).size());
+  }
+
+  {
+    asynchost::Ledger l(filename, wf, 0, entries_per_checkpoint);
+    check_entries(l, 7);
+    l.write_entry(entries.at(7).data(), entries.at(7).size());
+  }
+
+  INFO("A corrupted index is ignored");
+  {
+    FILE* f = fopen(index_filename.c_str(), "r+b");
+    REQUIRE(f != nullptr);
+    fseeko(f, 3, SEEK_SET);
+    uint8_t garbage = 0xff;
+    REQUIRE(fwrite(&garbage, 1, 1, f) == 1);
+    fclose(f);
+
+    asynchost::Ledger l(filename, wf, 0, entries_per_checkpoint);
+    check_entries(l, 8);
+  }
+
+  INFO("An index that does not match the ledger is ignored");
+  {
+    std::remove(filename.c_str());
+    {
+      asynchost::Ledger l(filename, wf, 0, entries_per_checkpoint);
+      REQUIRE(l.get_last_idx() == 0);
+      l.write_entry(entries.at(0).data(), entries.at(0).size());
+    }
+
+    asynchost::Ledger l(filename, wf, 0, entries_per_checkpoint);
+    check_entries(l, 1);
+  }
+
+  std::remove(filename.c_str());
+  std::remove(index_filename.c_str());
+}
+
+TEST_CASE("Ledger chunks")
+{
+  ringbuffer::Circuit eio(2);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_chunks";
+  auto remove_files = [&]() {
+    for (auto f : {filename,
+                   filename + ".1-3",
+                   filename + ".1-3.committed",
+                   filename + ".4-6",
+                   filename + ".4-6.committed",
+                   filename + ".7-9"})
+    {
+      chmod(f.c_str(), S_IRUSR | S_IWUSR);
+      std::remove(f.c_str());
+      std::remove((f + ".idx").c_str());
+    }
+  };
+  remove_files();
+
+  // Each chunk holds 3 entries
+  const size_t entry_size = 10;
+  const size_t chunk_size = 3 * (entry_size + sizeof(uint32_t));
+  std::vector<std::vector<uint8_t>> entries;
+  for (uint8_t i = 1; i <= 8; ++i)
+    entries.emplace_back(entry_size, i);
+
+  auto check_entries = [&](asynchost::Ledger& l, size_t count) {
+    REQUIRE(l.get_last_idx() == count);
+    for (size_t i = 1; i <= count; ++i)
+      REQUIRE(l.read_entry(i) == entries.at(i - 1));
+  };
+
+  auto exists = [](const std::string& f) {
+    return access(f.c_str(), F_OK) == 0;
+  };
+  auto writable = [](const std::string& f) {
+    struct stat st;
+    REQUIRE(stat(f.c_str(), &st) == 0);
+    return (st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) != 0;
+  };
+
+  {
+    asynchost::Ledger l(filename, wf, chunk_size);
+    for (auto& e : entries)
+      l.write_entry(e.data(), e.size());
+
+    REQUIRE(l.get_chunk_count() == 2);
+    REQUIRE(exists(filename + ".1-3"));
+    REQUIRE(exists(filename + ".4-6"));
+    check_entries(l, 8);
+
+    INFO("Entries can be read across chunks");
+    REQUIRE(
+      l.read_framed_entries(2, 8).size() ==
+      7 * (entry_size + sizeof(uint32_t)));
+    REQUIRE(l.framed_entries_size(3, 4) == 2 * (entry_size + sizeof(uint32_t)));
+
+    INFO("Committed chunks are read-only");
+    l.commit(5);
+    REQUIRE(exists(filename + ".1-3.committed"));
+    REQUIRE(!writable(filename + ".1-3.committed"));
+    REQUIRE(writable(filename + ".4-6"));
+    REQUIRE_THROWS_AS(l.truncate(2), std::logic_error);
+
+    INFO("Truncating removes chunks");
+    l.truncate(5);
+    REQUIRE(l.get_chunk_count() == 1);
+    REQUIRE(!exists(filename + ".4-6"));
+    check_entries(l, 5);
+
+    l.write_entry(entries.at(5).data(), entries.at(5).size());
+    REQUIRE(l.get_chunk_count() == 2);
+    REQUIRE(exists(filename + ".4-6"));
+    l.write_entry(entries.at(6).data(), entries.at(6).size());
+  }
+
+  INFO("Chunks are found when the ledger is re-opened");
+  {
+    asynchost::Ledger l(filename, wf, chunk_size);
+    REQUIRE(l.get_chunk_count() == 2);
+    check_entries(l, 7);
+
+    l.commit(7);
+    REQUIRE(exists(filename + ".4-6.committed"));
+    REQUIRE_THROWS_AS(l.truncate(6), std::logic_error);
+
+    INFO("Entries in committed chunks are viewed without being copied");
+    auto view = l.view_framed_entries(2, 7);
+    REQUIRE(view.size() == 3);
+
+    std::vector<uint8_t> viewed;
+    for (auto& segment : view)
+      viewed.insert(viewed.end(), segment.data, segment.data + segment.size);
+    REQUIRE(viewed == l.read_framed_entries(2, 7));
+
+    auto first = l.view_framed_entries(1, 1);
+    REQUIRE(first.size() == 1);
+    REQUIRE(first.at(0).owner == view.at(0).owner);
+    REQUIRE(
+      first.at(0).data + entry_size + sizeof(uint32_t) == view.at(0).data);
+  }
+
+  remove_files();
+}
+
+TEST_CASE("Durability")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_durability";
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+
+  const std::vector<uint8_t> e1 = {1, 2, 3};
+  const size_t framed_size = e1.size() + sizeof(uint32_t);
+
+  std::vector<consensus::Index> reported;
+  size_t reported_epoch = 0;
+  auto read_reported = [&]() {
+    eio.read_from_outside().read(
+      -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+        REQUIRE(m == consensus::ledger_durable);
+        auto [idx, epoch] =
+          ringbuffer::read_message<consensus::ledger_durable>(data, size);
+        reported.push_back(idx);
+        reported_epoch = epoch;
+      });
+  };
+
+  {
+    asynchost::Ledger l(filename, wf);
+
+    INFO("Nothing is synced or reported without durability");
+    l.write_entry(e1.data(), e1.size());
+    l.sync();
+    read_reported();
+    REQUIRE(reported.empty());
+    REQUIRE(l.get_durable_idx() == 0);
+
+    INFO("Entries written since the last sync are synced together");
+    l.set_durability(asynchost::LedgerDurability::batch);
+    l.write_entry(e1.data(), e1.size());
+    l.write_entry(e1.data(), e1.size());
+    l.sync();
+    l.sync();
+    read_reported();
+    REQUIRE(reported == std::vector<consensus::Index>({3}));
+    REQUIRE(l.get_durable_idx() == 3);
+    REQUIRE(reported_epoch == 0);
+
+    INFO("Reports carry the epoch of the last truncation");
+    l.truncate(2);
+    l.set_epoch(1);
+    REQUIRE(l.get_durable_idx() == 2);
+    l.write_entry(e1.data(), e1.size());
+    l.sync();
+    read_reported();
+    REQUIRE(reported == std::vector<consensus::Index>({3, 3}));
+    REQUIRE(reported_epoch == 1);
+
+    INFO("Entries are synced once enough bytes have been written");
+    REQUIRE_THROWS_AS(
+      l.set_durability(asynchost::LedgerDurability::interval),
+      std::logic_error);
+    l.set_durability(
+      asynchost::LedgerDurability::interval,
+      std::chrono::milliseconds(0),
+      2 * framed_size);
+    l.write_entry(e1.data(), e1.size());
+    l.sync();
+    REQUIRE(l.get_durable_idx() == 3);
+    l.write_entry(e1.data(), e1.size());
+    l.sync();
+    REQUIRE(l.get_durable_idx() == 5);
+
+    INFO("Entries are synced once enough time has elapsed");
+    l.set_durability(
+      asynchost::LedgerDurability::interval, std::chrono::milliseconds(10));
+    l.write_entry(e1.data(), e1.size());
+    l.sync();
+    REQUIRE(l.get_durable_idx() == 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    l.sync();
+    REQUIRE(l.get_durable_idx() == 6);
+    read_reported();
+    REQUIRE(reported == std::vector<consensus::Index>({3, 3, 5, 6}));
+  }
+
+  INFO("Existing entries are durable when the ledger is re-opened");
+  {
+    asynchost::Ledger l(filename, wf);
+    REQUIRE(l.get_durable_idx() == 6);
+  }
+
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+}
+
+TEST_CASE("Ledger worker")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_worker";
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+
+  const size_t entry_count = 100;
+  std::vector<size_t> read_sizes;
+
+  {
+    asynchost::Ledger l(filename, wf);
+
+    {
+      asynchost::LedgerWorker w(l, 1);
+
+      INFO("Jobs are queued without blocking, even once the worker is full");
+      std::atomic<bool> blocked = true;
+      w.post([&blocked](asynchost::Ledger&) {
+        while (blocked)
+          std::this_thread::yield();
+      });
+      w.post([](asynchost::Ledger&) {});
+      w.post([](asynchost::Ledger&) {});
+      REQUIRE(w.is_full());
+      blocked = false;
+
+      for (size_t i = 1; i <= entry_count; ++i)
+      {
+        // As the loop does, wait for the worker to catch up before posting
+        while (w.is_full())
+          std::this_thread::yield();
+
+        w.post([i](asynchost::Ledger& ledger) {
+          std::vector<uint8_t> entry(i, (uint8_t)i);
+          ledger.write_entry(entry.data(), entry.size());
+        });
+
+        // Jobs run in order, after the entries posted before them are written
+        w.post([&w, &read_sizes, i](asynchost::Ledger& ledger) {
+          auto size = ledger.entry_size(i);
+          w.post_completion([&read_sizes, size]() {
+            read_sizes.push_back(size);
+          });
+        });
+      }
+
+      while (read_sizes.size() < entry_count)
+        w.run_completions();
+
+      INFO("Exceptions thrown by jobs are rethrown by run_completions()");
+      std::atomic<bool> thrown = false;
+      w.post([](asynchost::Ledger& ledger) { ledger.commit_snapshot(1); });
+      w.post([&thrown](asynchost::Ledger&) { thrown = true; });
+      while (!thrown)
+        std::this_thread::yield();
+      REQUIRE_THROWS_AS(w.run_completions(), std::logic_error);
+      REQUIRE(w.run_completions() == 0);
+
+      w.post(
+        [](asynchost::Ledger& ledger) { ledger.truncate(entry_count / 2); });
+    }
+
+    INFO("Jobs posted before the worker is destroyed are run");
+    REQUIRE(l.get_last_idx() == entry_count / 2);
+  }
+
+  for (size_t i = 1; i <= entry_count; ++i)
+    REQUIRE(read_sizes[i - 1] == i);
+
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+}
+
+TEST_CASE("Recent entry cache")
+{
+  ringbuffer::Circuit eio(2);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_cache";
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+
+  const size_t entry_size = 10;
+  const size_t framed_size = entry_size + sizeof(uint32_t);
+
+  asynchost::Ledger l(filename, wf);
+  l.set_max_cache_bytes(3 * framed_size);
+
+  for (uint8_t i = 1; i <= 5; ++i)
+  {
+    std::vector<uint8_t> entry(entry_size, i);
+    l.write_entry(entry.data(), entry.size());
+  }
+  REQUIRE(l.get_cache_bytes() == 3 * framed_size);
+
+  INFO("Cached entries are shared rather than read from the file");
+  auto view = l.view_framed_entries(2, 5);
+  REQUIRE(view.size() == 4);
+  auto again = l.view_framed_entries(3, 5);
+  REQUIRE(view.at(0).owner != again.at(0).owner);
+  REQUIRE(view.at(1).owner == again.at(0).owner);
+  REQUIRE(view.at(3).owner == again.at(2).owner);
+  REQUIRE(l.read_framed_entries(1, 5).size() == 5 * framed_size);
+  REQUIRE(l.read_entry(5) == std::vector<uint8_t>(entry_size, 5));
+
+  INFO("Truncated entries are dropped from the cache");
+  l.truncate(3);
+  REQUIRE(l.get_cache_bytes() == framed_size);
+  std::vector<uint8_t> replacement(entry_size, 42);
+  l.write_entry(replacement.data(), replacement.size());
+  REQUIRE(l.read_entry(4) == replacement);
+  REQUIRE(l.view_framed_entries(4, 4).at(0).data[sizeof(uint32_t)] == 42);
+  REQUIRE(l.read_entry(3) == std::vector<uint8_t>(entry_size, 3));
+
+  INFO("The cache can be disabled");
+  l.set_max_cache_bytes(0);
+  REQUIRE(l.get_cache_bytes() == 0);
+  REQUIRE(l.read_entry(4) == replacement);
+
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+}
+
+TEST_CASE("Range reads")
+{
+  ringbuffer::Circuit eio(1024);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_range";
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+
+  std::vector<std::pair<consensus::Index, std::vector<uint8_t>>> sent;
+  std::optional<consensus::Index> end;
+  auto read_sent = [&]() {
+    eio.read_from_outside().read(
+      -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+        if (m == consensus::ledger_entry)
+        {
+          auto [idx, entry] =
+            ringbuffer::read_message<consensus::ledger_entry>(data, size);
+          sent.emplace_back(idx, entry);
+        }
+        else
+        {
+          REQUIRE(m == consensus::ledger_no_entry);
+          auto [idx] =
+            ringbuffer::read_message<consensus::ledger_no_entry>(data, size);
+          end = idx;
+        }
+      });
+  };
+
+  asynchost::Ledger l(filename, wf);
+  for (uint8_t i = 1; i <= 5; ++i)
+  {
+    std::vector<uint8_t> entry(i, i);
+    l.write_entry(entry.data(), entry.size());
+  }
+
+  INFO("Entries in the range are sent in order");
+  l.send_entries(2, 4);
+  read_sent();
+  REQUIRE(sent.size() == 3);
+  for (size_t i = 0; i < sent.size(); ++i)
+  {
+    REQUIRE(sent[i].first == i + 2);
+    REQUIRE(sent[i].second == std::vector<uint8_t>(i + 2, i + 2));
+  }
+  REQUIRE(!end.has_value());
+
+  INFO("The end of the ledger is reported once reached");
+  sent.clear();
+  l.send_entries(5, 10);
+  read_sent();
+  REQUIRE(sent.size() == 1);
+  REQUIRE(sent[0].first == 5);
+  REQUIRE(end == 6);
+
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+}
+
+TEST_CASE("Snapshot reads")
+{
+  ringbuffer::Circuit eio(1 << 22);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::string filename = "testlog_snapshot_reads";
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+  std::remove((filename + ".snapshot").c_str());
+
+  std::vector<uint8_t> sent;
+  std::optional<consensus::Index> end;
+  auto read_sent = [&]() {
+    eio.read_from_outside().read(
+      -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+        if (m == consensus::ledger_snapshot_part)
+        {
+          auto [offset, part] =
+            ringbuffer::read_message<consensus::ledger_snapshot_part>(
+              data, size);
+          REQUIRE(offset == sent.size());
+          sent.insert(sent.end(), part.begin(), part.end());
+        }
+        else
+        {
+          REQUIRE(m == consensus::ledger_snapshot_end);
+          auto [idx] =
+            ringbuffer::read_message<consensus::ledger_snapshot_end>(
+              data, size);
+          end = idx;
+        }
+      });
+  };
+
+  asynchost::Ledger l(filename, wf);
+
+  INFO("Only the end is sent if the ledger does not start from a snapshot");
+  l.send_snapshot();
+  read_sent();
+  REQUIRE(sent.empty());
+  REQUIRE(end == 0);
+
+  INFO("The snapshot is sent in parts, followed by its index");
+  std::vector<uint8_t> snapshot(asynchost::Ledger::snapshot_chunk_size + 3);
+  for (size_t i = 0; i < snapshot.size(); ++i)
+    snapshot[i] = static_cast<uint8_t>(i);
+  l.write_snapshot_chunk(4, 0, snapshot);
+  l.commit_snapshot(4);
+  l.send_snapshot();
+  read_sent();
+  REQUIRE(sent == snapshot);
+  REQUIRE(end == 4);
+
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+  std::remove((filename + ".snapshot").c_str());
+  std::remove((filename + ".snapshot.entries").c_str());
+  std::remove((filename + ".snapshot.entries.idx").c_str());
+}
@@ -0,0 +1,196 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "kvtypes.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace kv
+{
+  // Decrypts serialised transactions on worker threads, ahead of them being
+  // applied by the thread that owns the store. Only decryption is done by the
+  // workers: transactions are still parsed when they are applied, in order.
+  // Transactions are returned in the order they were pushed, whichever worker
+  // decrypted them. Threads cannot be started from inside the enclave, so
+  // the pipeline posts its jobs to a pool of workers provided by the caller,
+  // each running the jobs posted to it one at a time. Encryptors cannot be
+  // used concurrently, so each worker is given its own. With no workers, each
+  // transaction is decrypted when it is popped.
+  template <typename StoreType>
+  class DeserialisePipeline
+  {
+  public:
+    using Deserialiser = typename StoreType::Deserialiser;
+    using MakeEncryptor = std::function<std::shared_ptr<AbstractTxEncryptor>()>;
+    using Job = std::function<void()>;
+    // Runs a job on the given worker, after the jobs already posted to it
+    using Post = std::function<void(size_t worker, Job job)>;
+
+    struct Entry
+    {
+      Version idx;
+      std::vector<uint8_t> data;
+      // nullptr if the transaction could not be decrypted
+      std::unique_ptr<Deserialiser> d;
+      bool prepared = false;
+    };
+
+  private:
+    // Shared with the jobs, which may still be queued or running once the
+    // pipeline is destroyed
+    struct Queue
+    {
+      std::mutex lock;
+      std::condition_variable prepared;
+      std::deque<Entry> entries;
+      // Number of entries, from the front, that have been picked up by a job
+      size_t claimed = 0;
+      bool stopping = false;
+    };
+
+    const bool public_only;
+    std::shared_ptr<Queue> queue;
+    Post post;
+    std::vector<std::shared_ptr<AbstractTxEncryptor>> encryptors;
+    size_t next_worker = 0;
+
+    static void prepare_next(
+      Queue& q, std::shared_ptr<AbstractTxEncryptor> e, bool public_only)
+    {
+      std::unique_lock<std::mutex> guard(q.lock);
+
+      // Each job prepares one entry, so there is always one left to claim
+      // unless the pipeline has been destroyed
+      if (q.stopping || q.claimed >= q.entries.size())
+        return;
+
+      // Entries are only popped once prepared, so this reference remains
+      // valid while the lock is released
+      auto& entry = q.entries[q.claimed++];
+
+      guard.unlock();
+      auto d = StoreType::prepare_deserialise(entry.data, e, public_only);
+      guard.lock();
+
+      entry.d = std::move(d);
+      entry.prepared = true;
+      q.prepared.notify_all();
+    }
+
+  public:
+    /**
+     * @param make_encryptor Creates the encryptor of each worker
+     * @param num_workers Number of workers jobs are posted to
+     * @param post Posts a job to one of the workers, required if there are
+     * any and ignored otherwise
+     * @param public_only Whether to only decrypt the public domain
+     */
+    DeserialisePipeline(
+      MakeEncryptor make_encryptor,
+      size_t num_workers,
+      Post post = nullptr,
+      bool public_only = false) :
+      public_only(public_only),
+      queue(std::make_shared<Queue>()),
+      post(num_workers > 0 ? post : nullptr)
+    {
+      if (num_workers > 0 && post == nullptr)
+        throw std::logic_error(
+          "Deserialise pipeline needs a way to post jobs to its workers");
+
+      for (size_t i = 0; i < std::max<size_t>(num_workers, 1); ++i)
+        encryptors.push_back(make_encryptor());
+    }
+
+    DeserialisePipeline(const DeserialisePipeline& that) = delete;
+
+    ~DeserialisePipeline()
+    {
+      // Entries that have not been popped are discarded, and jobs that have
+      // not started return immediately
+      std::lock_guard<std::mutex> guard(queue->lock);
+      queue->stopping = true;
+    }
+
+    /**
+     * Queue a serialised transaction to be decrypted.
+     *
+     * @param idx Index of the transaction, returned with it
+     * @param data Serialised transaction
+     */
+    void push(Version idx, std::vector<uint8_t>&& data)
+    {
+      {
+        std::lock_guard<std::mutex> guard(queue->lock);
+        queue->entries.push_back({idx, std::move(data), nullptr, false});
+      }
+
+      if (post == nullptr)
+        return;
+
+      auto worker = next_worker++ % encryptors.size();
+      post(
+        worker,
+        [q = queue, e = encryptors[worker], public_only = public_only]() {
+          prepare_next(*q, e, public_only);
+        });
+    }
+
+    /**
+     * Take the oldest transaction, once it has been decrypted.
+     *
+     * @param wait Whether to wait for a worker to decrypt the transaction,
+     * rather than return immediately
+     *
+     * @return The oldest transaction, or nothing if there are none or if it
+     * is still being decrypted and wait is false
+     */
+    std::optional<Entry> pop(bool wait)
+    {
+      std::unique_lock<std::mutex> guard(queue->lock);
+
+      if (queue->entries.empty())
+        return {};
+
+      auto& front = queue->entries.front();
+      if (post == nullptr)
+      {
+        front.d = StoreType::prepare_deserialise(
+          front.data, encryptors.front(), public_only);
+        front.prepared = true;
+      }
+      else if (wait)
+      {
+        queue->prepared.wait(guard, [&front]() { return front.prepared; });
+      }
+      else if (!front.prepared)
+      {
+        return {};
+      }
+
+      // Moving the data does not move its buffer, which the deserialiser
+      // points to
+      Entry e = std::move(front);
+      queue->entries.pop_front();
+      if (queue->claimed > 0)
+        --queue->claimed;
+
+      return e;
+    }
+
+    size_t size()
+    {
+      std::lock_guard<std::mutex> guard(queue->lock);
+      return queue->entries.size();
+    }
+  };
+}
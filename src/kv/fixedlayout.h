@@ -0,0 +1,148 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <msgpack-c/msgpack.hpp>
+#include <type_traits>
+
+namespace kv
+{
+  // Keys and values of types that opt in, with DECLARE_FIXED_LAYOUT_TYPE, are
+  // serialised as their bytes in memory, rather than member by member. They
+  // are written as msgpack binaries, so that the ledger can still be parsed,
+  // but the KV serialiser reads and writes them without msgpack.
+  //
+  // The layout of such a type is part of the ledger format, so it can only be
+  // used for trivially copyable types without padding.
+  template <typename T>
+  struct is_fixed_layout : std::false_type
+  {};
+
+  namespace fixed_layout
+  {
+    static_assert(
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+      "Fixed layout types are serialised as little-endian");
+
+    // msgpack header of a binary of size bytes
+    template <size_t size>
+    constexpr auto header()
+    {
+      if constexpr (size <= std::numeric_limits<uint8_t>::max())
+      {
+        return std::array<uint8_t, 2>{0xc4, static_cast<uint8_t>(size)};
+      }
+      else if constexpr (size <= std::numeric_limits<uint16_t>::max())
+      {
+        return std::array<uint8_t, 3>{0xc5,
+                                      static_cast<uint8_t>(size >> 8),
+                                      static_cast<uint8_t>(size)};
+      }
+      else
+      {
+        static_assert(size <= std::numeric_limits<uint32_t>::max());
+        return std::array<uint8_t, 5>{0xc6,
+                                      static_cast<uint8_t>(size >> 24),
+                                      static_cast<uint8_t>(size >> 16),
+                                      static_cast<uint8_t>(size >> 8),
+                                      static_cast<uint8_t>(size)};
+      }
+    }
+
+    template <typename T>
+    constexpr auto header_v = header<sizeof(T)>();
+
+    template <typename T>
+    void check()
+    {
+      static_assert(
+        std::is_trivially_copyable_v<T>,
+        "Fixed layout types must be trivially copyable");
+      // Padding bytes would otherwise be written to the ledger, so that equal
+      // values could be serialised differently
+      static_assert(
+        std::has_unique_object_representations_v<T>,
+        "Fixed layout types must not have padding");
+    }
+
+    template <typename Stream, typename T>
+    void write(Stream& s, const T& t)
+    {
+      check<T>();
+      constexpr auto& h = header_v<T>;
+      s.write(reinterpret_cast<const char*>(h.data()), h.size());
+      s.write(reinterpret_cast<const char*>(&t), sizeof(T));
+    }
+
+    /** Read a T from data, at offset, which is moved past it
+     *
+     * @return false if there is no T at offset
+     */
+    template <typename T>
+    bool read(const char* data, size_t size, size_t& offset, T& t)
+    {
+      check<T>();
+      constexpr auto& h = header_v<T>;
+      if (
+        size < offset || size - offset < h.size() + sizeof(T) ||
+        std::memcmp(data + offset, h.data(), h.size()) != 0)
+        return false;
+
+      std::memcpy(&t, data + offset + h.size(), sizeof(T));
+      offset += h.size() + sizeof(T);
+      return true;
+    }
+  }
+}
+
+#define DECLARE_FIXED_LAYOUT_TYPE(TYPE) \
+  namespace kv \
+  { \
+    template <> \
+    struct is_fixed_layout<TYPE> : std::true_type \
+    {}; \
+  }
+
+namespace msgpack
+{
+  MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+  {
+    namespace adaptor
+    {
+      // Fixed layout types nested in other types, or decoded from a
+      // kv::LazyValue, are converted through msgpack objects
+      template <typename T>
+      struct pack<T, std::enable_if_t<kv::is_fixed_layout<T>::value>>
+      {
+        template <typename Stream>
+        msgpack::packer<Stream>& operator()(
+          msgpack::packer<Stream>& o, const T& t) const
+        {
+          kv::fixed_layout::check<T>();
+          o.pack_bin(sizeof(T));
+          o.pack_bin_body(reinterpret_cast<const char*>(&t), sizeof(T));
+          return o;
+        }
+      };
+
+      template <typename T>
+      struct convert<T, std::enable_if_t<kv::is_fixed_layout<T>::value>>
+      {
+        const msgpack::object& operator()(const msgpack::object& o, T& t) const
+        {
+          kv::fixed_layout::check<T>();
+          if (o.type != msgpack::type::BIN || o.via.bin.size != sizeof(T))
+          {
+            throw msgpack::type_error();
+          }
+
+          std::memcpy(&t, o.via.bin.ptr, sizeof(T));
+          return o;
+        }
+      };
+    }
+  }
+}
@@ -4,6 +4,7 @@
 
 #include "ds/buffer.h"
 #include "kvtypes.h"
+#include "mapids.h"
 
 #include <optional>
 
@@ -20,8 +21,18 @@ namespace kv
     KOT_WRITE = (1 << 5),
     KOT_REMOVE_VERSION = (1 << 6),
     KOT_REMOVE = (1 << 7),
+    KOT_MAP_DEFINITION = (1 << 8),
   };
 
+  // Written at the start of the public domain. Formats are negative, so that
+  // they cannot be mistaken for the version that transactions started with
+  // before the format was written.
+  using SerialisationFormat = int8_t;
+  static constexpr SerialisationFormat serialisation_format = -2;
+  // Format of the transactions that start with their version, which refer to
+  // maps by name and write absolute versions. It is only read.
+  static constexpr SerialisationFormat legacy_serialisation_format = -1;
+
   typedef std::underlying_type<KvOperationType>::type KotBase;
 
   inline KvOperationType operator&(
@@ -76,6 +87,10 @@ namespace kv
     W private_writer;
     W* current_writer;
     Version version;
+    MapIds& map_ids;
+    // Snapshots record the names of all maps, as they are not read along
+    // with the rest of the ledger
+    bool snapshot;
 
     std::shared_ptr<AbstractTxEncryptor> crypto_util;
 
@@ -94,6 +109,25 @@ namespace kv
       public_writer.append(std::forward<T>(t));
     }
 
+    // Versions read by, or written before, this transaction are serialised
+    // as their distance to its version, which is small, or 0 for NoVersion
+    void serialise_version_delta(Version v)
+    {
+      if (v == NoVersion)
+      {
+        serialise_internal(static_cast<uint64_t>(0));
+        return;
+      }
+
+      if (v > version)
+      {
+        throw KvSerialiserException(fmt::format(
+          "Version {} cannot be serialised in transaction {}", v, version));
+      }
+
+      serialise_internal(static_cast<uint64_t>(version - v) + 1);
+    }
+
     void set_current_domain(SecurityDomain domain)
     {
       switch (domain)
@@ -113,10 +147,16 @@ namespace kv
 
   public:
     GenericSerialiseWrapper(
-      std::shared_ptr<AbstractTxEncryptor> e, const Version& version_) :
+      std::shared_ptr<AbstractTxEncryptor> e,
+      const Version& version_,
+      MapIds& map_ids,
+      bool snapshot = false) :
+      map_ids(map_ids),
+      snapshot(snapshot),
       crypto_util(e)
     {
       set_current_domain(SecurityDomain::PUBLIC);
+      serialise_internal(serialisation_format);
       serialise_internal(version_);
       version = version_;
     }
@@ -132,14 +172,26 @@ namespace kv
       if (domain != current_domain)
         set_current_domain(domain);
 
-      serialise_internal(KvOperationType::KOT_MAP_START_INDICATOR);
-      serialise_internal(name);
+      auto [id, record_name] = snapshot ?
+        std::make_pair(map_ids.snapshot_id(name), true) :
+        map_ids.intern(name, version);
+
+      if (record_name)
+      {
+        serialise_internal(KvOperationType::KOT_MAP_DEFINITION);
+        serialise_internal(id);
+        serialise_internal(name);
+      }
+      else
+      {
+        serialise_internal(KvOperationType::KOT_MAP_START_INDICATOR);
+        serialise_internal(id);
+      }
     }
 
-    template <class Version>
-    void serialise_read_version(const Version& version)
+    void serialise_read_version(const Version& read_version)
     {
-      serialise_internal(version);
+      serialise_version_delta(read_version);
     }
 
     void serialise_count_header(uint64_t ctr)
@@ -148,10 +200,10 @@ namespace kv
     }
 
     template <class K>
-    void serialise_read(const K& k, const Version& version)
+    void serialise_read(const K& k, const Version& read_version)
     {
       serialise_internal(k);
-      serialise_internal(version);
+      serialise_version_delta(read_version);
     }
 
     template <class K, class V>
@@ -161,13 +213,14 @@ namespace kv
       serialise_internal(v);
     }
 
-    template <class K, class V, class Version>
-    void serialise_write_version(const K& k, const V& v, const Version& version)
+    template <class K, class V>
+    void serialise_write_version(
+      const K& k, const V& v, const Version& write_version)
     {
       serialise_internal(KvOperationType::KOT_WRITE_VERSION);
       serialise_internal(k);
       serialise_internal(v);
-      serialise_internal(version);
+      serialise_version_delta(write_version);
     }
 
     template <class K>
@@ -183,6 +236,11 @@ namespace kv
       serialise_internal(k);
     }
 
+    void serialise_raw(const std::vector<uint8_t>& raw)
+    {
+      serialise_internal(raw);
+    }
+
     std::vector<uint8_t> get_raw_data()
     {
       // make sure the private buffer is empty when we return
@@ -257,9 +315,9 @@ namespace kv
     R public_reader;
     R private_reader;
     R* current_reader;
-    std::vector<uint8_t> decrypted_buffer;
     KvOperationType unhandled_op;
     Version version;
+    SerialisationFormat format = serialisation_format;
     std::shared_ptr<AbstractTxEncryptor> crypto_util;
     std::optional<SecurityDomain> domain_restriction;
 
@@ -301,6 +359,35 @@ namespace kv
       return KvOperationType::KOT_NOT_SUPPORTED;
     }
 
+    Version deserialise_version_delta()
+    {
+      if (format == legacy_serialisation_format)
+        return current_reader->template read_next<Version>();
+
+      auto delta = current_reader->template read_next<uint64_t>();
+      if (delta == 0)
+        return NoVersion;
+
+      return version - static_cast<Version>(delta - 1);
+    }
+
+    bool read_format()
+    {
+      if (public_reader.is_eos())
+        return false;
+
+      // Versions are never negative
+      auto first = public_reader.template peek_next<Version>();
+      if (first >= 0)
+      {
+        format = legacy_serialisation_format;
+        return true;
+      }
+
+      format = public_reader.template read_next<SerialisationFormat>();
+      return format == serialisation_format;
+    }
+
   public:
     GenericDeserialiseWrapper(
       std::shared_ptr<AbstractTxEncryptor> e,
@@ -321,7 +408,7 @@ namespace kv
       if (!crypto_util)
       {
         public_reader.init(buffer.data(), buffer.size());
-        return true;
+        return read_format();
       }
 
       // Skip gcm hdr and read length of public domain
@@ -331,6 +418,8 @@ namespace kv
       // Set public reader
       auto data_public = data_;
       public_reader.init(data_public, public_domain_length);
+      if (!read_format())
+        return false;
 
       // If the domain is public only, skip the decryption and only return the
       // public data
@@ -344,20 +433,21 @@ namespace kv
 
       // Go to start of private domain
       serialized::skip(data_, size_, public_domain_length);
-      decrypted_buffer.resize(size_);
+      // Owned by the private reader, as lazy values may refer to it
+      auto decrypted_buffer = std::make_shared<std::vector<uint8_t>>(size_);
 
       if (!crypto_util->decrypt(
             {data_, data_ + size_},
             {data_public, data_public + public_domain_length},
             {buffer.data(), buffer.data() + crypto_util->get_header_length()},
-            decrypted_buffer,
+            *decrypted_buffer,
             version))
       {
         return false;
       }
 
       // Set private reader
-      private_reader.init(decrypted_buffer.data(), decrypted_buffer.size());
+      private_reader.init(std::move(decrypted_buffer));
       return true;
     }
 
@@ -368,7 +458,7 @@ namespace kv
       return version;
     }
 
-    std::optional<std::string> start_map()
+    std::optional<MapStart> start_map()
     {
       if (current_reader->is_eos())
       {
@@ -378,19 +468,39 @@ namespace kv
           return {};
       }
 
-      if (!try_read_op(KvOperationType::KOT_MAP_START_INDICATOR))
+      if (format == legacy_serialisation_format)
       {
-        return {};
+        if (!try_read_op(KvOperationType::KOT_MAP_START_INDICATOR))
+          return {};
+
+        return {
+          {std::nullopt, current_reader->template read_next<std::string>()}};
       }
 
-      return std::optional<std::string>{
-        current_reader->template read_next<std::string>()};
+      auto curr_op = try_read_op_flag(
+        KvOperationType::KOT_MAP_START_INDICATOR |
+        KvOperationType::KOT_MAP_DEFINITION);
+
+      switch (curr_op)
+      {
+        case KvOperationType::KOT_MAP_START_INDICATOR:
+        {
+          return {{current_reader->template read_next<MapId>(), {}}};
+        }
+        case KvOperationType::KOT_MAP_DEFINITION:
+        {
+          MapId id = current_reader->template read_next<MapId>();
+          std::string name = current_reader->template read_next<std::string>();
+          return {{id, std::move(name)}};
+        }
+        default:
+          return {};
+      }
     }
 
-    template <class Version>
     Version deserialise_read_version()
     {
-      return current_reader->template read_next<Version>();
+      return deserialise_version_delta();
     }
 
     uint64_t deserialise_read_header()
@@ -401,8 +511,8 @@ namespace kv
     template <class K>
     std::tuple<K, Version> deserialise_read()
     {
-      return {current_reader->template read_next<K>(),
-              current_reader->template read_next<Version>()};
+      K key = current_reader->template read_next<K>();
+      return {std::move(key), deserialise_version_delta()};
     }
 
     uint64_t deserialise_write_header()
@@ -428,7 +538,12 @@ namespace kv
       return current_reader->template read_next<K>();
     }
 
-    template <class K, class V, class Version>
+    std::vector<uint8_t> deserialise_raw()
+    {
+      return current_reader->template read_next<std::vector<uint8_t>>();
+    }
+
+    template <class K, class V>
     std::optional<KeyValVersion<K, V, Version>> deserialise_write_version()
     {
       if (end())
@@ -444,8 +559,8 @@ namespace kv
         {
           K key = current_reader->template read_next<K>();
           V value = current_reader->template read_next<V>();
-          Version version = current_reader->template read_next<Version>();
-          return {{key, value, version, false}};
+          Version write_version = deserialise_version_delta();
+          return {{key, value, write_version, false}};
         }
         case KvOperationType::KOT_REMOVE_VERSION:
         {
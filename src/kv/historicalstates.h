@@ -0,0 +1,353 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/logger.h"
+#include "kv.h"
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace kv
+{
+  // Rebuilds the state of a store at versions it has compacted away, by
+  // replaying the ledger in replay stores with the same schema. Ledger
+  // entries are fetched asynchronously, in batches, so a state is only
+  // returned once the ledger has been replayed up to its version. Each replay
+  // store keeps at most max_versions versions, and is compacted as it is
+  // replayed. Up to max_replays of them are kept, so that clients reading
+  // different ranges of versions do not replay the ledger over each other's
+  // states: an older version is rebuilt by replaying the ledger again, in a
+  // new replay store, or in the least recently used one that is not being
+  // replayed.
+  //
+  // If the local ledger starts from a snapshot, versions from the snapshot
+  // onwards are replayed from it. Versions that precede it are replayed from
+  // the start of the ledger, as long as the ledger still holds their entries.
+  // Reading the others throws HistoricalStatePruned, since they cannot be
+  // rebuilt on this node.
+  template <typename StoreType>
+  class HistoricalStates : public AbstractHistoricalStates<
+                             typename StoreType::Serialiser,
+                             typename StoreType::Deserialiser>
+  {
+  public:
+    // Requests the ledger entries from an index to another, inclusive
+    using FetchEntries = std::function<void(Version, Version)>;
+    // Requests the snapshot the ledger starts from
+    using FetchSnapshot = std::function<void()>;
+    using MakeEncryptor = std::function<std::shared_ptr<AbstractTxEncryptor>()>;
+
+    static constexpr size_t default_max_replays = 4;
+
+  private:
+    struct Replay
+    {
+      std::shared_ptr<StoreType> store;
+      // Highest version that has been asked for, and last ledger entry that
+      // has been requested
+      Version target = 0;
+      Version requested = 0;
+      // Number of the last request for a version in this replay
+      size_t last_used = 0;
+      // Whether the replay waits for the snapshot, and whether that is
+      // because the ledger ended before its target
+      bool waiting_for_snapshot = false;
+      bool at_end = false;
+
+      bool in_flight() const
+      {
+        return target > store->current_version();
+      }
+    };
+
+    StoreType& source;
+    MakeEncryptor make_encryptor;
+    FetchEntries fetch_entries;
+    FetchSnapshot fetch_snapshot;
+    const size_t max_versions;
+    const size_t batch_entries;
+    const size_t max_replays;
+
+    std::mutex lock;
+    std::list<Replay> replays;
+    size_t requests = 0;
+
+    // Index of the snapshot the ledger started from when last fetched, and
+    // whether it is being fetched again
+    Version snapshot_idx = 0;
+    bool snapshot_requested = false;
+
+    // Versions from pruned_from up to pruned_to, excluded, are neither in the
+    // ledger nor in its snapshot
+    Version pruned_from = 0;
+    Version pruned_to = 0;
+
+    void request_snapshot(Replay& r)
+    {
+      r.waiting_for_snapshot = true;
+      if (!snapshot_requested)
+      {
+        snapshot_requested = true;
+        fetch_snapshot();
+      }
+    }
+
+    void request_entries(Replay& r)
+    {
+      if (r.waiting_for_snapshot)
+        return;
+
+      // Once half of the requested entries have been replayed, the next ones
+      // are requested in a single batch
+      auto next = r.store->current_version() + 1;
+      auto batch = static_cast<Version>(batch_entries);
+      if (r.requested >= r.target || r.requested + 1 - next > batch / 2)
+        return;
+
+      auto from = std::max(next, r.requested + 1);
+      r.requested = std::min(r.target, next + batch - 1);
+      fetch_entries(from, r.requested);
+    }
+
+    // Replay from which v can be read, or rebuilt by replaying the ledger
+    // forward, if any. Of those, the one that is furthest ahead.
+    Replay* find_replay(Version v)
+    {
+      Replay* found = nullptr;
+      for (auto& r : replays)
+      {
+        if (v < r.store->commit_version())
+          continue;
+
+        if (
+          found == nullptr ||
+          r.store->current_version() > found->store->current_version())
+          found = &r;
+      }
+      return found;
+    }
+
+    Replay* start_replay(Version v)
+    {
+      if (replays.size() >= max_replays)
+      {
+        // Replays that are still being replayed towards a version are not
+        // started again, so that clients asking for versions in turn do not
+        // undo each other's replays
+        auto lru = replays.end();
+        for (auto it = replays.begin(); it != replays.end(); ++it)
+        {
+          if (
+            !it->in_flight() &&
+            (lru == replays.end() || it->last_used < lru->last_used))
+            lru = it;
+        }
+
+        if (lru == replays.end())
+        {
+          LOG_DEBUG_FMT(
+            "Cannot replay ledger to version {}: all replays in flight", v);
+          return nullptr;
+        }
+
+        LOG_DEBUG_FMT(
+          "Replaying ledger again, to version {}: compacted at {}",
+          v,
+          lru->store->commit_version());
+        replays.erase(lru);
+      }
+
+      Replay r;
+      r.store = std::make_shared<StoreType>();
+      r.store->clone_schema(source);
+      r.store->set_encryptor(make_encryptor());
+      replays.push_back(std::move(r));
+
+      // Versions from the snapshot the ledger starts from onwards are
+      // replayed from it, rather than from the start of the ledger
+      auto& started = replays.back();
+      if (snapshot_idx != 0 && v >= snapshot_idx)
+        request_snapshot(started);
+
+      return &started;
+    }
+
+  public:
+    HistoricalStates(
+      StoreType& source,
+      MakeEncryptor make_encryptor,
+      FetchEntries fetch_entries,
+      FetchSnapshot fetch_snapshot,
+      size_t max_versions,
+      size_t batch_entries = 1,
+      size_t max_replays = default_max_replays) :
+      source(source),
+      make_encryptor(make_encryptor),
+      fetch_entries(fetch_entries),
+      fetch_snapshot(fetch_snapshot),
+      max_versions(std::max<size_t>(max_versions, 1)),
+      batch_entries(std::max<size_t>(batch_entries, 1)),
+      max_replays(std::max<size_t>(max_replays, 1))
+    {}
+
+    HistoricalStates(const HistoricalStates& that) = delete;
+
+    std::shared_ptr<StoreType> get_store_at(Version v) override
+    {
+      std::lock_guard<std::mutex> guard(lock);
+
+      if (v >= pruned_from && v < pruned_to)
+        throw HistoricalStatePruned(v);
+
+      auto r = find_replay(v);
+      if (r == nullptr)
+        r = start_replay(v);
+      if (r == nullptr)
+        return nullptr;
+
+      r->last_used = ++requests;
+      if (v <= r->store->current_version())
+        return r->store;
+
+      r->target = std::max(r->target, v);
+      request_entries(*r);
+      return nullptr;
+    }
+
+    /**
+     * Replay an entry fetched from the ledger, in the replays that are
+     * waiting for it.
+     *
+     * @param idx Index of the entry
+     * @param entry Serialised transaction
+     */
+    void replay_entry(Version idx, const std::vector<uint8_t>& entry)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+
+      // Entries may have been requested more than once, or by other replays.
+      // Replays only go as far as they have been asked to, so that they keep
+      // the versions they were asked for.
+      bool replayed = false;
+      for (auto it = replays.begin(); it != replays.end();)
+      {
+        auto& r = *it;
+        if (idx != r.store->current_version() + 1 || idx > r.target)
+        {
+          ++it;
+          continue;
+        }
+
+        replayed = true;
+        if (r.store->deserialise(entry) == DeserialiseSuccess::FAILED)
+        {
+          LOG_FAIL_FMT("Failed to replay historical ledger entry {}", idx);
+          it = replays.erase(it);
+          continue;
+        }
+
+        auto max = static_cast<Version>(max_versions);
+        if (idx > max)
+          r.store->compact(idx - max);
+
+        request_entries(r);
+        ++it;
+      }
+
+      if (!replayed)
+        LOG_DEBUG_FMT("Ignoring historical ledger entry {}", idx);
+    }
+
+    /**
+     * Handle the end of the ledger, in the replays that are waiting for the
+     * entry past it. If the ledger starts from a snapshot past that entry,
+     * they are replayed from that snapshot instead.
+     *
+     * @param idx Index of the first entry past the end of the ledger
+     */
+    void replay_end(Version idx)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+
+      for (auto& r : replays)
+      {
+        if (idx != r.store->current_version() + 1 || idx > r.target)
+          continue;
+
+        r.at_end = true;
+        request_snapshot(r);
+      }
+    }
+
+    /**
+     * Replay the snapshot the ledger starts from, in the replays that are
+     * waiting for it. Replays that reached the end of the ledger stop waiting
+     * for entries past it, which are requested again when a state past the
+     * end is next asked for.
+     *
+     * @param idx Index of the snapshot, 0 if the ledger does not start from
+     * a snapshot
+     * @param snapshot Serialised snapshot
+     */
+    void replay_snapshot(Version idx, const std::vector<uint8_t>& snapshot)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+
+      snapshot_idx = idx;
+      snapshot_requested = false;
+
+      for (auto it = replays.begin(); it != replays.end();)
+      {
+        auto& r = *it;
+        if (!r.waiting_for_snapshot)
+        {
+          ++it;
+          continue;
+        }
+
+        r.waiting_for_snapshot = false;
+        auto at_end = r.at_end;
+        r.at_end = false;
+
+        auto next = r.store->current_version() + 1;
+        if (idx >= next && idx <= r.target)
+        {
+          if (
+            r.store->deserialise_snapshot(snapshot) ==
+            DeserialiseSuccess::FAILED)
+          {
+            LOG_FAIL_FMT("Failed to replay historical snapshot at {}", idx);
+            it = replays.erase(it);
+            continue;
+          }
+        }
+        else if (at_end)
+        {
+          // The entries from next up to the snapshot will not be found
+          if (idx >= next)
+          {
+            LOG_FAIL_FMT(
+              "Cannot replay ledger to version {}: entries from {} to {} are "
+              "not in the ledger",
+              r.target,
+              next,
+              idx - 1);
+            pruned_from = next;
+            pruned_to = idx;
+          }
+
+          r.target = r.store->current_version();
+        }
+
+        r.requested = r.store->current_version();
+        request_entries(r);
+        ++it;
+      }
+    }
+  };
+}
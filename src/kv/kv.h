@@ -2,18 +2,26 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
+#include "../ds/arena.h"
 #include "../ds/champmap.h"
+#include "../ds/flatmap.h"
 #include "../ds/logger.h"
+#include "../ds/rbmap.h"
 #include "../ds/spinlock.h"
 #include "kvtypes.h"
+#include "mapids.h"
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <iostream>
 #include <limits>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -57,7 +65,34 @@ namespace kv
   template <class S, class D>
   class Store;
 
-  template <class K, class V, class H, class S, class D>
+  // Provides the state of a store at versions that it has compacted away
+  template <class S, class D>
+  class AbstractHistoricalStates
+  {
+  public:
+    virtual ~AbstractHistoricalStates() {}
+
+    // Returns a store holding the state at version v, or nullptr if that
+    // state is not available yet, in which case it is rebuilt
+    virtual std::shared_ptr<Store<S, D>> get_store_at(Version v) = 0;
+  };
+
+  // Persistent containers holding the state of a Map, given the key, the
+  // versioned value and the hash of the key. Ordered state can be iterated
+  // over in key order, from any key.
+  template <class K, class V, class H>
+  using HashedState = champ::Map<K, V, H>;
+
+  template <class K, class V, class H>
+  using OrderedState = RBMap<K, V>;
+
+  template <
+    class K,
+    class V,
+    class H,
+    class S,
+    class D,
+    template <class, class, class> class M = HashedState>
   class Map : public AbstractMap<S, D>
   {
   public:
@@ -75,48 +110,321 @@ namespace kv
       VersionV(Version ver, V val) : version(ver), value(val) {}
     };
 
-    using State = champ::Map<K, VersionV, H>;
-    using Read = std::unordered_map<K, Version, H>;
+    using State = M<K, VersionV, H>;
+    // Read and write sets of a transaction, allocated from its arena
+    using Read = flat::
+      Map<K, Version, H, arena::Allocator<std::pair<K, Version>>>;
+    using WriteSet = flat::
+      Map<K, VersionV, H, arena::Allocator<std::pair<K, VersionV>>>;
+    // Writes of a committed transaction
     using Write = std::unordered_map<K, VersionV, H>;
     /// Signature for transaction commit handlers
     using CommitHook = std::function<void(Version, const State&, const Write&)>;
 
+    static constexpr bool is_ordered =
+      std::is_same_v<State, OrderedState<K, VersionV, H>>;
+
+    // Keys of the entries indexed under an index key, with the version of
+    // each entry. The version is negated once an entry is no longer indexed
+    // under that index key, until the bucket is pruned.
+    using IndexBucket = champ::Map<K, Version, H>;
+
+    struct AbstractIndexState
+    {
+      virtual ~AbstractIndexState() = default;
+    };
+    using IndexState = std::shared_ptr<const AbstractIndexState>;
+    using IndexStates = std::vector<IndexState>;
+
+    /// Secondary index on a Map, derived from the entries of the map
+    class AbstractIndex
+    {
+    public:
+      virtual ~AbstractIndex() = default;
+
+      virtual const std::string& get_name() const = 0;
+
+      // Index state once the writes that turned state before into state
+      // after have been applied. A null index state is an empty index.
+      virtual IndexState update(
+        const IndexState& index,
+        const State& before,
+        const State& after,
+        const Write& writes) const = 0;
+    };
+    using Indexes = std::vector<std::shared_ptr<AbstractIndex>>;
+
+    /// Signature for index key extractors
+    template <class IK>
+    using IndexKey = std::function<IK(const K&, const V&)>;
+
+    template <class IK>
+    class Index : public AbstractIndex
+    {
+    public:
+      struct Bucket
+      {
+        IndexBucket entries;
+        // Number of entries still indexed under the index key
+        size_t live = 0;
+      };
+
+      // Neither map supports removal, so the entries that are no longer
+      // indexed under an index key, and the index keys that no longer index
+      // any entry, are dropped by rebuilding the bucket or the index once
+      // they outnumber the others
+      struct Entries : public AbstractIndexState
+      {
+        RBMap<IK, Bucket> buckets;
+        size_t size = 0;
+        size_t unused = 0;
+      };
+
+    private:
+      std::string name;
+      IndexKey<IK> index_key;
+
+      static void set(Entries& entries, const IK& ik, const K& k, Version v)
+      {
+        auto p = entries.buckets.getp(ik);
+        auto bucket = p ? *p : Bucket();
+        if (p == nullptr)
+          ++entries.size;
+        else if (bucket.live == 0)
+          --entries.unused;
+
+        auto prev = bucket.entries.getp(k);
+        if (prev != nullptr && !deleted(*prev))
+          --bucket.live;
+        if (!deleted(v))
+          ++bucket.live;
+        bucket.entries = bucket.entries.put(k, v);
+
+        if (bucket.entries.size() > 2 * bucket.live)
+        {
+          auto live = IndexBucket().transient();
+          bucket.entries.foreach(
+            [&live](const K& key, const Version& version) {
+              if (!deleted(version))
+                live.put(key, version);
+              return true;
+            });
+          bucket.entries = live.persistent();
+        }
+
+        if (bucket.live == 0)
+          ++entries.unused;
+        entries.buckets = entries.buckets.put(ik, bucket);
+      }
+
+      static void prune(Entries& entries)
+      {
+        if (entries.unused <= entries.size / 2)
+          return;
+
+        auto used = RBMap<IK, Bucket>().transient();
+        entries.buckets.foreach([&used](const IK& ik, const Bucket& bucket) {
+          if (bucket.live != 0)
+            used.put(ik, bucket);
+          return true;
+        });
+        entries.buckets = used.persistent();
+        entries.size -= entries.unused;
+        entries.unused = 0;
+      }
+
+    public:
+      Index(std::string name_, IndexKey<IK> index_key_) :
+        name(name_),
+        index_key(index_key_)
+      {}
+
+      const std::string& get_name() const override
+      {
+        return name;
+      }
+
+      IK get_index_key(const K& k, const V& v) const
+      {
+        return index_key(k, v);
+      }
+
+      static const IndexBucket* get_bucket(
+        const IndexState& index, const IK& ik)
+      {
+        if (index == nullptr)
+          return nullptr;
+
+        auto bucket = static_cast<const Entries&>(*index).buckets.getp(ik);
+        return bucket ? &bucket->entries : nullptr;
+      }
+
+      IndexState update(
+        const IndexState& index,
+        const State& before,
+        const State& after,
+        const Write& writes) const override
+      {
+        auto entries = std::make_shared<Entries>();
+        if (index != nullptr)
+          *entries = static_cast<const Entries&>(*index);
+
+        for (auto& [k, w] : writes)
+        {
+          auto prev = before.getp(k);
+          auto next = after.getp(k);
+          if (
+            next == nullptr ||
+            (prev != nullptr && prev->version == next->version))
+            continue;
+
+          // Unindex the previous value, then index the new one, which may be
+          // under the same index key
+          if (prev != nullptr && !deleted(prev->version))
+            set(
+              *entries,
+              index_key(k, prev->value),
+              k,
+              deleted(next->version) ? next->version : -next->version);
+
+          if (!deleted(next->version))
+            set(*entries, index_key(k, next->value), k, next->version);
+        }
+
+        prune(*entries);
+        return entries;
+      }
+    };
+
+    /** Create a secondary index, to be passed to `kv::Store::create`
+     *
+     * Entries of the map are indexed by the key returned by the index key
+     * extractor, which must be comparable with `operator<`.
+     *
+     * @param name Index name
+     * @param index_key Index key extractor, taking a key and a value
+     *
+     * @return Index definition
+     */
+    template <class IK>
+    static std::shared_ptr<AbstractIndex> make_index(
+      std::string name, IndexKey<IK> index_key)
+    {
+      return std::make_shared<Index<IK>>(name, index_key);
+    }
+
   private:
-    using This = Map<K, V, H, S, D>;
+    using This = Map<K, V, H, S, D, M>;
+
+    // Keys iterated over in key order by a transaction, from the first one.
+    // The range is unbounded if the iteration reached the end of the map.
+    struct RangeRead
+    {
+      K from;
+      std::optional<K> to;
+      bool inclusive;
+    };
 
     struct LocalCommit
     {
       Version version;
       State state;
       Write writes;
+      IndexStates indexes;
     };
     using LocalCommits = std::list<LocalCommit>;
 
+    // What a view needs from the last entry of the roll, published whenever
+    // the roll changes so that read-only views are created without locking
+    // the map
+    struct LastCommit
+    {
+      Version version;
+      State state;
+      State committed;
+      IndexStates indexes;
+      size_t rollback_counter;
+    };
+
     Store<S, D>* store;
     std::string name;
     size_t rollback_counter;
     std::unique_ptr<LocalCommits> roll;
+    std::shared_ptr<const LastCommit> last_commit;
+    // Set when the roll changes, so that unlock() publishes the last commit
+    bool roll_changed = true;
     CommitHook local_hook;
     CommitHook global_hook;
     LocalCommits commit_deltas;
     SpinLock sl;
     const SecurityDomain security_domain;
+    const Indexes indexes;
 
     Map(
       Store<S, D>* store_,
       std::string name_,
       SecurityDomain security_domain_,
       CommitHook local_hook_,
-      CommitHook global_hook_) :
+      CommitHook global_hook_,
+      Indexes indexes_ = {}) :
       store(store_),
       name(name_),
       roll(std::make_unique<LocalCommits>()),
       rollback_counter(0),
       security_domain(security_domain_),
       local_hook(local_hook_),
-      global_hook(global_hook_)
+      global_hook(global_hook_),
+      indexes(indexes_)
     {
-      roll->push_back({0, State(), Write()});
+      roll->push_back({0, State(), Write(), IndexStates(indexes.size())});
+      publish_last_commit();
+    }
+
+    void publish_last_commit()
+    {
+      // Called with the map locked, or before it is shared
+      auto& c = roll->back();
+      std::atomic_store(
+        &last_commit,
+        std::shared_ptr<const LastCommit>(std::make_shared<LastCommit>(
+          LastCommit{c.version,
+                     c.state,
+                     roll->front().state,
+                     c.indexes,
+                     rollback_counter})));
+      roll_changed = false;
+    }
+
+    // Position of the named index, which must index by IK
+    template <class IK>
+    std::pair<size_t, const Index<IK>*> get_index(
+      const std::string& index_name) const
+    {
+      for (size_t i = 0; i < indexes.size(); ++i)
+      {
+        if (indexes[i]->get_name() != index_name)
+          continue;
+
+        auto index = dynamic_cast<const Index<IK>*>(indexes[i].get());
+        if (index == nullptr)
+          throw std::logic_error(fmt::format(
+            "Index {} on map {} has a different key type", index_name, name));
+
+        return {i, index};
+      }
+
+      throw std::logic_error(
+        fmt::format("No index {} on map {}", index_name, name));
+    }
+
+    IndexStates update_indexes(
+      const LocalCommit& before, const State& after, const Write& writes) const
+    {
+      IndexStates result(indexes.size());
+      for (size_t i = 0; i < indexes.size(); ++i)
+        result[i] =
+          indexes[i]->update(before.indexes[i], before.state, after, writes);
+      return result;
     }
 
     Map(const Map& that) = delete;
@@ -129,14 +437,14 @@ namespace kv
       if (store_ == nullptr)
         throw std::logic_error("Failed to cast store in Map clone");
 
-      return new Map(store_, name, security_domain, nullptr, nullptr);
+      return new Map(store_, name, security_domain, nullptr, nullptr, indexes);
     }
 
     /** Get the name of the map
      *
      * @return const std::string&
      */
-    const std::string& get_name() const
+    const std::string& get_name() const override
     {
       return name;
     }
@@ -247,7 +555,16 @@ namespace kv
       State state;
       State committed;
       Read reads;
-      Write writes;
+      std::vector<RangeRead> range_reads;
+      // Set once the map has been iterated over, up to scanned_to if the map
+      // is ordered and every iteration stopped early, otherwise entirely
+      bool scanned;
+      std::optional<K> scanned_to;
+      WriteSet writes;
+      IndexStates index_states;
+      // Checks that the index buckets this transaction has looked up hold the
+      // same entries, at the same versions, in the current index states
+      std::vector<std::function<bool(const IndexStates&)>> index_reads;
       Version start_version;
       size_t rollback_counter;
       Version read_version;
@@ -255,18 +572,42 @@ namespace kv
       bool changes;
       bool deserialised;
       bool committed_writes;
+      // Set for views of read-only transactions, whose reads are not recorded
+      bool read_only = false;
 
-      TxView(This& parent, State& s, Version v, size_t r) :
+      TxView(This& parent, LocalCommit& c, size_t r, arena::Arena* arena) :
         map(parent),
-        state(s),
+        state(c.state),
         committed(parent.roll->front().state),
-        start_version(v),
+        reads(arena),
+        writes(arena),
+        index_states(c.indexes),
+        start_version(c.version),
         rollback_counter(r),
         read_version(NoVersion),
         commit_version(NoVersion),
         changes(false),
         deserialised(false),
-        committed_writes(false)
+        committed_writes(false),
+        scanned(false)
+      {}
+
+      TxView(This& parent, const LastCommit& c, arena::Arena* arena) :
+        map(parent),
+        state(c.state),
+        committed(c.committed),
+        reads(arena),
+        writes(arena),
+        index_states(c.indexes),
+        start_version(c.version),
+        rollback_counter(c.rollback_counter),
+        read_version(NoVersion),
+        commit_version(NoVersion),
+        changes(false),
+        deserialised(false),
+        committed_writes(false),
+        scanned(false),
+        read_only(true)
       {}
 
     public:
@@ -316,13 +657,15 @@ namespace kv
         auto search = state.get(key);
         if (!search.has_value())
         {
-          reads.insert(std::make_pair(key, NoVersion));
+          if (!read_only)
+            reads.insert(std::make_pair(key, NoVersion));
           return {};
         }
 
         // Record the version that we depend on.
         auto& found = search.value();
-        reads.insert(std::make_pair(key, found.version));
+        if (!read_only)
+          reads.insert(std::make_pair(key, found.version));
 
         // If the key has been deleted, return empty.
         if (deleted(found.version))
@@ -364,6 +707,59 @@ namespace kv
         return found.value;
       }
 
+      /** Get value for key at a past version
+       *
+       * This returns the value the key had once the transaction at the
+       * specified version was committed, ignoring this transaction's writes.
+       * The state at that version is read from the map if it has not been
+       * compacted yet, and otherwise from the historical states of the
+       * store. Historical reads are not recorded in the read set.
+       *
+       * @param key Key
+       * @param version Version
+       *
+       * @return optional containing value, empty if the key didn't exist at
+       * that version
+       *
+       * @throws kv::HistoricalStateUnavailable if the state at that version
+       * is being rebuilt
+       * @throws kv::HistoricalStatePruned if the state at that version cannot
+       * be rebuilt from the local ledger
+       */
+      std::optional<V> get_at(const K& key, Version version)
+      {
+        if (commit_version != NoVersion)
+          return {};
+
+        auto current = map.store->current_version();
+        if (version > current)
+          throw std::logic_error(fmt::format(
+            "Cannot read {} at version {}, past the current version {}",
+            map.name,
+            version,
+            current));
+
+        auto past_state = map.get_state_at(version);
+        if (!past_state.has_value())
+        {
+          auto h = map.store->get_historical_states();
+          auto past_store = h ? h->get_store_at(version) : nullptr;
+          auto past_map =
+            past_store ? past_store->template get<This>(map.name) : nullptr;
+          if (past_map != nullptr)
+            past_state = past_map->get_state_at(version);
+
+          if (!past_state.has_value())
+            throw HistoricalStateUnavailable(version);
+        }
+
+        auto search = past_state->get(key);
+        if (!search.has_value() || deleted(search->version))
+          return {};
+
+        return search->value;
+      }
+
       /** Write value at key
        *
        * If the key already exists, the value will be replaced.
@@ -379,6 +775,8 @@ namespace kv
         if (commit_version != NoVersion)
           return false;
 
+        check_writable();
+
         // Record in the write set.
         writes[key] = {0, value};
         return true;
@@ -398,6 +796,8 @@ namespace kv
         if (commit_version != NoVersion)
           return false;
 
+        check_writable();
+
         auto write = writes.find(key);
         auto search = state.get(key).has_value();
 
@@ -423,14 +823,16 @@ namespace kv
           return false;
 
         // Record in the write set.
-        writes.emplace(
-          std::piecewise_construct,
-          std::forward_as_tuple(key),
-          std::forward_as_tuple(NoVersion, V()));
+        writes.try_emplace(key, NoVersion, V());
         return true;
       }
 
       /** Iterate over all entries in the map
+       *
+       * The transaction depends on the entries that have been visited, and
+       * on no entry being inserted in the map. In an ordered map, entries
+       * are visited in key order and, if the iteration stops early, only the
+       * insertion of keys up to the last visited one is a conflict.
        *
        * @param F functor, taking a key and a value, return value determines
        * whether the iteration should continue (true) or stop (false)
@@ -441,17 +843,32 @@ namespace kv
         if (commit_version != NoVersion)
           return false;
 
-        // Record a global read dependency.
-        read_version = start_version;
         auto& w = writes;
+        auto& r = reads;
+        auto ro = read_only;
+        std::optional<K> last;
 
-        state.foreach([&w, &f](const K& k, const VersionV& v) {
-          auto write = w.find(k);
+        bool completed = state.foreach(
+          [&w, &r, ro, &f, &last](const K& k, const VersionV& v) {
+            auto write = w.find(k);
 
-          if ((write == w.end()) && !deleted(v.version))
-            return f(k, v.value);
-          return true;
-        });
+            if ((write == w.end()) && !deleted(v.version))
+            {
+              // Record the version of each visited entry
+              if (!ro)
+                r.insert(std::make_pair(k, v.version));
+              if (!f(k, v.value))
+              {
+                last = k;
+                return false;
+              }
+            }
+            return true;
+          });
+
+        record_scan(last);
+        if (!completed)
+          return false;
 
         for (auto write = writes.begin(); write != writes.end(); ++write)
         {
@@ -462,6 +879,133 @@ namespace kv
         return true;
       }
 
+      /** Iterate over the entries with keys in [from, to), in key order
+       *
+       * This is only available on ordered maps. Rather than on the whole map,
+       * the transaction only depends on the keys that have been iterated over.
+       *
+       * @param from First key of the range
+       * @param to Key past the end of the range
+       * @param F functor, taking a key and a value, return value determines
+       * whether the iteration should continue (true) or stop (false)
+       *
+       * @return true if the iteration completed, false otherwise
+       */
+      template <class F>
+      bool range(const K& from, const K& to, F&& f)
+      {
+        static_assert(is_ordered, "range() requires an ordered map");
+
+        if (commit_version != NoVersion)
+          return false;
+
+        std::optional<K> last;
+        bool completed =
+          foreach_ordered(from, &to, [&last, &f](const K& k, const V& v) {
+            last = k;
+            return f(k, v);
+          });
+
+        if (read_only)
+          return completed;
+
+        if (completed)
+          range_reads.push_back({from, to, false});
+        else
+          range_reads.push_back({from, last, true});
+
+        return completed;
+      }
+
+      /** Get the first entry whose key is not less than key
+       *
+       * This is only available on ordered maps. The transaction depends on
+       * the keys from key to the returned one.
+       *
+       * @param key Key
+       *
+       * @return optional containing the key and value of the entry, empty if
+       * all keys are less than key
+       */
+      std::optional<std::pair<K, V>> lower_bound(const K& key)
+      {
+        static_assert(is_ordered, "lower_bound() requires an ordered map");
+
+        if (commit_version != NoVersion)
+          return {};
+
+        std::optional<std::pair<K, V>> found;
+        foreach_ordered(key, nullptr, [&found](const K& k, const V& v) {
+          found = std::make_pair(k, v);
+          return false;
+        });
+
+        if (read_only)
+          return found;
+
+        if (found.has_value())
+          range_reads.push_back({key, found->first, true});
+        else
+          range_reads.push_back({key, std::nullopt, false});
+
+        return found;
+      }
+
+      /** Iterate over the entries indexed under an index key
+       *
+       * The index must have been passed to `kv::Store::create` when the map
+       * was created. Rather than on the whole map, the transaction depends on
+       * the entries indexed under that index key.
+       *
+       * @param index_name Index name
+       * @param ik Index key
+       * @param F functor, taking a key and a value, return value determines
+       * whether the iteration should continue (true) or stop (false)
+       *
+       * @return true if the iteration completed, false otherwise
+       */
+      template <class IK, class F>
+      bool foreach_by_index(const std::string& index_name, const IK& ik, F&& f)
+      {
+        if (commit_version != NoVersion)
+          return false;
+
+        using Idx = Index<IK>;
+        auto [i, index] = map.template get_index<IK>(index_name);
+
+        auto bucket = Idx::get_bucket(index_states[i], ik);
+        auto found = bucket ? *bucket : IndexBucket();
+        if (!read_only)
+          index_reads.push_back(
+            [i = i, ik, found](const IndexStates& current) {
+              auto b = Idx::get_bucket(current[i], ik);
+              return same_bucket(found, b ? *b : IndexBucket());
+            });
+
+        // Entries written by this transaction are indexed by their new value
+        bool completed = found.foreach(
+          [this, &f](const K& k, const Version& version) {
+            if (deleted(version) || writes.find(k) != writes.end())
+              return true;
+
+            return f(k, state.getp(k)->value);
+          });
+
+        if (!completed)
+          return false;
+
+        for (auto& [k, w] : writes)
+        {
+          if (is_remove(w.version))
+            continue;
+
+          auto wk = index->get_index_key(k, w.value);
+          if (!(wk < ik) && !(ik < wk) && !f(k, w.value))
+            return false;
+        }
+        return true;
+      }
+
       Version start_order()
       {
         return start_version;
@@ -475,7 +1019,140 @@ namespace kv
         return commit_version;
       }
 
+      void set_read_only() override
+      {
+        if (has_writes())
+          throw std::logic_error(fmt::format(
+            "Cannot make transaction read-only, it has written to {}",
+            map.name));
+
+        read_only = true;
+      }
+
     private:
+      void check_writable()
+      {
+        if (read_only)
+          throw std::logic_error(fmt::format(
+            "Cannot write to {} in a read-only transaction", map.name));
+      }
+
+      void record_scan(const std::optional<K>& last)
+      {
+        if (read_only)
+          return;
+
+        if constexpr (is_ordered)
+        {
+          if (last.has_value())
+          {
+            if (!scanned || (scanned_to.has_value() && *scanned_to < *last))
+              scanned_to = last;
+
+            scanned = true;
+            return;
+          }
+        }
+
+        scanned_to.reset();
+        scanned = true;
+      }
+
+      // Whether a key that was not live when this transaction began has been
+      // written since, in the part of the map that has been iterated over
+      bool inserted_in_scan()
+      {
+        auto in_scan = [this](const K& k) {
+          if constexpr (is_ordered)
+            return !scanned_to.has_value() || !(scanned_to.value() < k);
+          else
+            return true;
+        };
+        auto was_live = [this](const K& k) {
+          auto p = state.getp(k);
+          return p != nullptr && !deleted(p->version);
+        };
+
+        // If no commit since this transaction began has been compacted, only
+        // their write sets need to be checked
+        if (map.roll->front().version <= start_version)
+        {
+          for (auto& r : *map.roll)
+          {
+            if (r.version <= start_version)
+              continue;
+
+            for (auto& [k, v] : r.writes)
+            {
+              if (!is_remove(v.version) && in_scan(k) && !was_live(k))
+                return true;
+            }
+          }
+          return false;
+        }
+
+        bool inserted = false;
+        map.roll->back().state.foreach(
+          [&inserted, &in_scan, &was_live](const K& k, const VersionV& v) {
+            if (!deleted(v.version) && in_scan(k) && !was_live(k))
+            {
+              inserted = true;
+              return false;
+            }
+            return true;
+          });
+        return inserted;
+      }
+
+      // Iterate, in key order, over the live entries from the key from and,
+      // if to is set, before to, including the writes of this transaction
+      template <class F>
+      bool foreach_ordered(const K& from, const K* to, F&& f)
+      {
+        // The write set is not ordered, so the writes in range are sorted
+        using WriteIt = typename WriteSet::const_iterator;
+        std::vector<WriteIt> w;
+        for (auto it = writes.cbegin(); it != writes.cend(); ++it)
+        {
+          if (!(it->first < from) && (to == nullptr || it->first < *to))
+            w.push_back(it);
+        }
+        std::sort(w.begin(), w.end(), [](const WriteIt& a, const WriteIt& b) {
+          return a->first < b->first;
+        });
+
+        auto next = w.begin();
+        auto visit_writes_before = [&next, &w, &f](const K* k) {
+          for (; next != w.end() && (k == nullptr || (*next)->first < *k);
+               ++next)
+          {
+            auto& written = (*next)->second;
+            if (!deleted(written.version) && !f((*next)->first, written.value))
+              return false;
+          }
+          return true;
+        };
+
+        auto visit = [&](const K& k, const VersionV& v) {
+          if (!visit_writes_before(&k))
+            return false;
+
+          // A key written by this transaction hides the committed value
+          if (next != w.end() && !(k < (*next)->first))
+          {
+            auto& written = (*next++)->second;
+            return deleted(written.version) || f(k, written.value);
+          }
+
+          return deleted(v.version) || f(k, v.value);
+        };
+
+        bool completed =
+          to ? state.range(from, *to, visit) : state.foreach_from(from, visit);
+
+        return completed && visit_writes_before(nullptr);
+      }
+
       virtual bool has_writes()
       {
         return committed_writes || !writes.empty();
@@ -496,7 +1173,7 @@ namespace kv
         if (rollback_counter != map.rollback_counter)
           return false;
 
-        // If we have iterated over the map, check for a global version match.
+        // If we depend on the whole map, check for a global version match.
         auto& current = map.roll->back();
 
         if ((read_version != NoVersion) && (read_version != current.version))
@@ -532,24 +1209,65 @@ namespace kv
           }
         }
 
-        return true;
-      }
-
-      virtual void commit(Version v)
-      {
-        if (writes.empty())
+        // If we have iterated over the map, check that no key has been
+        // inserted where we have iterated.
+        if (scanned && current.version != start_version && inserted_in_scan())
         {
-          commit_version = start_version;
-          return;
+          LOG_DEBUG_FMT("Iteration depends on entries not being inserted");
+          return false;
         }
 
-        // Record our commit time.
-        commit_version = v;
-        committed_writes = true;
+        // Check that the ranges we have iterated over have not been written
+        // to since this transaction began.
+        if constexpr (is_ordered)
+        {
+          if (current.version != start_version)
+          {
+            for (auto& r : range_reads)
+            {
+              if (!same_range(state, current.state, r))
+              {
+                LOG_DEBUG_FMT("Range read depends on modified entries");
+                return false;
+              }
+            }
+          }
+        }
+
+        // Check that the index keys we have looked up still index the same
+        // entries.
+        if (current.version != start_version)
+        {
+          for (auto& r : index_reads)
+          {
+            if (!r(current.indexes))
+            {
+              LOG_DEBUG_FMT("Index lookup depends on modified entries");
+              return false;
+            }
+          }
+        }
+
+        return true;
+      }
+
+      virtual void commit(Version v)
+      {
+        if (writes.empty())
+        {
+          commit_version = start_version;
+          return;
+        }
+
+        // Record our commit time.
+        commit_version = v;
+        committed_writes = true;
 
         if (!writes.empty())
         {
-          auto state = map.roll->back().state;
+          // Writes are applied as a batch, so that the nodes of the new state
+          // are only copied once
+          auto transient = map.roll->back().state.transient();
 
           for (auto it = writes.begin(); it != writes.end(); ++it)
           {
@@ -557,23 +1275,31 @@ namespace kv
             {
               // Write the new value with the global version.
               changes = true;
-              state = state.put(it->first, VersionV{v, it->second.value});
+              transient.put(it->first, VersionV{v, it->second.value});
             }
             else
             {
               // Write an empty value with the deleted global version only if
               // the key exists.
-              auto search = state.get(it->first);
-              if (search.has_value())
+              if (transient.getp(it->first) != nullptr)
               {
                 changes = true;
-                state = state.put(it->first, VersionV{-v, V()});
+                transient.put(it->first, VersionV{-v, V()});
               }
             }
           }
 
           if (changes)
-            map.roll->push_back({v, state, writes});
+          {
+            // The roll outlives the arena of the transaction
+            auto state = transient.persistent();
+            auto& prev = map.roll->back();
+            Write w(writes.begin(), writes.end());
+            auto index_states = map.update_indexes(prev, state, w);
+            map.roll->push_back(
+              {v, state, std::move(w), std::move(index_states)});
+            map.roll_changed = true;
+          }
         }
       }
 
@@ -652,7 +1378,7 @@ namespace kv
         commit_version = version;
         uint64_t ctr;
 
-        auto rv = d.template deserialise_read_version<Version>();
+        auto rv = d.deserialise_read_version();
         if (rv != NoVersion)
           read_version = rv;
 
@@ -691,32 +1417,134 @@ namespace kv
     friend Tx<S, D>;
     friend Store<S, D>;
 
-    TxView* create_view(Version version) override
+    template <class F>
+    static void foreach_in_range(const State& s, const RangeRead& r, F&& f)
+    {
+      if (!r.to.has_value())
+        s.foreach_from(r.from, f);
+      else if (!r.inclusive)
+        s.range(r.from, r.to.value(), f);
+      else
+        s.foreach_from(r.from, [&r, &f](const K& k, const VersionV& v) {
+          return !(r.to.value() < k) && f(k, v);
+        });
+    }
+
+    // Whether two states hold the same keys, at the same versions, in a range
+    static bool same_range(const State& a, const State& b, const RangeRead& r)
+    {
+      std::vector<std::pair<const K*, Version>> entries;
+      foreach_in_range(a, r, [&entries](const K& k, const VersionV& v) {
+        entries.emplace_back(&k, v.version);
+        return true;
+      });
+
+      size_t i = 0;
+      bool same = true;
+      foreach_in_range(
+        b, r, [&entries, &i, &same](const K& k, const VersionV& v) {
+          if (
+            i == entries.size() || *entries[i].first < k ||
+            k < *entries[i].first || entries[i].second != v.version)
+          {
+            same = false;
+            return false;
+          }
+
+          ++i;
+          return true;
+        });
+
+      return same && i == entries.size();
+    }
+
+    // Whether two index buckets index the same entries, at the same versions
+    static bool same_bucket(const IndexBucket& a, const IndexBucket& b)
+    {
+      size_t count = 0;
+      bool same = a.foreach([&b, &count](const K& k, const Version& version) {
+        if (deleted(version))
+          return true;
+
+        auto p = b.getp(k);
+        ++count;
+        return p != nullptr && *p == version;
+      });
+
+      b.foreach([&count](const K& k, const Version& version) {
+        if (!deleted(version))
+          --count;
+        return true;
+      });
+
+      return same && count == 0;
+    }
+
+    TxView* create_view(
+      Version version,
+      arena::Arena* arena = nullptr,
+      bool read_only = false) override
     {
+      if (read_only)
+      {
+        // The last commit is the one to read from unless the map has been
+        // committed to past this version since, which is rare
+        auto c = std::atomic_load(&last_commit);
+        if (c->version <= version)
+        {
+          return arena == nullptr ?
+            new TxView(*this, *c, arena) :
+            new (arena->allocate(sizeof(TxView), alignof(TxView)))
+              TxView(*this, *c, arena);
+        }
+      }
+
       lock();
 
       // Find the last entry committed at or before this version.
-      TxView* view = nullptr;
-
+      auto c = &roll->front();
       for (auto it = roll->rbegin(); it != roll->rend(); ++it)
       {
         if (it->version <= version)
         {
-          view = new TxView(*this, it->state, it->version, rollback_counter);
+          c = &*it;
           break;
         }
       }
 
-      if (view == nullptr)
-      {
-        view = new TxView(
-          *this, roll->front().state, roll->front().version, rollback_counter);
-      }
+      TxView* view = arena == nullptr ?
+        new TxView(*this, *c, rollback_counter, arena) :
+        new (arena->allocate(sizeof(TxView), alignof(TxView)))
+          TxView(*this, *c, rollback_counter, arena);
+      view->read_only = read_only;
 
       unlock();
       return view;
     }
 
+    /** Get the state of the map at a past version
+     *
+     * @param version Version
+     *
+     * @return optional containing the state, empty if the map has been
+     * compacted past that version
+     */
+    std::optional<State> get_state_at(Version version)
+    {
+      std::lock_guard<SpinLock> guard(sl);
+
+      if (roll->front().version > version)
+        return {};
+
+      for (auto it = roll->rbegin(); it != roll->rend(); ++it)
+      {
+        if (it->version <= version)
+          return it->state;
+      }
+
+      return {};
+    }
+
     void compact(Version v) override
     {
       // This discards available rollback state before version v, and populates
@@ -746,6 +1574,7 @@ namespace kv
           return;
 
         roll->pop_front();
+        roll_changed = true;
       }
 
       // There is only one roll. We may need to call the commit hook.
@@ -787,7 +1616,10 @@ namespace kv
       }
 
       if (advance)
+      {
         rollback_counter++;
+        roll_changed = true;
+      }
     }
 
     void clear() override
@@ -795,8 +1627,91 @@ namespace kv
       // This discards all entries in the roll and resets the compacted value
       // and rollback counter. The Map expects to be locked before clearing it.
       roll->clear();
-      roll->push_back({0, State(), Write()});
+      roll->push_back({0, State(), Write(), IndexStates(indexes.size())});
       rollback_counter = 0;
+      roll_changed = true;
+    }
+
+    void serialise_snapshot(S& s, Version v) override
+    {
+      // This serialises every live entry of the last state committed at or
+      // before version v, along with the version at which each entry was
+      // written. The Map expects to be locked during serialisation.
+      auto r = roll->begin();
+      for (auto it = roll->rbegin(); it != roll->rend(); ++it)
+      {
+        if (it->version <= v)
+        {
+          r = std::prev(it.base());
+          break;
+        }
+      }
+
+      // A map that has never been written to is not part of the snapshot.
+      if (r->version == 0)
+        return;
+
+      uint64_t ctr = 0;
+      r->state.foreach([&ctr](const K& k, const VersionV& v) {
+        if (!deleted(v.version))
+          ++ctr;
+        return true;
+      });
+
+      s.start_map(name, security_domain);
+      s.serialise_read_version(r->version);
+      s.serialise_count_header(ctr);
+      r->state.foreach([&s](const K& k, const VersionV& v) {
+        if (!deleted(v.version))
+          s.serialise_write_version(k, v.value, v.version);
+        return true;
+      });
+    }
+
+    bool deserialise_snapshot(D& d) override
+    {
+      // This replaces the entire content of the map with the state read from
+      // a snapshot. The whole state is recorded as the write set of that
+      // version, so that a subsequent compaction passes it to the global
+      // commit hook. The Map expects to be locked during deserialisation.
+      auto map_version = d.deserialise_read_version();
+      auto ctr = d.deserialise_write_header();
+
+      auto transient = State().transient();
+      Write writes;
+      for (size_t i = 0; i < ctr; ++i)
+      {
+        auto w = d.template deserialise_write_version<K, V>();
+        if (!w.has_value() || w->is_remove || deleted(w->version))
+          return false;
+
+        transient.put(w->key, VersionV{w->version, w->value});
+        writes[w->key] = {w->version, w->value};
+      }
+      auto state = transient.persistent();
+
+      LocalCommit empty{0, State(), Write(), IndexStates(indexes.size())};
+      auto index_states = update_indexes(empty, state, writes);
+
+      roll->clear();
+      roll->push_back(
+        {map_version, state, std::move(writes), std::move(index_states)});
+      rollback_counter++;
+      roll_changed = true;
+      return true;
+    }
+
+    void post_deserialise_snapshot() override
+    {
+      // Once a snapshot has been verified, the local hook sees the whole
+      // content of the map as written at the version of the map. This must
+      // run before compaction, which hands the writes over to the global hook.
+      if (!local_hook)
+        return;
+
+      auto& r = roll->back();
+      if (!r.writes.empty())
+        local_hook(r.version, r.state, r.writes);
     }
 
     void lock() override
@@ -806,6 +1721,9 @@ namespace kv
 
     void unlock() override
     {
+      if (roll_changed)
+        publish_last_commit();
+
       sl.unlock();
     }
 
@@ -816,8 +1734,30 @@ namespace kv
         throw std::logic_error(
           "Attempted to swap maps with incompatible types");
 
+      if (indexes.size() != map->indexes.size())
+        throw std::logic_error(
+          "Attempted to swap maps with incompatible indexes");
+
       std::swap(rollback_counter, map->rollback_counter);
       std::swap(roll, map->roll);
+      roll_changed = true;
+      map->roll_changed = true;
+    }
+  };
+
+  // Views allocated in the arena of a transaction are only destroyed, their
+  // memory is reclaimed with the arena
+  template <class S, class D>
+  struct ViewDeleter
+  {
+    bool in_arena = false;
+
+    void operator()(AbstractTxView<S, D>* view) const
+    {
+      if (in_arena)
+        view->~AbstractTxView();
+      else
+        delete view;
     }
   };
 
@@ -828,13 +1768,17 @@ namespace kv
     AbstractMap<S, D>* map;
 
     // Owning pointer of TxView over that map
-    std::unique_ptr<AbstractTxView<S, D>> view;
+    std::unique_ptr<AbstractTxView<S, D>, ViewDeleter<S, D>> view;
   };
 
   // When a collection of Maps are locked, the locks must be acquired in a
   // stable order to avoid deadlocks. This ordered map will claim in name-order
   template <class S, class D>
-  using OrderedViews = std::map<std::string, MapView<S, D>>;
+  using OrderedViews = std::map<
+    std::string,
+    MapView<S, D>,
+    std::less<std::string>,
+    arena::Allocator<std::pair<const std::string, MapView<S, D>>>>;
 
   template <typename SP, typename DP>
   static inline std::
@@ -855,12 +1799,17 @@ namespace kv
   class Tx
   {
   private:
+    // Holds the views of the transaction and their read and write sets, so
+    // that a small transaction does not allocate on the heap until it
+    // commits. It must outlive the views.
+    arena::Arena arena;
     OrderedViews<S, D> view_list;
     bool committed;
     bool success;
     Version read_version;
     Version version;
     bool read_globally_committed = false;
+    bool read_only = false;
 
     kv::TxHistory::RequestID req_id;
 
@@ -893,8 +1842,8 @@ namespace kv
         }
       }
 
-      typename M::TxView* view = m.create_view(read_version);
-      view_list[m.name] = {&m, std::unique_ptr<AbstractTxView<S, D>>(view)};
+      typename M::TxView* view = m.create_view(read_version, &arena, read_only);
+      view_list[m.name] = {&m, {view, {true}}};
       return std::make_tuple(view);
     }
 
@@ -907,7 +1856,7 @@ namespace kv
 
   public:
     Tx() :
-      view_list(),
+      view_list(&arena),
       committed(false),
       success(false),
       read_version(NoVersion),
@@ -921,6 +1870,29 @@ namespace kv
       req_id = req_id_;
     }
 
+    /** Make this a read-only transaction
+     *
+     * A read-only transaction reads from the snapshot of the store at its
+     * read version. Its reads are not recorded, and committing it does not
+     * lock the maps or the store, so that read-only transactions never
+     * conflict. Writing to one of its views throws.
+     */
+    void set_read_only()
+    {
+      if (committed)
+        throw std::logic_error("Transaction already committed");
+
+      for (auto& [name, v] : view_list)
+        v.view->set_read_only();
+
+      read_only = true;
+    }
+
+    bool is_read_only() const
+    {
+      return read_only;
+    }
+
     /** Version for the transaction set
      *
      * @return Committed version, or `kv::NoVersion` otherwise
@@ -984,6 +1956,15 @@ namespace kv
       }
 
       auto store = view_list.begin()->second.map->get_store();
+
+      if (read_only)
+      {
+        // The snapshot the transaction read from is immutable, so there is
+        // nothing to validate or to replicate
+        success = true;
+        return CommitSuccess::OK;
+      }
+
       auto c = commit(view_list, [store]() { return store->next_version(); });
       success = c.has_value();
 
@@ -996,18 +1977,29 @@ namespace kv
       version = c.value();
 
       const std::vector<uint8_t> data = serialise();
+      auto h = store->get_history();
       if (!data.size())
       {
-        auto h = store->get_history();
+#ifdef PBFT
+        // Only PBFT uses the results of requests. Other transactions may be
+        // committed by several worker threads, so they must not get the root
+        // of the history while the store appends to it.
         if (h != nullptr)
         {
           // This tx does not have a write set, so this is a read only tx
           // because of this we are returning NoVersion
           h->add_result(req_id, NoVersion);
         }
+#endif
         return CommitSuccess::OK;
       }
 
+      // Hashed here, concurrently with other transactions being committed,
+      // rather than when the store adds it to the history in order
+      std::optional<crypto::Sha256Hash> leaf;
+      if (h != nullptr)
+        leaf = h->hash_leaf(data);
+
       return store->commit(
         version,
         [data = std::move(data), req_id = std::move(req_id)]()
@@ -1015,7 +2007,8 @@ namespace kv
             tuple<CommitSuccess, TxHistory::RequestID, std::vector<uint8_t>> {
               return {CommitSuccess::OK, std::move(req_id), std::move(data)};
             },
-        false);
+        false,
+        leaf);
     }
 
     /** Commit version if committed
@@ -1112,9 +2105,9 @@ namespace kv
 
       // Retrieve encryptor.
       auto map = view_list.begin()->second.map;
-      auto e = map->get_store()->get_encryptor();
+      auto store = map->get_store();
 
-      S s(e, version);
+      S s(store->get_encryptor(), version, store->get_map_ids());
 
       auto grouped_maps = get_maps_grouped_by_domain(view_list);
 
@@ -1132,7 +2125,7 @@ namespace kv
 
     // Used by frontend for reserved transactions
     Tx(Version reserved) :
-      view_list(),
+      view_list(&arena),
       committed(false),
       success(false),
       read_version(reserved - 1),
@@ -1161,6 +2154,22 @@ namespace kv
       return {CommitSuccess::OK, {0, 0, 0}, std::move(data)};
     }
 
+    /** Discard the views of the transaction, so that it can be executed again
+     *
+     * This is used to retry a transaction that failed to commit because of a
+     * conflict. Once reset, the transaction reads from the current version of
+     * the store.
+     */
+    void reset()
+    {
+      view_list.clear();
+      arena.reset();
+      committed = false;
+      success = false;
+      read_version = NoVersion;
+      version = NoVersion;
+    }
+
     // Set all reads on transaction to read at the global commit version,
     // rather than the local commit.
     void set_read_committed()
@@ -1177,13 +2186,165 @@ namespace kv
     }
   };
 
+  // Transactions committed locally and waiting to be replicated, in a ring
+  // indexed by version. They are added concurrently, and possibly out of
+  // order, by the threads committing them, and are taken in version order by
+  // a single replication stage. Each slot has its own lock, which is only
+  // contended when a transaction is added to the slot as it is being taken.
+  // Transactions whose slot still holds one that has not been replicated,
+  // such as when replication stalls, overflow to a map until they are taken.
+  class PendingTxs
+  {
+  public:
+    struct Entry
+    {
+      PendingTx tx;
+      bool globally_committable = false;
+      // Hash of the transaction in the history, if already computed
+      std::optional<crypto::Sha256Hash> leaf;
+    };
+
+  private:
+    struct Slot
+    {
+      std::atomic_flag lock = ATOMIC_FLAG_INIT;
+      Version version = 0;
+      Entry entry;
+    };
+
+    class SlotGuard
+    {
+    private:
+      Slot& slot;
+
+    public:
+      SlotGuard(Slot& slot_) : slot(slot_)
+      {
+        while (slot.lock.test_and_set())
+          ;
+      }
+
+      ~SlotGuard()
+      {
+        slot.lock.clear();
+      }
+    };
+
+    std::vector<Slot> slots;
+
+    SpinLock overflow_lock;
+    std::map<Version, Entry> overflow;
+    // Size of overflow, so that it is only locked when it is not empty
+    std::atomic<size_t> overflow_size = 0;
+
+    Slot& slot(Version v)
+    {
+      return slots[static_cast<size_t>(v) % slots.size()];
+    }
+
+  public:
+    PendingTxs(size_t capacity) : slots(capacity) {}
+
+    /** Add a transaction
+     *
+     * @param v Version of the transaction
+     * @param entry Transaction
+     * @param replicated Last replicated version
+     */
+    void add(Version v, Entry&& entry, Version replicated)
+    {
+      // The slot may still hold the transaction one lap of the ring earlier,
+      // which has not been replicated yet
+      if (v - static_cast<Version>(slots.size()) > replicated)
+      {
+        std::lock_guard<SpinLock> guard(overflow_lock);
+        overflow[v] = std::move(entry);
+        overflow_size = overflow.size();
+        return;
+      }
+
+      // Any other transaction left in the slot was left behind by a rollback
+      auto& s = slot(v);
+      SlotGuard guard(s);
+      s.version = v;
+      s.entry = std::move(entry);
+    }
+
+    bool ready(Version v)
+    {
+      {
+        auto& s = slot(v);
+        SlotGuard guard(s);
+        if (s.entry.tx && s.version == v)
+          return true;
+      }
+
+      if (overflow_size == 0)
+        return false;
+
+      std::lock_guard<SpinLock> guard(overflow_lock);
+      return overflow.find(v) != overflow.end();
+    }
+
+    /** Take the transaction at a version, if it has been added
+     *
+     * @param v Version of the transaction
+     *
+     * @return Transaction, if it has been added
+     */
+    std::optional<Entry> take(Version v)
+    {
+      {
+        auto& s = slot(v);
+        SlotGuard guard(s);
+        if (s.entry.tx && s.version == v)
+        {
+          std::optional<Entry> r(std::move(s.entry));
+          s.entry.tx = nullptr;
+          return r;
+        }
+      }
+
+      if (overflow_size == 0)
+        return std::nullopt;
+
+      std::lock_guard<SpinLock> guard(overflow_lock);
+      auto search = overflow.find(v);
+      if (search == overflow.end())
+        return std::nullopt;
+
+      std::optional<Entry> r(std::move(search->second));
+      overflow.erase(search);
+      overflow_size = overflow.size();
+      return r;
+    }
+
+    void clear()
+    {
+      for (auto& s : slots)
+      {
+        SlotGuard guard(s);
+        s.entry.tx = nullptr;
+        s.version = 0;
+      }
+
+      std::lock_guard<SpinLock> guard(overflow_lock);
+      overflow.clear();
+      overflow_size = 0;
+    }
+  };
+
   template <class S, class D>
   class Store : public AbstractStore
   {
   public:
     template <class K, class V, class H = std::hash<K>>
     using Map = Map<K, V, H, S, D>;
+    template <class K, class V>
+    using OrderedMap = kv::Map<K, V, std::hash<K>, S, D, OrderedState>;
     using Tx = Tx<S, D>;
+    using Serialiser = S;
+    using Deserialiser = D;
 
   private:
     // All collections of Map must be ordered so that we lock their contained
@@ -1191,19 +2352,32 @@ namespace kv
     using Maps = std::map<std::string, std::unique_ptr<AbstractMap<S, D>>>;
     Maps maps;
 
+    // Serialised transactions refer to maps by id. Deserialised ones are
+    // applied to the maps found here, or else by name, under maps_lock.
+    MapIds map_ids;
+    std::vector<AbstractMap<S, D>*> maps_by_id;
+
     std::shared_ptr<Consensus> consensus = nullptr;
     std::shared_ptr<TxHistory> history = nullptr;
     std::shared_ptr<AbstractTxEncryptor> encryptor = nullptr;
-    Version version = 0;
-    Version compacted = 0;
+    std::shared_ptr<AbstractHistoricalStates<S, D>> historical_states =
+      nullptr;
+    std::atomic<Version> version = 0;
+    std::atomic<Version> compacted = 0;
 
     SpinLock maps_lock;
+    // Serialises compaction, rollback and deserialisation with the history,
+    // and with each replicated batch. Versions are allocated, and committed
+    // transactions are added to pending_txs, without it.
     SpinLock version_lock;
 
-    std::unordered_map<Version, std::pair<PendingTx, bool>> pending_txs;
-    Version last_replicated = 0;
-    Version last_committable = 0;
-    Version rollback_count = 0;
+    static constexpr size_t max_pending_txs = 1024;
+    PendingTxs pending_txs{max_pending_txs};
+    std::atomic<Version> last_replicated = 0;
+    std::atomic<Version> last_committable = 0;
+    std::atomic<Version> rollback_count = 0;
+    // Set while a thread takes and replicates pending transactions
+    std::atomic<bool> replicating = false;
 
     template <typename SP, typename DP>
     inline std::map<kv::SecurityDomain, std::vector<AbstractMap<SP, DP>*>>
@@ -1220,6 +2394,146 @@ namespace kv
       return grouped_maps;
     }
 
+    // Transactions may be committed concurrently, and out of order. Only the
+    // next transactions in version order are batched, by a single thread at
+    // a time, which replicates them before taking the next batch. A thread
+    // that finds another one replicating leaves its transaction to it.
+    CommitSuccess replicate_pending(const std::shared_ptr<Consensus>& r)
+    {
+      while (true)
+      {
+        bool expected = false;
+        if (!replicating.compare_exchange_strong(expected, true))
+          return CommitSuccess::OK;
+
+        std::vector<std::tuple<Version, std::vector<uint8_t>, bool>> batch;
+        Version previous_rollback_count = rollback_count;
+        Version previous_last_replicated = last_replicated;
+        auto h = get_history();
+
+        for (auto v = previous_last_replicated + 1; true; ++v)
+        {
+          // Transactions are added to the history under version_lock, which
+          // compaction, rollback and snapshots also take. Those taken before
+          // a rollback are dropped, as it discarded them.
+          std::lock_guard<SpinLock> vguard(version_lock);
+          if (rollback_count != previous_rollback_count)
+          {
+            batch.clear();
+            break;
+          }
+
+          auto pending = pending_txs.take(v);
+          if (!pending.has_value())
+            break;
+
+          auto& [pending_tx_, committable_, leaf_] = pending.value();
+          auto [success_, reqid, data_] = pending_tx_();
+
+          // NB: this cannot happen currently. Regular Tx only make it here
+          // if they did succeed, and signatures cannot conflict because they
+          // execute in order with a read_version that's version - 1, so even
+          // two contiguous signatures are fine
+          if (success_ != CommitSuccess::OK)
+            LOG_DEBUG_FMT("Failed Tx commit {}", v);
+
+          // Transactions are hashed by the threads that committed them, so
+          // that only adding their hashes to the history is done in order.
+          // Those that are only serialised here, such as signatures, are
+          // hashed here.
+          if (h)
+          {
+            if (leaf_.has_value())
+              h->add_result(reqid, v, leaf_.value());
+            else
+              h->add_result(reqid, v, data_);
+          }
+
+          LOG_DEBUG_FMT("Batching {} ({})", v, data_.size());
+          batch.emplace_back(v, std::move(data_), committable_);
+        }
+
+        if (batch.size() == 0)
+        {
+          replicating = false;
+
+          // The next transaction may have been added after it was looked
+          // for, by a thread that found this one replicating
+          if (pending_txs.ready(last_replicated + 1))
+            continue;
+
+          return CommitSuccess::OK;
+        }
+
+        auto replicated = r->replicate(batch);
+
+        // Transactions that failed to replicate have been taken, and are
+        // dropped as they were before. They are skipped over, so that the
+        // following ones are not left waiting for them.
+        {
+          std::lock_guard<SpinLock> vguard(version_lock);
+          if (
+            last_replicated == previous_last_replicated &&
+            previous_rollback_count == rollback_count)
+            last_replicated = previous_last_replicated + batch.size();
+        }
+
+        replicating = false;
+
+        if (!replicated)
+        {
+          LOG_DEBUG_FMT("Failed to replicate");
+          return CommitSuccess::NO_REPLICATE;
+        }
+      }
+    }
+
+    // Find the map that a deserialised transaction at version v refers to,
+    // and record its name if the transaction does. Expects maps_lock to be
+    // held.
+    AbstractMap<S, D>* find_map(const MapStart& start, Version v)
+    {
+      if (!start.id.has_value())
+      {
+        // Transactions in the legacy format do not record ids
+        auto search = maps.find(start.name.value());
+        return search == maps.end() ? nullptr : search->second.get();
+      }
+
+      auto id = start.id.value();
+      if (start.name.has_value())
+      {
+        // Ids that previously referred to another map, or that this map
+        // previously had, are no longer valid
+        if (!map_ids.record(id, start.name.value(), v))
+          maps_by_id.clear();
+      }
+      else if (id < maps_by_id.size() && maps_by_id[id] != nullptr)
+      {
+        return maps_by_id[id];
+      }
+
+      auto name = start.name.has_value() ? start.name : map_ids.get_name(id);
+      if (!name.has_value())
+        return nullptr;
+
+      auto search = maps.find(name.value());
+      if (search == maps.end())
+        return nullptr;
+
+      if (id >= maps_by_id.size())
+        maps_by_id.resize(id + 1, nullptr);
+      maps_by_id[id] = search->second.get();
+      return search->second.get();
+    }
+
+    static std::string describe(const MapStart& start)
+    {
+      return start.name.has_value() ?
+        start.name.value() :
+        fmt::format("with id {}", start.id.value());
+    }
+
   public:
     // TODO(#api): This (along with other parts of the API) should be
     // hidden
@@ -1234,6 +2548,9 @@ namespace kv
       {
         maps[name] = std::unique_ptr<AbstractMap<S, D>>(map->clone(this));
       }
+
+      map_ids.copy_from(target.map_ids);
+      maps_by_id.clear();
     }
 
     Store() {}
@@ -1272,6 +2589,22 @@ namespace kv
       return encryptor;
     }
 
+    MapIds& get_map_ids() override
+    {
+      return map_ids;
+    }
+
+    void set_historical_states(
+      std::shared_ptr<AbstractHistoricalStates<S, D>> historical_states_)
+    {
+      historical_states = historical_states_;
+    }
+
+    std::shared_ptr<AbstractHistoricalStates<S, D>> get_historical_states()
+    {
+      return historical_states;
+    }
+
     template <class K, class V, class H = std::hash<K>>
     Map<K, V, H>* get(std::string name)
     {
@@ -1310,6 +2643,7 @@ namespace kv
      *
      * @param name Map name
      * @param global_hook Handler to execute on global commit
+     * @param indexes Secondary indexes maintained on the map
      *
      * @return Newly created Map
      */
@@ -1318,10 +2652,11 @@ namespace kv
       std::string name,
       SecurityDomain security_domain = kv::SecurityDomain::PRIVATE,
       typename Map<K, V, H>::CommitHook local_hook = nullptr,
-      typename Map<K, V, H>::CommitHook global_hook = nullptr)
+      typename Map<K, V, H>::CommitHook global_hook = nullptr,
+      typename Map<K, V, H>::Indexes indexes = {})
     {
       return create<Map<K, V, H>>(
-        name, security_domain, local_hook, global_hook);
+        name, security_domain, local_hook, global_hook, indexes);
     }
 
     /** Create a Map
@@ -1331,6 +2666,7 @@ namespace kv
      *
      * @param name Map name
      * @param global_hook Handler to execute on global commit
+     * @param indexes Secondary indexes maintained on the map
      *
      * @return Newly created Map
      */
@@ -1339,7 +2675,8 @@ namespace kv
       std::string name,
       SecurityDomain security_domain = kv::SecurityDomain::PRIVATE,
       typename M::CommitHook local_hook = nullptr,
-      typename M::CommitHook global_hook = nullptr)
+      typename M::CommitHook global_hook = nullptr,
+      typename M::Indexes indexes = {})
     {
       std::lock_guard<SpinLock> mguard(maps_lock);
 
@@ -1347,7 +2684,8 @@ namespace kv
       if (search != maps.end())
         throw std::logic_error("Map already exists");
 
-      auto result = new M(this, name, security_domain, local_hook, global_hook);
+      auto result =
+        new M(this, name, security_domain, local_hook, global_hook, indexes);
       maps[name] = std::unique_ptr<AbstractMap<S, D>>(result);
       return *result;
     }
@@ -1406,6 +2744,9 @@ namespace kv
       for (auto& map : maps)
         map.second->unlock();
 
+      map_ids.rollback(v);
+      maps_by_id.clear();
+
       std::lock_guard<SpinLock> vguard(version_lock);
       version = v;
       last_replicated = v;
@@ -1417,16 +2758,73 @@ namespace kv
         h->rollback(v);
     }
 
-    DeserialiseSuccess deserialise(
-      const std::vector<uint8_t>& data,
-      bool public_only = false,
-      Term* term = nullptr) override
+    /** Serialise a snapshot of all maps
+     *
+     * The snapshot contains every live entry of every map at the globally
+     * committed version v, along with the serialised history, so that a
+     * signature at v can be verified when the snapshot is loaded. Private
+     * maps are encrypted in the same way as they are in transactions.
+     *
+     * @param v Version of the snapshot, must be the commit version
+     *
+     * @return Serialised snapshot
+     */
+    std::vector<uint8_t> serialise_snapshot(Version v) override
+    {
+      std::lock_guard<SpinLock> mguard(maps_lock);
+
+      // Signatures are serialised, and so lock their map, while the
+      // version_lock is held, so it must not be taken with maps locked
+      std::vector<uint8_t> tree;
+      {
+        std::lock_guard<SpinLock> vguard(version_lock);
+        if (v != compacted)
+          throw std::logic_error(fmt::format(
+            "Cannot snapshot at {}, commit version is {}",
+            v,
+            compacted.load()));
+
+        auto h = get_history();
+        if (h)
+          tree = h->serialise_tree();
+      }
+
+      for (auto& map : maps)
+        map.second->lock();
+
+      S s(get_encryptor(), v, map_ids, true);
+      s.serialise_raw(tree);
+
+      for (auto& [domain, domain_maps] : get_maps_grouped_by_domain(maps))
+      {
+        for (auto map : domain_maps)
+          map->serialise_snapshot(s, v);
+      }
+
+      for (auto& map : maps)
+        map.second->unlock();
+
+      return s.get_raw_data();
+    }
+
+    /** Load a snapshot produced by serialise_snapshot
+     *
+     * This replaces the content of all maps with the content of the
+     * snapshot. Maps that are not present in the snapshot are cleared. The
+     * store is then considered compacted at the version of the snapshot, and
+     * global hooks are run with the entire content of each map. If the
+     * store has a history, the snapshot signature is verified.
+     *
+     * @param data Serialised snapshot
+     * @param public_only If true, only the public maps are loaded, and the
+     * private ones are cleared
+     *
+     * @return `kv::DeserialiseSuccess::FAILED` if the snapshot could not be
+     * loaded, in which case the store is cleared
+     */
+    DeserialiseSuccess deserialise_snapshot(
+      const std::vector<uint8_t>& data, bool public_only = false) override
     {
-      // This will return FAILED if the serialised transaction is being
-      // applied out of order.
-      // Processing transactions locally and also deserialising to the
-      // same store will result in a store version mismatch and
-      // deserialisation will then fail.
       auto e = get_encryptor();
       D d(
         e,
@@ -1434,10 +2832,193 @@ namespace kv
                       std::optional<kv::SecurityDomain>());
       if (!d.init(data))
       {
-        LOG_FAIL_FMT("Initialisation of deserialise object failed");
+        LOG_FAIL_FMT("Initialisation of snapshot deserialise object failed");
         return DeserialiseSuccess::FAILED;
       }
 
+      Version v = d.template deserialise_version<Version>();
+      auto tree = d.deserialise_raw();
+      LOG_DEBUG_FMT("Deserialising snapshot at {}", v);
+
+      std::lock_guard<SpinLock> mguard(maps_lock);
+
+      for (auto& map : maps)
+        map.second->lock();
+
+      std::unordered_set<std::string> present;
+      bool ok = true;
+
+      // The snapshot records the ids of all its maps, which later
+      // transactions may refer to
+      map_ids.rollback(v);
+      maps_by_id.clear();
+
+      for (auto r = d.start_map(); r.has_value(); r = d.start_map())
+      {
+        auto map = find_map(r.value(), v);
+        if (map == nullptr)
+        {
+          LOG_FAIL_FMT("No such map {} in snapshot at {}", describe(*r), v);
+          ok = false;
+          break;
+        }
+
+        const auto& map_name = map->get_name();
+        if (!present.insert(map_name).second)
+        {
+          LOG_FAIL_FMT("Map {} repeated in snapshot at {}", map_name, v);
+          ok = false;
+          break;
+        }
+
+        if (!map->deserialise_snapshot(d))
+        {
+          LOG_FAIL_FMT(
+            "Could not deserialise map {} in snapshot at {}", map_name, v);
+          ok = false;
+          break;
+        }
+      }
+
+      if (ok && !d.end())
+      {
+        LOG_FAIL_FMT("Unexpected content in snapshot at {}", v);
+        ok = false;
+      }
+
+      for (auto& [name, map] : maps)
+      {
+        if (!ok || present.find(name) == present.end())
+          map->clear();
+      }
+
+      if (!ok)
+      {
+        map_ids.clear();
+        maps_by_id.clear();
+      }
+
+      for (auto& map : maps)
+        map.second->unlock();
+
+      {
+        std::lock_guard<SpinLock> vguard(version_lock);
+        version = ok ? v : 0;
+        compacted = version.load();
+        last_replicated = version.load();
+        last_committable = version.load();
+        rollback_count++;
+        pending_txs.clear();
+      }
+
+      // The history verifies the signature at v over the content of the
+      // snapshot, which requires the maps to be readable.
+      auto h = get_history();
+      if (ok && h && !h->init_from_snapshot(tree, v))
+      {
+        LOG_FAIL_FMT("Signature in snapshot at {} failed to verify", v);
+        ok = false;
+
+        for (auto& map : maps)
+          map.second->lock();
+
+        for (auto& map : maps)
+          map.second->clear();
+
+        for (auto& map : maps)
+          map.second->unlock();
+
+        map_ids.clear();
+        maps_by_id.clear();
+
+        std::lock_guard<SpinLock> vguard(version_lock);
+        version = 0;
+        compacted = 0;
+        last_replicated = 0;
+        last_committable = 0;
+      }
+
+      if (!ok)
+        return DeserialiseSuccess::FAILED;
+
+      for (auto& map : maps)
+        map.second->lock();
+
+      for (auto& map : maps)
+        map.second->post_deserialise_snapshot();
+
+      for (auto& map : maps)
+        map.second->compact(v);
+
+      for (auto& map : maps)
+        map.second->unlock();
+
+      for (auto& map : maps)
+        map.second->post_compact();
+
+      return DeserialiseSuccess::PASS;
+    }
+
+    /** Decrypt a serialised transaction, ahead of it being applied.
+     *
+     * This does not depend on the state of the store, so transactions may be
+     * prepared concurrently, and in any order, as long as each thread uses its
+     * own encryptor.
+     *
+     * @param data Serialised transaction, which must outlive the result
+     * @param encryptor Encryptor used to decrypt the private domain
+     * @param public_only Whether to only deserialise the public domain
+     *
+     * @return Deserialiser to pass to `apply_deserialise()`, or nullptr if
+     * the transaction could not be decrypted
+     */
+    static std::unique_ptr<D> prepare_deserialise(
+      const std::vector<uint8_t>& data,
+      std::shared_ptr<AbstractTxEncryptor> encryptor,
+      bool public_only = false)
+    {
+      auto d = std::make_unique<D>(
+        encryptor,
+        public_only ? kv::SecurityDomain::PUBLIC :
+                      std::optional<kv::SecurityDomain>());
+      if (!d->init(data))
+      {
+        LOG_FAIL_FMT("Initialisation of deserialise object failed");
+        return nullptr;
+      }
+
+      return d;
+    }
+
+    DeserialiseSuccess deserialise(
+      const std::vector<uint8_t>& data,
+      bool public_only = false,
+      Term* term = nullptr) override
+    {
+      auto d = prepare_deserialise(data, get_encryptor(), public_only);
+      if (!d)
+        return DeserialiseSuccess::FAILED;
+
+      return apply_deserialise(*d, data, term);
+    }
+
+    /** Apply a transaction prepared by `prepare_deserialise()`.
+     *
+     * Transactions must be applied in order, from the thread that owns the
+     * store.
+     *
+     * @param d Deserialiser for the transaction
+     * @param data Serialised transaction, as passed to `prepare_deserialise()`
+     * @param term Term of the transaction, set if it contains a signature
+     */
+    DeserialiseSuccess apply_deserialise(
+      D& d, const std::vector<uint8_t>& data, Term* term = nullptr)
+    {
+      // This will return FAILED if the serialised transaction is being
+      // applied out of order.
+      // Processing transactions locally and also deserialising to the
+      // same store will result in a store version mismatch and
+      // deserialisation will then fail.
       Version v = d.template deserialise_version<Version>();
       LOG_DEBUG_FMT("Deserialising {}", v);
 
@@ -1459,20 +3040,18 @@ namespace kv
       // need snapshot isolation on the map state, and so do not need to
       // lock all the maps before creating the transaction.
       OrderedViews<S, D> views;
-      std::unordered_set<std::string> present;
       std::lock_guard<SpinLock> mguard(maps_lock);
 
       for (auto r = d.start_map(); r.has_value(); r = d.start_map())
       {
-        const auto map_name = r.value();
-
-        auto search = maps.find(map_name);
-        if (search == maps.end())
+        auto map = find_map(r.value(), v);
+        if (map == nullptr)
         {
-          LOG_FAIL_FMT("No such map {} at version {}", map_name, v);
+          LOG_FAIL_FMT("No such map {} at version {}", describe(*r), v);
           return DeserialiseSuccess::FAILED;
         }
 
+        const auto& map_name = map->get_name();
         auto view_search = views.find(map_name);
         if (view_search != views.end())
         {
@@ -1480,16 +3059,14 @@ namespace kv
           return DeserialiseSuccess::FAILED;
         }
 
-        auto view = search->second->create_view(v);
+        auto view = map->create_view(v);
+        views[map_name] = {map, {view, {false}}};
         if (!view->deserialise(d, v))
         {
           LOG_FAIL_FMT(
             "Could not deserialise Tx for map {} at version {}", map_name, v);
           return DeserialiseSuccess::FAILED;
         }
-
-        views[map_name] = {search->second.get(),
-                           std::unique_ptr<AbstractTxView<S, D>>(view)};
       }
 
       if (!d.end())
@@ -1573,20 +3150,19 @@ namespace kv
 
     Version current_version() override
     {
-      // Must lock in case the version is being incremented.
-      std::lock_guard<SpinLock> vguard(version_lock);
       return version;
     }
 
     Version commit_version() override
     {
-      // Must lock in case the store is being compacted.
-      std::lock_guard<SpinLock> vguard(version_lock);
       return compacted;
     }
 
     CommitSuccess commit(
-      Version version, PendingTx pending_tx, bool globally_committable) override
+      Version version,
+      PendingTx pending_tx,
+      bool globally_committable,
+      std::optional<crypto::Sha256Hash> leaf = std::nullopt) override
     {
       auto r = get_consensus();
       if (!r)
@@ -1597,89 +3173,38 @@ namespace kv
         version,
         (globally_committable ? " globally_committable" : ""));
 
-      std::vector<std::tuple<Version, std::vector<uint8_t>, bool>> batch;
-      Version previous_last_replicated = 0;
-      Version next_last_replicated = 0;
-      Version previous_rollback_count = 0;
-
+      if (globally_committable)
       {
-        std::lock_guard<SpinLock> vguard(version_lock);
-        if (globally_committable && version > last_committable)
-          last_committable = version;
-
-        pending_txs.insert({version, {pending_tx, globally_committable}});
-
-        auto h = get_history();
-
-        for (Version offset = 1; true; ++offset)
-        {
-          auto search = pending_txs.find(last_replicated + offset);
-          if (search == pending_txs.end())
-            break;
-
-          auto& [pending_tx_, committable_] = search->second;
-          auto [success_, reqid, data_] = pending_tx_();
-
-          // NB: this cannot happen currently. Regular Tx only make it here if
-          // they did succeed, and signatures cannot conflict because they
-          // execute in order with a read_version that's version - 1, so even
-          // two contiguous signatures are fine
-          if (success_ != CommitSuccess::OK)
-            LOG_DEBUG_FMT("Failed Tx commit {}", last_replicated + offset);
-
-          if (h)
-          {
-            h->add_result(reqid, version, data_);
-          }
-
-          LOG_DEBUG_FMT(
-            "Batching {} ({})", last_replicated + offset, data_.size());
-          batch.emplace_back(
-            last_replicated + offset, std::move(data_), committable_);
-          pending_txs.erase(search);
-        }
-
-        if (batch.size() == 0)
-          return CommitSuccess::OK;
-
-        previous_rollback_count = rollback_count;
-        previous_last_replicated = last_replicated;
-        next_last_replicated = last_replicated + batch.size();
+        auto committable = last_committable.load();
+        while (
+          version > committable &&
+          !last_committable.compare_exchange_weak(committable, version))
+          ;
       }
 
-      if (r->replicate(batch))
-      {
-        std::lock_guard<SpinLock> vguard(version_lock);
-        if (
-          last_replicated == previous_last_replicated &&
-          previous_rollback_count == rollback_count)
-          last_replicated = next_last_replicated;
-        return CommitSuccess::OK;
-      }
-      else
-      {
-        std::lock_guard<SpinLock> vguard(version_lock);
-        LOG_DEBUG_FMT("Failed to replicate");
-        return CommitSuccess::NO_REPLICATE;
-      }
+      pending_txs.add(
+        version,
+        {std::move(pending_tx), globally_committable, std::move(leaf)},
+        last_replicated);
+
+      return replicate_pending(r);
     }
 
     Version next_version() override
     {
-      std::lock_guard<SpinLock> vguard(version_lock);
-
       // Get the next global version. If we would go negative, wrap to 0.
-      ++version;
-
-      if (version < 0)
-        version = 0;
+      auto v = version.load();
+      Version next;
+      do
+      {
+        next = v < std::numeric_limits<Version>::max() ? v + 1 : 0;
+      } while (!version.compare_exchange_weak(v, next));
 
-      return version;
+      return next;
     }
 
     size_t commit_gap() override
     {
-      std::lock_guard<SpinLock> vguard(version_lock);
       return version - last_committable;
     }
 
@@ -1697,6 +3222,9 @@ namespace kv
       for (auto& map : maps)
         map.second->unlock();
 
+      map_ids.clear();
+      maps_by_id.clear();
+
       version = 0;
       compacted = 0;
       last_replicated = 0;
@@ -4,12 +4,16 @@
 
 #include "consensus/consensustypes.h"
 #include "crypto/hash.h"
+#include "ds/arena.h"
 
 #include <array>
 #include <chrono>
+#include <exception>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <optional>
+#include <string>
 #include <unordered_set>
 #include <vector>
 
@@ -51,6 +55,43 @@ namespace kv
     PASS_SIGNATURE = 2
   };
 
+  // Thrown when reading the state at a past version that is not available
+  // yet. The read can be retried once the state has been rebuilt.
+  class HistoricalStateUnavailable : public std::exception
+  {
+  private:
+    std::string msg;
+
+  public:
+    HistoricalStateUnavailable(Version v) :
+      msg("State at version " + std::to_string(v) + " is not available yet")
+    {}
+
+    virtual const char* what() const throw()
+    {
+      return msg.c_str();
+    }
+  };
+
+  // Thrown when reading the state at a past version that is not in the local
+  // ledger, because the node started from a later snapshot. The read cannot
+  // be served by this node.
+  class HistoricalStatePruned : public std::exception
+  {
+  private:
+    std::string msg;
+
+  public:
+    HistoricalStatePruned(Version v) :
+      msg("State at version " + std::to_string(v) + " is not in the ledger")
+    {}
+
+    virtual const char* what() const throw()
+    {
+      return msg.c_str();
+    }
+  };
+
   class TxHistory
   {
   public:
@@ -96,8 +137,13 @@ namespace kv
       uint64_t caller_id,
       const std::vector<uint8_t>& caller_cert,
       const std::vector<uint8_t>& request) = 0;
+    // Hashing a transaction may be done concurrently, by the thread that
+    // committed it, ahead of its hash being added to the history in order
+    virtual crypto::Sha256Hash hash_leaf(const std::vector<uint8_t>& data) = 0;
     virtual void add_result(
       RequestID id, kv::Version version, const std::vector<uint8_t>& data) = 0;
+    virtual void add_result(
+      RequestID id, kv::Version version, const crypto::Sha256Hash& leaf) = 0;
     virtual void add_result(RequestID id, kv::Version version) = 0;
     virtual void add_response(
       RequestID id, const std::vector<uint8_t>& response) = 0;
@@ -106,6 +152,9 @@ namespace kv
     virtual void clear_on_result() = 0;
     virtual void clear_on_response() = 0;
     virtual crypto::Sha256Hash get_root() = 0;
+    virtual std::vector<uint8_t> serialise_tree() = 0;
+    virtual bool init_from_snapshot(
+      const std::vector<uint8_t>& tree, Version v) = 0;
   };
 
   class Consensus
@@ -192,6 +241,8 @@ namespace kv
     virtual void enable_all_domains() {}
     virtual void resume_replication() {}
     virtual void suspend_replication(kv::Version) {}
+    virtual void set_durable_seqno(SeqNo, size_t) {}
+    virtual void set_snapshot(SeqNo, const std::vector<uint8_t>&) {}
 
     virtual void set_f(ccf::NodeId f) = 0;
   };
@@ -218,6 +269,8 @@ namespace kv
     virtual size_t get_header_length() = 0;
   };
 
+  class MapIds;
+
   class AbstractStore
   {
   public:
@@ -234,10 +287,17 @@ namespace kv
       Term* term = nullptr) = 0;
     virtual void compact(Version v) = 0;
     virtual void rollback(Version v) = 0;
+    virtual std::vector<uint8_t> serialise_snapshot(Version v) = 0;
+    virtual DeserialiseSuccess deserialise_snapshot(
+      const std::vector<uint8_t>& data, bool public_only = false) = 0;
     // TODO (#api): split out?
     virtual CommitSuccess commit(
-      Version v, PendingTx pt, bool globally_committable) = 0;
+      Version v,
+      PendingTx pt,
+      bool globally_committable,
+      std::optional<crypto::Sha256Hash> leaf = std::nullopt) = 0;
     virtual size_t commit_gap() = 0;
+    virtual MapIds& get_map_ids() = 0;
   };
 
   template <class S, class D>
@@ -254,6 +314,7 @@ namespace kv
     virtual bool deserialise(D& d, Version version) = 0;
     virtual Version start_order() = 0;
     virtual Version end_order() = 0;
+    virtual void set_read_only() = 0;
   };
 
   template <class S, class D>
@@ -265,7 +326,13 @@ namespace kv
     virtual bool operator!=(const AbstractMap<S, D>& that) const = 0;
 
     virtual AbstractStore* get_store() = 0;
-    virtual AbstractTxView<S, D>* create_view(Version version) = 0;
+    virtual const std::string& get_name() const = 0;
+    // Views are allocated from the arena if there is one, or else on the heap.
+    // Views of read-only transactions are created without locking the map.
+    virtual AbstractTxView<S, D>* create_view(
+      Version version,
+      arena::Arena* arena = nullptr,
+      bool read_only = false) = 0;
     virtual void compact(Version v) = 0;
     virtual void post_compact() = 0;
     virtual void rollback(Version v) = 0;
@@ -273,6 +340,9 @@ namespace kv
     virtual void unlock() = 0;
     virtual SecurityDomain get_security_domain() = 0;
     virtual void clear() = 0;
+    virtual void serialise_snapshot(S& s, Version v) = 0;
+    virtual bool deserialise_snapshot(D& d) = 0;
+    virtual void post_deserialise_snapshot() = 0;
 
     virtual AbstractMap<S, D>* clone(AbstractStore* store) = 0;
     virtual void swap(AbstractMap<S, D>* map) = 0;
@@ -0,0 +1,208 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <msgpack-c/msgpack.hpp>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <type_traits>
+#include <vector>
+
+namespace kv
+{
+  // Buffer of a deserialised ledger entry, shared by the values read from it
+  using EntryBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+  // Value of a map that is decoded and encoded at most once.
+  //
+  // Values read from the ledger are kept as msgpack-encoded slices of their
+  // entry, and only decoded the first time they are read. Values written by
+  // a transaction are encoded the first time they are serialised, and keep
+  // their encoding. Either way, serialising a value again, in a transaction
+  // that rewrites it, in a snapshot, or on a follower, copies its encoding.
+  //
+  // Copies share the encoded and the decoded value. A value read from the
+  // ledger keeps the whole buffer of its entry alive, so this suits maps with
+  // large values, most of which are not read on followers.
+  template <typename T>
+  class LazyValue
+  {
+  private:
+    struct Cell
+    {
+      // Entry the value was read from, or its own encoding
+      EntryBuffer buffer;
+      const char* data = nullptr;
+      size_t size = 0;
+      std::once_flag encoded;
+
+      T value;
+      std::once_flag decoded;
+
+      Cell(T&& value_) : value(std::move(value_))
+      {
+        std::call_once(decoded, []() {});
+      }
+
+      Cell(EntryBuffer buffer_, const char* data_, size_t size_) :
+        buffer(std::move(buffer_)),
+        data(data_),
+        size(size_),
+        value()
+      {
+        std::call_once(encoded, []() {});
+      }
+    };
+
+    // Stream to which msgpack packs a value
+    struct Encoding
+    {
+      std::vector<uint8_t> bytes;
+
+      void write(const char* data, size_t size)
+      {
+        bytes.insert(bytes.end(), data, data + size);
+      }
+    };
+
+    std::shared_ptr<Cell> cell;
+
+    static bool reference(msgpack::type::object_type, size_t, void*)
+    {
+      return true;
+    }
+
+  public:
+    LazyValue() : LazyValue(T()) {}
+
+    LazyValue(const T& value) : LazyValue(T(value)) {}
+
+    LazyValue(T&& value) : cell(std::make_shared<Cell>(std::move(value))) {}
+
+    /** Value encoded in [data, data + size), which must be in buffer
+     */
+    LazyValue(EntryBuffer buffer, const char* data, size_t size) :
+      cell(std::make_shared<Cell>(std::move(buffer), data, size))
+    {}
+
+    const T& get() const
+    {
+      std::call_once(cell->decoded, [this]() {
+        auto oh = msgpack::unpack(cell->data, cell->size, reference);
+        oh->convert(cell->value);
+      });
+      return cell->value;
+    }
+
+    const T& operator*() const
+    {
+      return get();
+    }
+
+    const T* operator->() const
+    {
+      return &get();
+    }
+
+    /** Encoded value, encoding it if it has not been encoded yet
+     *
+     * @return Pointer to the encoded value, and its size
+     */
+    std::pair<const char*, size_t> get_serialised() const
+    {
+      std::call_once(cell->encoded, [this]() {
+        Encoding e;
+        msgpack::pack(e, cell->value);
+        auto buffer =
+          std::make_shared<const std::vector<uint8_t>>(std::move(e.bytes));
+        cell->data = reinterpret_cast<const char*>(buffer->data());
+        cell->size = buffer->size();
+        cell->buffer = std::move(buffer);
+      });
+      return {cell->data, cell->size};
+    }
+
+    /** Whether a and b are the same value, or have the same encoding,
+     * without decoding them
+     */
+    static bool same(const LazyValue& a, const LazyValue& b)
+    {
+      if (a.cell == b.cell)
+        return true;
+
+      auto [a_data, a_size] = a.get_serialised();
+      auto [b_data, b_size] = b.get_serialised();
+      return a_size == b_size && std::memcmp(a_data, b_data, a_size) == 0;
+    }
+  };
+
+  // Values with different encodings may still be equal, for instance if they
+  // contain unordered containers, so these are decoded and compared
+  template <typename T>
+  auto operator==(const LazyValue<T>& a, const LazyValue<T>& b)
+    -> decltype(a.get() == b.get())
+  {
+    return LazyValue<T>::same(a, b) || a.get() == b.get();
+  }
+
+  template <typename T>
+  auto operator!=(const LazyValue<T>& a, const LazyValue<T>& b)
+    -> decltype(a.get() != b.get())
+  {
+    return !LazyValue<T>::same(a, b) && a.get() != b.get();
+  }
+
+  template <typename T>
+  struct is_lazy_value : std::false_type
+  {};
+
+  template <typename T>
+  struct is_lazy_value<LazyValue<T>> : std::true_type
+  {};
+
+  template <typename T>
+  void to_json(nlohmann::json& j, const LazyValue<T>& v)
+  {
+    j = v.get();
+  }
+
+  template <typename T>
+  void from_json(const nlohmann::json& j, LazyValue<T>& v)
+  {
+    v = LazyValue<T>(j.get<T>());
+  }
+}
+
+namespace msgpack
+{
+  MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+  {
+    namespace adaptor
+    {
+      template <typename T>
+      struct pack<kv::LazyValue<T>>
+      {
+        template <typename Stream>
+        msgpack::packer<Stream>& operator()(
+          msgpack::packer<Stream>& o, const kv::LazyValue<T>& v) const
+        {
+          o.pack(v.get());
+          return o;
+        }
+      };
+
+      template <typename T>
+      struct convert<kv::LazyValue<T>>
+      {
+        const msgpack::object& operator()(
+          const msgpack::object& o, kv::LazyValue<T>& v) const
+        {
+          v = kv::LazyValue<T>(o.as<T>());
+          return o;
+        }
+      };
+    }
+  }
+}
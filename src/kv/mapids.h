@@ -0,0 +1,196 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ds/spinlock.h"
+#include "kvtypes.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kv
+{
+  using MapId = uint32_t;
+
+  // Start of a map in a serialised transaction. The name is only set if the
+  // transaction records it.
+  struct MapStart
+  {
+    // Transactions in the legacy format only refer to maps by name
+    std::optional<MapId> id;
+    std::optional<std::string> name;
+  };
+
+  // Interns map names to small integer ids, by which serialised transactions
+  // refer to maps. The first transaction in the ledger to refer to a map
+  // records its name along with its id, and later ones only its id.
+  //
+  // Ids recorded by transactions that are rolled back are forgotten, and may
+  // be assigned to another map. A name read from the ledger replaces any
+  // previous assignment of its id, or of its name.
+  class MapIds
+  {
+  private:
+    // Ids assigned to maps in a snapshot, but not recorded in the ledger
+    // yet, are recorded by the next transaction that refers to them
+    static constexpr Version unrecorded = std::numeric_limits<Version>::max();
+
+    struct Entry
+    {
+      std::string name;
+      // Version of the first transaction recording the name
+      Version recorded_at;
+    };
+
+    SpinLock lock;
+    // Indexed by id
+    std::vector<std::optional<Entry>> entries;
+    std::unordered_map<std::string, MapId> ids;
+
+    MapId assign(const std::string& name, Version v)
+    {
+      auto id = static_cast<MapId>(entries.size());
+      entries.push_back(Entry{name, v});
+      ids[name] = id;
+      return id;
+    }
+
+    void erase(MapId id)
+    {
+      ids.erase(entries[id]->name);
+      entries[id].reset();
+
+      while (!entries.empty() && !entries.back().has_value())
+        entries.pop_back();
+    }
+
+  public:
+    MapIds() = default;
+    MapIds(const MapIds& that) = delete;
+
+    /** Get the id of a map in the transaction at version v
+     *
+     * @return Id of the map, and whether the transaction must record its name
+     */
+    std::pair<MapId, bool> intern(const std::string& name, Version v)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      auto search = ids.find(name);
+      if (search == ids.end())
+        return {assign(name, v), true};
+
+      // Transactions may be serialised out of order, so the name is recorded
+      // again by any transaction earlier than the one that recorded it
+      auto& entry = entries[search->second].value();
+      if (entry.recorded_at < v)
+        return {search->second, false};
+
+      entry.recorded_at = v;
+      return {search->second, true};
+    }
+
+    /** Get the id of a map in a snapshot, which records all names
+     */
+    MapId snapshot_id(const std::string& name)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      auto search = ids.find(name);
+      if (search != ids.end())
+        return search->second;
+
+      return assign(name, unrecorded);
+    }
+
+    /** Record the name of a map read from the transaction at version v
+     *
+     * @return false if this replaced the assignment of the id or the name
+     */
+    bool record(MapId id, const std::string& name, Version v)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      if (id < entries.size() && entries[id].has_value())
+      {
+        auto& entry = entries[id].value();
+        if (entry.name == name)
+        {
+          entry.recorded_at = std::min(entry.recorded_at, v);
+          return true;
+        }
+      }
+
+      bool replaced = false;
+
+      if (id < entries.size() && entries[id].has_value())
+      {
+        erase(id);
+        replaced = true;
+      }
+
+      auto search = ids.find(name);
+      if (search != ids.end())
+      {
+        erase(search->second);
+        replaced = true;
+      }
+
+      if (id >= entries.size())
+        entries.resize(id + 1);
+      entries[id] = Entry{name, v};
+      ids[name] = id;
+      return !replaced;
+    }
+
+    std::optional<std::string> get_name(MapId id)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      if (id >= entries.size() || !entries[id].has_value())
+        return {};
+
+      return entries[id]->name;
+    }
+
+    /** Forget the ids recorded after version v
+     */
+    void rollback(Version v)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      for (MapId id = 0; id < entries.size(); ++id)
+      {
+        if (entries[id].has_value() && entries[id]->recorded_at > v)
+          erase(id);
+      }
+    }
+
+    void clear()
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      entries.clear();
+      ids.clear();
+    }
+
+    void copy_from(MapIds& that)
+    {
+      decltype(entries) that_entries;
+      decltype(ids) that_ids;
+      {
+        std::lock_guard<SpinLock> guard(that.lock);
+        that_entries = that.entries;
+        that_ids = that.ids;
+      }
+
+      std::lock_guard<SpinLock> guard(lock);
+      entries = std::move(that_entries);
+      ids = std::move(that_ids);
+    }
+  };
+}
@@ -5,7 +5,9 @@
 #include "../ds/msgpack_adaptor_nlohmann.h"
 #include "../ds/serialized.h"
 #include "genericserialisewrapper.h"
+#include "fixedlayout.h"
 #include "kvtypes.h"
+#include "lazyvalue.h"
 
 #include <iterator>
 #include <msgpack-c/msgpack.hpp>
@@ -37,7 +39,19 @@ namespace kv
     template <typename T>
     void append(T&& t)
     {
-      msgpack::pack(sb, std::forward<T>(t));
+      if constexpr (is_lazy_value<std::decay_t<T>>::value)
+      {
+        auto [data, size] = t.get_serialised();
+        sb.write(data, size);
+      }
+      else if constexpr (is_fixed_layout<std::decay_t<T>>::value)
+      {
+        fixed_layout::write(sb, t);
+      }
+      else
+      {
+        msgpack::pack(sb, std::forward<T>(t));
+      }
     }
 
     void clear()
@@ -64,6 +78,29 @@ namespace kv
     size_t data_offset;
     size_t data_size;
     msgpack::object_handle msg;
+    // Owner of the buffer being read, if lazy values may refer to it
+    EntryBuffer buffer;
+
+  private:
+    // Strings and binaries are converted from the buffer, rather than copied
+    // to the zone of the unpacked object first
+    static bool reference(msgpack::type::object_type, size_t, void*)
+    {
+      return true;
+    }
+
+    // Lazy values outlive the buffer passed to init, so it is copied the
+    // first time one is read from it
+    void retain()
+    {
+      if (buffer != nullptr)
+        return;
+
+      buffer = std::make_shared<const std::vector<uint8_t>>(
+        reinterpret_cast<const uint8_t*>(data_ptr),
+        reinterpret_cast<const uint8_t*>(data_ptr) + data_size);
+      data_ptr = reinterpret_cast<const char*>(buffer->data());
+    }
 
   public:
     MsgPackReader(const MsgPackReader& other) = delete;
@@ -79,20 +116,47 @@ namespace kv
       data_offset = 0;
       data_ptr = (const char*)data_in_ptr;
       data_size = data_in_size;
+      buffer = nullptr;
+    }
+
+    void init(EntryBuffer data_in)
+    {
+      init(data_in->data(), data_in->size());
+      buffer = std::move(data_in);
     }
 
     template <typename T>
     T read_next()
     {
-      msgpack::unpack(msg, data_ptr, data_size, data_offset);
-      return msg->as<T>();
+      if constexpr (is_lazy_value<T>::value)
+      {
+        // Skip over the value, without unpacking it
+        retain();
+        auto start = data_offset;
+        msgpack::null_visitor skip;
+        if (!msgpack::parse(data_ptr, data_size, data_offset, skip))
+          throw KvSerialiserException("Could not read lazy value");
+        return T(buffer, data_ptr + start, data_offset - start);
+      }
+      else if constexpr (is_fixed_layout<T>::value)
+      {
+        T t;
+        if (!fixed_layout::read(data_ptr, data_size, data_offset, t))
+          throw KvSerialiserException("Could not read fixed layout value");
+        return t;
+      }
+      else
+      {
+        msgpack::unpack(msg, data_ptr, data_size, data_offset, reference);
+        return msg->as<T>();
+      }
     }
 
     template <typename T>
     T peek_next()
     {
       auto before_offset = data_offset;
-      msgpack::unpack(msg, data_ptr, data_size, data_offset);
+      msgpack::unpack(msg, data_ptr, data_size, data_offset, reference);
       data_offset = before_offset;
       return msg->as<T>();
     }
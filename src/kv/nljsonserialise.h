@@ -6,6 +6,7 @@
 #include "../ds/serialized.h"
 #include "genericserialisewrapper.h"
 #include "kvtypes.h"
+#include "lazyvalue.h"
 
 #include <iterator>
 #include <nlohmann/json.hpp>
@@ -78,6 +79,13 @@ namespace kv
       }
     }
 
+    // Values are all decoded with the entry, so lazy values do not refer to
+    // its buffer
+    void init(EntryBuffer data_in)
+    {
+      init(data_in->data(), data_in->size());
+    }
+
     template <typename T>
     T read_next()
     {
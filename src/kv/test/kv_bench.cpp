@@ -3,15 +3,38 @@
 #define PICOBENCH_IMPLEMENT_WITH_MAIN
 
 #include "enclave/appinterface.h"
+#include "kv/fixedlayout.h"
 #include "kv/kv.h"
 #include "node/encryptor.h"
 #include "stub_consensus.h"
 
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
 #include <picobench/picobench.hpp>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 using namespace ccfapp;
 
+// Heap allocations are counted, to report how many a transaction makes
+static std::atomic<size_t> heap_allocations = 0;
+
+void* operator new(size_t size)
+{
+  ++heap_allocations;
+  if (auto p = std::malloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
 // Helper functions
 ccf::NetworkSecrets create_network_secrets()
 {
@@ -94,6 +117,318 @@ static void deserialise(picobench::state& s)
   s.stop_timer();
 }
 
+// Small transactions applied by a follower, one at a time, as they are read
+// from the ledger
+template <size_t MAPS>
+static void deserialise_small(picobench::state& s)
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  Store kv_store2;
+
+  std::vector<Store::Map<std::string, std::string>*> maps;
+  for (size_t m = 0; m < MAPS; ++m)
+  {
+    auto name = "ccf.client_signatures_" + std::to_string(m);
+    maps.push_back(&kv_store.create<std::string, std::string>(
+      name, kv::SecurityDomain::PUBLIC));
+    kv_store2.create<std::string, std::string>(
+      name, kv::SecurityDomain::PUBLIC);
+  }
+
+  std::vector<std::vector<uint8_t>> serialised;
+  size_t bytes = 0;
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    for (auto map : maps)
+      tx.get_view(*map)->put("key" + std::to_string(i), "value");
+    tx.commit();
+    serialised.push_back(consensus->get_latest_data().first);
+    bytes += serialised.back().size();
+  }
+
+  s.start_timer();
+  for (auto& data : serialised)
+  {
+    auto rc = kv_store2.deserialise(data);
+    if (rc != kv::DeserialiseSuccess::PASS)
+      throw std::logic_error(
+        "Transaction deserialisation failed: " + std::to_string(rc));
+  }
+  s.stop_timer();
+
+  static bool reported = false;
+  if (!reported)
+  {
+    reported = true;
+    std::cout << "deserialise_small<" << MAPS << ">: "
+              << bytes / s.iterations() << " bytes per transaction"
+              << std::endl;
+  }
+}
+
+// Transactions writing large values, which a follower applies without reading
+// them, either decoding them with the transaction or lazily
+using LargeValue = std::vector<std::string>;
+using LazyLargeValue = kv::LazyValue<LargeValue>;
+
+template <class V>
+static void deserialise_large(picobench::state& s)
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  Store kv_store2;
+
+  auto& map = kv_store.create<size_t, V>("map", kv::SecurityDomain::PUBLIC);
+  kv_store2.create<size_t, V>("map", kv::SecurityDomain::PUBLIC);
+
+  const LargeValue value(64, std::string(64, 'x'));
+  std::vector<std::vector<uint8_t>> serialised;
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    tx.get_view(map)->put(i, value);
+    tx.commit();
+    serialised.push_back(consensus->get_latest_data().first);
+  }
+
+  s.start_timer();
+  for (auto& data : serialised)
+  {
+    auto rc = kv_store2.deserialise(data);
+    if (rc != kv::DeserialiseSuccess::PASS)
+      throw std::logic_error(
+        "Transaction deserialisation failed: " + std::to_string(rc));
+  }
+  s.stop_timer();
+}
+
+// Transactions writing large values again, as read from the store, which
+// are either encoded again or copied from their cached encoding
+template <class V>
+static void serialise_large(picobench::state& s)
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  auto& map = kv_store.create<size_t, V>("map", kv::SecurityDomain::PUBLIC);
+
+  {
+    Store::Tx tx;
+    tx.get_view(map)->put(0, LargeValue(64, std::string(64, 'x')));
+    tx.commit();
+  }
+
+  s.start_timer();
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put((i + 1) % 2, view->get(i % 2).value());
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+  }
+  s.stop_timer();
+}
+
+// Values of plain structs, serialised member by member, or as their bytes in
+// memory
+template <bool FIXED>
+struct PodValue
+{
+  uint64_t a, b, c, d, e, f, g, h;
+
+  MSGPACK_DEFINE(a, b, c, d, e, f, g, h);
+};
+
+using MsgPackPod = PodValue<false>;
+using FixedPod = PodValue<true>;
+DECLARE_FIXED_LAYOUT_TYPE(FixedPod)
+
+template <class V>
+static void serialise_pod(picobench::state& s)
+{
+  Store kv_store;
+  auto& map = kv_store.create<uint64_t, V>("map", kv::SecurityDomain::PUBLIC);
+  Store::Tx tx;
+  auto view = tx.get_view(map);
+
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    uint64_t k = i;
+    view->put(k, V{k, k, k, k, k, k, k, k});
+  }
+
+  s.start_timer();
+  auto rc = tx.commit();
+  if (rc != kv::CommitSuccess::OK)
+    throw std::logic_error("Transaction commit failed: " + std::to_string(rc));
+  s.stop_timer();
+}
+
+template <class V>
+static void deserialise_pod(picobench::state& s)
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  Store kv_store2;
+
+  auto& map = kv_store.create<uint64_t, V>("map", kv::SecurityDomain::PUBLIC);
+  kv_store2.create<uint64_t, V>("map", kv::SecurityDomain::PUBLIC);
+  Store::Tx tx;
+  auto view = tx.get_view(map);
+
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    uint64_t k = i;
+    view->put(k, V{k, k, k, k, k, k, k, k});
+  }
+  tx.commit();
+
+  auto serial = consensus->get_latest_data();
+  s.start_timer();
+  auto rc = kv_store2.deserialise(serial.first);
+  if (rc != kv::DeserialiseSuccess::PASS)
+    throw std::logic_error(
+      "Transaction deserialisation failed: " + std::to_string(rc));
+  s.stop_timer();
+}
+
+// A transaction reading and writing a few keys, as most RPCs do
+template <size_t KEYS>
+static void small_tx(picobench::state& s)
+{
+  Store kv_store;
+  auto& map0 = kv_store.create<std::string, std::string>(
+    "map0", kv::SecurityDomain::PUBLIC);
+  auto& map1 = kv_store.create<std::string, std::string>(
+    "map1", kv::SecurityDomain::PUBLIC);
+
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < KEYS; ++i)
+    keys.push_back("key" + std::to_string(i));
+
+  size_t allocations = heap_allocations;
+  s.start_timer();
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    Store::Tx tx;
+    auto [tx0, tx1] = tx.get_view(map0, map1);
+    for (auto& key : keys)
+    {
+      auto v = tx0->get(key);
+      tx1->put(key, v.value_or("value"));
+    }
+    auto rc = tx.commit();
+    if (rc != kv::CommitSuccess::OK)
+      throw std::logic_error(
+        "Transaction commit failed: " + std::to_string(rc));
+  }
+  s.stop_timer();
+  allocations = heap_allocations - allocations;
+
+  static bool reported = false;
+  if (!reported)
+  {
+    reported = true;
+    std::cout << "small_tx<" << KEYS << ">: "
+              << allocations / s.iterations()
+              << " heap allocations per transaction" << std::endl;
+  }
+}
+
+// Read and write sets of a transaction, as they were before being allocated
+// from its arena, and as they are now
+template <class K, class V>
+struct HeapMap : public std::unordered_map<K, V>
+{
+  static constexpr auto name = "std::unordered_map";
+
+  HeapMap(arena::Arena*) {}
+};
+
+template <class K, class V>
+struct ArenaMap
+  : public flat::Map<K, V, std::hash<K>, arena::Allocator<std::pair<K, V>>>
+{
+  static constexpr auto name = "flat::Map in arena";
+
+  ArenaMap(arena::Arena* a) :
+    flat::Map<K, V, std::hash<K>, arena::Allocator<std::pair<K, V>>>(a)
+  {}
+};
+
+// Records a few keys in the read and write sets of a transaction
+template <template <class, class> class M>
+static void rw_sets(picobench::state& s)
+{
+  constexpr size_t keys = 4;
+  size_t allocations = heap_allocations;
+  s.start_timer();
+  for (int i = 0; i < s.iterations(); i++)
+  {
+    arena::Arena a;
+    M<size_t, kv::Version> reads(&a);
+    M<size_t, std::string> writes(&a);
+    for (size_t k = 0; k < keys; ++k)
+    {
+      reads.insert(std::make_pair(k, kv::Version(k)));
+      writes[k + 1] = "value";
+    }
+  }
+  s.stop_timer();
+  allocations = heap_allocations - allocations;
+
+  static bool reported = false;
+  if (!reported)
+  {
+    reported = true;
+    std::cout << M<size_t, kv::Version>::name << ": "
+              << allocations / s.iterations()
+              << " heap allocations per read and write sets" << std::endl;
+  }
+}
+
+// Transactions committed and replicated concurrently by several threads,
+// each writing to its own map so that they do not conflict
+template <size_t THREADS>
+static void commit_threads(picobench::state& s)
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+
+  std::vector<Store::Map<std::string, std::string>*> maps;
+  for (size_t t = 0; t < THREADS; ++t)
+    maps.push_back(&kv_store.create<std::string, std::string>(
+      "map" + std::to_string(t), kv::SecurityDomain::PUBLIC));
+
+  std::atomic<size_t> failures = 0;
+  s.start_timer();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < THREADS; ++t)
+  {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < static_cast<size_t>(s.iterations()); i += THREADS)
+      {
+        Store::Tx tx;
+        auto view = tx.get_view(*maps[t]);
+        view->put("key", "value");
+        if (tx.commit() != kv::CommitSuccess::OK)
+          ++failures;
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  s.stop_timer();
+
+  if (failures > 0)
+    throw std::logic_error(
+      "Transaction commit failed: " + std::to_string(failures));
+}
+
 const std::vector<int> tx_count = {10, 100, 200};
 const uint32_t sample_size = 100;
 
@@ -112,3 +447,79 @@ PICOBENCH(deserialise<SD::PUBLIC>)
   .samples(sample_size)
   .baseline();
 PICOBENCH(deserialise<SD::PRIVATE>).iterations(tx_count).samples(sample_size);
+
+const std::vector<int> small_tx_count = {1000, 10000};
+
+PICOBENCH_SUITE("deserialise_small");
+PICOBENCH(deserialise_small<1>)
+  .iterations(small_tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(deserialise_small<4>)
+  .iterations(small_tx_count)
+  .samples(sample_size);
+
+PICOBENCH_SUITE("deserialise_large");
+PICOBENCH(deserialise_large<LargeValue>)
+  .iterations(tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(deserialise_large<LazyLargeValue>)
+  .iterations(tx_count)
+  .samples(sample_size);
+
+PICOBENCH_SUITE("serialise_large");
+PICOBENCH(serialise_large<LargeValue>)
+  .iterations(tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(serialise_large<LazyLargeValue>)
+  .iterations(tx_count)
+  .samples(sample_size);
+
+PICOBENCH_SUITE("serialise_pod");
+PICOBENCH(serialise_pod<MsgPackPod>)
+  .iterations(tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(serialise_pod<FixedPod>).iterations(tx_count).samples(sample_size);
+
+PICOBENCH_SUITE("deserialise_pod");
+PICOBENCH(deserialise_pod<MsgPackPod>)
+  .iterations(tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(deserialise_pod<FixedPod>).iterations(tx_count).samples(sample_size);
+
+PICOBENCH_SUITE("small_tx");
+PICOBENCH(small_tx<1>)
+  .iterations(small_tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(small_tx<4>).iterations(small_tx_count).samples(sample_size);
+PICOBENCH(small_tx<16>).iterations(small_tx_count).samples(sample_size);
+
+PICOBENCH_SUITE("rw_sets");
+PICOBENCH(rw_sets<HeapMap>)
+  .iterations(small_tx_count)
+  .samples(sample_size)
+  .baseline();
+PICOBENCH(rw_sets<ArenaMap>).iterations(small_tx_count).samples(sample_size);
+
+const std::vector<int> commit_count = {1000, 10000};
+const uint32_t commit_sample_size = 10;
+
+PICOBENCH_SUITE("commit_threads");
+PICOBENCH(commit_threads<1>)
+  .iterations(commit_count)
+  .samples(commit_sample_size)
+  .baseline();
+PICOBENCH(commit_threads<2>)
+  .iterations(commit_count)
+  .samples(commit_sample_size);
+PICOBENCH(commit_threads<4>)
+  .iterations(commit_count)
+  .samples(commit_sample_size);
+PICOBENCH(commit_threads<8>)
+  .iterations(commit_count)
+  .samples(commit_sample_size);
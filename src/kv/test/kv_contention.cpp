@@ -2,18 +2,158 @@
 // Licensed under the Apache 2.0 License.
 #include "../kv.h"
 #include "../kvserialiser.h"
+#include "stub_consensus.h"
 
 #include <atomic>
 #include <chrono>
 #include <doctest/doctest.h>
 #include <ds/logger.h>
 #include <enclave/appinterface.h>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
 using namespace ccfapp;
 
+// History that records whether it was ever used by several threads at once,
+// and the versions of the transactions it contains. Only hashing
+// transactions may be done concurrently.
+class ExclusiveHistory : public kv::TxHistory
+{
+private:
+  std::atomic<size_t> users = 0;
+  std::mutex versions_lock;
+  std::vector<kv::Version> versions;
+
+  void add(kv::Version v)
+  {
+    std::lock_guard<std::mutex> guard(versions_lock);
+    versions.push_back(v);
+  }
+
+  struct Use
+  {
+    ExclusiveHistory& h;
+
+    Use(ExclusiveHistory& h_) : h(h_)
+    {
+      if (h.users++ != 0)
+        h.shared = true;
+
+      // Leave time for other threads to use the history meanwhile
+      std::this_thread::yield();
+    }
+
+    ~Use()
+    {
+      h.users--;
+    }
+  };
+
+public:
+  std::atomic<bool> shared = false;
+
+  std::vector<kv::Version> get_versions()
+  {
+    std::lock_guard<std::mutex> guard(versions_lock);
+    return versions;
+  }
+
+  kv::Version last_version()
+  {
+    std::lock_guard<std::mutex> guard(versions_lock);
+    return versions.empty() ? 0 : versions.back();
+  }
+
+  void append(const std::vector<uint8_t>&) override
+  {
+    Use u(*this);
+  }
+
+  bool verify(kv::Term*) override
+  {
+    Use u(*this);
+    return true;
+  }
+
+  void rollback(kv::Version v) override
+  {
+    Use u(*this);
+    std::lock_guard<std::mutex> guard(versions_lock);
+    while (!versions.empty() && versions.back() > v)
+      versions.pop_back();
+  }
+
+  void compact(kv::Version) override
+  {
+    Use u(*this);
+  }
+
+  void emit_signature() override {}
+
+  bool add_request(
+    kv::TxHistory::RequestID,
+    uint64_t,
+    uint64_t,
+    const std::vector<uint8_t>&,
+    const std::vector<uint8_t>&) override
+  {
+    return true;
+  }
+
+  crypto::Sha256Hash hash_leaf(const std::vector<uint8_t>&) override
+  {
+    return {};
+  }
+
+  void add_result(
+    RequestID, kv::Version v, const std::vector<uint8_t>&) override
+  {
+    Use u(*this);
+    add(v);
+  }
+
+  void add_result(RequestID, kv::Version v, const crypto::Sha256Hash&) override
+  {
+    Use u(*this);
+    add(v);
+  }
+
+  void add_result(RequestID, kv::Version) override
+  {
+    Use u(*this);
+  }
+
+  void add_response(RequestID, const std::vector<uint8_t>&) override {}
+
+  void register_on_result(ResultCallbackHandler) override {}
+
+  void register_on_response(ResponseCallbackHandler) override {}
+
+  void clear_on_result() override {}
+
+  void clear_on_response() override {}
+
+  crypto::Sha256Hash get_root() override
+  {
+    Use u(*this);
+    return {};
+  }
+
+  std::vector<uint8_t> serialise_tree() override
+  {
+    Use u(*this);
+    return {};
+  }
+
+  bool init_from_snapshot(const std::vector<uint8_t>&, kv::Version) override
+  {
+    Use u(*this);
+    return true;
+  }
+};
+
 TEST_CASE("Concurrent kv access" * doctest::test_suite("concurrency"))
 {
   // Multiple threads write random entries into random tables, and attempt to
@@ -149,3 +289,379 @@ TEST_CASE("Concurrent kv access" * doctest::test_suite("concurrency"))
     compact_thread.join();
   }
 }
+
+TEST_CASE(
+  "Iteration under write contention" * doctest::test_suite("concurrency"))
+{
+  // Scanning threads iterate over a map until its first entry, then update
+  // an entry of their own, while writing threads update every other entry.
+  // Scans only depend on the entries they visit and on no entry being
+  // inserted, so none of the writes conflict with them.
+  Store kv_store;
+
+  using MapType = Store::Map<size_t, size_t>;
+  auto& map = kv_store.create<MapType>("map", kv::SecurityDomain::PUBLIC);
+
+  constexpr size_t scan_thread_count = 4;
+  constexpr size_t write_thread_count = 4;
+  constexpr size_t key_count = 64;
+  constexpr size_t tx_count = 200;
+
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (size_t k = 0; k < key_count; ++k)
+      view->put(k, 0);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  auto first_key = [&map]() {
+    Store::Tx tx;
+    size_t first = 0;
+    tx.get_view(map)->foreach([&first](const auto& k, const auto&) {
+      first = k;
+      return false;
+    });
+    return first;
+  };
+
+  // Entries other than the first one are owned by a scanning thread, or
+  // shared by the writing threads
+  const auto first = first_key();
+  std::vector<size_t> scanner_keys;
+  std::vector<size_t> writer_keys;
+  for (size_t k = 0; k < key_count; ++k)
+  {
+    if (k == first)
+      continue;
+
+    if (scanner_keys.size() < scan_thread_count)
+      scanner_keys.push_back(k);
+    else
+      writer_keys.push_back(k);
+  }
+
+  std::atomic<size_t> scan_commits(0);
+  std::atomic<size_t> write_commits(0);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < scan_thread_count; ++i)
+  {
+    threads.emplace_back([&, own_key = scanner_keys[i]]() {
+      for (size_t j = 0; j < tx_count; ++j)
+      {
+        Store::Tx tx;
+        auto view = tx.get_view(map);
+        size_t seen = 0;
+        view->foreach([&seen](const auto& k, const auto& v) {
+          seen = v;
+          return false;
+        });
+        view->put(own_key, seen + 1);
+
+        // Leave time for writes to be committed during the transaction
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+
+        if (tx.commit() == kv::CommitSuccess::OK)
+          ++scan_commits;
+      }
+    });
+  }
+
+  for (size_t i = 0; i < write_thread_count; ++i)
+  {
+    threads.emplace_back([&, i]() {
+      for (size_t j = 0; j < tx_count; ++j)
+      {
+        Store::Tx tx;
+        auto view = tx.get_view(map);
+        view->put(writer_keys[(i + j) % writer_keys.size()], j);
+
+        if (tx.commit() == kv::CommitSuccess::OK)
+          ++write_commits;
+      }
+    });
+  }
+
+  for (auto& t : threads)
+    t.join();
+
+  REQUIRE(first_key() == first);
+  REQUIRE(scan_commits == scan_thread_count * tx_count);
+  REQUIRE(write_commits == write_thread_count * tx_count);
+}
+
+TEST_CASE(
+  "Concurrent commits are replicated in order" *
+  doctest::test_suite("concurrency"))
+{
+  // Threads increment counters in a shared map, retrying on conflicts, while
+  // the store replicates their transactions. Each transaction must be
+  // replicated exactly once, in version order.
+  class OrderedConsensus : public kv::StubConsensus
+  {
+  public:
+    std::vector<kv::Version> replicated;
+
+    bool replicate(
+      const std::vector<std::tuple<SeqNo, std::vector<uint8_t>, bool>>& entries)
+      override
+    {
+      for (auto& entry : entries)
+        replicated.push_back(std::get<0>(entry));
+      return kv::StubConsensus::replicate(entries);
+    }
+  };
+
+  auto consensus = std::make_shared<OrderedConsensus>();
+  Store kv_store(consensus);
+  auto& map =
+    kv_store.create<size_t, size_t>("counters", kv::SecurityDomain::PUBLIC);
+
+  constexpr size_t thread_count = 8;
+  constexpr size_t tx_count = 200;
+  constexpr size_t counter_count = 4;
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; ++i)
+  {
+    threads.emplace_back([&, i]() {
+      Store::Tx tx;
+      for (size_t j = 0; j < tx_count; ++j)
+      {
+        while (true)
+        {
+          auto view = tx.get_view(map);
+          auto k = (i + j) % counter_count;
+          view->put(k, view->get(k).value_or(0) + 1);
+
+          auto result = tx.commit();
+          tx.reset();
+          if (result == kv::CommitSuccess::OK)
+            break;
+
+          REQUIRE(result == kv::CommitSuccess::CONFLICT);
+        }
+      }
+    });
+  }
+
+  for (auto& t : threads)
+    t.join();
+
+  Store::Tx tx;
+  auto view = tx.get_view(map);
+  size_t total = 0;
+  view->foreach([&total](const size_t&, const size_t& v) {
+    total += v;
+    return true;
+  });
+  REQUIRE(total == thread_count * tx_count);
+
+  REQUIRE(consensus->replicated.size() == thread_count * tx_count);
+  for (size_t i = 0; i < consensus->replicated.size(); ++i)
+    REQUIRE(consensus->replicated[i] == i + 1);
+}
+
+TEST_CASE(
+  "Commits do not wait for the transaction one lap of the pending ring "
+  "earlier" *
+  doctest::test_suite("concurrency"))
+{
+  // A version is reserved, as for a signature, but only committed once many
+  // later transactions have been committed. Those do not wait for it, even
+  // once their versions wrap around the ring of pending transactions. They
+  // are replicated after it, in order, and none of them is lost.
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  auto reserved = kv_store.next_version();
+
+  constexpr size_t tx_count = 3000;
+  std::atomic<size_t> committed = 0;
+  std::thread t([&]() {
+    Store::Tx tx;
+    for (size_t i = 0; i < tx_count; ++i)
+    {
+      auto view = tx.get_view(map);
+      view->put(i, i);
+      REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+      tx.reset();
+      ++committed;
+    }
+  });
+
+  t.join();
+  REQUIRE(committed == tx_count);
+  REQUIRE(consensus->number_of_replicas() == 0);
+
+  kv_store.commit(
+    reserved,
+    []() -> std::tuple<
+           kv::CommitSuccess,
+           kv::TxHistory::RequestID,
+           std::vector<uint8_t>> {
+      return {kv::CommitSuccess::OK, {0, 0, 0}, {1}};
+    },
+    false);
+
+  REQUIRE(consensus->number_of_replicas() == tx_count + 1);
+  REQUIRE(kv_store.current_version() == tx_count + 1);
+}
+
+TEST_CASE(
+  "Commits go on after transactions fail to replicate" *
+  doctest::test_suite("concurrency"))
+{
+  // Transactions that fail to replicate are dropped. Those committed after
+  // them, over more than a lap of the ring of pending transactions, are
+  // replicated rather than left waiting for them.
+  class FailingConsensus : public kv::StubConsensus
+  {
+  public:
+    bool fail = true;
+
+    bool replicate(
+      const std::vector<std::tuple<SeqNo, std::vector<uint8_t>, bool>>& entries)
+      override
+    {
+      if (fail)
+        return false;
+      return kv::StubConsensus::replicate(entries);
+    }
+  };
+
+  auto consensus = std::make_shared<FailingConsensus>();
+  Store kv_store(consensus);
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  Store::Tx tx;
+  tx.get_view(map)->put(0, 0);
+  REQUIRE(tx.commit() == kv::CommitSuccess::NO_REPLICATE);
+  consensus->fail = false;
+
+  constexpr size_t tx_count = 3000;
+  for (size_t i = 0; i < tx_count; ++i)
+  {
+    Store::Tx tx;
+    tx.get_view(map)->put(i, i);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  REQUIRE(consensus->number_of_replicas() == tx_count);
+  REQUIRE(kv_store.current_version() == tx_count + 1);
+}
+
+TEST_CASE(
+  "Transactions without writes do not use the history" *
+  doctest::test_suite("concurrency"))
+{
+  // Worker threads commit transactions that only read, while another thread
+  // commits writes, which the store adds to the history
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto history = std::make_shared<ExclusiveHistory>();
+  Store kv_store(consensus);
+  kv_store.set_history(history);
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  constexpr size_t reader_count = 4;
+  constexpr size_t tx_count = 2000;
+
+  std::vector<std::thread> threads;
+  threads.emplace_back([&]() {
+    for (size_t i = 0; i < tx_count; ++i)
+    {
+      Store::Tx tx;
+      tx.get_view(map)->put(0, i);
+      REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    }
+  });
+
+  for (size_t i = 0; i < reader_count; ++i)
+  {
+    threads.emplace_back([&]() {
+      for (size_t j = 0; j < tx_count; ++j)
+      {
+        Store::Tx tx;
+        tx.get_view(map)->get(0);
+        REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+        REQUIRE(tx.commit_version() == 0);
+      }
+    });
+  }
+
+  for (auto& t : threads)
+    t.join();
+
+  REQUIRE(consensus->number_of_replicas() == tx_count);
+  REQUIRE_FALSE(history->shared);
+}
+
+TEST_CASE(
+  "Compaction and rollback during concurrent commits" *
+  doctest::test_suite("concurrency"))
+{
+  // Threads commit writes, while another one repeatedly rolls back the store
+  // to the last transaction added to the history, or earlier, and compacts
+  // it. The history must only be used by one thread at a time, and only
+  // contain the transactions that were not rolled back, in order.
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto history = std::make_shared<ExclusiveHistory>();
+  Store kv_store(consensus);
+  kv_store.set_history(history);
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  constexpr size_t thread_count = 4;
+  constexpr size_t tx_count = 1000;
+
+  std::atomic<size_t> active_threads(thread_count);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; ++i)
+  {
+    threads.emplace_back([&, i]() {
+      for (size_t j = 0; j < tx_count; ++j)
+      {
+        // Transactions conflict with rollbacks, which is not checked here
+        Store::Tx tx;
+        tx.get_view(map)->put(i, j);
+        tx.commit();
+        std::this_thread::yield();
+      }
+      --active_threads;
+    });
+  }
+
+  // As with consensus, the store is only rolled back to transactions that
+  // were already replicated, or are being replicated
+  size_t rollbacks = 0;
+  while (active_threads > 0)
+  {
+    auto current = kv_store.current_version();
+    auto v = std::min(current - 1, history->last_version());
+    if (v < kv_store.commit_version())
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    kv_store.rollback(v);
+    if (kv_store.current_version() < current && ++rollbacks % 10 == 0)
+      kv_store.compact(v);
+  }
+
+  for (auto& t : threads)
+    t.join();
+
+  REQUIRE(rollbacks > 0);
+  REQUIRE_FALSE(history->shared);
+
+  const auto versions = history->get_versions();
+  REQUIRE(versions.size() == kv_store.current_version());
+  for (size_t i = 0; i < versions.size(); ++i)
+    REQUIRE(versions[i] == i + 1);
+}
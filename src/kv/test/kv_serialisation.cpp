@@ -2,6 +2,10 @@
 // Licensed under the Apache 2.0 License.
 #include "ds/logger.h"
 #include "enclave/appinterface.h"
+#include "enclave/rpcworkers.h"
+#include "kv/deserialisepipeline.h"
+#include "kv/fixedlayout.h"
+#include "kv/historicalstates.h"
 #include "kv/kv.h"
 #include "kv/kvserialiser.h"
 #include "node/encryptor.h"
@@ -10,6 +14,7 @@
 #include <doctest/doctest.h>
 #include <msgpack-c/msgpack.hpp>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace ccfapp;
@@ -64,6 +69,22 @@ namespace std
 DECLARE_JSON_TYPE(CustomClass)
 DECLARE_JSON_REQUIRED_FIELDS(CustomClass, m_i)
 
+struct FixedClass
+{
+  uint64_t a;
+  uint32_t b;
+  uint32_t c;
+
+  bool operator==(const FixedClass& other) const
+  {
+    return a == other.a && b == other.b && c == other.c;
+  }
+};
+
+DECLARE_FIXED_LAYOUT_TYPE(FixedClass)
+DECLARE_JSON_TYPE(FixedClass)
+DECLARE_JSON_REQUIRED_FIELDS(FixedClass, a, b, c)
+
 TEST_CASE(
   "Serialise/deserialise public map only" *
   doctest::test_suite("serialisation"))
@@ -296,6 +317,307 @@ TEST_CASE(
   }
 }
 
+TEST_CASE("Map ids" * doctest::test_suite("serialisation"))
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  auto& map_a =
+    kv_store.create<size_t, size_t>("map_a", kv::SecurityDomain::PUBLIC);
+  auto& map_b =
+    kv_store.create<size_t, size_t>("map_b", kv::SecurityDomain::PUBLIC);
+  auto& map_c =
+    kv_store.create<size_t, size_t>("map_c", kv::SecurityDomain::PUBLIC);
+
+  auto commit = [&](Store::Map<size_t, size_t>& map, size_t v) {
+    Store::Tx tx;
+    tx.get_view(map)->put(0, v);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    return consensus->get_latest_data().first;
+  };
+
+  auto records_name = [](const std::vector<uint8_t>& data) {
+    const std::string name = "map_";
+    return std::search(data.begin(), data.end(), name.begin(), name.end()) !=
+      data.end();
+  };
+
+  Store follower;
+  follower.clone_schema(kv_store);
+  auto follower_get = [&follower](const std::string& name) {
+    Store::Tx tx;
+    return tx.get_view(*follower.get<size_t, size_t>(name))->get(0);
+  };
+
+  INFO("Only the first transaction to refer to a map records its name");
+  auto tx1 = commit(map_a, 1);
+  auto tx2 = commit(map_a, 2);
+  REQUIRE(records_name(tx1));
+  REQUIRE_FALSE(records_name(tx2));
+  REQUIRE(tx2.size() < tx1.size());
+
+  {
+    Store other;
+    other.create<size_t, size_t>("map_a", kv::SecurityDomain::PUBLIC);
+    REQUIRE(other.deserialise(tx2) == kv::DeserialiseSuccess::FAILED);
+  }
+
+  REQUIRE(follower.deserialise(tx1) == kv::DeserialiseSuccess::PASS);
+  REQUIRE(follower.deserialise(tx2) == kv::DeserialiseSuccess::PASS);
+  REQUIRE(follower_get("map_a") == 2);
+
+  INFO("Ids recorded by transactions that are rolled back are forgotten");
+  {
+    auto tx3 = commit(map_b, 3);
+    REQUIRE(records_name(tx3));
+    REQUIRE(follower.deserialise(tx3) == kv::DeserialiseSuccess::PASS);
+
+    kv_store.rollback(2);
+    auto tx3_ = commit(map_c, 3);
+    auto tx4_ = commit(map_c, 4);
+    REQUIRE(records_name(tx3_));
+    REQUIRE_FALSE(records_name(tx4_));
+
+    REQUIRE(follower.deserialise(tx3_) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(follower.deserialise(tx4_) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(follower_get("map_c") == 4);
+    REQUIRE_FALSE(follower_get("map_b").has_value());
+  }
+
+  INFO("Snapshots record the ids of all their maps");
+  {
+    kv_store.compact(4);
+    auto snapshot = kv_store.serialise_snapshot(4);
+    auto tx5 = commit(map_a, 5);
+    REQUIRE_FALSE(records_name(tx5));
+
+    Store other;
+    other.create<size_t, size_t>("map_c", kv::SecurityDomain::PUBLIC);
+    other.create<size_t, size_t>("map_b", kv::SecurityDomain::PUBLIC);
+    auto& other_a =
+      other.create<size_t, size_t>("map_a", kv::SecurityDomain::PUBLIC);
+    REQUIRE(
+      other.deserialise_snapshot(snapshot) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(other.deserialise(tx5) == kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx;
+    REQUIRE(tx.get_view(other_a)->get(0) == 5);
+  }
+}
+
+TEST_CASE("Legacy format" * doctest::test_suite("serialisation"))
+{
+  // Transactions serialised before the format was recorded start with their
+  // version, refer to maps by name and write absolute versions
+  const std::vector<uint8_t> tx1 = {
+    0x01, 0x02, 0xa5, 0x6d, 0x61, 0x70, 0x5f, 0x61, 0xd3, 0x80, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0xa3, 0x6f, 0x6e, 0x65,
+    0x00, 0x02, 0xa5, 0x6d, 0x61, 0x70, 0x5f, 0x62, 0xd3, 0x80, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x00};
+  const std::vector<uint8_t> tx2 = {
+    0x02, 0x02, 0xa5, 0x6d, 0x61, 0x70, 0x5f, 0x61, 0xd3, 0x80, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x02,
+    0xa5, 0x6d, 0x61, 0x70, 0x5f, 0x62, 0xd3, 0x80, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x04, 0x00};
+
+  Store kv_store;
+  auto& map_a =
+    kv_store.create<size_t, std::string>("map_a", kv::SecurityDomain::PUBLIC);
+  auto& map_b =
+    kv_store.create<size_t, size_t>("map_b", kv::SecurityDomain::PUBLIC);
+
+  REQUIRE(kv_store.deserialise(tx1) == kv::DeserialiseSuccess::PASS);
+  {
+    Store::Tx tx;
+    auto [view_a, view_b] = tx.get_view(map_a, map_b);
+    REQUIRE(view_a->get(1) == "one");
+    REQUIRE(view_b->get(2) == 3);
+  }
+
+  REQUIRE(kv_store.deserialise(tx2) == kv::DeserialiseSuccess::PASS);
+  {
+    Store::Tx tx;
+    auto [view_a, view_b] = tx.get_view(map_a, map_b);
+    REQUIRE_FALSE(view_a->get(1).has_value());
+    REQUIRE(view_b->get(2) == 4);
+  }
+  REQUIRE(kv_store.current_version() == 2);
+
+  INFO("Transactions serialised now are still read");
+  {
+    auto consensus = std::make_shared<kv::StubConsensus>();
+    kv_store.set_consensus(consensus);
+    Store::Tx tx;
+    tx.get_view(map_b)->put(2, 5);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store follower;
+    follower.clone_schema(kv_store);
+    REQUIRE(follower.deserialise(tx1) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(follower.deserialise(tx2) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(
+      follower.deserialise(consensus->get_latest_data().first) ==
+      kv::DeserialiseSuccess::PASS);
+  }
+}
+
+TEST_CASE("Lazy values" * doctest::test_suite("serialisation"))
+{
+  using Value = kv::LazyValue<std::vector<std::string>>;
+
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+  Store kv_store(consensus);
+  kv_store.set_encryptor(encryptor);
+  auto& pub_map =
+    kv_store.create<size_t, Value>("pub_map", kv::SecurityDomain::PUBLIC);
+  auto& priv_map =
+    kv_store.create<size_t, Value>("priv_map", kv::SecurityDomain::PRIVATE);
+
+  const std::vector<std::string> value = {"a", "b", "c"};
+  {
+    Store::Tx tx;
+    auto [pub_view, priv_view] = tx.get_view(pub_map, priv_map);
+    pub_view->put(0, value);
+    priv_view->put(0, value);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  auto serialised = consensus->get_latest_data().first;
+
+  auto follower_consensus = std::make_shared<kv::StubConsensus>();
+  Store follower(follower_consensus);
+  follower.set_encryptor(encryptor);
+  follower.clone_schema(kv_store);
+  auto& follower_pub = *follower.get<size_t, Value>("pub_map");
+  auto& follower_priv = *follower.get<size_t, Value>("priv_map");
+
+  INFO("Values are read as slices of the deserialised transaction");
+  std::optional<Value> pub_value, priv_value;
+  {
+    // The buffer read by the follower does not outlive the deserialisation
+    auto copy = serialised;
+    REQUIRE(follower.deserialise(copy) == kv::DeserialiseSuccess::PASS);
+    std::fill(copy.begin(), copy.end(), 0);
+
+    Store::Tx tx;
+    auto [pub_view, priv_view] = tx.get_view(follower_pub, follower_priv);
+    pub_value = pub_view->get(0);
+    priv_value = priv_view->get(0);
+  }
+  REQUIRE(pub_value.has_value());
+  REQUIRE(priv_value.has_value());
+
+  INFO("Values are decoded when first read");
+  REQUIRE(pub_value->get() == value);
+  REQUIRE((*priv_value)->size() == value.size());
+  REQUIRE(**priv_value == value);
+
+  INFO("Values read from the ledger are written as they were read");
+  {
+    Store::Tx tx;
+    auto [pub_view, priv_view] = tx.get_view(follower_pub, follower_priv);
+    pub_view->put(1, pub_view->get(0).value());
+    priv_view->put(1, priv_view->get(0).value());
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store other;
+    other.set_encryptor(encryptor);
+    other.clone_schema(kv_store);
+    REQUIRE(other.deserialise(serialised) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(
+      other.deserialise(follower_consensus->get_latest_data().first) ==
+      kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx2;
+    auto [pub_view2, priv_view2] = tx2.get_view(
+      *other.get<size_t, Value>("pub_map"),
+      *other.get<size_t, Value>("priv_map"));
+    REQUIRE(pub_view2->get(1)->get() == value);
+    REQUIRE(priv_view2->get(1)->get() == value);
+  }
+
+  INFO("Values written by a transaction keep their encoding");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(pub_map);
+    auto written = view->get(0).value();
+    auto [data, size] = written.get_serialised();
+    REQUIRE(written.get_serialised().first == data);
+
+    // A value that is written again is serialised from the same encoding
+    view->put(2, written);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    auto serialised2 = consensus->get_latest_data().first;
+    REQUIRE(
+      std::search(
+        serialised2.begin(),
+        serialised2.end(),
+        reinterpret_cast<const uint8_t*>(data),
+        reinterpret_cast<const uint8_t*>(data) + size) != serialised2.end());
+
+    Store::Tx tx2;
+    auto rewritten = tx2.get_view(pub_map)->get(2).value();
+    REQUIRE(rewritten.get_serialised().first == data);
+    REQUIRE(rewritten == Value(value));
+  }
+}
+
+TEST_CASE("Fixed layout types" * doctest::test_suite("serialisation"))
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store kv_store(consensus);
+  auto& map =
+    kv_store.create<size_t, FixedClass>("map", kv::SecurityDomain::PUBLIC);
+  auto& lazy_map = kv_store.create<size_t, kv::LazyValue<FixedClass>>(
+    "lazy_map", kv::SecurityDomain::PUBLIC);
+  auto& nested_map = kv_store.create<size_t, std::vector<FixedClass>>(
+    "nested_map", kv::SecurityDomain::PUBLIC);
+
+  const FixedClass value{0x0102030405060708, 42, 43};
+  {
+    Store::Tx tx;
+    auto [view, lazy_view, nested_view] =
+      tx.get_view(map, lazy_map, nested_map);
+    view->put(0, value);
+    lazy_view->put(0, value);
+    nested_view->put(0, {value, value});
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  auto serialised = consensus->get_latest_data().first;
+
+#ifndef USE_NLJSON_KV_SERIALISER
+  INFO("Values are written as their bytes in memory");
+  {
+    auto bytes = reinterpret_cast<const uint8_t*>(&value);
+    auto it = serialised.begin();
+    size_t found = 0;
+    while ((it = std::search(
+              it, serialised.end(), bytes, bytes + sizeof(value))) !=
+           serialised.end())
+    {
+      ++found;
+      ++it;
+    }
+    REQUIRE(found == 4);
+  }
+#endif
+
+  INFO("Values are read from their bytes");
+  {
+    Store follower;
+    follower.clone_schema(kv_store);
+    REQUIRE(follower.deserialise(serialised) == kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx;
+    auto [view, lazy_view, nested_view] = tx.get_view(
+      *follower.get<size_t, FixedClass>("map"),
+      *follower.get<size_t, kv::LazyValue<FixedClass>>("lazy_map"),
+      *follower.get<size_t, std::vector<FixedClass>>("nested_map"));
+    REQUIRE(view->get(0) == value);
+    REQUIRE(lazy_view->get(0)->get() == value);
+    REQUIRE(nested_view->get(0) == std::vector<FixedClass>{value, value});
+  }
+}
+
 bool corrupt_serialised_tx(
   std::vector<uint8_t>& serialised_tx, std::vector<uint8_t>& value_to_corrupt)
 {
@@ -406,3 +728,359 @@ TEST_CASE("nlohmann (de)serialisation" * doctest::test_suite("serialisation"))
       kv::DeserialiseSuccess::FAILED);
   }
 }
+
+TEST_CASE("Pipelined deserialisation" * doctest::test_suite("serialisation"))
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto secrets = ccf::NetworkSecrets("");
+  auto encryptor = std::make_shared<ccf::TxEncryptor>(1, secrets);
+
+  Store kv_store(consensus);
+  kv_store.set_encryptor(encryptor);
+
+  auto& public_map = kv_store.create<std::string, std::string>(
+    "public_map", kv::SecurityDomain::PUBLIC);
+  auto& private_map = kv_store.create<std::string, std::string>(
+    "private_map", kv::SecurityDomain::PRIVATE);
+
+  constexpr size_t tx_count = 50;
+  std::vector<std::vector<uint8_t>> serialised_txs;
+  for (size_t i = 0; i < tx_count; ++i)
+  {
+    Store::Tx tx;
+    auto [public_view, private_view] = tx.get_view(public_map, private_map);
+    public_view->put("pubk", std::to_string(i));
+    private_view->put("privk" + std::to_string(i), std::to_string(i));
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    serialised_txs.push_back(consensus->get_latest_data().first);
+  }
+
+  auto make_encryptor = [&secrets]() {
+    return std::make_shared<ccf::TxEncryptor>(1, secrets);
+  };
+
+  // Workers run jobs on threads started outside the pipeline, as they are
+  // when the host enters the enclave
+  struct Workers
+  {
+    enclave::RPCWorkers pool;
+    std::vector<std::thread> threads;
+
+    Workers(size_t n) : pool(n, "recovery")
+    {
+      for (size_t i = 0; i < n; ++i)
+        threads.emplace_back([this]() { pool.run(); });
+    }
+
+    ~Workers()
+    {
+      pool.stop();
+      for (auto& t : threads)
+        t.join();
+    }
+
+    kv::DeserialisePipeline<Store>::Post post()
+    {
+      return [this](size_t worker, std::function<void()> job) {
+        pool.post(worker, std::move(job));
+      };
+    }
+  };
+
+  REQUIRE_THROWS_AS(
+    kv::DeserialisePipeline<Store>(make_encryptor, 2), std::logic_error);
+
+  for (size_t workers : {0, 1, 4})
+  {
+    INFO("Workers: " << workers);
+
+    Store kv_store_target;
+    kv_store_target.set_encryptor(encryptor);
+    kv_store_target.clone_schema(kv_store);
+
+    Workers pool(workers);
+    kv::DeserialisePipeline<Store> pipeline(
+      make_encryptor, workers, pool.post());
+    REQUIRE(!pipeline.pop(true).has_value());
+
+    for (size_t i = 0; i < tx_count; ++i)
+      pipeline.push(i + 1, std::vector<uint8_t>(serialised_txs[i]));
+
+    for (size_t i = 0; i < tx_count; ++i)
+    {
+      auto entry = pipeline.pop(true);
+      REQUIRE(entry.has_value());
+      REQUIRE(entry->idx == i + 1);
+      REQUIRE(entry->d != nullptr);
+      REQUIRE(
+        kv_store_target.apply_deserialise(*entry->d, entry->data) ==
+        kv::DeserialiseSuccess::PASS);
+    }
+    REQUIRE(pipeline.size() == 0);
+
+    Store::Tx tx;
+    auto [public_view, private_view] = tx.get_view(
+      *kv_store_target.get<std::string, std::string>("public_map"),
+      *kv_store_target.get<std::string, std::string>("private_map"));
+    REQUIRE(public_view->get("pubk") == std::to_string(tx_count - 1));
+    for (size_t i = 0; i < tx_count; ++i)
+      REQUIRE(
+        private_view->get("privk" + std::to_string(i)) == std::to_string(i));
+  }
+
+  INFO("Entries that cannot be decrypted are returned without a deserialiser");
+  {
+    auto corrupted = serialised_txs.back();
+    corrupted.back() ^= 0xff;
+
+    Workers pool(2);
+    kv::DeserialisePipeline<Store> pipeline(make_encryptor, 2, pool.post());
+    pipeline.push(1, std::move(corrupted));
+
+    auto entry = pipeline.pop(true);
+    REQUIRE(entry.has_value());
+    REQUIRE(entry->d == nullptr);
+  }
+
+  INFO("Jobs outliving the pipeline do nothing");
+  {
+    std::vector<std::function<void()>> jobs;
+    {
+      kv::DeserialisePipeline<Store> pipeline(
+        make_encryptor, 2, [&jobs](size_t, std::function<void()> job) {
+          jobs.push_back(std::move(job));
+        });
+      pipeline.push(1, std::vector<uint8_t>(serialised_txs[0]));
+      pipeline.push(2, std::vector<uint8_t>(serialised_txs[1]));
+      jobs.front()();
+      REQUIRE(pipeline.pop(false).has_value());
+    }
+
+    REQUIRE(jobs.size() == 2);
+    jobs.back()();
+  }
+}
+
+TEST_CASE("Historical reads" * doctest::test_suite("serialisation"))
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto secrets = ccf::NetworkSecrets("");
+  auto encryptor = std::make_shared<ccf::TxEncryptor>(1, secrets);
+
+  Store kv_store(consensus);
+  kv_store.set_encryptor(encryptor);
+
+  auto& public_map = kv_store.create<std::string, std::string>(
+    "public_map", kv::SecurityDomain::PUBLIC);
+  auto& private_map = kv_store.create<std::string, std::string>(
+    "private_map", kv::SecurityDomain::PRIVATE);
+
+  constexpr size_t tx_count = 10;
+  std::vector<std::vector<uint8_t>> serialised_txs;
+  for (size_t i = 0; i < tx_count; ++i)
+  {
+    Store::Tx tx;
+    auto [public_view, private_view] = tx.get_view(public_map, private_map);
+    public_view->put("pubk", std::to_string(i));
+    if (i % 2 == 0)
+      private_view->put("privk", std::to_string(i));
+    else
+      private_view->remove("privk");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    serialised_txs.push_back(consensus->get_latest_data().first);
+  }
+
+  auto read_at = [&](kv::Version v) {
+    Store::Tx tx;
+    tx.set_read_only();
+    auto [public_view, private_view] = tx.get_view(public_map, private_map);
+    return std::make_pair(
+      public_view->get_at("pubk", v), private_view->get_at("privk", v));
+  };
+
+  INFO("Versions that have not been compacted are read from the maps");
+  {
+    auto [pub, priv] = read_at(3);
+    REQUIRE(pub == "2");
+    REQUIRE(priv == "2");
+    REQUIRE_FALSE(read_at(4).second.has_value());
+    REQUIRE_FALSE(read_at(0).first.has_value());
+    REQUIRE_THROWS_AS(read_at(tx_count + 1), std::logic_error);
+  }
+
+  kv_store.compact(8);
+
+  INFO("Compacted versions are not available without historical states");
+  {
+    REQUIRE(read_at(8).first == "7");
+    REQUIRE(read_at(tx_count).first == std::to_string(tx_count - 1));
+    REQUIRE_THROWS_AS(read_at(3), kv::HistoricalStateUnavailable);
+  }
+
+  using Range = std::pair<kv::Version, kv::Version>;
+  std::vector<Range> fetched;
+  size_t snapshots_fetched = 0;
+  auto historical_states = std::make_shared<kv::HistoricalStates<Store>>(
+    kv_store,
+    [&secrets]() { return std::make_shared<ccf::TxEncryptor>(1, secrets); },
+    [&fetched](kv::Version from, kv::Version to) {
+      fetched.emplace_back(from, to);
+    },
+    [&snapshots_fetched]() { ++snapshots_fetched; },
+    4,
+    100);
+  kv_store.set_historical_states(historical_states);
+
+  auto replay = [&](kv::Version from, kv::Version to) {
+    for (auto i = from; i <= to; ++i)
+      historical_states->replay_entry(i, serialised_txs[i - 1]);
+  };
+
+  INFO("Compacted versions are rebuilt from the ledger");
+  {
+    REQUIRE_THROWS_AS(read_at(3), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.size() == 1);
+    REQUIRE(fetched.back() == Range(1, 3));
+
+    // Entries that are not next are ignored
+    replay(2, 3);
+    REQUIRE_THROWS_AS(read_at(3), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.size() == 1);
+
+    replay(1, 3);
+    auto [pub, priv] = read_at(3);
+    REQUIRE(pub == "2");
+    REQUIRE(priv == "2");
+    REQUIRE(read_at(2).first == "1");
+    REQUIRE_FALSE(read_at(2).second.has_value());
+  }
+
+  INFO("Entries past the end of the ledger are requested again");
+  {
+    REQUIRE_THROWS_AS(read_at(5), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(4, 5));
+    historical_states->replay_end(4);
+
+    // The ledger does not start from a snapshot
+    REQUIRE(snapshots_fetched == 1);
+    historical_states->replay_snapshot(0, {});
+    REQUIRE_THROWS_AS(read_at(5), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(4, 5));
+    REQUIRE(fetched.size() == 3);
+    historical_states->replay_end(4);
+    historical_states->replay_snapshot(0, {});
+  }
+
+  INFO("Later versions are rebuilt from the replayed ones");
+  {
+    REQUIRE_THROWS_AS(read_at(7), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(4, 7));
+    replay(4, 7);
+    REQUIRE(read_at(7).first == "6");
+    REQUIRE(read_at(3).first == "2");
+  }
+
+  INFO("Older versions are replayed in another state");
+  {
+    REQUIRE_THROWS_AS(read_at(2), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(1, 2));
+    replay(1, 2);
+    REQUIRE(read_at(2).first == "1");
+    REQUIRE(fetched.size() == 5);
+  }
+
+  INFO("Alternating requests for old and recent versions are both served");
+  {
+    for (size_t i = 0; i < 3; ++i)
+    {
+      REQUIRE(read_at(2).first == "1");
+      REQUIRE(read_at(6).first == "5");
+    }
+    REQUIRE(fetched.size() == 5);
+  }
+
+  INFO("Replays are not started again while they are in flight");
+  {
+    auto single_replay = std::make_shared<kv::HistoricalStates<Store>>(
+      kv_store,
+      [&secrets]() { return std::make_shared<ccf::TxEncryptor>(1, secrets); },
+      [&fetched](kv::Version from, kv::Version to) {
+        fetched.emplace_back(from, to);
+      },
+      [&snapshots_fetched]() { ++snapshots_fetched; },
+      2,
+      100,
+      1);
+    kv_store.set_historical_states(single_replay);
+    fetched.clear();
+
+    REQUIRE_THROWS_AS(read_at(7), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(1, 7));
+    for (kv::Version i = 1; i <= 5; ++i)
+      single_replay->replay_entry(i, serialised_txs[i - 1]);
+
+    // Version 2 has been compacted away, while version 7 is still being
+    // replayed
+    REQUIRE_THROWS_AS(read_at(2), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.size() == 1);
+
+    for (kv::Version i = 6; i <= 7; ++i)
+      single_replay->replay_entry(i, serialised_txs[i - 1]);
+    REQUIRE(read_at(7).first == "6");
+
+    REQUIRE_THROWS_AS(read_at(2), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(1, 2));
+  }
+
+  INFO("Versions from the snapshot the ledger starts from are replayed from it");
+  {
+    auto from_snapshot = std::make_shared<kv::HistoricalStates<Store>>(
+      kv_store,
+      [&secrets]() { return std::make_shared<ccf::TxEncryptor>(1, secrets); },
+      [&fetched](kv::Version from, kv::Version to) {
+        fetched.emplace_back(from, to);
+      },
+      [&snapshots_fetched]() { ++snapshots_fetched; },
+      4,
+      100);
+    kv_store.set_historical_states(from_snapshot);
+    fetched.clear();
+    snapshots_fetched = 0;
+
+    // The ledger holds the entries up to 3, then a snapshot at 8 and the
+    // entries following it
+    auto snapshot = kv_store.serialise_snapshot(8);
+    kv_store.compact(tx_count);
+
+    REQUIRE_THROWS_AS(read_at(6), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(1, 6));
+    for (kv::Version i = 1; i <= 3; ++i)
+      from_snapshot->replay_entry(i, serialised_txs[i - 1]);
+    from_snapshot->replay_end(4);
+    REQUIRE(snapshots_fetched == 1);
+    from_snapshot->replay_snapshot(8, snapshot);
+
+    REQUIRE_THROWS_AS(read_at(6), kv::HistoricalStatePruned);
+    REQUIRE_THROWS_AS(read_at(4), kv::HistoricalStatePruned);
+    REQUIRE(read_at(3).first == "2");
+
+    REQUIRE_THROWS_AS(read_at(9), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(4, 9));
+    from_snapshot->replay_end(4);
+    REQUIRE(snapshots_fetched == 2);
+    from_snapshot->replay_snapshot(8, snapshot);
+    REQUIRE(fetched.back() == Range(9, 9));
+    from_snapshot->replay_entry(9, serialised_txs[8]);
+
+    auto [pub, priv] = read_at(9);
+    REQUIRE(pub == "8");
+    REQUIRE(priv == "8");
+    REQUIRE(read_at(8).first == "7");
+    REQUIRE_FALSE(read_at(8).second.has_value());
+
+    INFO("Older versions are replayed from the start of the ledger");
+    REQUIRE_THROWS_AS(read_at(2), kv::HistoricalStateUnavailable);
+    REQUIRE(fetched.back() == Range(1, 2));
+    REQUIRE(snapshots_fetched == 2);
+  }
+}
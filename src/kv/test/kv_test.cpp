@@ -149,6 +149,583 @@ TEST_CASE("Reads/writes and deletions")
   }
 }
 
+TEST_CASE("Ordered map range queries")
+{
+  Store kv_store;
+  auto& map = kv_store.create<Store::OrderedMap<std::string, std::string>>(
+    "map", kv::SecurityDomain::PUBLIC);
+
+  using Entries = std::vector<std::pair<std::string, std::string>>;
+  auto collect = [](auto view, const std::string& from, const std::string& to) {
+    Entries entries;
+    view->range(from, to, [&entries](const auto& key, const auto& value) {
+      entries.emplace_back(key, value);
+      return true;
+    });
+    return entries;
+  };
+
+  INFO("Populate map");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (auto k : {"a", "c", "e", "g"})
+      view->put(k, k);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Iterate over a range in key order, including uncommitted writes");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(collect(view, "b", "g") == Entries{{"c", "c"}, {"e", "e"}});
+
+    view->put("d", "d");
+    view->put("c", "c2");
+    view->remove("e");
+    REQUIRE(collect(view, "b", "g") == Entries{{"c", "c2"}, {"d", "d"}});
+    REQUIRE(collect(view, "g", "b").empty());
+  }
+
+  INFO("Stop iterating when the functor returns false");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    size_t ctr = 0;
+    REQUIRE(!view->range("a", "z", [&ctr](const auto&, const auto&) {
+      return ++ctr < 2;
+    }));
+    REQUIRE(ctr == 2);
+  }
+
+  INFO("Find the first key not less than a key");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(view->lower_bound("c")->first == "c");
+    REQUIRE(view->lower_bound("d")->first == "e");
+    REQUIRE(!view->lower_bound("h").has_value());
+
+    view->remove("e");
+    REQUIRE(view->lower_bound("d")->first == "g");
+    view->put("h", "h");
+    REQUIRE(view->lower_bound("h")->second == "h");
+  }
+
+  INFO("Writes outside of a range read do not conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    collect(view1, "a", "d");
+    view1->put("x", "x");
+
+    view2->put("d", "d");
+    view2->put("f", "f");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Writes inside of a range read conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    collect(view1, "a", "d");
+    view1->put("y", "y");
+
+    view2->put("b", "b");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Writes up to the key found by lower_bound conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    REQUIRE(view1->lower_bound("ca")->first == "d");
+    view1->put("z", "z");
+
+    view2->put("e", "e2");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx3;
+    Store::Tx tx4;
+    auto view3 = tx3.get_view(map);
+    auto view4 = tx4.get_view(map);
+
+    REQUIRE(view3->lower_bound("ca")->first == "d");
+    view3->put("z", "z2");
+
+    view4->remove("d");
+    REQUIRE(tx4.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx3.commit() == kv::CommitSuccess::CONFLICT);
+  }
+}
+
+TEST_CASE("Secondary indexes")
+{
+  Store kv_store;
+  using StringString = Store::Map<std::string, std::string>;
+  // Index entries by the first letter of their value
+  auto& map = kv_store.create<StringString>(
+    "map",
+    kv::SecurityDomain::PUBLIC,
+    nullptr,
+    nullptr,
+    {StringString::make_index<char>(
+      "initial",
+      [](const std::string&, const std::string& v) { return v.at(0); })});
+
+  using Keys = std::vector<std::string>;
+  auto lookup = [](auto view, char initial) {
+    Keys keys;
+    view->foreach_by_index(
+      "initial", initial, [&keys](const auto& key, const auto&) {
+        keys.push_back(key);
+        return true;
+      });
+    std::sort(keys.begin(), keys.end());
+    return keys;
+  };
+
+  INFO("Populate map");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put("k1", "apple");
+    view->put("k2", "avocado");
+    view->put("k3", "banana");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Look up entries by index key, including uncommitted writes");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(lookup(view, 'a') == Keys{"k1", "k2"});
+    REQUIRE(lookup(view, 'b') == Keys{"k3"});
+    REQUIRE(lookup(view, 'c').empty());
+
+    view->put("k1", "blueberry");
+    view->put("k4", "apricot");
+    view->remove("k3");
+    REQUIRE(lookup(view, 'a') == Keys{"k2", "k4"});
+    REQUIRE(lookup(view, 'b') == Keys{"k1"});
+  }
+
+  INFO("Unknown indexes and index key types are rejected");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    auto f = [](const auto&, const auto&) { return true; };
+    REQUIRE_THROWS_AS(view->foreach_by_index("none", 'a', f), std::logic_error);
+    REQUIRE_THROWS_AS(
+      view->foreach_by_index("initial", std::string("a"), f),
+      std::logic_error);
+  }
+
+  INFO("Indexes are updated on commit");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    view->put("k1", "cherry");
+    view->remove("k2");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx2;
+    auto view2 = tx2.get_view(map);
+    REQUIRE(lookup(view2, 'a').empty());
+    REQUIRE(lookup(view2, 'b') == Keys{"k3"});
+    REQUIRE(lookup(view2, 'c') == Keys{"k1"});
+  }
+
+  INFO("Writes under other index keys do not conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    lookup(view1, 'b');
+    view1->put("x", "xylophone");
+
+    view2->put("k5", "cranberry");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Writes under a looked up index key conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+
+    lookup(view1, 'b');
+    view1->put("y", "yam");
+
+    view2->put("k1", "blackcurrant");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Indexes are rolled back");
+  {
+    kv_store.rollback(kv_store.current_version() - 1);
+
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(lookup(view, 'b') == Keys{"k3"});
+    REQUIRE(lookup(view, 'c') == Keys{"k1", "k5"});
+  }
+
+  INFO("Indexes are maintained on deserialised transactions");
+  {
+    Store kv_store2;
+    auto& map2 = kv_store2.create<StringString>(
+      "map",
+      kv::SecurityDomain::PUBLIC,
+      nullptr,
+      nullptr,
+      {StringString::make_index<char>(
+        "initial",
+        [](const std::string&, const std::string& v) { return v.at(0); })});
+
+    Store::Tx tx;
+    auto view = tx.get_view(map2);
+    view->put("k1", "damson");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store kv_store3;
+    auto& map3 = kv_store3.create<StringString>(
+      "map",
+      kv::SecurityDomain::PUBLIC,
+      nullptr,
+      nullptr,
+      {StringString::make_index<char>(
+        "initial",
+        [](const std::string&, const std::string& v) { return v.at(0); })});
+    REQUIRE(
+      kv_store3.deserialise(tx.serialise()) == kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx2;
+    auto view2 = tx2.get_view(map3);
+    REQUIRE(lookup(view2, 'd') == Keys{"k1"});
+  }
+
+  INFO("Indexes are rebuilt from snapshots");
+  {
+    auto v = kv_store.current_version();
+    kv_store.compact(v);
+    auto snapshot = kv_store.serialise_snapshot(v);
+
+    Store kv_store2;
+    auto& map2 = kv_store2.create<StringString>(
+      "map",
+      kv::SecurityDomain::PUBLIC,
+      nullptr,
+      nullptr,
+      {StringString::make_index<char>(
+        "initial",
+        [](const std::string&, const std::string& v) { return v.at(0); })});
+    REQUIRE(
+      kv_store2.deserialise_snapshot(snapshot) ==
+      kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx;
+    auto view = tx.get_view(map2);
+    REQUIRE(lookup(view, 'b') == Keys{"k3"});
+    REQUIRE(lookup(view, 'c') == Keys{"k1", "k5"});
+  }
+}
+
+TEST_CASE("Secondary indexes are pruned")
+{
+  using StringString = Store::Map<std::string, std::string>;
+  using Index = StringString::Index<size_t>;
+  // Index entries by the length of their value
+  Index index("length", [](const std::string&, const std::string& v) {
+    return v.size();
+  });
+
+  StringString::State state;
+  StringString::IndexState entries;
+  kv::Version version = 0;
+  auto put = [&](const std::string& k, const std::string& v) {
+    ++version;
+    auto next = state.put(k, {version, v});
+    entries = index.update(entries, state, next, {{k, {version, v}}});
+    state = next;
+  };
+
+  auto bucket_size = [&](size_t length) {
+    auto bucket = Index::get_bucket(entries, length);
+    return bucket ? bucket->size() : 0;
+  };
+
+  auto buckets = [&]() {
+    size_t count = 0;
+    static_cast<const Index::Entries&>(*entries).buckets.foreach(
+      [&count](const size_t&, const Index::Bucket&) {
+        ++count;
+        return true;
+      });
+    return count;
+  };
+
+  for (size_t i = 0; i < 10; ++i)
+    put("fixed" + std::to_string(i), "a");
+
+  INFO("Entries re-keyed between two index keys");
+  {
+    for (size_t i = 0; i < 1000; ++i)
+      put("k", i % 2 ? "a" : "bb");
+
+    REQUIRE(bucket_size(1) <= 2 * 11);
+    REQUIRE(bucket_size(2) <= 2 * 1);
+  }
+
+  INFO("Entries re-keyed under a new index key every time");
+  {
+    for (size_t i = 0; i < 1000; ++i)
+      put("k", std::string(i + 3, 'c'));
+
+    REQUIRE(buckets() <= 2 * 2);
+    REQUIRE(bucket_size(1) <= 2 * 10);
+    REQUIRE(bucket_size(1002) == 1);
+  }
+}
+
+TEST_CASE("Iteration conflicts")
+{
+  Store kv_store;
+  auto& map = kv_store.create<std::string, std::string>(
+    "map", kv::SecurityDomain::PUBLIC);
+  auto& ordered_map =
+    kv_store.create<Store::OrderedMap<std::string, std::string>>(
+      "ordered_map", kv::SecurityDomain::PUBLIC);
+
+  INFO("Populate maps");
+  {
+    Store::Tx tx;
+    auto [view, ordered_view] = tx.get_view(map, ordered_map);
+    for (auto k : {"a", "c", "e", "g"})
+    {
+      view->put(k, k);
+      ordered_view->put(k, k);
+    }
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  // Iterate until the first entry, and record it in the map
+  auto find_first = [](auto view) {
+    std::string first;
+    view->foreach([&first](const auto& k, const auto&) {
+      first = k;
+      return false;
+    });
+    view->put("z", first);
+    return first;
+  };
+
+  INFO("Writes to entries that have not been visited do not conflict");
+  {
+    Store::Tx tx1;
+    auto first = find_first(tx1.get_view(map));
+
+    Store::Tx tx2;
+    auto view2 = tx2.get_view(map);
+    for (auto k : {"a", "c", "e", "g"})
+    {
+      if (k != first)
+        view2->put(k, "new");
+    }
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Writes to visited entries conflict");
+  {
+    Store::Tx tx1;
+    auto first = find_first(tx1.get_view(map));
+
+    Store::Tx tx2;
+    tx2.get_view(map)->put(first, "new");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Insertions conflict with iteration");
+  {
+    Store::Tx tx1;
+    find_first(tx1.get_view(map));
+
+    Store::Tx tx2;
+    tx2.get_view(map)->put("b", "b");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("In ordered maps, only insertions up to the last visited key conflict");
+  {
+    Store::Tx tx1;
+    REQUIRE(find_first(tx1.get_view(ordered_map)) == "a");
+
+    Store::Tx tx2;
+    tx2.get_view(ordered_map)->put("b", "b");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx3;
+    REQUIRE(find_first(tx3.get_view(ordered_map)) == "a");
+
+    Store::Tx tx4;
+    tx4.get_view(ordered_map)->put("0", "0");
+    REQUIRE(tx4.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx3.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Insertions conflict even if earlier commits have been compacted");
+  {
+    Store::Tx tx1;
+    find_first(tx1.get_view(map));
+
+    Store::Tx tx2;
+    tx2.get_view(map)->put("y", "y");
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    kv_store.compact(kv_store.current_version());
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+}
+
+TEST_CASE("Retry transaction after conflict")
+{
+  Store kv_store;
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  Store::Tx tx1;
+  Store::Tx tx2;
+  auto increment = [&map](Store::Tx& tx) {
+    auto view = tx.get_view(map);
+    view->put(0, view->get(0).value_or(0) + 1);
+  };
+
+  increment(tx1);
+  increment(tx2);
+  REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+  REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+
+  INFO("A reset transaction reads the current state");
+  {
+    tx1.reset();
+    REQUIRE_THROWS_AS(tx1.commit_version(), std::logic_error);
+    increment(tx1);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit_version() == tx2.commit_version() + 1);
+
+    Store::Tx tx3;
+    REQUIRE(tx3.get_view(map)->get(0) == 2);
+  }
+}
+
+TEST_CASE("Read-only transactions")
+{
+  Store kv_store;
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+
+  {
+    Store::Tx tx;
+    tx.get_view(map)->put(0, 1);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Read-only transactions read from a snapshot and do not conflict");
+  {
+    Store::Tx tx1;
+    tx1.set_read_only();
+    REQUIRE(tx1.is_read_only());
+    auto view1 = tx1.get_view(map);
+    REQUIRE(view1->get(0) == 1);
+    REQUIRE_FALSE(view1->get(1).has_value());
+    size_t count = 0;
+    view1->foreach([&count](const size_t&, const size_t&) {
+      ++count;
+      return true;
+    });
+    REQUIRE(count == 1);
+
+    Store::Tx tx2;
+    auto view2 = tx2.get_view(map);
+    view2->put(0, 2);
+    view2->put(1, 2);
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+
+    REQUIRE(view1->get(0) == 1);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.get_read_version() == tx2.commit_version() - 1);
+    REQUIRE(kv_store.current_version() == tx2.commit_version());
+  }
+
+  INFO("Read-only transactions cannot write");
+  {
+    Store::Tx tx;
+    tx.set_read_only();
+    auto view = tx.get_view(map);
+    REQUIRE_THROWS_AS(view->put(0, 3), std::logic_error);
+    REQUIRE_THROWS_AS(view->remove(0), std::logic_error);
+  }
+
+  INFO("Existing views become read-only");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(view->get(0) == 2);
+    tx.set_read_only();
+    REQUIRE_THROWS_AS(view->put(0, 3), std::logic_error);
+
+    Store::Tx tx2;
+    tx2.get_view(map)->put(0, 3);
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Transactions with writes cannot be made read-only");
+  {
+    Store::Tx tx;
+    tx.get_view(map)->put(0, 4);
+    REQUIRE_THROWS_AS(tx.set_read_only(), std::logic_error);
+  }
+
+  INFO("Read-only views are created without locking the map");
+  {
+    kv::AbstractMap<kv::KvStoreSerialiser, kv::KvStoreDeserialiser>& m = map;
+    m.lock();
+    Store::Tx tx;
+    tx.set_read_only();
+    REQUIRE(tx.get_view(map)->get(0) == 3);
+    m.unlock();
+
+    Store::Tx tx2;
+    tx2.get_view(map)->put(0, 5);
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx3;
+    tx3.set_read_only();
+    REQUIRE(tx3.get_view(map)->get(0) == 5);
+  }
+}
+
 TEST_CASE("Rollback and compact")
 {
   Store kv_store;
@@ -462,6 +1039,157 @@ TEST_CASE("Clone schema")
   REQUIRE(clone.deserialise(serialised) == kv::DeserialiseSuccess::PASS);
 }
 
+TEST_CASE("Snapshot")
+{
+  using State = Store::Map<std::string, std::string>::State;
+  using Write = Store::Map<std::string, std::string>::Write;
+
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+  Store store;
+  store.set_encryptor(encryptor);
+
+  auto& public_map = store.create<std::string, std::string>(
+    "public", kv::SecurityDomain::PUBLIC);
+  auto& private_map = store.create<std::string, std::string>(
+    "private", kv::SecurityDomain::PRIVATE);
+  auto& empty_map = store.create<std::string, std::string>(
+    "empty", kv::SecurityDomain::PUBLIC);
+
+  {
+    Store::Tx tx;
+    auto [view1, view2] = tx.get_view(public_map, private_map);
+    view1->put("pubk1", "pubv1");
+    view1->put("pubk2", "pubv2");
+    view2->put("privk1", "privv1");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  {
+    Store::Tx tx;
+    auto view1 = tx.get_view(public_map);
+    REQUIRE(view1->remove("pubk2"));
+    view1->put("pubk3", "pubv3");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  store.compact(2);
+
+  INFO("Snapshots can only be taken at the commit version");
+  std::vector<uint8_t> serialised;
+  {
+    Store::Tx tx(store.next_version());
+    auto view1 = tx.get_view(public_map);
+    view1->put("pubk4", "pubv4");
+    auto [success, reqid, data] = tx.commit_reserved();
+    REQUIRE(success == kv::CommitSuccess::OK);
+    serialised = data;
+
+    REQUIRE_THROWS_AS(store.serialise_snapshot(1), std::logic_error);
+    REQUIRE_THROWS_AS(store.serialise_snapshot(3), std::logic_error);
+  }
+
+  auto snapshot = store.serialise_snapshot(2);
+
+  std::vector<std::pair<kv::Version, Write>> global_writes;
+  Store clone;
+  clone.clone_schema(store);
+  clone.set_encryptor(encryptor);
+  auto clone_public = clone.get<std::string, std::string>("public");
+  auto clone_private = clone.get<std::string, std::string>("private");
+  auto clone_empty = clone.get<std::string, std::string>("empty");
+  clone_public->set_global_hook(
+    [&](kv::Version v, const State& s, const Write& w) {
+      global_writes.emplace_back(v, w);
+    });
+  std::vector<std::pair<kv::Version, Write>> local_writes;
+  clone_private->set_local_hook(
+    [&](kv::Version v, const State& s, const Write& w) {
+      local_writes.emplace_back(v, w);
+    });
+
+  INFO("Entries written before a snapshot is loaded are discarded");
+  {
+    Store::Tx tx;
+    auto view3 = tx.get_view(*clone_empty);
+    view3->put("key", "value");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Load snapshot");
+  {
+    REQUIRE(
+      clone.deserialise_snapshot(snapshot) == kv::DeserialiseSuccess::PASS);
+    REQUIRE(clone.current_version() == 2);
+    REQUIRE(clone.commit_version() == 2);
+
+    Store::Tx tx;
+    auto [view1, view2, view3] =
+      tx.get_view(*clone_public, *clone_private, *clone_empty);
+    REQUIRE(view1->get("pubk1") == "pubv1");
+    REQUIRE_FALSE(view1->get("pubk2").has_value());
+    REQUIRE(view1->get("pubk3") == "pubv3");
+    REQUIRE_FALSE(view1->get("pubk4").has_value());
+    REQUIRE(view2->get("privk1") == "privv1");
+    REQUIRE_FALSE(view3->get("key").has_value());
+
+    REQUIRE(global_writes.size() == 1);
+    REQUIRE(global_writes.at(0).first == 2);
+    REQUIRE(global_writes.at(0).second.size() == 2);
+    REQUIRE(global_writes.at(0).second.at("pubk1").value == "pubv1");
+
+    REQUIRE(local_writes.size() == 1);
+    REQUIRE(local_writes.at(0).second.at("privk1").value == "privv1");
+  }
+
+  INFO("Transactions can be applied on top of a snapshot");
+  {
+    REQUIRE(clone.deserialise(serialised) == kv::DeserialiseSuccess::PASS);
+
+    Store::Tx tx;
+    auto view1 = tx.get_view(*clone_public);
+    REQUIRE(view1->get("pubk1") == "pubv1");
+    REQUIRE(view1->get("pubk4") == "pubv4");
+  }
+
+  INFO("Only the public maps of a snapshot can be loaded");
+  {
+    Store public_only;
+    public_only.set_encryptor(encryptor);
+    auto& public_only_public = public_only.create<std::string, std::string>(
+      "public", kv::SecurityDomain::PUBLIC);
+    auto& public_only_private = public_only.create<std::string, std::string>(
+      "private", kv::SecurityDomain::PRIVATE);
+
+    REQUIRE(
+      public_only.deserialise_snapshot(snapshot, true) ==
+      kv::DeserialiseSuccess::PASS);
+    REQUIRE(public_only.current_version() == 2);
+
+    Store::Tx tx;
+    auto [view1, view2] =
+      tx.get_view(public_only_public, public_only_private);
+    REQUIRE(view1->get("pubk1") == "pubv1");
+    REQUIRE_FALSE(view2->get("privk1").has_value());
+  }
+
+  INFO("Snapshots with unknown maps are rejected");
+  {
+    Store partial;
+    partial.set_encryptor(encryptor);
+    auto& partial_public = partial.create<std::string, std::string>(
+      "public", kv::SecurityDomain::PUBLIC);
+
+    REQUIRE(
+      partial.deserialise_snapshot(snapshot) ==
+      kv::DeserialiseSuccess::FAILED);
+    REQUIRE(partial.current_version() == 0);
+
+    Store::Tx tx;
+    auto view1 = tx.get_view(partial_public);
+    REQUIRE_FALSE(view1->get("pubk1").has_value());
+  }
+}
+
 TEST_CASE("Deserialise return status")
 {
   Store store;
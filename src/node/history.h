@@ -151,11 +151,21 @@ namespace ccf
     {
       return true;
     }
+    crypto::Sha256Hash hash_leaf(const std::vector<uint8_t>&) override
+    {
+      return crypto::Sha256Hash();
+    }
+
     void add_result(
       kv::TxHistory::RequestID id,
       kv::Version version,
       const std::vector<uint8_t>& data) override
     {}
+    void add_result(
+      kv::TxHistory::RequestID id,
+      kv::Version version,
+      const crypto::Sha256Hash& leaf) override
+    {}
     void add_result(RequestID id, kv::Version version) override {}
     void add_response(
       kv::TxHistory::RequestID id,
@@ -174,6 +184,17 @@ namespace ccf
     {
       return crypto::Sha256Hash();
     }
+
+    std::vector<uint8_t> serialise_tree() override
+    {
+      return {};
+    }
+
+    bool init_from_snapshot(
+      const std::vector<uint8_t>& tree, kv::Version v) override
+    {
+      return true;
+    }
   };
 
   class MerkleTreeHistory
@@ -190,11 +211,28 @@ namespace ccf
       free_hash(ih);
     }
 
+    MerkleTreeHistory(const std::vector<uint8_t>& serialised)
+    {
+      tree = mt_deserialize(
+        const_cast<uint8_t*>(serialised.data()), serialised.size());
+      if (tree == nullptr)
+        throw std::logic_error("Failed to deserialise merkle tree");
+    }
+
     ~MerkleTreeHistory()
     {
       mt_free(tree);
     }
 
+    std::vector<uint8_t> serialise() const
+    {
+      std::vector<uint8_t> output(mt_serialize_size(tree));
+      auto written = mt_serialize(tree, output.data(), output.size());
+      if (written != output.size())
+        throw std::logic_error("Failed to serialise merkle tree");
+      return output;
+    }
+
     void append(const crypto::Sha256Hash& hash)
     {
       uint8_t* h = const_cast<uint8_t*>(hash.h);
@@ -219,6 +257,11 @@ namespace ccf
       tree = mt_create(root.h);
     }
 
+    void swap(MerkleTreeHistory& rhs)
+    {
+      std::swap(tree, rhs.tree);
+    }
+
     void flush(uint64_t index)
     {
       if (!mt_flush_to_pre(tree, index))
@@ -301,14 +344,28 @@ namespace ccf
       return tree.get_root();
     }
 
+    crypto::Sha256Hash hash_leaf(const std::vector<uint8_t>& data) override
+    {
+      return crypto::Sha256Hash({data});
+    }
+
     void append(const std::vector<uint8_t>& data) override
     {
-      crypto::Sha256Hash h({data});
-      log_hash(h, APPEND);
-      tree.append(h);
+      append(hash_leaf(data));
+    }
+
+    void append(const crypto::Sha256Hash& leaf)
+    {
+      log_hash(leaf, APPEND);
+      tree.append(leaf);
     }
 
     bool verify(kv::Term* term = nullptr) override
+    {
+      return verify_root(tree.get_root(), term);
+    }
+
+    bool verify_root(const crypto::Sha256Hash& root, kv::Term* term = nullptr)
     {
       Store::Tx tx;
       auto [sig_tv, ni_tv] = tx.get_view(signatures, nodes);
@@ -330,7 +387,6 @@ namespace ccf
         return false;
       }
       tls::VerifierPtr from_cert = tls::make_verifier(ni.value().cert);
-      crypto::Sha256Hash root = tree.get_root();
       log_hash(root, VERIFY);
       return from_cert->verify_hash(
         root.h, root.SIZE, sig_value.sig.data(), sig_value.sig.size());
@@ -349,6 +405,39 @@ namespace ccf
       log_hash(tree.get_root(), COMPACT);
     }
 
+    std::vector<uint8_t> serialise_tree() override
+    {
+      return tree.serialise();
+    }
+
+    bool init_from_snapshot(
+      const std::vector<uint8_t>& serialised_tree, kv::Version v) override
+    {
+      // The serialised tree may contain leaves past the snapshot version,
+      // which are discarded. A snapshot is always taken at a signature, and
+      // that signature is over the root of the tree before the signature
+      // transaction itself was appended.
+      T signed_tree(serialised_tree);
+      signed_tree.retract(v - 1);
+
+      Store::Tx tx;
+      auto sig = tx.get_view(signatures)->get(0);
+      if (!sig.has_value() || sig->index != v)
+      {
+        LOG_FAIL_FMT("No signature at snapshot version {}", v);
+        return false;
+      }
+
+      if (!verify_root(signed_tree.get_root()))
+        return false;
+
+      T snapshot_tree(serialised_tree);
+      snapshot_tree.retract(v);
+      tree.swap(snapshot_tree);
+      log_hash(tree.get_root(), VERIFY);
+      return true;
+    }
+
     void emit_signature() override
     {
 #ifndef PBFT
@@ -400,7 +489,15 @@ namespace ccf
       kv::Version version,
       const std::vector<uint8_t>& data) override
     {
-      append(data);
+      add_result(id, version, hash_leaf(data));
+    }
+
+    void add_result(
+      kv::TxHistory::RequestID id,
+      kv::Version version,
+      const crypto::Sha256Hash& leaf) override
+    {
+      append(leaf);
       auto root = get_root();
       LOG_DEBUG << fmt::format(
                      "HISTORY: add_result {0} {1} {2}", id, version, root)
@@ -12,6 +12,8 @@
 #include "entities.h"
 #include "genesisgen.h"
 #include "history.h"
+#include "kv/deserialisepipeline.h"
+#include "kv/historicalstates.h"
 #include "networkstate.h"
 #include "node/nodetonode.h"
 #include "nodetonode.h"
@@ -178,6 +180,11 @@ namespace ccf
     std::shared_ptr<kv::TxHistory> history;
     std::shared_ptr<kv::AbstractTxEncryptor> encryptor;
 
+    // Past states of the store, rebuilt from the ledger for historical reads,
+    // of which the historical_versions most recent ones are kept
+    std::shared_ptr<kv::HistoricalStates<Store>> historical_states;
+    size_t historical_versions = 1;
+
     //
     // join protocol
     //
@@ -193,12 +200,29 @@ namespace ccf
     std::shared_ptr<Store> recovery_store;
     std::shared_ptr<kv::TxHistory> recovery_history;
     std::shared_ptr<kv::AbstractTxEncryptor> recovery_encryptor;
+    // Private ledger entries are decrypted by recovery_workers, and applied
+    // to the recovery store in order
+    std::unique_ptr<kv::DeserialisePipeline<Store>> recovery_pipeline;
+    std::shared_ptr<enclave::RPCWorkers> recovery_workers;
     kv::Version recovery_v;
     crypto::Sha256Hash recovery_root;
     std::vector<kv::Version> term_history;
     kv::Version last_recovered_commit_idx = 1;
 
+    // When recovering, the entry being read from the ledger, and the last
+    // entry requested from the host. Up to ledger_prefetch_entries entries
+    // are requested ahead of the one being read, so that the host streams
+    // them without waiting for each one to be processed.
     consensus::Index ledger_idx = 0;
+    consensus::Index ledger_requested_idx = 0;
+    size_t ledger_prefetch_entries = 1;
+
+    // Snapshot the ledger starts from, as it is received from the host. The
+    // one the public ledger was recovered from is kept until the network is
+    // restarted, so that it can be sent to joining nodes.
+    std::vector<uint8_t> ledger_snapshot;
+    consensus::Index recovery_snapshot_idx = 0;
+    std::vector<uint8_t> recovery_snapshot;
 
   public:
     NodeState(
@@ -225,6 +249,9 @@ namespace ccf
     //
     void initialize(
       const raft::Config& raft_config_,
+      size_t ledger_prefetch_entries_,
+      std::shared_ptr<enclave::RPCWorkers> recovery_workers_,
+      size_t historical_versions_,
       std::shared_ptr<NodeToNode> n2n_channels_,
       std::shared_ptr<enclave::RPCMap> rpc_map_,
       std::shared_ptr<Forwarder<NodeToNode>> cmd_forwarder_)
@@ -233,6 +260,9 @@ namespace ccf
       sm.expect(State::uninitialized);
 
       raft_config = raft_config_;
+      ledger_prefetch_entries = std::max<size_t>(ledger_prefetch_entries_, 1);
+      recovery_workers = recovery_workers_;
+      historical_versions = std::max<size_t>(historical_versions_, 1);
       n2n_channels = n2n_channels_;
       // Capture rpc_map to pass to pbft for frontend execution
       rpc_map = rpc_map_;
@@ -338,6 +368,7 @@ namespace ccf
 #endif
           setup_history();
           setup_encryptor();
+          setup_historical_states();
 
           // Become the primary and force replication.
           consensus->force_become_primary();
@@ -366,6 +397,9 @@ namespace ccf
           // sent by the primary via the kv store
           raw_fresh_key = tls::create_entropy()->random(crypto::GCM_SIZE_KEY);
 
+          // Joining nodes do not load a snapshot from the host ledger. Once
+          // they have joined, a primary sends them its own snapshot if they
+          // lag too far behind (--raft-snapshot-lag).
           sm.advance(State::pending);
           return Success<CreateNew::Out>({node_cert, quote});
         }
@@ -378,6 +412,7 @@ namespace ccf
             "CN=The CA", std::make_unique<Seal>(writer_factory), false);
           setup_history();
           setup_encryptor();
+          setup_historical_states();
 
           // Accept members connections for members to finish recovery once the
           // public ledger has been read
@@ -455,6 +490,7 @@ namespace ccf
 #endif
             setup_history();
             setup_encryptor();
+            setup_historical_states();
 
             accept_node_connections();
             accept_member_connections();
@@ -535,14 +571,22 @@ namespace ccf
       std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::readingPublicLedger);
       LOG_INFO_FMT("Start public recovery");
-      read_ledger_idx(++ledger_idx);
+      start_reading_ledger();
     }
 
-    void recover_public_ledger_entry(const std::vector<uint8_t>& ledger_entry)
+    void recover_public_ledger_entry(
+      consensus::Index idx, const std::vector<uint8_t>& ledger_entry)
     {
       std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::readingPublicLedger);
 
+      if (idx != ledger_idx)
+      {
+        LOG_DEBUG_FMT(
+          "Ignoring ledger entry {}, expecting {}", idx, ledger_idx);
+        return;
+      }
+
       LOG_DEBUG_FMT(
         "Deserialising public ledger entry ({})", ledger_entry.size());
 
@@ -579,7 +623,33 @@ namespace ccf
         }
       }
 
-      read_ledger_idx(++ledger_idx);
+      read_next_ledger_idx();
+    }
+
+    void recover_public_ledger_snapshot_unsafe(consensus::Index idx)
+    {
+      // When reading the public ledger, only the public state of the snapshot
+      // is loaded in the real store
+      if (
+        network.tables->deserialise_snapshot(ledger_snapshot, true) ==
+        kv::DeserialiseSuccess::FAILED)
+        throw std::logic_error(
+          "Failed to load public ledger snapshot at " + std::to_string(idx));
+
+      Store::Tx tx;
+      GenesisGenerator g(network, tx);
+      auto last_sig = g.get_last_signature();
+      if (!last_sig.has_value() || last_sig->index != idx)
+        throw std::logic_error("Invalid signature");
+
+      // Entries up to the snapshot are not read, so they are all recorded as
+      // part of the term of the snapshot
+      term_history.assign(last_sig->term + 1, idx);
+      term_history[0] = 0;
+      last_recovered_commit_idx = idx;
+
+      recovery_snapshot_idx = idx;
+      recovery_snapshot = std::move(ledger_snapshot);
     }
 
     void recover_public_ledger_end_unsafe()
@@ -647,6 +717,16 @@ namespace ccf
         global_commit);
       consensus->force_become_primary(index, term, term_history, index);
 
+      // The entries up to the snapshot the public ledger was recovered from
+      // are not in the ledger, so that snapshot is sent to joining nodes
+      // instead
+      if (recovery_snapshot_idx != 0)
+      {
+        consensus->set_snapshot(recovery_snapshot_idx, recovery_snapshot);
+        recovery_snapshot.clear();
+        recovery_snapshot.shrink_to_fit();
+      }
+
       // Sets itself as trusted
       g.trust_node(self);
 
@@ -669,38 +749,72 @@ namespace ccf
     //
     // funcs in state "readingPrivateLedger"
     //
-    void recover_private_ledger_entry(const std::vector<uint8_t>& ledger_entry)
+    void recover_private_ledger_entry(
+      consensus::Index idx, const std::vector<uint8_t>& ledger_entry)
     {
       std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::readingPrivateLedger);
 
-      LOG_INFO_FMT(
-        "Deserialising private ledger entry ({})", ledger_entry.size());
-
-      // When reading the private ledger, deserialise in the recovery store
-      auto result = recovery_store->deserialise(ledger_entry);
-      if (result == kv::DeserialiseSuccess::FAILED)
+      // Entries that are still being decrypted have been received already
+      auto next_idx = ledger_idx + recovery_pipeline->size();
+      if (idx != next_idx)
       {
-        LOG_FAIL_FMT("Failed to deserialise entry in private ledger");
-        recovery_store->rollback(ledger_idx - 1);
-        recover_private_ledger_end_unsafe();
+        LOG_DEBUG_FMT("Ignoring ledger entry {}, expecting {}", idx, next_idx);
         return;
       }
 
-      if (result == kv::DeserialiseSuccess::PASS_SIGNATURE)
-        recovery_store->compact(ledger_idx);
+      LOG_INFO_FMT(
+        "Deserialising private ledger entry ({})", ledger_entry.size());
 
-      if (recovery_store->current_version() == recovery_v)
-      {
-        LOG_INFO_FMT("Reached recovery final version at {}", recovery_v);
-        recover_private_ledger_end_unsafe();
-      }
-      else
+      recovery_pipeline->push(idx, std::vector<uint8_t>(ledger_entry));
+
+      // Entries are applied as soon as they have been decrypted. Once all
+      // requested entries have been received, no more will arrive until some
+      // are applied, so wait for them.
+      apply_private_ledger_entries(idx == ledger_requested_idx);
+    }
+
+    void apply_private_ledger_entries(bool wait)
+    {
+      while (auto entry = recovery_pipeline->pop(wait))
       {
-        read_ledger_idx(++ledger_idx);
+        // When reading the private ledger, deserialise in the recovery store
+        auto result = entry->d ?
+          recovery_store->apply_deserialise(*entry->d, entry->data) :
+          kv::DeserialiseSuccess::FAILED;
+        if (result == kv::DeserialiseSuccess::FAILED)
+        {
+          LOG_FAIL_FMT("Failed to deserialise entry in private ledger");
+          recovery_store->rollback(ledger_idx - 1);
+          recover_private_ledger_end_unsafe();
+          return;
+        }
+
+        if (result == kv::DeserialiseSuccess::PASS_SIGNATURE)
+          recovery_store->compact(ledger_idx);
+
+        if (recovery_store->current_version() == recovery_v)
+        {
+          LOG_INFO_FMT("Reached recovery final version at {}", recovery_v);
+          recover_private_ledger_end_unsafe();
+          return;
+        }
+
+        read_next_ledger_idx();
       }
     }
 
+    void recover_private_ledger_snapshot_unsafe(consensus::Index idx)
+    {
+      // When reading the private ledger, load the snapshot in the recovery
+      // store
+      if (
+        recovery_store->deserialise_snapshot(ledger_snapshot) ==
+        kv::DeserialiseSuccess::FAILED)
+        throw std::logic_error(
+          "Failed to load private ledger snapshot at " + std::to_string(idx));
+    }
+
     void recover_private_ledger_end_unsafe()
     {
       sm.expect(State::readingPrivateLedger);
@@ -715,6 +829,7 @@ namespace ccf
       }
 
       network.tables->swap_private_maps(*recovery_store.get());
+      recovery_pipeline.reset();
       recovery_store.reset();
 
       // Raft should deserialise all security domains when network is opened
@@ -749,17 +864,95 @@ namespace ccf
     //
     // funcs in state "readingPublicLedger" or "readingPrivateLedger"
     //
-    void recover_ledger_end()
+    void recv_ledger_snapshot_part(
+      size_t offset, const std::vector<uint8_t>& part)
     {
       std::lock_guard<SpinLock> guard(lock);
 
+      // The snapshot is received in the same way for recovery and for
+      // historical reads. Parts that do not follow the ones received are from
+      // an earlier response, which the host stopped sending.
+      if (offset == 0)
+      {
+        ledger_snapshot.clear();
+      }
+      else if (offset != ledger_snapshot.size())
+      {
+        LOG_DEBUG_FMT(
+          "Ignoring ledger snapshot part at {}, expecting {}",
+          offset,
+          ledger_snapshot.size());
+        return;
+      }
+
+      ledger_snapshot.insert(ledger_snapshot.end(), part.begin(), part.end());
+    }
+
+    void recover_ledger_snapshot(consensus::Index idx)
+    {
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        if (ledger_idx == 0)
+        {
+          recover_ledger_snapshot_unsafe(idx);
+          return;
+        }
+      }
+
+      // Snapshots fetched for historical reads may also arrive while the
+      // ledger is read
+      replay_historical_ledger_snapshot(idx);
+    }
+
+    void recover_ledger_snapshot_unsafe(consensus::Index idx)
+    {
+      if (idx != 0)
+      {
+        LOG_INFO_FMT(
+          "Loading ledger snapshot at {} ({} bytes)",
+          idx,
+          ledger_snapshot.size());
+
+        if (is_reading_public_ledger())
+          recover_public_ledger_snapshot_unsafe(idx);
+        else
+          recover_private_ledger_snapshot_unsafe(idx);
+      }
+
+      ledger_snapshot.clear();
+      ledger_snapshot.shrink_to_fit();
+      ledger_idx = idx + 1;
+      ledger_requested_idx = idx;
+      request_ledger_entries();
+    }
+
+    void recover_ledger_end(consensus::Index idx)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      // Entries past the end of the ledger may have been requested more than
+      // once, or by an earlier read of the ledger
+      auto end_idx = ledger_idx;
+      if (is_reading_private_ledger())
+        end_idx += recovery_pipeline->size();
+
+      if (idx != end_idx)
+      {
+        LOG_DEBUG_FMT(
+          "Ignoring end of ledger at {}, expecting {}", idx, end_idx);
+        return;
+      }
+
       if (is_reading_public_ledger())
       {
         recover_public_ledger_end_unsafe();
       }
       else if (is_reading_private_ledger())
       {
-        recover_private_ledger_end_unsafe();
+        // The last entries of the ledger may still be being decrypted
+        apply_private_ledger_entries(true);
+        if (is_reading_private_ledger())
+          recover_private_ledger_end_unsafe();
       }
       else
       {
@@ -769,6 +962,39 @@ namespace ccf
       }
     }
 
+    //
+    // funcs in state "partOfNetwork" or "partOfPublicNetwork"
+    //
+    void replay_historical_ledger_entry(
+      consensus::Index idx, const std::vector<uint8_t>& ledger_entry)
+    {
+      if (historical_states == nullptr)
+      {
+        LOG_DEBUG_FMT("Ignoring ledger entry {}: no historical reads", idx);
+        return;
+      }
+
+      historical_states->replay_entry(idx, ledger_entry);
+    }
+
+    void replay_historical_ledger_end(consensus::Index idx)
+    {
+      if (historical_states != nullptr)
+        historical_states->replay_end(idx);
+    }
+
+    void replay_historical_ledger_snapshot(consensus::Index idx)
+    {
+      std::vector<uint8_t> snapshot;
+      {
+        std::lock_guard<SpinLock> guard(lock);
+        snapshot.swap(ledger_snapshot);
+      }
+
+      if (historical_states != nullptr)
+        historical_states->replay_snapshot(idx, snapshot);
+    }
+
     //
     // funcs in state "partOfPublicNetwork"
     //
@@ -798,6 +1024,13 @@ namespace ccf
       recovery_store->set_history(recovery_history);
       recovery_store->set_encryptor(recovery_encryptor);
 
+      recovery_pipeline = std::make_unique<kv::DeserialisePipeline<Store>>(
+        [this]() { return make_encryptor(); },
+        recovery_workers->size(),
+        [w = recovery_workers](size_t worker, std::function<void()> job) {
+          w->post(worker, std::move(job));
+        });
+
       // Record real store version and root
       recovery_v = network.tables->current_version();
       auto h = dynamic_cast<MerkleTxHistory*>(history.get());
@@ -891,8 +1124,7 @@ namespace ccf
       setup_private_recovery_store();
 
       // Start reading private security domain of ledger
-      ledger_idx = 0;
-      read_ledger_idx(++ledger_idx);
+      start_reading_ledger();
 
       sm.advance(State::readingPrivateLedger);
       return true;
@@ -911,6 +1143,16 @@ namespace ccf
       consensus->periodic(elapsed);
     }
 
+    void ledger_durable(consensus::Index idx, size_t epoch)
+    {
+      if (
+        !sm.check(State::partOfNetwork) &&
+        !sm.check(State::partOfPublicNetwork))
+        return;
+
+      consensus->set_durable_seqno(idx, epoch);
+    }
+
     void node_msg(const std::vector<uint8_t>& data)
     {
       // Only process messages once part of network
@@ -1144,8 +1386,7 @@ namespace ccf
       consensus->suspend_replication(recovery_v + 1);
 
       // Start reading private security domain of ledger
-      ledger_idx = 0;
-      read_ledger_idx(++ledger_idx);
+      start_reading_ledger();
 
       sm.advance(State::readingPrivateLedger);
     }
@@ -1253,7 +1494,9 @@ namespace ccf
         self,
         std::chrono::milliseconds(raft_config.request_timeout),
         std::chrono::milliseconds(raft_config.election_timeout),
-        public_only);
+        public_only,
+        raft_config.snapshot_lag,
+        raft_config.wait_for_durable);
 
       consensus = std::make_shared<RaftConsensusType>(std::move(raft));
 
@@ -1339,6 +1582,39 @@ namespace ccf
       network.tables->set_encryptor(encryptor);
     }
 
+    std::shared_ptr<kv::AbstractTxEncryptor> make_encryptor()
+    {
+#ifdef USE_NULL_ENCRYPTOR
+      return std::make_shared<NullTxEncryptor>();
+#else
+      return std::make_shared<TxEncryptor>(self, *network.secrets);
+#endif
+    }
+
+    void setup_historical_states()
+    {
+      // Past states are replayed on the enclave thread, while transactions
+      // may be committed on RPC workers, so the replay store has its own
+      // encryptor
+      historical_states = std::make_shared<kv::HistoricalStates<Store>>(
+        *network.tables,
+        [this]() { return make_encryptor(); },
+        [this](kv::Version from, kv::Version to) {
+          RINGBUFFER_WRITE_MESSAGE(
+            consensus::ledger_get_range,
+            to_host,
+            static_cast<consensus::Index>(from),
+            static_cast<consensus::Index>(to));
+        },
+        [this]() {
+          RINGBUFFER_WRITE_MESSAGE(consensus::ledger_get_snapshot, to_host);
+        },
+        historical_versions,
+        ledger_prefetch_entries);
+
+      network.tables->set_historical_states(historical_states);
+    }
+
     void add_node(
       NodeId node, const std::string& hostname, const std::string& service)
     {
@@ -1357,14 +1633,41 @@ namespace ccf
       }
     }
 
-    void read_ledger_idx(consensus::Index idx)
+    void start_reading_ledger()
+    {
+      // The ledger is read from the snapshot it starts from, if any, and
+      // then from the entries following it
+      ledger_idx = 0;
+      ledger_requested_idx = 0;
+      ledger_snapshot.clear();
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_get_snapshot, to_host);
+    }
+
+    void read_next_ledger_idx()
+    {
+      ++ledger_idx;
+      request_ledger_entries();
+    }
+
+    void request_ledger_entries()
     {
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_get, to_host, idx);
+      // Once half of the prefetched entries have been read, the next ones
+      // are requested in a single range
+      if (ledger_requested_idx + 1 - ledger_idx > ledger_prefetch_entries / 2)
+        return;
+
+      auto from = std::max(ledger_idx, ledger_requested_idx + 1);
+      ledger_requested_idx = ledger_idx + ledger_prefetch_entries - 1;
+
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_get_range, to_host, from, ledger_requested_idx);
     }
 
     void ledger_truncate(consensus::Index idx)
     {
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx);
+      // Only called before consensus has started, at its initial ledger epoch
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_truncate, to_host, idx, (size_t)0);
     }
 
 #ifdef PBFT
@@ -5,6 +5,7 @@
 #include "ds/buffer.h"
 #include "ds/histogram.h"
 #include "ds/json_schema.h"
+#include "ds/spinlock.h"
 #include "enclave/rpchandler.h"
 #include "forwarder.h"
 #include "jsonrpc.h"
@@ -16,7 +17,9 @@
 #include "rpcexception.h"
 #include "serialization.h"
 
+#include <atomic>
 #include <fmt/format_header_only.h>
+#include <mutex>
 #include <utility>
 #include <vector>
 
@@ -170,6 +173,7 @@ namespace ccf
   private:
     // TODO: replace with an lru map
     std::map<CallerId, tls::VerifierPtr> verifiers;
+    SpinLock verifiers_lock;
 
     struct Handler
     {
@@ -186,22 +190,28 @@ namespace ccf
     CT* callers;
     std::optional<Handler> default_handler;
     std::unordered_map<std::string, Handler> handlers;
-    kv::Consensus* consensus;
     std::shared_ptr<enclave::AbstractForwarder> cmd_forwarder;
-    kv::TxHistory* history;
 
+    // RPCs may be processed concurrently by several worker threads, while
+    // the frontend is ticked by the enclave thread
+    std::atomic<kv::Consensus*> consensus;
+    std::atomic<kv::TxHistory*> history;
     size_t sig_max_tx = 1000;
-    size_t tx_count = 0;
+    std::atomic<size_t> tx_count = 0;
     std::chrono::milliseconds sig_max_ms = std::chrono::milliseconds(1000);
     std::chrono::milliseconds ms_to_sig = std::chrono::milliseconds(1000);
     bool request_storing_disabled = false;
     metrics::Metrics metrics;
+    SpinLock metrics_lock;
 
+    // These are called on every RPC, so the pointers are only written when
+    // they change, rather than by every worker thread
     void update_consensus()
     {
-      if (consensus != tables.get_consensus().get())
+      auto c = tables.get_consensus().get();
+      if (consensus.load() != c)
       {
-        consensus = tables.get_consensus().get();
+        consensus = c;
       }
     }
 
@@ -211,7 +221,11 @@ namespace ccf
       // during recovery, on RPC, when not primary. Can be changed back once
       // frontend calls into Consensus.
       // if (history == nullptr)
-      history = tables.get_history().get();
+      auto h = tables.get_history().get();
+      if (history.load() != h)
+      {
+        history = h;
+      }
     }
 
     std::pair<bool, nlohmann::json> unpack_json(
@@ -272,7 +286,7 @@ namespace ccf
         // been forwarded, redirect to the current primary
         if ((nodes != nullptr) && (consensus != nullptr))
         {
-          NodeId primary_id = consensus->primary();
+          NodeId primary_id = consensus.load()->primary();
           Store::Tx tx;
           auto nodes_view = tx.get_view(*nodes);
           auto info = nodes_view->get(primary_id);
@@ -318,14 +332,21 @@ namespace ccf
         return false;
       }
 
-      auto v = verifiers.find(caller_id);
-      if (v == verifiers.end())
+      tls::VerifierPtr verifier;
       {
-        std::vector<uint8_t> caller_cert(caller);
-        verifiers.emplace(
-          std::make_pair(caller_id, tls::make_verifier(caller_cert)));
+        std::lock_guard<SpinLock> guard(verifiers_lock);
+        auto v = verifiers.find(caller_id);
+        if (v == verifiers.end())
+        {
+          std::vector<uint8_t> caller_cert(caller);
+          v = verifiers
+                .emplace(
+                  std::make_pair(caller_id, tls::make_verifier(caller_cert)))
+                .first;
+        }
+        verifier = v->second;
       }
-      if (!verifiers[caller_id]->verify(signed_request.req, signed_request.sig))
+      if (!verifier->verify(signed_request.req, signed_request.sig))
       {
         return false;
       }
@@ -377,7 +398,7 @@ namespace ccf
 
         if (consensus != nullptr)
         {
-          auto term = consensus->get_view(commit);
+          auto term = consensus.load()->get_view(commit);
           return jsonrpc::success(GetCommit::Out{term, commit});
         }
 
@@ -387,6 +408,7 @@ namespace ccf
       };
 
       auto get_metrics = [this](Store::Tx& tx, const nlohmann::json& params) {
+        std::lock_guard<SpinLock> guard(metrics_lock);
         auto result = metrics.get_metrics();
         return jsonrpc::success(result);
       };
@@ -397,7 +419,7 @@ namespace ccf
 
           if (history != nullptr)
           {
-            history->emit_signature();
+            history.load()->emit_signature();
             return jsonrpc::success(true);
           }
 
@@ -410,7 +432,7 @@ namespace ccf
         [this](Store::Tx& tx, const nlohmann::json& params) {
           if ((nodes != nullptr) && (consensus != nullptr))
           {
-            NodeId primary_id = consensus->primary();
+            NodeId primary_id = consensus.load()->primary();
 
             auto nodes_view = tx.get_view(*nodes);
             auto info = nodes_view->get(primary_id);
@@ -434,7 +456,7 @@ namespace ccf
           GetNetworkInfo::Out out;
           if (consensus != nullptr)
           {
-            out.primary_id = consensus->primary();
+            out.primary_id = consensus.load()->primary();
           }
 
           auto nodes_view = tx.get_view(*nodes);
@@ -560,6 +582,7 @@ namespace ccf
       update_consensus();
       auto rpc_ = &rpc.second;
       SignedReq signed_request(rpc.second);
+      bool record_signature = false;
       if (rpc_->find(jsonrpc::SIG) != rpc_->end())
       {
         auto& req = rpc_->at(jsonrpc::REQ);
@@ -578,12 +601,9 @@ namespace ccf
         }
 
         // Client signature is only recorded on the primary
-        if (
-          consensus == nullptr || consensus->is_primary() ||
-          ctx.is_create_request)
-        {
-          record_client_signature(tx, caller_id.value(), signed_request);
-        }
+        auto c = consensus.load();
+        record_signature =
+          c == nullptr || c->is_primary() || ctx.is_create_request;
 
         rpc_ = &req;
       }
@@ -597,7 +617,7 @@ namespace ccf
       reqid = {caller_id.value(), ctx.client_session_id, jsonrpc_id};
       if (history)
       {
-        if (!history->add_request(
+        if (!history.load()->add_request(
               reqid, ctx.actor, caller_id.value(), ctx.caller_cert, input))
         {
           LOG_FAIL_FMT("Adding request {} failed", jsonrpc_id);
@@ -622,15 +642,20 @@ namespace ccf
       }
       return {};
 #else
-      auto rep =
-        process_json(ctx, tx, caller_id.value(), unsigned_rpc, signed_request);
+      auto rep = process_json(
+        ctx,
+        tx,
+        caller_id.value(),
+        unsigned_rpc,
+        signed_request,
+        record_signature);
 
       // If necessary, forward the RPC to the current primary
       if (!rep.has_value())
       {
         if (consensus != nullptr)
         {
-          auto primary_id = consensus->primary();
+          auto primary_id = consensus.load()->primary();
 
           // Only forward caller certificate if frontend cannot retrieve caller
           // cert from caller id
@@ -725,16 +750,16 @@ namespace ccf
         update_history();
       }
 
-      history->register_on_result(cb);
+      history.load()->register_on_result(cb);
 
       auto rep =
         process_json(ctx, tx, ctx.fwd->caller_id, unsigned_rpc, signed_request);
 
-      history->clear_on_result();
+      history.load()->clear_on_result();
 
       if (!has_updated_merkle_root)
       {
-        merkle_root = history->get_root();
+        merkle_root = history.load()->get_root();
       }
 
       // TODO(#PBFT): Add RPC response to history based on Request ID
@@ -807,16 +832,23 @@ namespace ccf
       auto rpc_ = &rpc.second;
       SignedReq signed_request(rpc.second);
 
+      bool record_signature = false;
+
       if (rpc_->find(jsonrpc::SIG) != rpc_->end())
       {
         auto& req = rpc_->at(jsonrpc::REQ);
-        record_client_signature(tx, ctx.fwd->caller_id, signed_request);
+        record_signature = true;
         rpc_ = &req;
       }
       auto& unsigned_rpc = *rpc_;
 
-      auto rep =
-        process_json(ctx, tx, ctx.fwd->caller_id, unsigned_rpc, signed_request);
+      auto rep = process_json(
+        ctx,
+        tx,
+        ctx.fwd->caller_id,
+        unsigned_rpc,
+        signed_request,
+        record_signature);
       if (!rep.has_value())
       {
         // This should never be called when process_json is called with a
@@ -832,7 +864,8 @@ namespace ccf
       Store::Tx& tx,
       CallerId caller_id,
       const nlohmann::json& rpc,
-      const SignedReq& signed_request)
+      SignedReq& signed_request,
+      bool record_signature = false)
     {
       std::string method = rpc.at(jsonrpc::METHOD);
       ctx.req.seq_no = rpc.at(jsonrpc::ID);
@@ -886,8 +919,9 @@ namespace ccf
       update_history();
 
 #ifndef PBFT
-      bool is_primary = (consensus == nullptr) || consensus->is_primary() ||
-        ctx.is_create_request;
+      auto c = consensus.load();
+      bool is_primary =
+        (c == nullptr) || c->is_primary() || ctx.is_create_request;
 
       if (!is_primary)
       {
@@ -923,10 +957,21 @@ namespace ccf
 
       tx_count++;
 
+      // Handlers that only read run on a snapshot of the store, without
+      // recording their reads or going through the commit, unless the client
+      // signature must be written
+      if (handler->rw == Read && !record_signature)
+        tx.set_read_only();
+
+      // Transactions from concurrent RPCs may conflict, in which case the
+      // handler is executed again, in a fresh transaction
       while (true)
       {
         try
         {
+          if (record_signature)
+            record_client_signature(tx, caller_id, signed_request);
+
           auto tx_result = func(args);
 
           if (!tx_result.first)
@@ -942,20 +987,20 @@ namespace ccf
                 jsonrpc::result_response(ctx.req.seq_no, tx_result.second);
 
               auto cv = tx.commit_version();
-              if (cv == 0)
+              if (cv == 0 || tx.is_read_only())
                 cv = tx.get_read_version();
               if (cv == kv::NoVersion)
                 cv = tables.current_version();
               result[COMMIT] = cv;
               if (consensus != nullptr)
               {
-                result[TERM] = consensus->get_view();
-                result[GLOBAL_COMMIT] = consensus->get_commit_seqno();
+                result[TERM] = consensus.load()->get_view();
+                result[GLOBAL_COMMIT] = consensus.load()->get_commit_seqno();
 
                 if (
-                  history && consensus->is_primary() &&
+                  history && consensus.load()->is_primary() &&
                   (cv % sig_max_tx == sig_max_tx / 2))
-                  history->emit_signature();
+                  history.load()->emit_signature();
               }
 
               return result;
@@ -963,6 +1008,7 @@ namespace ccf
 
             case kv::CommitSuccess::CONFLICT:
             {
+              tx.reset();
               break;
             }
 
@@ -989,6 +1035,24 @@ namespace ccf
           return jsonrpc::error_response(
             ctx.req.seq_no, jsonrpc::StandardErrorCodes::PARSE_ERROR, err);
         }
+        catch (const kv::HistoricalStateUnavailable& e)
+        {
+          // The state is being rebuilt from the ledger, the client should
+          // retry later
+          return jsonrpc::error_response(
+            ctx.req.seq_no,
+            jsonrpc::CCFErrorCodes::TX_HISTORY_UNAVAILABLE,
+            e.what());
+        }
+        catch (const kv::HistoricalStatePruned& e)
+        {
+          // The state cannot be rebuilt on this node, so retrying would not
+          // help
+          return jsonrpc::error_response(
+            ctx.req.seq_no,
+            jsonrpc::CCFErrorCodes::TX_HISTORY_PRUNED,
+            e.what());
+        }
         catch (const kv::KvSerialiserException& e)
         {
           // If serialising the committed transaction fails, there is no way to
@@ -1008,12 +1072,14 @@ namespace ccf
 
     void tick(std::chrono::milliseconds elapsed) override
     {
-      metrics.track_tx_rates(elapsed, tx_count);
-      // reset tx_counter for next tick interval
-      tx_count = 0;
+      {
+        // reset tx_counter for next tick interval
+        std::lock_guard<SpinLock> guard(metrics_lock);
+        metrics.track_tx_rates(elapsed, tx_count.exchange(0));
+      }
       // TODO(#refactoring): move this to NodeState::tick
       update_consensus();
-      if ((consensus != nullptr) && consensus->is_primary())
+      if ((consensus != nullptr) && consensus.load()->is_primary())
       {
         if (elapsed < ms_to_sig)
         {
@@ -1024,7 +1090,7 @@ namespace ccf
         ms_to_sig = sig_max_ms;
         if (history && tables.commit_gap() > 0)
         {
-          history->emit_signature();
+          history.load()->emit_signature();
         }
       }
     }
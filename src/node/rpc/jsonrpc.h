@@ -48,6 +48,8 @@ namespace jsonrpc
   XX(CODE_ID_RETIRED, -32010) \
   XX(RPC_NOT_FORWARDED, -32011) \
   XX(QUOTE_NOT_VERIFIED, -32012) \
+  XX(TX_HISTORY_UNAVAILABLE, -32013) \
+  XX(TX_HISTORY_PRUNED, -32014) \
   XX(APP_ERROR_START, -32050)
 
   using ErrorBaseType = int;
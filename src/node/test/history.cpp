@@ -12,6 +12,7 @@
 #include "node/signatures.h"
 
 #include <doctest/doctest.h>
+#include <thread>
 
 extern "C"
 {
@@ -428,6 +429,86 @@ TEST_CASE(
   }
 }
 
+class ReplayConsensus : public kv::StubConsensus
+{
+public:
+  Store* store;
+
+  ReplayConsensus(Store* store_) : store(store_) {}
+
+  bool replicate(
+    const std::vector<std::tuple<SeqNo, std::vector<uint8_t>, bool>>& entries)
+    override
+  {
+    for (auto& [version, data, committable] : entries)
+    {
+      if (store->deserialise(data) == kv::DeserialiseSuccess::FAILED)
+        return false;
+    }
+    return true;
+  }
+};
+
+TEST_CASE(
+  "Transactions committed concurrently are added to the history in order")
+{
+  constexpr size_t threads = 4;
+  constexpr size_t tx_count = 500;
+
+  Store primary_store;
+  auto& primary_nodes = primary_store.create<ccf::Nodes>(
+    ccf::Tables::NODES, kv::SecurityDomain::PUBLIC);
+  auto& primary_signatures = primary_store.create<ccf::Signatures>(
+    ccf::Tables::SIGNATURES, kv::SecurityDomain::PUBLIC);
+  std::vector<Store::Map<size_t, size_t>*> tables;
+  for (size_t t = 0; t < threads; ++t)
+    tables.push_back(&primary_store.create<size_t, size_t>(
+      "table" + std::to_string(t), kv::SecurityDomain::PUBLIC));
+
+  Store backup_store;
+  backup_store.clone_schema(primary_store);
+
+  auto kp = tls::make_key_pair();
+
+  primary_store.set_consensus(std::make_shared<ReplayConsensus>(&backup_store));
+
+  std::shared_ptr<kv::TxHistory> primary_history =
+    std::make_shared<ccf::MerkleTxHistory>(
+      primary_store, 0, *kp, primary_signatures, primary_nodes);
+  primary_store.set_history(primary_history);
+
+  std::shared_ptr<kv::TxHistory> backup_history =
+    std::make_shared<ccf::MerkleTxHistory>(
+      backup_store,
+      1,
+      *kp,
+      *backup_store.get<ccf::Signatures>(ccf::Tables::SIGNATURES),
+      *backup_store.get<ccf::Nodes>(ccf::Tables::NODES));
+  backup_store.set_history(backup_history);
+
+  INFO("Commit transactions from several threads");
+  {
+    std::vector<std::thread> committers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+      committers.emplace_back([&, t]() {
+        for (size_t i = 0; i < tx_count; ++i)
+        {
+          Store::Tx tx;
+          tx.get_view(*tables[t])->put(i, i);
+          REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+        }
+      });
+    }
+    for (auto& committer : committers)
+      committer.join();
+  }
+
+  INFO("The backup, which hashes them in order, has the same root");
+  REQUIRE(backup_store.current_version() == threads * tx_count);
+  REQUIRE(primary_history->get_root() == backup_history->get_root());
+}
+
 // We need an explicit main to initialize kremlib and EverCrypt
 int main(int argc, char** argv)
 {
@@ -43,6 +43,8 @@ class ErrorCode(IntEnum):
     CODE_ID_RETIRED = -32010
     RPC_NOT_FORWARDED = -32011
     QUOTE_NOT_VERIFIED = -32012
+    TX_HISTORY_UNAVAILABLE = -32013
+    TX_HISTORY_PRUNED = -32014
     SERVER_ERROR_END = -32099
 
 
@@ -9,6 +9,10 @@ GCM_SIZE_IV = 12
 LEDGER_TRANSACTION_SIZE = 4
 LEDGER_DOMAIN_SIZE = 8
 
+# See kv::serialisation_format and kv::KvOperationType
+SERIALISATION_FORMAT = -2
+KOT_MAP_DEFINITION = 1 << 8
+
 
 def to_uint_32(buffer):
     return struct.unpack("@I", buffer)[0]
@@ -42,11 +46,23 @@ class LedgerDomain:
     _read_version = 0
     _tables = {}
 
-    def __init__(self, buffer):
+    def __init__(self, buffer, map_names):
         self._buffer = buffer
         self._buffer_size = buffer.getbuffer().nbytes
         self._unpacker = msgpack.Unpacker(self._buffer)
-        self._version = self._read_next()
+        # Maps are referred to by id, and their names are only recorded by the
+        # first transaction in the ledger that refers to them
+        self._map_names = map_names
+        # Transactions written before the format was recorded start with their
+        # version, and refer to maps by name
+        first = self._read_next()
+        self._legacy = first >= 0
+        if self._legacy:
+            self._version = first
+        elif first == SERIALISATION_FORMAT:
+            self._version = self._read_next()
+        else:
+            raise ValueError(f"Unsupported serialisation format: {first}")
         self._read()
 
     def _read_next(self):
@@ -59,7 +75,13 @@ class LedgerDomain:
 
         while self._buffer_size > self._unpacker.tell():
             map_start_indicator = self._read_next()
-            map_name = self._read_next_string()
+            if self._legacy:
+                map_name = self._read_next_string()
+            else:
+                map_id = self._read_next()
+                if map_start_indicator == KOT_MAP_DEFINITION:
+                    self._map_names[map_id] = self._read_next_string()
+                map_name = self._map_names[map_id]
             records = {}
             self._tables[map_name] = records
             read_version = self._read_next()
@@ -98,6 +120,7 @@ class Transaction:
     _next_offset = 0
     _public_domain = None
     _file_size = 0
+    _map_names = None
     gcm_header = None
 
     def __init__(self, filename):
@@ -105,6 +128,7 @@ class Transaction:
         self._file.seek(0, 2)
         self._file_size = self._file.tell()
         self._file.seek(0, 0)
+        self._map_names = {}
 
     def __del__(self):
         self._file.close()
@@ -127,7 +151,7 @@ class Transaction:
     def get_public_domain(self):
         if self._public_domain == None:
             buffer = io.BytesIO(_byte_read_safe(self._file, self._public_domain_size))
-            self._public_domain = LedgerDomain(buffer)
+            self._public_domain = LedgerDomain(buffer, self._map_names)
         return self._public_domain
 
     def _complete_read(self):
@@ -143,6 +167,8 @@ class Transaction:
         try:
             self._complete_read()
             self._read_header()
+            # Every public domain is read, for the names of the maps it records
+            self.get_public_domain()
             return self
         except:
             raise StopIteration()